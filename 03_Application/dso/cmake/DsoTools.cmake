@@ -0,0 +1,41 @@
+# additions of this fork to DSO's own CMakeLists.txt (which is not part of this tree).
+# include it there after the OpenCV / Pangolin source selection and before add_library(dso ...):
+#
+#   include(${PROJECT_SOURCE_DIR}/cmake/DsoTools.cmake)
+
+
+# sources added to the dso library by this fork.
+list(APPEND dso_SOURCE_FILES
+  ${PROJECT_SOURCE_DIR}/src/FullSystem/PatternLinearize.cpp
+  ${PROJECT_SOURCE_DIR}/src/FullSystem/PyramidRows.cpp
+  ${PROJECT_SOURCE_DIR}/src/OptimizationBackend/EnergyFunctionalGps.cpp
+  ${PROJECT_SOURCE_DIR}/src/OptimizationBackend/PoseGraphBackend.cpp
+  ${PROJECT_SOURCE_DIR}/src/OptimizationBackend/ResidualTable.cpp
+  ${PROJECT_SOURCE_DIR}/src/util/ExternalPoseQueue.cpp
+  ${PROJECT_SOURCE_DIR}/src/util/KeyframeArchive.cpp
+  ${PROJECT_SOURCE_DIR}/src/util/SlabPool.cpp
+  ${PROJECT_SOURCE_DIR}/src/util/StageProfiler.cpp
+)
+
+
+# the library without any GUI, for the headless tools: dummy image display and no viewer.
+# images are still read through OpenCV if it was found, the dataset reader needs them decoded.
+if (OpenCV_FOUND)
+  set(dso_headless_imagerw_SOURCE_FILES ${PROJECT_SOURCE_DIR}/src/IOWrapper/OpenCV/ImageRW_OpenCV.cpp)
+  set(dso_headless_imagerw_LIBS ${OpenCV_LIBS})
+else ()
+  set(dso_headless_imagerw_SOURCE_FILES ${PROJECT_SOURCE_DIR}/src/IOWrapper/ImageRW_dummy.cpp)
+  set(dso_headless_imagerw_LIBS)
+endif ()
+add_library(dso_headless ${dso_SOURCE_FILES} ${dso_headless_imagerw_SOURCE_FILES} ${PROJECT_SOURCE_DIR}/src/IOWrapper/ImageDisplay_dummy.cpp)
+
+add_executable(dso_bench ${PROJECT_SOURCE_DIR}/src/main_dso_bench.cpp)
+target_link_libraries(dso_bench dso_headless boost_system cxsparse ${BOOST_THREAD_LIBRARY} ${LIBZIP_LIBRARY} ${dso_headless_imagerw_LIBS})
+
+
+# checks the SIMD / row kernels against their scalar references, needs no data.
+add_executable(dso_selftest ${PROJECT_SOURCE_DIR}/src/main_dso_selftest.cpp)
+target_link_libraries(dso_selftest dso_headless boost_system cxsparse ${BOOST_THREAD_LIBRARY} ${LIBZIP_LIBRARY} ${dso_headless_imagerw_LIBS})
+
+enable_testing()
+add_test(NAME dso_selftest COMMAND dso_selftest)
@@ -36,6 +36,7 @@
 #include "OptimizationBackend/EnergyFunctionalStructs.h"
 #include "IOWrapper/ImageRW.h"
 #include <algorithm>
+#include "util/StageProfiler.h"
 
 #if !defined(__SSE3__) && !defined(__SSE2__) && !defined(__SSE1__)
 #include "SSE2NEON.h"
@@ -75,30 +76,94 @@ CoarseTracker::CoarseTracker(int ww, int hh) : lastRef_aff_g2l(0,0)
 
 	}
 
-	// warped buffers
-    buf_warped_idepth = allocAligned<4,float>(ww*hh, ptrToDelete);
-    buf_warped_u = allocAligned<4,float>(ww*hh, ptrToDelete);
-    buf_warped_v = allocAligned<4,float>(ww*hh, ptrToDelete);
-    buf_warped_dx = allocAligned<4,float>(ww*hh, ptrToDelete);
-    buf_warped_dy = allocAligned<4,float>(ww*hh, ptrToDelete);
-    buf_warped_residual = allocAligned<4,float>(ww*hh, ptrToDelete);
-    buf_warped_weight = allocAligned<4,float>(ww*hh, ptrToDelete);
-    buf_warped_refColor = allocAligned<4,float>(ww*hh, ptrToDelete);
+	// warped buffers. cache-line aligned, for the AVX-512 loads.
+    buf_warped_idepth = allocAligned<6,float>(ww*hh, ptrToDelete);
+    buf_warped_u = allocAligned<6,float>(ww*hh, ptrToDelete);
+    buf_warped_v = allocAligned<6,float>(ww*hh, ptrToDelete);
+    buf_warped_dx = allocAligned<6,float>(ww*hh, ptrToDelete);
+    buf_warped_dy = allocAligned<6,float>(ww*hh, ptrToDelete);
+    buf_warped_residual = allocAligned<6,float>(ww*hh, ptrToDelete);
+    buf_warped_weight = allocAligned<6,float>(ww*hh, ptrToDelete);
+    buf_warped_refColor = allocAligned<6,float>(ww*hh, ptrToDelete);
 
 
 	newFrame = 0;
 	lastRef = 0;
+	parent = 0;
 	debugPlot = debugPrint = true;
 	w[0]=h[0]=0;
 	refFrameID=-1;
 }
+CoarseTracker::CoarseTracker(CoarseTracker* parent) : lastRef_aff_g2l(0,0), parent(parent)
+{
+	// reference point cloud is the parent's; only the warped buffers are our own, sized for the coarsest level.
+	int lvl = pyrLevelsUsed-1;
+	for(int l=0; l<pyrLevelsUsed; l++)
+	{
+		idepth[l] = weightSums[l] = weightSums_bak[l] = 0;
+		pc_u[l] = parent->pc_u[l];
+		pc_v[l] = parent->pc_v[l];
+		pc_idepth[l] = parent->pc_idepth[l];
+		pc_color[l] = parent->pc_color[l];
+	}
+
+	int n = (parent->w[lvl] > 0 ? parent->w[lvl]*parent->h[lvl] : (wG[0]>>lvl)*(hG[0]>>lvl)) + 16;
+    buf_warped_idepth = allocAligned<6,float>(n, ptrToDelete);
+    buf_warped_u = allocAligned<6,float>(n, ptrToDelete);
+    buf_warped_v = allocAligned<6,float>(n, ptrToDelete);
+    buf_warped_dx = allocAligned<6,float>(n, ptrToDelete);
+    buf_warped_dy = allocAligned<6,float>(n, ptrToDelete);
+    buf_warped_residual = allocAligned<6,float>(n, ptrToDelete);
+    buf_warped_weight = allocAligned<6,float>(n, ptrToDelete);
+    buf_warped_refColor = allocAligned<6,float>(n, ptrToDelete);
+
+	newFrame = 0;
+	lastRef = 0;
+	debugPlot = debugPrint = false;
+	w[0]=h[0]=0;
+	refFrameID=-1;
+	syncFromParent();
+}
 CoarseTracker::~CoarseTracker()
 {
+	for(CoarseTracker* wk : workers)
+		delete wk;
     for(float* ptr : ptrToDelete)
         delete[] ptr;
     ptrToDelete.clear();
 }
 
+void CoarseTracker::makeWorkers(int num)
+{
+	while((int)workers.size() < num)
+		workers.push_back(new CoarseTracker(this));
+	for(CoarseTracker* wk : workers)
+		wk->syncFromParent();
+}
+
+CoarseTracker* CoarseTracker::getWorker(int tid)
+{
+	assert(tid >= 0 && tid < (int)workers.size());
+	return workers[tid];
+}
+
+void CoarseTracker::syncFromParent()
+{
+	for(int l=0; l<PYR_LEVELS; l++)
+	{
+		K[l] = parent->K[l]; Ki[l] = parent->Ki[l];
+		fx[l] = parent->fx[l]; fy[l] = parent->fy[l]; fxi[l] = parent->fxi[l]; fyi[l] = parent->fyi[l];
+		cx[l] = parent->cx[l]; cy[l] = parent->cy[l]; cxi[l] = parent->cxi[l]; cyi[l] = parent->cyi[l];
+		w[l] = parent->w[l]; h[l] = parent->h[l];
+	}
+	for(int l=0; l<pyrLevelsUsed; l++)
+		pc_n[l] = parent->pc_n[l];
+	lastRef = parent->lastRef;
+	lastRef_aff_g2l = parent->lastRef_aff_g2l;
+	refFrameID = parent->refFrameID;
+	firstCoarseRMSE = parent->firstCoarseRMSE;
+}
+
 void CoarseTracker::makeK(CalibHessian* HCalib)
 {
 	w[0] = wG[0];
@@ -308,7 +373,19 @@ void CoarseTracker::calcGSSSE(int lvl, Mat88 &H_out, Vec8 &b_out, const SE3 &ref
 
 	int n = buf_warped_n;
 	assert(n%4==0);
-	for(int i=0;i<n;i+=4)
+
+	// the wide kernels do the first n rounded down to 8 / 16 terms, the SSE loop the rest.
+	int start = 0;
+#ifdef DSO_SIMD_DISPATCH
+	int simdLevel = getSimdLevel();
+	float aScalar = (float)(AffLight::fromToVecExposure(lastRef->ab_exposure, newFrame->ab_exposure, lastRef_aff_g2l, aff_g2l)[0]);
+	if(simdLevel >= SIMD_AVX512)
+		start = calcGSAccumulateAVX512(lvl, aScalar, lastRef_aff_g2l.b);
+	else if(simdLevel >= SIMD_AVX2)
+		start = calcGSAccumulateAVX2(lvl, aScalar, lastRef_aff_g2l.b);
+#endif
+
+	for(int i=start;i<n;i+=4)
 	{
 		__m128 dx = _mm_mul_ps(_mm_load_ps(buf_warped_dx+i), fxl);
 		__m128 dy = _mm_mul_ps(_mm_load_ps(buf_warped_dy+i), fyl);
@@ -353,6 +430,88 @@ void CoarseTracker::calcGSSSE(int lvl, Mat88 &H_out, Vec8 &b_out, const SE3 &ref
 }
 
 
+#ifdef DSO_SIMD_DISPATCH
+int CoarseTracker::calcGSAccumulateAVX2(int lvl, float aScalar, float b0Scalar)
+{
+	__m256 fxl = _mm256_set1_ps(fx[lvl]);
+	__m256 fyl = _mm256_set1_ps(fy[lvl]);
+	__m256 b0 = _mm256_set1_ps(b0Scalar);
+	__m256 a = _mm256_set1_ps(aScalar);
+
+	__m256 one = _mm256_set1_ps(1);
+	__m256 minusOne = _mm256_set1_ps(-1);
+	__m256 zero = _mm256_set1_ps(0);
+
+	int n = buf_warped_n - buf_warped_n%8;
+	for(int i=0;i<n;i+=8)
+	{
+		__m256 dx = _mm256_mul_ps(_mm256_load_ps(buf_warped_dx+i), fxl);
+		__m256 dy = _mm256_mul_ps(_mm256_load_ps(buf_warped_dy+i), fyl);
+		__m256 u = _mm256_load_ps(buf_warped_u+i);
+		__m256 v = _mm256_load_ps(buf_warped_v+i);
+		__m256 id = _mm256_load_ps(buf_warped_idepth+i);
+
+
+		acc.updateAVX2_eighted(
+				_mm256_mul_ps(id,dx),
+				_mm256_mul_ps(id,dy),
+				_mm256_sub_ps(zero, _mm256_mul_ps(id,_mm256_add_ps(_mm256_mul_ps(u,dx), _mm256_mul_ps(v,dy)))),
+				_mm256_sub_ps(zero, _mm256_add_ps(
+						_mm256_mul_ps(_mm256_mul_ps(u,v),dx),
+						_mm256_mul_ps(dy,_mm256_add_ps(one, _mm256_mul_ps(v,v))))),
+				_mm256_add_ps(
+						_mm256_mul_ps(_mm256_mul_ps(u,v),dy),
+						_mm256_mul_ps(dx,_mm256_add_ps(one, _mm256_mul_ps(u,u)))),
+				_mm256_sub_ps(_mm256_mul_ps(u,dy), _mm256_mul_ps(v,dx)),
+				_mm256_mul_ps(a,_mm256_sub_ps(b0, _mm256_load_ps(buf_warped_refColor+i))),
+				minusOne,
+				_mm256_load_ps(buf_warped_residual+i),
+				_mm256_load_ps(buf_warped_weight+i));
+	}
+	return n;
+}
+
+int CoarseTracker::calcGSAccumulateAVX512(int lvl, float aScalar, float b0Scalar)
+{
+	__m512 fxl = _mm512_set1_ps(fx[lvl]);
+	__m512 fyl = _mm512_set1_ps(fy[lvl]);
+	__m512 b0 = _mm512_set1_ps(b0Scalar);
+	__m512 a = _mm512_set1_ps(aScalar);
+
+	__m512 one = _mm512_set1_ps(1);
+	__m512 minusOne = _mm512_set1_ps(-1);
+	__m512 zero = _mm512_set1_ps(0);
+
+	int n = buf_warped_n - buf_warped_n%16;
+	for(int i=0;i<n;i+=16)
+	{
+		__m512 dx = _mm512_mul_ps(_mm512_load_ps(buf_warped_dx+i), fxl);
+		__m512 dy = _mm512_mul_ps(_mm512_load_ps(buf_warped_dy+i), fyl);
+		__m512 u = _mm512_load_ps(buf_warped_u+i);
+		__m512 v = _mm512_load_ps(buf_warped_v+i);
+		__m512 id = _mm512_load_ps(buf_warped_idepth+i);
+
+
+		acc.updateAVX512_eighted(
+				_mm512_mul_ps(id,dx),
+				_mm512_mul_ps(id,dy),
+				_mm512_sub_ps(zero, _mm512_mul_ps(id,_mm512_add_ps(_mm512_mul_ps(u,dx), _mm512_mul_ps(v,dy)))),
+				_mm512_sub_ps(zero, _mm512_add_ps(
+						_mm512_mul_ps(_mm512_mul_ps(u,v),dx),
+						_mm512_mul_ps(dy,_mm512_add_ps(one, _mm512_mul_ps(v,v))))),
+				_mm512_add_ps(
+						_mm512_mul_ps(_mm512_mul_ps(u,v),dy),
+						_mm512_mul_ps(dx,_mm512_add_ps(one, _mm512_mul_ps(u,u)))),
+				_mm512_sub_ps(_mm512_mul_ps(u,dy), _mm512_mul_ps(v,dx)),
+				_mm512_mul_ps(a,_mm512_sub_ps(b0, _mm512_load_ps(buf_warped_refColor+i))),
+				minusOne,
+				_mm512_load_ps(buf_warped_residual+i),
+				_mm512_load_ps(buf_warped_weight+i));
+	}
+	return n;
+}
+#endif
+
 
 
 Vec6 CoarseTracker::calcRes(int lvl, const SE3 &refToNew, AffLight aff_g2l, float cutoffTH)
@@ -533,152 +692,174 @@ void CoarseTracker::setCoarseTrackingRef(
 	firstCoarseRMSE=-1;
 
 }
-bool CoarseTracker::trackNewestCoarse(
-		FrameHessian* newFrameHessian,
-		SE3 &lastToNew_out, AffLight &aff_g2l_out,
-		int coarsestLvl,
-		Vec5 minResForAbort,
-		IOWrap::Output3DWrapper* wrap)
+Vec6 CoarseTracker::optimizeLevel(int lvl, SE3 &refToNew_current, AffLight &aff_g2l_current, float &levelCutoffRepeat)
 {
-	debugPlot = setting_render_displayCoarseTrackingFull;
-	debugPrint = false;
-
-	assert(coarsestLvl < 5 && coarsestLvl < pyrLevelsUsed);
+	DSO_PROFILE_STAGE_ARG("trackLevel", lvl);
+	int maxIterations[] = {10,20,50,50,50};
+	float lambdaExtrapolationLimit = 0.001;
 
-	lastResiduals.setConstant(NAN);
-	lastFlowIndicators.setConstant(1000);
+	Mat88 H; Vec8 b;
+	Vec6 resOld = calcRes(lvl, refToNew_current, aff_g2l_current, setting_coarseCutoffTH*levelCutoffRepeat);
+	while(resOld[5] > 0.6 && levelCutoffRepeat < 50)
+	{
+		levelCutoffRepeat*=2;
+		resOld = calcRes(lvl, refToNew_current, aff_g2l_current, setting_coarseCutoffTH*levelCutoffRepeat);
 
+            if(!setting_debugout_runquiet)
+                printf("INCREASING cutoff to %f (ratio is %f)!\n", setting_coarseCutoffTH*levelCutoffRepeat, resOld[5]);
+	}
 
-	newFrame = newFrameHessian;
-	int maxIterations[] = {10,20,50,50,50};
-	float lambdaExtrapolationLimit = 0.001;
+	calcGSSSE(lvl, H, b, refToNew_current, aff_g2l_current);
 
-	SE3 refToNew_current = lastToNew_out;
-	AffLight aff_g2l_current = aff_g2l_out;
+	float lambda = 0.01;
 
-	bool haveRepeated = false;
+	if(debugPrint)
+	{
+		Vec2f relAff = AffLight::fromToVecExposure(lastRef->ab_exposure, newFrame->ab_exposure, lastRef_aff_g2l, aff_g2l_current).cast<float>();
+		printf("lvl%d, it %d (l=%f / %f) %s: %.3f->%.3f (%d -> %d) (|inc| = %f)! \t",
+				lvl, -1, lambda, 1.0f,
+				"INITIA",
+				0.0f,
+				resOld[0] / resOld[1],
+				 0,(int)resOld[1],
+				0.0f);
+		std::cout << refToNew_current.log().transpose() << " AFF " << aff_g2l_current.vec().transpose() <<" (rel " << relAff.transpose() << ")\n";
+	}
 
 
-	for(int lvl=coarsestLvl; lvl>=0; lvl--)
+	for(int iteration=0; iteration < maxIterations[lvl]; iteration++)
 	{
-		Mat88 H; Vec8 b;
-		float levelCutoffRepeat=1;
-		Vec6 resOld = calcRes(lvl, refToNew_current, aff_g2l_current, setting_coarseCutoffTH*levelCutoffRepeat);
-		while(resOld[5] > 0.6 && levelCutoffRepeat < 50)
-		{
-			levelCutoffRepeat*=2;
-			resOld = calcRes(lvl, refToNew_current, aff_g2l_current, setting_coarseCutoffTH*levelCutoffRepeat);
+		Mat88 Hl = H;
+		for(int i=0;i<8;i++) Hl(i,i) *= (1+lambda);
+		Vec8 inc = Hl.ldlt().solve(-b);
 
-            if(!setting_debugout_runquiet)
-                printf("INCREASING cutoff to %f (ratio is %f)!\n", setting_coarseCutoffTH*levelCutoffRepeat, resOld[5]);
+		if(setting_affineOptModeA < 0 && setting_affineOptModeB < 0)	// fix a, b
+		{
+			inc.head<6>() = Hl.topLeftCorner<6,6>().ldlt().solve(-b.head<6>());
+		 	inc.tail<2>().setZero();
+		}
+		if(!(setting_affineOptModeA < 0) && setting_affineOptModeB < 0)	// fix b
+		{
+			inc.head<7>() = Hl.topLeftCorner<7,7>().ldlt().solve(-b.head<7>());
+		 	inc.tail<1>().setZero();
 		}
+		if(setting_affineOptModeA < 0 && !(setting_affineOptModeB < 0))	// fix a
+		{
+			Mat88 HlStitch = Hl;
+			Vec8 bStitch = b;
+			HlStitch.col(6) = HlStitch.col(7);
+			HlStitch.row(6) = HlStitch.row(7);
+			bStitch[6] = bStitch[7];
+			Vec7 incStitch = HlStitch.topLeftCorner<7,7>().ldlt().solve(-bStitch.head<7>());
+			inc.setZero();
+			inc.head<6>() = incStitch.head<6>();
+			inc[6] = 0;
+			inc[7] = incStitch[6];
+		}
+
+
+
+
+		float extrapFac = 1;
+		if(lambda < lambdaExtrapolationLimit) extrapFac = sqrt(sqrt(lambdaExtrapolationLimit / lambda));
+		inc *= extrapFac;
+
+		Vec8 incScaled = inc;
+		incScaled.segment<3>(0) *= SCALE_XI_ROT;
+		incScaled.segment<3>(3) *= SCALE_XI_TRANS;
+		incScaled.segment<1>(6) *= SCALE_A;
+		incScaled.segment<1>(7) *= SCALE_B;
+
+            if(!std::isfinite(incScaled.sum())) incScaled.setZero();
 
-		calcGSSSE(lvl, H, b, refToNew_current, aff_g2l_current);
+		SE3 refToNew_new = SE3::exp((Vec6)(incScaled.head<6>())) * refToNew_current;
+		AffLight aff_g2l_new = aff_g2l_current;
+		aff_g2l_new.a += incScaled[6];
+		aff_g2l_new.b += incScaled[7];
 
-		float lambda = 0.01;
+		Vec6 resNew = calcRes(lvl, refToNew_new, aff_g2l_new, setting_coarseCutoffTH*levelCutoffRepeat);
+
+		bool accept = (resNew[0] / resNew[1]) < (resOld[0] / resOld[1]);
 
 		if(debugPrint)
 		{
-			Vec2f relAff = AffLight::fromToVecExposure(lastRef->ab_exposure, newFrame->ab_exposure, lastRef_aff_g2l, aff_g2l_current).cast<float>();
-			printf("lvl%d, it %d (l=%f / %f) %s: %.3f->%.3f (%d -> %d) (|inc| = %f)! \t",
-					lvl, -1, lambda, 1.0f,
-					"INITIA",
-					0.0f,
+			Vec2f relAff = AffLight::fromToVecExposure(lastRef->ab_exposure, newFrame->ab_exposure, lastRef_aff_g2l, aff_g2l_new).cast<float>();
+			printf("lvl %d, it %d (l=%f / %f) %s: %.3f->%.3f (%d -> %d) (|inc| = %f)! \t",
+					lvl, iteration, lambda,
+					extrapFac,
+					(accept ? "ACCEPT" : "REJECT"),
 					resOld[0] / resOld[1],
-					 0,(int)resOld[1],
-					0.0f);
-			std::cout << refToNew_current.log().transpose() << " AFF " << aff_g2l_current.vec().transpose() <<" (rel " << relAff.transpose() << ")\n";
+					resNew[0] / resNew[1],
+					(int)resOld[1], (int)resNew[1],
+					inc.norm());
+			std::cout << refToNew_new.log().transpose() << " AFF " << aff_g2l_new.vec().transpose() <<" (rel " << relAff.transpose() << ")\n";
+		}
+		if(accept)
+		{
+			calcGSSSE(lvl, H, b, refToNew_new, aff_g2l_new);
+			resOld = resNew;
+			aff_g2l_current = aff_g2l_new;
+			refToNew_current = refToNew_new;
+			lambda *= 0.5;
+		}
+		else
+		{
+			lambda *= 4;
+			if(lambda < lambdaExtrapolationLimit) lambda = lambdaExtrapolationLimit;
 		}
 
-
-		for(int iteration=0; iteration < maxIterations[lvl]; iteration++)
+		if(!(inc.norm() > 1e-3))
 		{
-			Mat88 Hl = H;
-			for(int i=0;i<8;i++) Hl(i,i) *= (1+lambda);
-			Vec8 inc = Hl.ldlt().solve(-b);
+			if(debugPrint)
+				printf("inc too small, break!\n");
+			break;
+		}
+	}
 
-			if(setting_affineOptModeA < 0 && setting_affineOptModeB < 0)	// fix a, b
-			{
-				inc.head<6>() = Hl.topLeftCorner<6,6>().ldlt().solve(-b.head<6>());
-			 	inc.tail<2>().setZero();
-			}
-			if(!(setting_affineOptModeA < 0) && setting_affineOptModeB < 0)	// fix b
-			{
-				inc.head<7>() = Hl.topLeftCorner<7,7>().ldlt().solve(-b.head<7>());
-			 	inc.tail<1>().setZero();
-			}
-			if(setting_affineOptModeA < 0 && !(setting_affineOptModeB < 0))	// fix a
-			{
-				Mat88 HlStitch = Hl;
-				Vec8 bStitch = b;
-				HlStitch.col(6) = HlStitch.col(7);
-				HlStitch.row(6) = HlStitch.row(7);
-				bStitch[6] = bStitch[7];
-				Vec7 incStitch = HlStitch.topLeftCorner<7,7>().ldlt().solve(-bStitch.head<7>());
-				inc.setZero();
-				inc.head<6>() = incStitch.head<6>();
-				inc[6] = 0;
-				inc[7] = incStitch[6];
-			}
+	return resOld;
+}
 
+float CoarseTracker::trackCoarsestLevel(
+		FrameHessian* newFrameHessian,
+		SE3 &lastToNew, AffLight &aff_g2l)
+{
+	debugPlot = false;
+	debugPrint = false;
+	newFrame = newFrameHessian;
 
+	float levelCutoffRepeat=1;
+	Vec6 res = optimizeLevel(pyrLevelsUsed-1, lastToNew, aff_g2l, levelCutoffRepeat);
+	return sqrtf((float)(res[0] / res[1]));
+}
 
+bool CoarseTracker::trackNewestCoarse(
+		FrameHessian* newFrameHessian,
+		SE3 &lastToNew_out, AffLight &aff_g2l_out,
+		int coarsestLvl,
+		Vec5 minResForAbort,
+		IOWrap::Output3DWrapper* wrap)
+{
+	debugPlot = setting_render_displayCoarseTrackingFull;
+	debugPrint = false;
 
-			float extrapFac = 1;
-			if(lambda < lambdaExtrapolationLimit) extrapFac = sqrt(sqrt(lambdaExtrapolationLimit / lambda));
-			inc *= extrapFac;
+	assert(coarsestLvl < 5 && coarsestLvl < pyrLevelsUsed);
 
-			Vec8 incScaled = inc;
-			incScaled.segment<3>(0) *= SCALE_XI_ROT;
-			incScaled.segment<3>(3) *= SCALE_XI_TRANS;
-			incScaled.segment<1>(6) *= SCALE_A;
-			incScaled.segment<1>(7) *= SCALE_B;
+	lastResiduals.setConstant(NAN);
+	lastFlowIndicators.setConstant(1000);
 
-            if(!std::isfinite(incScaled.sum())) incScaled.setZero();
 
-			SE3 refToNew_new = SE3::exp((Vec6)(incScaled.head<6>())) * refToNew_current;
-			AffLight aff_g2l_new = aff_g2l_current;
-			aff_g2l_new.a += incScaled[6];
-			aff_g2l_new.b += incScaled[7];
+	newFrame = newFrameHessian;
 
-			Vec6 resNew = calcRes(lvl, refToNew_new, aff_g2l_new, setting_coarseCutoffTH*levelCutoffRepeat);
+	SE3 refToNew_current = lastToNew_out;
+	AffLight aff_g2l_current = aff_g2l_out;
 
-			bool accept = (resNew[0] / resNew[1]) < (resOld[0] / resOld[1]);
+	bool haveRepeated = false;
 
-			if(debugPrint)
-			{
-				Vec2f relAff = AffLight::fromToVecExposure(lastRef->ab_exposure, newFrame->ab_exposure, lastRef_aff_g2l, aff_g2l_new).cast<float>();
-				printf("lvl %d, it %d (l=%f / %f) %s: %.3f->%.3f (%d -> %d) (|inc| = %f)! \t",
-						lvl, iteration, lambda,
-						extrapFac,
-						(accept ? "ACCEPT" : "REJECT"),
-						resOld[0] / resOld[1],
-						resNew[0] / resNew[1],
-						(int)resOld[1], (int)resNew[1],
-						inc.norm());
-				std::cout << refToNew_new.log().transpose() << " AFF " << aff_g2l_new.vec().transpose() <<" (rel " << relAff.transpose() << ")\n";
-			}
-			if(accept)
-			{
-				calcGSSSE(lvl, H, b, refToNew_new, aff_g2l_new);
-				resOld = resNew;
-				aff_g2l_current = aff_g2l_new;
-				refToNew_current = refToNew_new;
-				lambda *= 0.5;
-			}
-			else
-			{
-				lambda *= 4;
-				if(lambda < lambdaExtrapolationLimit) lambda = lambdaExtrapolationLimit;
-			}
 
-			if(!(inc.norm() > 1e-3))
-			{
-				if(debugPrint)
-					printf("inc too small, break!\n");
-				break;
-			}
-		}
+	for(int lvl=coarsestLvl; lvl>=0; lvl--)
+	{
+		float levelCutoffRepeat=1;
+		Vec6 resOld = optimizeLevel(lvl, refToNew_current, aff_g2l_current, levelCutoffRepeat);
 
 		// set last residual for that level, as well as flow indicators.
 		lastResiduals[lvl] = sqrtf((float)(resOld[0] / resOld[1]));
@@ -842,9 +1023,6 @@ CoarseDistanceMap::CoarseDistanceMap(int ww, int hh)
 {
 	fwdWarpedIDDistFinal = new float[ww*hh/4];
 
-	bfsList1 = new Eigen::Vector2i[ww*hh/4];
-	bfsList2 = new Eigen::Vector2i[ww*hh/4];
-
 	int fac = 1 << (pyrLevelsUsed-1);
 
 
@@ -856,8 +1034,6 @@ CoarseDistanceMap::CoarseDistanceMap(int ww, int hh)
 CoarseDistanceMap::~CoarseDistanceMap()
 {
 	delete[] fwdWarpedIDDistFinal;
-	delete[] bfsList1;
-	delete[] bfsList2;
 	delete[] coarseProjectionGrid;
 	delete[] coarseProjectionGridNum;
 }
@@ -878,8 +1054,6 @@ void CoarseDistanceMap::makeDistanceMap(
 
 
 	// make coarse tracking templates for latstRef.
-	int numItems = 0;
-
 	for(FrameHessian* fh : frameHessians)
 	{
 		if(frame == fh) continue;
@@ -896,12 +1070,10 @@ void CoarseDistanceMap::makeDistanceMap(
 			int v = ptp[1] / ptp[2] + 0.5f;
 			if(!(u > 0 && v > 0 && u < w[1] && v < h[1])) continue;
 			fwdWarpedIDDistFinal[u+w1*v]=0;
-			bfsList1[numItems] = Eigen::Vector2i(u,v);
-			numItems++;
 		}
 	}
 
-	growDistBFS(numItems);
+	distanceTransform();
 }
 
 
@@ -914,109 +1086,126 @@ void CoarseDistanceMap::makeInlierVotes(std::vector<FrameHessian*> frameHessians
 
 
 
-void CoarseDistanceMap::growDistBFS(int bfsNum)
+/*
+ * distances are chamfer distances: 1 per straight, 4/3 per diagonal step (approximates the old
+ * BFS, which alternated 4- and 8-neighbourhood rings). both passes first take the row above / below
+ * 4 pixels at a time, and then do the sequential scan within the row.
+ */
+static const float distStraight = 1.0f;
+static const float distDiag = 4.0f / 3.0f;
+
+void CoarseDistanceMap::distanceTransform()
 {
 	assert(w[0] != 0);
 	int w1 = w[1], h1 = h[1];
-	for(int k=1;k<40;k++)
-	{
-		int bfsNum2 = bfsNum;
-		std::swap<Eigen::Vector2i*>(bfsList1,bfsList2);
-		bfsNum=0;
+	const __m128 straight = _mm_set1_ps(distStraight);
+	const __m128 diag = _mm_set1_ps(distDiag);
 
-		if(k%2==0)
+	// forward: from (x-1,y-1), (x,y-1), (x+1,y-1), then (x-1,y).
+	for(int y=0;y<h1;y++)
+	{
+		float* row = fwdWarpedIDDistFinal + y*w1;
+		if(y>0)
 		{
-			for(int i=0;i<bfsNum2;i++)
+			const float* up = row - w1;
+			row[0] = std::min(row[0], std::min(up[0]+distStraight, up[1]+distDiag));
+			int x=1;
+			for(;x+4<w1;x+=4)
 			{
-				int x = bfsList2[i][0];
-				int y = bfsList2[i][1];
-				if(x==0 || y== 0 || x==w1-1 || y==h1-1) continue;
-				int idx = x + y * w1;
-
-				if(fwdWarpedIDDistFinal[idx+1] > k)
-				{
-					fwdWarpedIDDistFinal[idx+1] = k;
-					bfsList1[bfsNum] = Eigen::Vector2i(x+1,y); bfsNum++;
-				}
-				if(fwdWarpedIDDistFinal[idx-1] > k)
-				{
-					fwdWarpedIDDistFinal[idx-1] = k;
-					bfsList1[bfsNum] = Eigen::Vector2i(x-1,y); bfsNum++;
-				}
-				if(fwdWarpedIDDistFinal[idx+w1] > k)
-				{
-					fwdWarpedIDDistFinal[idx+w1] = k;
-					bfsList1[bfsNum] = Eigen::Vector2i(x,y+1); bfsNum++;
-				}
-				if(fwdWarpedIDDistFinal[idx-w1] > k)
-				{
-					fwdWarpedIDDistFinal[idx-w1] = k;
-					bfsList1[bfsNum] = Eigen::Vector2i(x,y-1); bfsNum++;
-				}
+				__m128 d = _mm_loadu_ps(row+x);
+				d = _mm_min_ps(d, _mm_add_ps(_mm_loadu_ps(up+x), straight));
+				d = _mm_min_ps(d, _mm_add_ps(_mm_loadu_ps(up+x-1), diag));
+				d = _mm_min_ps(d, _mm_add_ps(_mm_loadu_ps(up+x+1), diag));
+				_mm_storeu_ps(row+x, d);
+			}
+			for(;x<w1;x++)
+			{
+				float d = std::min(row[x], std::min(up[x]+distStraight, up[x-1]+distDiag));
+				if(x+1<w1) d = std::min(d, up[x+1]+distDiag);
+				row[x] = d;
 			}
 		}
-		else
+		for(int x=1;x<w1;x++)
+			row[x] = std::min(row[x], row[x-1]+distStraight);
+	}
+
+	// backward: from (x-1,y+1), (x,y+1), (x+1,y+1), then (x+1,y).
+	for(int y=h1-1;y>=0;y--)
+	{
+		float* row = fwdWarpedIDDistFinal + y*w1;
+		if(y<h1-1)
 		{
-			for(int i=0;i<bfsNum2;i++)
+			const float* down = row + w1;
+			row[0] = std::min(row[0], std::min(down[0]+distStraight, down[1]+distDiag));
+			int x=1;
+			for(;x+4<w1;x+=4)
 			{
-				int x = bfsList2[i][0];
-				int y = bfsList2[i][1];
-				if(x==0 || y== 0 || x==w1-1 || y==h1-1) continue;
-				int idx = x + y * w1;
-
-				if(fwdWarpedIDDistFinal[idx+1] > k)
-				{
-					fwdWarpedIDDistFinal[idx+1] = k;
-					bfsList1[bfsNum] = Eigen::Vector2i(x+1,y); bfsNum++;
-				}
-				if(fwdWarpedIDDistFinal[idx-1] > k)
-				{
-					fwdWarpedIDDistFinal[idx-1] = k;
-					bfsList1[bfsNum] = Eigen::Vector2i(x-1,y); bfsNum++;
-				}
-				if(fwdWarpedIDDistFinal[idx+w1] > k)
-				{
-					fwdWarpedIDDistFinal[idx+w1] = k;
-					bfsList1[bfsNum] = Eigen::Vector2i(x,y+1); bfsNum++;
-				}
-				if(fwdWarpedIDDistFinal[idx-w1] > k)
-				{
-					fwdWarpedIDDistFinal[idx-w1] = k;
-					bfsList1[bfsNum] = Eigen::Vector2i(x,y-1); bfsNum++;
-				}
-
-				if(fwdWarpedIDDistFinal[idx+1+w1] > k)
-				{
-					fwdWarpedIDDistFinal[idx+1+w1] = k;
-					bfsList1[bfsNum] = Eigen::Vector2i(x+1,y+1); bfsNum++;
-				}
-				if(fwdWarpedIDDistFinal[idx-1+w1] > k)
-				{
-					fwdWarpedIDDistFinal[idx-1+w1] = k;
-					bfsList1[bfsNum] = Eigen::Vector2i(x-1,y+1); bfsNum++;
-				}
-				if(fwdWarpedIDDistFinal[idx-1-w1] > k)
-				{
-					fwdWarpedIDDistFinal[idx-1-w1] = k;
-					bfsList1[bfsNum] = Eigen::Vector2i(x-1,y-1); bfsNum++;
-				}
-				if(fwdWarpedIDDistFinal[idx+1-w1] > k)
-				{
-					fwdWarpedIDDistFinal[idx+1-w1] = k;
-					bfsList1[bfsNum] = Eigen::Vector2i(x+1,y-1); bfsNum++;
-				}
+				__m128 d = _mm_loadu_ps(row+x);
+				d = _mm_min_ps(d, _mm_add_ps(_mm_loadu_ps(down+x), straight));
+				d = _mm_min_ps(d, _mm_add_ps(_mm_loadu_ps(down+x-1), diag));
+				d = _mm_min_ps(d, _mm_add_ps(_mm_loadu_ps(down+x+1), diag));
+				_mm_storeu_ps(row+x, d);
+			}
+			for(;x<w1;x++)
+			{
+				float d = std::min(row[x], std::min(down[x]+distStraight, down[x-1]+distDiag));
+				if(x+1<w1) d = std::min(d, down[x+1]+distDiag);
+				row[x] = d;
 			}
 		}
+		for(int x=w1-2;x>=0;x--)
+			row[x] = std::min(row[x], row[x+1]+distStraight);
 	}
 }
 
 
+/*
+ * a new point only lowers distances, to min(old, distance to (u,v)), which is closed-form for the chamfer
+ * metric: max + (4/3-1)*min of |du|,|dv|. so only a window around it is touched; rows are done outwards,
+ * and stop on each side once a row did not change (the region a point is nearest to is star-shaped).
+ * no need to re-run the whole transform.
+ */
 void CoarseDistanceMap::addIntoDistFinal(int u, int v)
 {
 	if(w[0] == 0) return;
-	bfsList1[0] = Eigen::Vector2i(u,v);
-	fwdWarpedIDDistFinal[u+w[1]*v] = 0;
-	growDistBFS(1);
+	const int maxRadius = 40;
+	int w1 = w[1], h1 = h[1];
+	int x0 = std::max(0, u-maxRadius);
+	int x1 = std::min(w1-1, u+maxRadius);
+
+	const __m128 diagExtra = _mm_set1_ps(distDiag-distStraight);
+	const __m128 four = _mm_set1_ps(4);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+	for(int dir=1;dir>=-1;dir-=2)
+		for(int dv=(dir==1 ? 0 : 1); dv<=maxRadius; dv++)
+		{
+			int y = v + dir*dv;
+			if(y < 0 || y >= h1) break;
+			float* row = fwdWarpedIDDistFinal + y*w1;
+			const __m128 b = _mm_set1_ps(dv);
+			int changed = 0;
+
+			int x=x0;
+			__m128 du = _mm_setr_ps(x0-u, x0-u+1, x0-u+2, x0-u+3);
+			for(;x+4<=x1+1;x+=4)
+			{
+				__m128 a = _mm_and_ps(du, absMask);
+				__m128 dist = _mm_add_ps(_mm_max_ps(a,b), _mm_mul_ps(diagExtra, _mm_min_ps(a,b)));
+				__m128 old = _mm_loadu_ps(row+x);
+				changed |= _mm_movemask_ps(_mm_cmplt_ps(dist, old));
+				_mm_storeu_ps(row+x, _mm_min_ps(old, dist));
+				du = _mm_add_ps(du, four);
+			}
+			for(;x<=x1;x++)
+			{
+				float a = abs(x-u);
+				float dist = std::max(a,(float)dv) + (distDiag-distStraight)*std::min(a,(float)dv);
+				if(dist < row[x]) {row[x] = dist; changed=1;}
+			}
+
+			if(!changed) break;
+		}
 }
 
 
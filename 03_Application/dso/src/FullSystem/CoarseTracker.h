@@ -54,6 +54,17 @@ public:
 			int coarsestLvl, Vec5 minResForAbort,
 			IOWrap::Output3DWrapper* wrap=0);
 
+	// only optimizes on the coarsest level (pyrLevelsUsed-1), to rank many initializations quickly.
+	// lastToNew / aff_g2l are optimized in place; returns the RMSE on that level.
+	float trackCoarsestLevel(
+			FrameHessian* newFrameHessian,
+			SE3 &lastToNew, AffLight &aff_g2l);
+
+	// worker copy #[tid] for trackCoarsestLevel: shares the reference point cloud with this tracker, but has
+	// its own warped buffers, so different workers can run concurrently. create them with makeWorkers() first.
+	void makeWorkers(int num);
+	CoarseTracker* getWorker(int tid);
+
 	void setCoarseTrackingRef(
 			std::vector<FrameHessian*> frameHessians);
 
@@ -90,6 +101,14 @@ public:
 private:
 
 
+	// worker copy, see makeWorkers().
+	CoarseTracker(CoarseTracker* parent);
+	void syncFromParent();
+	CoarseTracker* parent;
+	std::vector<CoarseTracker*> workers;
+
+	Vec6 optimizeLevel(int lvl, SE3 &refToNew_current, AffLight &aff_g2l_current, float &levelCutoffRepeat);
+
 	void makeCoarseDepthL0(std::vector<FrameHessian*> frameHessians);
 	float* idepth[PYR_LEVELS];
 	float* weightSums[PYR_LEVELS];
@@ -99,6 +118,10 @@ private:
 	Vec6 calcResAndGS(int lvl, Mat88 &H_out, Vec8 &b_out, const SE3 &refToNew, AffLight aff_g2l, float cutoffTH);
 	Vec6 calcRes(int lvl, const SE3 &refToNew, AffLight aff_g2l, float cutoffTH);
 	void calcGSSSE(int lvl, Mat88 &H_out, Vec8 &b_out, const SE3 &refToNew, AffLight aff_g2l);
+#ifdef DSO_SIMD_DISPATCH
+	DSO_TARGET_AVX2 int calcGSAccumulateAVX2(int lvl, float a, float b0);
+	DSO_TARGET_AVX512 int calcGSAccumulateAVX512(int lvl, float a, float b0);
+#endif
 	void calcGS(int lvl, Mat88 &H_out, Vec8 &b_out, const SE3 &refToNew, AffLight aff_g2l);
 
 	// pc buffers
@@ -166,10 +189,9 @@ private:
 
 	PointFrameResidual** coarseProjectionGrid;
 	int* coarseProjectionGridNum;
-	Eigen::Vector2i* bfsList1;
-	Eigen::Vector2i* bfsList2;
 
-	void growDistBFS(int bfsNum);
+	// two-pass chamfer distance transform of fwdWarpedIDDistFinal (0 at the points).
+	void distanceTransform();
 };
 
 }
@@ -49,13 +49,19 @@
 
 #include "OptimizationBackend/EnergyFunctional.h"
 #include "OptimizationBackend/EnergyFunctionalStructs.h"
+#include "OptimizationBackend/PoseGraphBackend.h"
 
 #include "IOWrapper/Output3DWrapper.h"
 
 #include "util/ImageAndExposure.h"
+#include "util/SlabPool.h"
+#include "util/KeyframeArchive.h"
+#include "util/StageProfiler.h"
 
 #include <cmath>
 
+#define TRACE_BLOCK_SIZE 64		// immature points per work item in traceNewCoarse.
+
 namespace dso
 {
 int FrameHessian::instanceCounter=0;
@@ -64,7 +70,7 @@ int CalibHessian::instanceCounter=0;
 
 
 
-FullSystem::FullSystem()
+FullSystem::FullSystem() : unmappedTrackedFrames(setting_mappingQueueSize)
 {
 
 	int retstat =0;
@@ -146,6 +152,9 @@ FullSystem::FullSystem()
 	statistics_numForceDroppedResFwd = 0;
 	statistics_numMargResFwd = 0;
 	statistics_numMargResBwd = 0;
+	statistics_numDroppedFrames = 0;
+	statistics_numCoalescedFrames = 0;
+	statistics_numLostFrames = 0;
 
 	lastCoarseRMSE.setConstant(100);
 
@@ -153,17 +162,22 @@ FullSystem::FullSystem()
 	initialized=false;
 
 
-	ef = new EnergyFunctional();
-	ef->red = &this->treadReduce;
+	ef = new EnergyFunctional(&this->treadReduce);
+	linearizeToRemove.resize(treadReduce.getNumThreads());
+	poseGraph = setting_poseGraph ? new PoseGraphBackend(&shellPoseMutex) : 0;
+	kfArchive = 0;
+	firstArchiveRecord = 0;
+	numSpilledFrames = numSpilledKeyFrames = numSpilledPoses = 0;
 
 	isLost=false;
 	initFailed=false;
 
 
 	needNewKFAfter = -1;
+	needToKetchupMapping = false;
 
 	linearizeOperation=true;
-	runMapping=true;
+	externalPosesById=false;
 	mappingThread = boost::thread(&FullSystem::mappingLoop, this);
 	lastRefStopID=0;
 
@@ -195,10 +209,28 @@ FullSystem::~FullSystem()
 
 	delete[] selectionMap;
 
+	// holds pointers to the shells.
+	if(poseGraph != 0)
+	{
+		if(!setting_debugout_runquiet) poseGraph->printStats();
+		delete poseGraph;
+	}
+
+	if(!setting_debugout_runquiet && !linearizeOperation)
+	{
+		unmappedTrackedFrames.printStats("tracking->mapping queue");
+		printf("tracking->mapping queue: %ld non-keyframes dropped by the tracker, %ld coalesced by the mapper, %ld pushed after mapping stopped.\n",
+				statistics_numDroppedFrames, statistics_numCoalescedFrames, statistics_numLostFrames);
+	}
+
+	TrackedFrame left;
+	while(unmappedTrackedFrames.tryPop(left))
+		delete left.fh;
+	// the final pose of every frame that was not spilled yet.
+	if(kfArchive != 0)
+		for(FrameShell* s : allFrameHistory) archiveFramePose(s);
 	for(FrameShell* s : allFrameHistory)
 		delete s;
-	for(FrameHessian* fh : unmappedTrackedFrames)
-		delete fh;
 
 	delete coarseDistanceMap;
 	delete coarseTracker;
@@ -206,6 +238,9 @@ FullSystem::~FullSystem()
 	delete coarseInitializer;
 	delete pixelSelector;
 	delete ef;
+
+	if(!setting_debugout_runquiet)
+		SlabPool::printStats();
 }
 
 void FullSystem::setOriginalCalib(const VecXf &originalCalib, int originalW, int originalH)
@@ -240,13 +275,50 @@ void FullSystem::setGammaFunction(float* BInv)
 	Hcalib.B[255] = 255;
 }
 
+void FullSystem::addExternalPose(const ExternalPoseMeasurement &m)
+{
+	externalPoses.push(m);
+}
+
+void FullSystem::setKeyframeArchive(KeyframeArchive* archive)
+{
+	kfArchive = archive;
+	firstArchiveRecord = archive != 0 ? archive->getNumRecords() : 0;
+}
+
 void FullSystem::setCameraPoses(std::vector<SE3> poses)
 {
-    this->cameraPoses = poses;
+	externalPoses.clear();
+	externalPoses.setMaxSize(std::max<int>(poses.size(), 100000));	// the whole sequence has to fit.
+	externalPosesById = poses.size() > 0;
+	for(unsigned int i=0;i<poses.size();i++)
+	{
+		ExternalPoseMeasurement m;
+		m.timestamp = i;
+		m.position = poses[i].translation();
+		m.orientation = poses[i].unit_quaternion();
+		m.hasOrientation = true;
+		externalPoses.push(m);
+	}
+}
+
+static void writeResultLine(std::ofstream &myfile, double timestamp, const SE3 &camToWorld)
+{
+	myfile << timestamp <<
+		" " << camToWorld.translation().transpose()<<
+		" " << camToWorld.so3().unit_quaternion().x()<<
+		" " << camToWorld.so3().unit_quaternion().y()<<
+		" " << camToWorld.so3().unit_quaternion().z()<<
+		" " << camToWorld.so3().unit_quaternion().w() << "\n";
 }
 
 void FullSystem::printResult(std::string file)
 {
+	boost::unique_lock<boost::mutex> slock(spillMutex);
+	std::vector<ArchivedKeyframe,Eigen::aligned_allocator<ArchivedKeyframe>> spilled;
+	if(!readSpilledPoses(spilled, setting_onlyLogKFPoses))
+		printf("WARNING: could not read all spilled poses back from the keyframe archive, %s is missing frames!\n", file.c_str());
+
 	boost::unique_lock<boost::mutex> lock(trackMutex);
 	boost::unique_lock<boost::mutex> crlock(shellPoseMutex);
 
@@ -254,25 +326,65 @@ void FullSystem::printResult(std::string file)
 	myfile.open (file.c_str());
 	myfile << std::setprecision(15);
 
+	for(const ArchivedKeyframe &r : spilled)
+		writeResultLine(myfile, r.timestamp, r.camToWorld);
+
 	for(FrameShell* s : allFrameHistory)
 	{
 		if(!s->poseValid) continue;
 
 		if(setting_onlyLogKFPoses && s->marginalizedAt == s->id) continue;
 
-		myfile << s->timestamp <<
-			" " << s->camToWorld.translation().transpose()<<
-			" " << s->camToWorld.so3().unit_quaternion().x()<<
-			" " << s->camToWorld.so3().unit_quaternion().y()<<
-			" " << s->camToWorld.so3().unit_quaternion().z()<<
-			" " << s->camToWorld.so3().unit_quaternion().w() << "\n";
+		writeResultLine(myfile, s->timestamp, s->camToWorld);
 	}
 	myfile.close();
 }
 
+void FullSystem::getTrajectory(std::vector<SE3> &camToWorld, std::vector<int> &incomingIds)
+{
+	boost::unique_lock<boost::mutex> slock(spillMutex);
+	std::vector<ArchivedKeyframe,Eigen::aligned_allocator<ArchivedKeyframe>> spilled;
+	if(!readSpilledPoses(spilled, false))
+		printf("WARNING: could not read all spilled poses back from the keyframe archive, the trajectory is missing frames!\n");
+
+	boost::unique_lock<boost::mutex> lock(trackMutex);
+	boost::unique_lock<boost::mutex> crlock(shellPoseMutex);
+
+	camToWorld.clear();
+	incomingIds.clear();
+	for(const ArchivedKeyframe &r : spilled)
+	{
+		camToWorld.push_back(r.camToWorld);
+		incomingIds.push_back(r.incomingId);
+	}
+	for(FrameShell* s : allFrameHistory)
+	{
+		if(!s->poseValid) continue;
+		camToWorld.push_back(s->camToWorld);
+		incomingIds.push_back(s->incoming_id);
+	}
+}
+
+int FullSystem::getNumKeyframes()
+{
+	boost::unique_lock<boost::mutex> lock(mapMutex);
+	return numSpilledKeyFrames + allKeyFramesHistory.size();
+}
+
+MappingQueueStats FullSystem::getMappingQueueStats()
+{
+	MappingQueueStats s;
+	s.ring = unmappedTrackedFrames.getStats();
+	s.numDropped = statistics_numDroppedFrames;
+	s.numCoalesced = statistics_numCoalescedFrames;
+	s.numLost = statistics_numLostFrames;
+	return s;
+}
+
 
 Vec4 FullSystem::trackNewCoarse(FrameHessian* fh)
 {
+	DSO_PROFILE_STAGE("trackNewCoarse");
     printf("FUNCTION: FullSystem::trackNewCoarse(FrameHessian* fh)\n");
     assert(allFrameHistory.size() > 0);
     // set pose initialization.
@@ -287,7 +399,7 @@ Vec4 FullSystem::trackNewCoarse(FrameHessian* fh)
 	AffLight aff_last_2_l = AffLight(0,0);
 
 	std::vector<SE3,Eigen::aligned_allocator<SE3>> lastF_2_fh_tries;
-	if(allFrameHistory.size() == 2)
+	if(numSpilledFrames + allFrameHistory.size() == 2)
 		for(unsigned int i=0;i<lastF_2_fh_tries.size();i++) lastF_2_fh_tries.push_back(SE3());
 	else
 	{
@@ -350,6 +462,19 @@ Vec4 FullSystem::trackNewCoarse(FrameHessian* fh)
 			lastF_2_fh_tries.clear();
 			lastF_2_fh_tries.push_back(SE3());
 		}
+
+		// external prediction (GPS / IMU with orientation) goes first: rotation and direction of motion from the
+		// prediction, length of the motion from the first guess, as the metric scale is not known here.
+		if(fh->shell->predictedValid && fh->shell->predictedHasOrientation
+				&& lastF->shell->predictedValid && lastF->shell->predictedHasOrientation)
+		{
+			SE3 predicted = fh->shell->camToWorld_predicted.inverse() * lastF->shell->camToWorld_predicted;
+			double predictedLength = predicted.translation().norm();
+			Vec3 t = Vec3(0,0,0);
+			if(predictedLength > 1e-6)
+				t = predicted.translation() * (lastF_2_fh_tries[0].translation().norm() / predictedLength);
+			lastF_2_fh_tries.insert(lastF_2_fh_tries.begin(), SE3(predicted.so3(), t));
+		}
 	}
 
 
@@ -366,23 +491,45 @@ Vec4 FullSystem::trackNewCoarse(FrameHessian* fh)
 	Vec5 achievedRes = Vec5::Constant(NAN);
 	bool haveOneGood = false;
 	int tryIterations=0;
-        
-        
-        // TODO ADAM !!!!
-        // If we have a file with available camera poses,
-        // then use them insted of randomly trying around stuff
-        /*
-        if( (int)this->cameraPoses.size() > 0)
-        {
-            lastF_2_fh_tries.clear();
-            lastF_2_fh_tries.push_back(this->cameraPoses.at(fh->shell->id));
-        }
-        */
-        
-        
+
+	// if the first guess is not good enough, the others are ranked on the coarsest level (in parallel), and
+	// only the best [setting_reTrackRefine] are tracked fully, starting from where the coarsest level ended.
+	std::vector<AffLight> lastF_2_fh_triesAff(lastF_2_fh_tries.size(), aff_last_2_l);
+	std::vector<int> lastF_2_fh_triesIdx;		// index of the hypothesis before ranking, for the log.
+	for(unsigned int i=0;i<lastF_2_fh_tries.size();i++) lastF_2_fh_triesIdx.push_back(i);
+	bool rankRest = multiThreading && setting_reTrackRefine > 0 && (int)lastF_2_fh_tries.size() > 1+setting_reTrackRefine;
+
 	for(unsigned int i=0;i<lastF_2_fh_tries.size();i++)
 	{
-		AffLight aff_g2l_this = aff_last_2_l;
+		if(i == 1 && rankRest)
+		{
+			std::vector<float> res(lastF_2_fh_tries.size(), NAN);
+			coarseTracker->makeWorkers(trackReduce.getNumThreads());
+			trackReduce.reduce(boost::bind(&FullSystem::rankCoarseHypotheses_Reductor, this, fh,
+					&lastF_2_fh_tries, &lastF_2_fh_triesAff, &res, _1, _2, _3, _4), 1, lastF_2_fh_tries.size(), 1);
+
+			std::vector<int> order;
+			for(unsigned int k=1;k<lastF_2_fh_tries.size();k++)
+				if(std::isfinite(res[k])) order.push_back(k);
+			std::sort(order.begin(), order.end(), [&res](int a, int b) {return res[a] < res[b];});
+			if((int)order.size() > setting_reTrackRefine) order.resize(setting_reTrackRefine);
+
+			std::vector<SE3,Eigen::aligned_allocator<SE3>> best(1, lastF_2_fh_tries[0]);
+			std::vector<AffLight> bestAff(1, lastF_2_fh_triesAff[0]);
+			std::vector<int> bestIdx(1, 0);
+			for(int k : order)
+			{
+				best.push_back(lastF_2_fh_tries[k]);
+				bestAff.push_back(lastF_2_fh_triesAff[k]);
+				bestIdx.push_back(k);
+			}
+			lastF_2_fh_tries = best;
+			lastF_2_fh_triesAff = bestAff;
+			lastF_2_fh_triesIdx = bestIdx;
+			if(lastF_2_fh_tries.size() == 1) break;
+		}
+
+		AffLight aff_g2l_this = lastF_2_fh_triesAff[i];
 		SE3 lastF_2_fh_this = lastF_2_fh_tries[i];
 		bool trackingIsGood = coarseTracker->trackNewestCoarse(
 				fh, lastF_2_fh_this, aff_g2l_this,
@@ -394,7 +541,7 @@ Vec4 FullSystem::trackNewCoarse(FrameHessian* fh)
 		{
 			printf("RE-TRACK ATTEMPT %d with initOption %d and start-lvl %d (ab %f %f): %f %f %f %f %f -> %f %f %f %f %f \n",
 					i,
-					i, pyrLevelsUsed-1,
+					lastF_2_fh_triesIdx[i], pyrLevelsUsed-1,
 					aff_g2l_this.a,aff_g2l_this.b,
 					achievedRes[0],
 					achievedRes[1],
@@ -477,48 +624,74 @@ Vec4 FullSystem::trackNewCoarse(FrameHessian* fh)
 	return Vec4(achievedRes[0], flowVecs[0], flowVecs[1], flowVecs[2]);
 }
 
+void FullSystem::rankCoarseHypotheses_Reductor(FrameHessian* fh, std::vector<SE3,Eigen::aligned_allocator<SE3>>* tries, std::vector<AffLight>* affs, std::vector<float>* res, int min, int max, Vec10* stats, int tid)
+{
+	CoarseTracker* worker = coarseTracker->getWorker(tid);
+	for(int k=min;k<max;k++)
+		(*res)[k] = worker->trackCoarsestLevel(fh, (*tries)[k], (*affs)[k]);
+}
+
+void FullSystem::traceNewCoarse_Reductor(FrameHessian* fh, std::vector<TraceHostPrecalc>* hosts, std::vector<Eigen::Vector2i>* blocks, int min, int max, Vec10* stats, int tid)
+{
+	for(int k=min;k<max;k++)
+	{
+		const TraceHostPrecalc &p = (*hosts)[(*blocks)[k][0]];
+		const std::vector<ImmaturePoint*> &points = p.host->immaturePoints;
+		int end = std::min((int)points.size(), (*blocks)[k][1] + TRACE_BLOCK_SIZE);
+
+		for(int i=(*blocks)[k][1];i<end;i++)
+		{
+			ImmaturePoint* ph = points[i];
+			ph->traceOn(fh, p.KRKi, p.Kt, p.aff, &Hcalib, false );
+
+			// counted per status, see ImmaturePointStatus.
+			(*stats)[ph->lastTraceStatus]++;
+			(*stats)[9]++;
+		}
+	}
+}
+
 void FullSystem::traceNewCoarse(FrameHessian* fh)
 {
+	DSO_PROFILE_STAGE("traceNewCoarse");
 	boost::unique_lock<boost::mutex> lock(mapMutex);
 
-	int trace_total=0, trace_good=0, trace_oob=0, trace_out=0, trace_skip=0, trace_badcondition=0, trace_uninitialized=0;
-
 	Mat33f K = Mat33f::Identity();
 	K(0,0) = Hcalib.fxl();
 	K(1,1) = Hcalib.fyl();
 	K(0,2) = Hcalib.cxl();
 	K(1,2) = Hcalib.cyl();
 
-	for(FrameHessian* host : frameHessians)		// go through all active frames
+	// every point is traced independently: split into blocks of (host, TRACE_BLOCK_SIZE points).
+	std::vector<TraceHostPrecalc> hosts(frameHessians.size());
+	std::vector<Eigen::Vector2i> blocks;
+	for(unsigned int h=0;h<frameHessians.size();h++)		// go through all active frames
 	{
-
+		FrameHessian* host = frameHessians[h];
 		SE3 hostToNew = fh->PRE_worldToCam * host->PRE_camToWorld;
-		Mat33f KRKi = K * hostToNew.rotationMatrix().cast<float>() * K.inverse();
-		Vec3f Kt = K * hostToNew.translation().cast<float>();
-
-		Vec2f aff = AffLight::fromToVecExposure(host->ab_exposure, fh->ab_exposure, host->aff_g2l(), fh->aff_g2l()).cast<float>();
+		hosts[h].host = host;
+		hosts[h].KRKi = K * hostToNew.rotationMatrix().cast<float>() * K.inverse();
+		hosts[h].Kt = K * hostToNew.translation().cast<float>();
+		hosts[h].aff = AffLight::fromToVecExposure(host->ab_exposure, fh->ab_exposure, host->aff_g2l(), fh->aff_g2l()).cast<float>();
 
-		for(ImmaturePoint* ph : host->immaturePoints)
-		{
-			ph->traceOn(fh, KRKi, Kt, aff, &Hcalib, false );
-
-			if(ph->lastTraceStatus==ImmaturePointStatus::IPS_GOOD) trace_good++;
-			if(ph->lastTraceStatus==ImmaturePointStatus::IPS_BADCONDITION) trace_badcondition++;
-			if(ph->lastTraceStatus==ImmaturePointStatus::IPS_OOB) trace_oob++;
-			if(ph->lastTraceStatus==ImmaturePointStatus::IPS_OUTLIER) trace_out++;
-			if(ph->lastTraceStatus==ImmaturePointStatus::IPS_SKIPPED) trace_skip++;
-			if(ph->lastTraceStatus==ImmaturePointStatus::IPS_UNINITIALIZED) trace_uninitialized++;
-			trace_total++;
-		}
+		for(int i=0;i<(int)host->immaturePoints.size();i+=TRACE_BLOCK_SIZE)
+			blocks.push_back(Eigen::Vector2i(h,i));
 	}
+
+	Vec10 stats = Vec10::Zero();
+	if(multiThreading)
+		stats = treadReduce.reduce(boost::bind(&FullSystem::traceNewCoarse_Reductor, this, fh, &hosts, &blocks, _1, _2, _3, _4), 0, blocks.size(), 1);
+	else
+		traceNewCoarse_Reductor(fh, &hosts, &blocks, 0, blocks.size(), &stats, 0);
+
 //	printf("ADD: TRACE: %'d points. %'d (%.0f%%) good. %'d (%.0f%%) skip. %'d (%.0f%%) badcond. %'d (%.0f%%) oob. %'d (%.0f%%) out. %'d (%.0f%%) uninit.\n",
-//			trace_total,
-//			trace_good, 100*trace_good/(float)trace_total,
-//			trace_skip, 100*trace_skip/(float)trace_total,
-//			trace_badcondition, 100*trace_badcondition/(float)trace_total,
-//			trace_oob, 100*trace_oob/(float)trace_total,
-//			trace_out, 100*trace_out/(float)trace_total,
-//			trace_uninitialized, 100*trace_uninitialized/(float)trace_total);
+//			(int)stats[9],
+//			(int)stats[IPS_GOOD], 100*stats[IPS_GOOD]/stats[9],
+//			(int)stats[IPS_SKIPPED], 100*stats[IPS_SKIPPED]/stats[9],
+//			(int)stats[IPS_BADCONDITION], 100*stats[IPS_BADCONDITION]/stats[9],
+//			(int)stats[IPS_OOB], 100*stats[IPS_OOB]/stats[9],
+//			(int)stats[IPS_OUTLIER], 100*stats[IPS_OUTLIER]/stats[9],
+//			(int)stats[IPS_UNINITIALIZED], 100*stats[IPS_UNINITIALIZED]/stats[9]);
 }
 
 
@@ -541,6 +714,7 @@ void FullSystem::activatePointsMT_Reductor(
 
 void FullSystem::activatePointsMT()
 {
+	DSO_PROFILE_STAGE("activatePointsMT");
 
 	if(ef->nPoints < setting_desiredPointDensity*0.66)
 		currentMinActDist -= 0.8;
@@ -766,7 +940,7 @@ void FullSystem::flagPointsForRemoval()
 					{
 						r->resetOOB();
 						r->linearize(&Hcalib);
-						r->efResidual->isLinearized = false;
+						r->efResidual->setLinearized(false);
 						r->applyRes(true);
 						if(r->efResidual->isActive())
 						{
@@ -818,6 +992,7 @@ void FullSystem::flagPointsForRemoval()
 
 void FullSystem::addActiveFrame( ImageAndExposure* image, int id )
 {
+	DSO_PROFILE_STAGE("addActiveFrame");
 
     if(isLost) return;
 	boost::unique_lock<boost::mutex> lock(trackMutex);
@@ -826,16 +1001,18 @@ void FullSystem::addActiveFrame( ImageAndExposure* image, int id )
 	// =========================== add into allFrameHistory =========================
 	FrameHessian* fh = new FrameHessian();
 	FrameShell* shell = new FrameShell();
-        //initialize camToWorld_predicted (SE3) with external information (GroundTruth, GPS, ...)
-        SE3 initialCameraPose;
-        if( (int)this->cameraPoses.size() > 0 && (int)this->cameraPoses.size() >= id)
-        {
-            printf("\nLoading Camera pose number %d\n\n", id);
-            shell->camToWorld_predicted = this->cameraPoses.at(id);
-        }
-	shell->camToWorld = initialCameraPose;		// no lock required, as fh is not used anywhere yet.
+	// initialize camToWorld_predicted with external information (GroundTruth, GPS, ...), if there is some for this time.
+	ExternalPoseMeasurement externalPose;
+	if(externalPoses.lookUp(externalPosesById ? (double)id : image->timestamp, externalPose))
+	{
+		shell->camToWorld_predicted = externalPose.camToWorld();
+		shell->predictedValid = true;
+		shell->predictedHasOrientation = externalPose.hasOrientation;
+		shell->predictedPositionCov = externalPose.covariance;
+	}
+	shell->camToWorld = SE3();		// no lock required, as fh is not used anywhere yet.
         shell->aff_g2l = AffLight(0,0);
-        shell->marginalizedAt = shell->id = allFrameHistory.size();
+        shell->marginalizedAt = shell->id = numSpilledFrames + allFrameHistory.size();
         shell->timestamp = image->timestamp;
         shell->incoming_id = id;
 	fh->shell = shell;
@@ -893,7 +1070,7 @@ void FullSystem::addActiveFrame( ImageAndExposure* image, int id )
 		bool needToMakeKF = false;
 		if(setting_keyframesPerSecond > 0)
 		{
-			needToMakeKF = allFrameHistory.size()== 1 ||
+			needToMakeKF = numSpilledFrames + allFrameHistory.size()== 1 ||
 					(fh->shell->timestamp - allKeyFramesHistory.back()->timestamp) > 0.95f/setting_keyframesPerSecond;
 		}
 		else
@@ -902,7 +1079,7 @@ void FullSystem::addActiveFrame( ImageAndExposure* image, int id )
 					coarseTracker->lastRef_aff_g2l, fh->shell->aff_g2l);
 
 			// BRIGHTNESS CHECK
-			needToMakeKF = allFrameHistory.size()== 1 ||
+			needToMakeKF = numSpilledFrames + allFrameHistory.size()== 1 ||
 					setting_kfGlobalWeight*setting_maxShiftWeightT *  sqrtf((double)tres[1]) / (wG[0]+hG[0]) +
 					setting_kfGlobalWeight*setting_maxShiftWeightR *  sqrtf((double)tres[2]) / (wG[0]+hG[0]) +
 					setting_kfGlobalWeight*setting_maxShiftWeightRT * sqrtf((double)tres[3]) / (wG[0]+hG[0]) +
@@ -952,105 +1129,107 @@ void FullSystem::deliverTrackedFrame(FrameHessian* fh, bool needKF)
 	}
 	else
 	{
-		boost::unique_lock<boost::mutex> lock(trackMapSyncMutex);
-		unmappedTrackedFrames.push_back(fh);
-		if(needKF) needNewKFAfter=fh->shell->trackingRef->id;
-		trackedFrameSignal.notify_all();
-
-		while(coarseTracker_forNewKF->refFrameID == -1 && coarseTracker->refFrameID == -1 )
+		TrackedFrame tf;
+		tf.fh = fh;
+		tf.needKF = needKF;
+		if(!unmappedTrackedFrames.tryPush(tf))
 		{
-			mappedFrameSignal.wait(lock);
+			// mapper lags behind. keyframes are never dropped.
+			if(!needKF && setting_mappingQueuePolicy == 1)
+			{
+				propagateNonKeyFramePose(fh);
+				delete fh;
+				statistics_numDroppedFrames++;
+			}
+			else if(!unmappedTrackedFrames.push(tf))
+			{
+				// mapping has stopped, nobody will ever pop it.
+				delete fh;
+				statistics_numLostFrames++;
+			}
 		}
 
-		lock.unlock();
+		if(coarseTracker_forNewKF->refFrameID == -1 && coarseTracker->refFrameID == -1)
+		{
+			boost::unique_lock<boost::mutex> lock(trackMapSyncMutex);
+			while(coarseTracker_forNewKF->refFrameID == -1 && coarseTracker->refFrameID == -1 )
+			{
+				mappedFrameSignal.wait(lock);
+			}
+		}
 	}
 }
 
 void FullSystem::mappingLoop()
 {
-	boost::unique_lock<boost::mutex> lock(trackMapSyncMutex);
-
-	while(runMapping)
+	TrackedFrame tf;
+	while(unmappedTrackedFrames.pop(tf))
 	{
-		while(unmappedTrackedFrames.size()==0)
-		{
-			trackedFrameSignal.wait(lock);
-			if(!runMapping) return;
-		}
-
-		FrameHessian* fh = unmappedTrackedFrames.front();
-		unmappedTrackedFrames.pop_front();
+		FrameHessian* fh = tf.fh;
 
 
 		// guaranteed to make a KF for the very first two tracked frames.
-		if(allKeyFramesHistory.size() <= 2)
+		if(numSpilledKeyFrames + allKeyFramesHistory.size() <= 2)
 		{
-			lock.unlock();
 			makeKeyFrame(fh);
-			lock.lock();
+			boost::unique_lock<boost::mutex> lock(trackMapSyncMutex);
 			mappedFrameSignal.notify_all();
 			continue;
 		}
 
-		if(unmappedTrackedFrames.size() > 3)
+		// the request of a coalesced frame is served by the next one traced.
+		if(tf.needKF) needNewKFAfter = std::max(needNewKFAfter, fh->shell->trackingRef->id);
+
+		int backlog = unmappedTrackedFrames.size();
+		if(backlog > setting_mappingCoalesceAfter)
 			needToKetchupMapping=true;
 
 
-		if(unmappedTrackedFrames.size() > 0) // if there are other frames to tracke, do that first.
+		if(backlog > 0) // if there are other frames to tracke, do that first.
 		{
-			lock.unlock();
-			makeNonKeyFrame(fh);
-			lock.lock();
-
-			if(needToKetchupMapping && unmappedTrackedFrames.size() > 0)
+			// catching up: coalesce, i.e. only the newest queued frame is traced, the ones before only get their pose.
+			if(needToKetchupMapping)
 			{
-				FrameHessian* fh = unmappedTrackedFrames.front();
-				unmappedTrackedFrames.pop_front();
-				{
-					boost::unique_lock<boost::mutex> crlock(shellPoseMutex);
-					assert(fh->shell->trackingRef != 0);
-					fh->shell->camToWorld = fh->shell->trackingRef->camToWorld * fh->shell->camToTrackingRef;
-					fh->setEvalPT_scaled(fh->shell->camToWorld.inverse(),fh->shell->aff_g2l);
-				}
+				propagateNonKeyFramePose(fh);
 				delete fh;
+				statistics_numCoalescedFrames++;
 			}
-
+			else makeNonKeyFrame(fh);
 		}
 		else
 		{
 			if(setting_realTimeMaxKF || needNewKFAfter >= frameHessians.back()->shell->id)
 			{
-				lock.unlock();
 				makeKeyFrame(fh);
 				needToKetchupMapping=false;
-				lock.lock();
+				boost::unique_lock<boost::mutex> lock(trackMapSyncMutex);
+				mappedFrameSignal.notify_all();
 			}
 			else
 			{
-				lock.unlock();
 				makeNonKeyFrame(fh);
-				lock.lock();
 			}
 		}
-		mappedFrameSignal.notify_all();
 	}
 	printf("MAPPING FINISHED!\n");
 }
 
 void FullSystem::blockUntilMappingIsFinished()
 {
-	boost::unique_lock<boost::mutex> lock(trackMapSyncMutex);
-	runMapping = false;
-	trackedFrameSignal.notify_all();
-	lock.unlock();
+	unmappedTrackedFrames.close();
 
 	mappingThread.join();
 
+	if(poseGraph != 0)
+	{
+		std::vector<FrameShell*> window;
+		for(FrameHessian* fh : frameHessians) window.push_back(fh->shell);
+		poseGraph->finish(window);
+	}
 }
 
-void FullSystem::makeNonKeyFrame( FrameHessian* fh)
+void FullSystem::propagateNonKeyFramePose( FrameHessian* fh)
 {
-	// needs to be set by mapping thread. no lock required since we are in mapping thread.
 	{
 		boost::unique_lock<boost::mutex> crlock(shellPoseMutex);
 		assert(fh->shell->trackingRef != 0);
@@ -1058,12 +1237,21 @@ void FullSystem::makeNonKeyFrame( FrameHessian* fh)
 		fh->setEvalPT_scaled(fh->shell->camToWorld.inverse(),fh->shell->aff_g2l);
 	}
 
+	if(poseGraph != 0) poseGraph->attachFrame(fh->shell);
+}
+
+void FullSystem::makeNonKeyFrame( FrameHessian* fh)
+{
+	// needs to be set by mapping thread. no lock required since we are in mapping thread.
+	propagateNonKeyFramePose(fh);
+
 	traceNewCoarse(fh);
 	delete fh;
 }
 
 void FullSystem::makeKeyFrame( FrameHessian* fh)
 {
+	DSO_PROFILE_STAGE("makeKeyFrame");
 	// needs to be set by mapping thread
 	{
 		boost::unique_lock<boost::mutex> crlock(shellPoseMutex);
@@ -1083,7 +1271,7 @@ void FullSystem::makeKeyFrame( FrameHessian* fh)
 	// =========================== add New Frame to Hessian Struct. =========================
 	fh->idx = frameHessians.size();
 	frameHessians.push_back(fh);
-	fh->frameID = allKeyFramesHistory.size();
+	fh->frameID = numSpilledKeyFrames + allKeyFramesHistory.size();
 	allKeyFramesHistory.push_back(fh->shell);
 	ef->insertFrame(fh, &Hcalib);
 
@@ -1128,19 +1316,20 @@ void FullSystem::makeKeyFrame( FrameHessian* fh)
 
 
 	// =========================== Figure Out if INITIALIZATION FAILED =========================
-	if(allKeyFramesHistory.size() <= 4)
+	int numKeyFrames = numSpilledKeyFrames + allKeyFramesHistory.size();
+	if(numKeyFrames <= 4)
 	{
-		if(allKeyFramesHistory.size()==2 && rmse > 20*benchmark_initializerSlackFactor)
+		if(numKeyFrames==2 && rmse > 20*benchmark_initializerSlackFactor)
 		{
 			printf("I THINK INITIALIZATINO FAILED! Resetting.\n");
 			initFailed=true;
 		}
-		if(allKeyFramesHistory.size()==3 && rmse > 13*benchmark_initializerSlackFactor)
+		if(numKeyFrames==3 && rmse > 13*benchmark_initializerSlackFactor)
 		{
 			printf("I THINK INITIALIZATINO FAILED! Resetting.\n");
 			initFailed=true;
 		}
-		if(allKeyFramesHistory.size()==4 && rmse > 9*benchmark_initializerSlackFactor)
+		if(numKeyFrames==4 && rmse > 9*benchmark_initializerSlackFactor)
 		{
 			printf("I THINK INITIALIZATINO FAILED! Resetting.\n");
 			initFailed=true;
@@ -1217,6 +1406,10 @@ void FullSystem::makeKeyFrame( FrameHessian* fh)
 	printLogLine();
     //printEigenValLine();
 
+	// frames still queued for mapping were tracked against fh's reference or a newer keyframe.
+	int keepFromId = fh->shell->trackingRef->id;
+	lock.unlock();
+	spillFrameHistory(keepFromId);
 }
 
 
@@ -1228,7 +1421,7 @@ void FullSystem::initializeFromInitializer(FrameHessian* newFrame)
 	FrameHessian* firstFrame = coarseInitializer->firstFrame;
 	firstFrame->idx = frameHessians.size();
 	frameHessians.push_back(firstFrame);
-	firstFrame->frameID = allKeyFramesHistory.size();
+	firstFrame->frameID = numSpilledKeyFrames + allKeyFramesHistory.size();
 	allKeyFramesHistory.push_back(firstFrame->shell);
 	ef->insertFrame(firstFrame, &Hcalib);
 	setPrecalcValues();
@@ -1309,6 +1502,7 @@ void FullSystem::initializeFromInitializer(FrameHessian* newFrame)
 
 void FullSystem::makeNewTraces(FrameHessian* newFrame, float* gtDepth)
 {
+	DSO_PROFILE_STAGE("makeNewTraces");
 	pixelSelector->allowFast = true;
 	//int numPointsTotal = makePixelStatus(newFrame->dI, selectionMap, wG[0], hG[0], setting_desiredDensity);
 	int numPointsTotal = pixelSelector->makeMaps(newFrame, selectionMap,setting_desiredImmatureDensity);
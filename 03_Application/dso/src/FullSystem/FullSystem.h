@@ -37,7 +37,10 @@
 #include "FullSystem/HessianBlocks.h"
 #include "util/FrameShell.h"
 #include "util/IndexThreadReduce.h"
+#include "util/SPSCRing.h"
+#include "util/ExternalPoseQueue.h"
 #include "OptimizationBackend/EnergyFunctional.h"
+#include "OptimizationBackend/ResidualTable.h"
 #include "FullSystem/PixelSelector2.h"
 
 #include <math.h>
@@ -58,6 +61,9 @@ class CoarseInitializer;
 struct ImmaturePointTemporaryResidual;
 class ImageAndExposure;
 class CoarseDistanceMap;
+class PoseGraphBackend;
+class KeyframeArchive;
+struct ArchivedKeyframe;
 
 class EnergyFunctional;
 
@@ -129,6 +135,15 @@ inline bool eigenTestNan(const MatXX &m, std::string msg)
 
 
 
+struct MappingQueueStats
+{
+	SPSCRingStats ring;
+	long numDropped;		// non-keyframes the tracker did not hand to the mapper.
+	long numCoalesced;		// non-keyframes the mapper only propagated the pose of.
+	long numLost;			// frames pushed after the mapper stopped (deleted unmapped).
+};
+
+
 class FullSystem {
 public:
 	EIGEN_MAKE_ALIGNED_OPERATOR_NEW
@@ -144,8 +159,15 @@ public:
 
 	float optimize(int mnumOptIts);
 
+	// frames spilled to the keyframe archive (setting_memoryBudgetMB) are read back from there.
 	void printResult(std::string file);
 
+	// for evaluation: pose & incoming id of every frame with a valid pose, and the number of keyframes so far.
+	void getTrajectory(std::vector<SE3> &camToWorld, std::vector<int> &incomingIds);
+	int getNumKeyframes();
+	// tracking->mapping queue. only valid after blockUntilMappingIsFinished(), all zero if linearizeOperation.
+	MappingQueueStats getMappingQueueStats();
+
 	void debugPlot(std::string name);
 
 	void printFrameLifetimes();
@@ -161,12 +183,20 @@ public:
 
 	void setGammaFunction(float* BInv);
 	void setOriginalCalib(const VecXf &originalCalib, int originalW, int originalH);
-        void setCameraPoses(std::vector<SE3> poses);
+	// external poses (GPS, ...). thread-safe, can be called at any rate from any thread.
+	void addExternalPose(const ExternalPoseMeasurement &m);
+	// legacy: one pose per incoming frame id, looked up by id instead of timestamp.
+	void setCameraPoses(std::vector<SE3> poses);
+
+	// marginalized keyframes and the final frame poses are appended to [archive] (not owned, may outlive
+	// this FullSystem). 0: off.
+	void setKeyframeArchive(KeyframeArchive* archive);
 
 private:
 
 	CalibHessian Hcalib;
-        std::vector<SE3> cameraPoses;
+	ExternalPoseQueue externalPoses;
+	bool externalPosesById;
 
 
 
@@ -187,6 +217,14 @@ private:
 	void initializeFromInitializer(FrameHessian* newFrame);
 	void flagFramesForMarginalization(FrameHessian* newFH);
 
+	// over setting_memoryBudgetMB: writes the pose of every frame nothing refers to any more to kfArchive
+	// and deletes its shell. keepFromId: oldest shell id the caller still needs.
+	void spillFrameHistory(int keepFromId);
+	void archiveFramePose(FrameShell* shell);
+	// the spilled poses, read back from kfArchive. false (and a prefix only) if the archive is incomplete.
+	// call with spillMutex held.
+	bool readSpilledPoses(std::vector<ArchivedKeyframe,Eigen::aligned_allocator<ArchivedKeyframe>> &poses, bool onlyKeyFrames);
+
 
 	void removeOutliers();
 
@@ -207,6 +245,17 @@ private:
 	void activatePointsMT_Reductor(std::vector<PointHessian*>* optimized,std::vector<ImmaturePoint*>* toOptimize,int min, int max, Vec10* stats, int tid);
 	void applyRes_Reductor(bool copyJacobians, int min, int max, Vec10* stats, int tid);
 
+	// traceNewCoarse: projection from one host into the new frame.
+	struct TraceHostPrecalc
+	{
+		FrameHessian* host;
+		Mat33f KRKi;
+		Vec3f Kt;
+		Vec2f aff;
+	};
+	void rankCoarseHypotheses_Reductor(FrameHessian* fh, std::vector<SE3,Eigen::aligned_allocator<SE3>>* tries, std::vector<AffLight>* affs, std::vector<float>* res, int min, int max, Vec10* stats, int tid);
+	void traceNewCoarse_Reductor(FrameHessian* fh, std::vector<TraceHostPrecalc>* hosts, std::vector<Eigen::Vector2i>* blocks, int min, int max, Vec10* stats, int tid);
+
 	void printOptRes(const Vec3 &res, double resL, double resM, double resPrior, double LExact, float a, float b);
 
 	void debugPlotTracking();
@@ -245,6 +294,9 @@ private:
 	long int statistics_numMargResFwd;
 	long int statistics_numMargResBwd;
 	float statistics_lastFineTrackRMSE;
+	long int statistics_numDroppedFrames;		// non-keyframes the tracker did not hand to the mapper (queue full).
+	long int statistics_numCoalescedFrames;		// non-keyframes the mapper only propagated the pose of (catching up).
+	long int statistics_numLostFrames;			// frames the mapper stopped before (close()), deleted unmapped.
 
 
 
@@ -254,17 +306,25 @@ private:
 
 	// =================== changed by tracker-thread. protected by trackMutex ============
 	boost::mutex trackMutex;
-	std::vector<FrameShell*> allFrameHistory;
+	std::vector<FrameShell*> allFrameHistory;		// without the oldest numSpilledFrames, see spillFrameHistory.
+	int numSpilledFrames;
 	CoarseInitializer* coarseInitializer;
 	Vec5 lastCoarseRMSE;
+	IndexThreadReduce<Vec10> trackReduce;	// the tracker's own workers, so it never queues behind the mapper's jobs.
 
 
 	// ================== changed by mapper-thread. protected by mapMutex ===============
 	boost::mutex mapMutex;
-	std::vector<FrameShell*> allKeyFramesHistory;
+	std::vector<FrameShell*> allKeyFramesHistory;	// without the oldest numSpilledKeyFrames. spilling also holds trackMutex.
+	int numSpilledKeyFrames;
 
 	EnergyFunctional* ef;
 	IndexThreadReduce<Vec10> treadReduce;
+	PoseGraphBackend* poseGraph;	// marginalized keyframes, if setting_poseGraph. runs its own thread.
+	KeyframeArchive* kfArchive;
+	int firstArchiveRecord;		// the first record of this FullSystem in kfArchive.
+	boost::mutex spillMutex;	// held by spillFrameHistory until the spilled poses are archived. before trackMutex.
+	int numSpilledPoses;		// spilled frames with a valid pose. protected by spillMutex.
 
 	float* selectionMap;
 	PixelSelector* pixelSelector;
@@ -272,6 +332,8 @@ private:
 
 	std::vector<FrameHessian*> frameHessians;	// ONLY changed in marginalizeFrame and addFrame.
 	std::vector<PointFrameResidual*> activeResiduals;
+	std::vector<std::vector<PointFrameResidual*>> linearizeToRemove;	// linearizeAll: residuals to drop, one list per worker.
+	std::vector<ResidualSlot> activeResidualSlots;	// where activeResiduals[k] lives in ef->resTable.
 	float currentMinActDist;
 
 
@@ -302,18 +364,25 @@ private:
 
 	void makeKeyFrame( FrameHessian* fh);
 	void makeNonKeyFrame( FrameHessian* fh);
+	void propagateNonKeyFramePose( FrameHessian* fh);
 	void deliverTrackedFrame(FrameHessian* fh, bool needKF);
 	void mappingLoop();
 
-	// tracking / mapping synchronization. All protected by [trackMapSyncMutex].
+	// tracking / mapping synchronization. tracker pushes, mapper pops; no lock unless one side has to wait.
+	struct TrackedFrame
+	{
+		FrameHessian* fh;
+		bool needKF;
+	};
+	SPSCRing<TrackedFrame> unmappedTrackedFrames;
+	boost::thread mappingThread;
+	int needNewKFAfter;				// only used by mapper-thread. a new KF is *needed that has ID bigger than [needNewKFAfter]*,
+									// collected from TrackedFrame::needKF of the popped frames.
+	bool needToKetchupMapping;		// only used by mapper-thread.
+
+	// only used to wait for the very first keyframe to be mapped.
 	boost::mutex trackMapSyncMutex;
-	boost::condition_variable trackedFrameSignal;
 	boost::condition_variable mappedFrameSignal;
-	std::deque<FrameHessian*> unmappedTrackedFrames;
-	int needNewKFAfter;	// Otherwise, a new KF is *needed that has ID bigger than [needNewKFAfter]*.
-	boost::thread mappingThread;
-	bool runMapping;
-	bool needToKetchupMapping;
 
 	int lastRefStopID;
 };
@@ -45,10 +45,13 @@
 
 #include "OptimizationBackend/EnergyFunctional.h"
 #include "OptimizationBackend/EnergyFunctionalStructs.h"
+#include "OptimizationBackend/PoseGraphBackend.h"
+#include "util/KeyframeArchive.h"
 
 #include "IOWrapper/Output3DWrapper.h"
 
 #include "FullSystem/CoarseTracker.h"
+#include "util/StageProfiler.h"
 
 namespace dso
 {
@@ -151,6 +154,7 @@ void FullSystem::flagFramesForMarginalization(FrameHessian* newFH)
 
 void FullSystem::marginalizeFrame(FrameHessian* frame)
 {
+	DSO_PROFILE_STAGE("marginalizeFrame");
 	// marginalize or remove all this frames points.
 
 	assert((int)frame->pointHessians.size()==0);
@@ -199,10 +203,50 @@ void FullSystem::marginalizeFrame(FrameHessian* frame)
             ow->publishKeyframes(v, true, &Hcalib);
     }
 
+	if(kfArchive != 0)
+	{
+		ArchivedKeyframe kf;
+		kf.kfId = frame->frameID;
+		kf.frameId = frame->shell->id;
+		kf.incomingId = frame->shell->incoming_id;
+		kf.timestamp = frame->shell->timestamp;
+		kf.camToWorld = frame->PRE_camToWorld;
+		kf.fx = Hcalib.fxl(); kf.fy = Hcalib.fyl(); kf.cx = Hcalib.cxl(); kf.cy = Hcalib.cyl();
+		kf.width = wG[0]; kf.height = hG[0];
+
+		kf.points.reserve(frame->pointHessiansMarginalized.size() + frame->pointHessiansOut.size());
+		for(int status=2;status<=3;status++)
+			for(PointHessian* ph : (status==2 ? frame->pointHessiansMarginalized : frame->pointHessiansOut))
+			{
+				ArchivedPoint p = ArchivedPoint();
+				p.u = ph->u;
+				p.v = ph->v;
+				p.idepth = ph->idepth_scaled;
+				p.idepth_hessian = ph->idepth_hessian;
+				p.maxRelBaseline = ph->maxRelBaseline;
+				for(int i=0;i<patternNum;i++) p.color[i] = (unsigned char)std::min(255.0f, std::max(0.0f, ph->color[i]));
+				p.status = status;
+				kf.points.push_back(p);
+			}
+		kfArchive->append(kf);
+	}
+
+	// connectivity of marginalized frames is only used for display. with a memory budget it is dropped,
+	// so the map does not grow with the sequence.
+	if(setting_memoryBudgetMB > 0)
+		ef->eraseConnectivityF(frame->frameID);
+
 
 	frame->shell->marginalizedAt = frameHessians.back()->shell->id;
 	frame->shell->movedByOpt = frame->w2c_leftEps().norm();
 
+	// from here on, the pose of this keyframe is only changed by the pose graph.
+	if(poseGraph != 0)
+	{
+		poseGraph->setGpsAlignment(ef->gpsAlignmentValid, ef->gpsScale, ef->gpsR, ef->gpsT);
+		poseGraph->addKeyframe(frame->shell, frameHessians.front()->shell->id);
+	}
+
 	deleteOutOrder<FrameHessian>(frameHessians, frame);
 	for(unsigned int i=0;i<frameHessians.size();i++)
 		frameHessians[i]->idx = i;
@@ -217,4 +261,102 @@ void FullSystem::marginalizeFrame(FrameHessian* frame)
 
 
 
+
+
+void FullSystem::archiveFramePose(FrameShell* shell)
+{
+	if(!shell->poseValid) return;
+
+	ArchivedKeyframe pose;
+	pose.kfId = -1;
+	pose.frameId = shell->id;
+	pose.incomingId = shell->incoming_id;
+	pose.timestamp = shell->timestamp;
+	pose.camToWorld = shell->camToWorld;
+	pose.fx = Hcalib.fxl(); pose.fy = Hcalib.fyl(); pose.cx = Hcalib.cxl(); pose.cy = Hcalib.cyl();
+	pose.width = wG[0]; pose.height = hG[0];
+	kfArchive->append(pose);
+}
+
+void FullSystem::spillFrameHistory(int keepFromId)
+{
+	// without an archive the poses would be lost.
+	if(setting_memoryBudgetMB <= 0 || kfArchive == 0) return;
+
+	// held until the poses are in the archive, see readSpilledPoses.
+	boost::unique_lock<boost::mutex> slock(spillMutex);
+
+	std::vector<FrameShell*> spilled;
+	{
+		// the tracker reads the newest shells of allFrameHistory and allKeyFramesHistory.back().
+		boost::unique_lock<boost::mutex> lock(trackMutex);
+		boost::unique_lock<boost::mutex> mlock(mapMutex);
+
+		// pyramids and points of marginalized keyframes are freed in marginalizeFrame, this is what is left.
+		size_t bytes = allFrameHistory.size() * (sizeof(FrameShell) + sizeof(FrameShell*));
+		if(bytes <= (size_t)setting_memoryBudgetMB * 1024 * 1024) return;
+
+		// shells that may still be used: the window keyframes (and frames tracked against them), the ones the
+		// pose graph may still correct, the references of queued frames. the tracker's motion model needs the
+		// last three frames.
+		int cut = keepFromId;
+		for(FrameHessian* fh : frameHessians) cut = std::min(cut, fh->shell->id);
+		if(poseGraph != 0) cut = std::min(cut, poseGraph->getOldestShellId());
+
+		int n=0;
+		while(n+3 < (int)allFrameHistory.size() && allFrameHistory[n]->id < cut) n++;
+		if(n == 0) return;
+
+		int nk=0;
+		while(nk < (int)allKeyFramesHistory.size() && allKeyFramesHistory[nk]->id < allFrameHistory[n]->id) nk++;
+
+		spilled.assign(allFrameHistory.begin(), allFrameHistory.begin()+n);
+		allFrameHistory.erase(allFrameHistory.begin(), allFrameHistory.begin()+n);
+		allKeyFramesHistory.erase(allKeyFramesHistory.begin(), allKeyFramesHistory.begin()+nk);
+		numSpilledFrames += n;
+		numSpilledKeyFrames += nk;
+	}
+
+	// the disk I/O without the tracker / mapper locks. nothing reads or writes these shells any more.
+	for(FrameShell* s : spilled)
+	{
+		if(s->poseValid) numSpilledPoses++;
+		archiveFramePose(s);
+		delete s;
+	}
+}
+
+bool FullSystem::readSpilledPoses(std::vector<ArchivedKeyframe,Eigen::aligned_allocator<ArchivedKeyframe>> &poses, bool onlyKeyFrames)
+{
+	poses.clear();
+	if(numSpilledFrames == 0) return true;
+
+	// records before firstArchiveRecord are from earlier runs (resets), with the same frame ids.
+	kfArchive->flush();
+	KeyframeArchiveReader reader(kfArchive->getFile());
+	std::vector<int> kfFrameIds;
+	ArchivedKeyframe r;
+	for(int i=firstArchiveRecord;i<reader.size();i++)
+	{
+		if(!reader.load(i, r, false)) break;
+		if(r.kfId >= 0) kfFrameIds.push_back(r.frameId);
+		else poses.push_back(r);
+	}
+
+	// so far, the pose records are exactly the spilled frames, in frame order.
+	bool complete = (int)poses.size() == numSpilledPoses;
+
+	// keyframes: the ones that were marginalized, as in printResult.
+	if(onlyKeyFrames)
+	{
+		std::sort(kfFrameIds.begin(), kfFrameIds.end());
+		int k=0;
+		for(unsigned int i=0;i<poses.size();i++)
+			if(std::binary_search(kfFrameIds.begin(), kfFrameIds.end(), poses[i].frameId))
+				poses[k++] = poses[i];
+		poses.resize(k);
+	}
+	return complete;
+}
+
 }
@@ -37,6 +37,7 @@
 
 #include "OptimizationBackend/EnergyFunctional.h"
 #include "OptimizationBackend/EnergyFunctionalStructs.h"
+#include "util/StageProfiler.h"
 
 #include <cmath>
 
@@ -54,7 +55,8 @@ void FullSystem::linearizeAll_Reductor(bool fixLinearization, std::vector<PointF
 	for(int k=min;k<max;k++)
 	{
 		PointFrameResidual* r = activeResiduals[k];
-		(*stats)[0] += r->linearize(&Hcalib);
+		const ResidualSlot &s = activeResidualSlots[k];
+		(*stats)[0] += r->linearize(&Hcalib, s.block->u[s.idx], s.block->v[s.idx], s.block->colorOf(s.idx), s.block->weightsOf(s.idx));
 
 		if(fixLinearization)
 		{
@@ -146,8 +148,9 @@ Vec3 FullSystem::linearizeAll(bool fixLinearization)
 	double num = 0;
 
 
-	std::vector<PointFrameResidual*> toRemove[NUM_THREADS];
-	for(int i=0;i<NUM_THREADS;i++) toRemove[i].clear();
+	// one list per worker of the pool; kept as a member, so their capacity survives between calls.
+	std::vector<PointFrameResidual*>* toRemove = linearizeToRemove.data();
+	for(unsigned int i=0;i<linearizeToRemove.size();i++) toRemove[i].clear();
 
 	if(multiThreading)
 	{
@@ -181,7 +184,7 @@ Vec3 FullSystem::linearizeAll(bool fixLinearization)
 		}
 
 		int nResRemoved=0;
-		for(int i=0;i<NUM_THREADS;i++)
+		for(unsigned int i=0;i<linearizeToRemove.size();i++)
 		{
 			for(PointFrameResidual* r : toRemove[i])
 			{
@@ -405,6 +408,7 @@ void FullSystem::printOptRes(const Vec3 &res, double resL, double resM, double r
 
 float FullSystem::optimize(int mnumOptIts)
 {
+	DSO_PROFILE_STAGE("optimize");
 
 	if(frameHessians.size() < 2) return 0;
 	if(frameHessians.size() < 3) mnumOptIts = 20;
@@ -417,24 +421,14 @@ float FullSystem::optimize(int mnumOptIts)
 
 	// get statistics and active residuals.
 
-	activeResiduals.clear();
-	int numPoints = 0;
-	int numLRes = 0;
-	for(FrameHessian* fh : frameHessians)
-		for(PointHessian* ph : fh->pointHessians)
-		{
-			for(PointFrameResidual* r : ph->residuals)
-			{
-				if(!r->efResidual->isLinearized)
-				{
-					activeResiduals.push_back(r);
-					r->resetOOB();
-				}
-				else
-					numLRes++;
-			}
-			numPoints++;
-		}
+	// taken from the residual table, so they come grouped by (host,target).
+	ef->resTable->getActive(activeResiduals, activeResidualSlots);
+	for(PointFrameResidual* r : activeResiduals)
+		r->resetOOB();
+	int numLRes = ef->resTable->nResiduals - (int)activeResiduals.size();
+
+	// GPS alignment is fixed during the iterations.
+	ef->updateGpsAlignmentF();
 
     if(!setting_debugout_runquiet)
         printf("OPTIMIZE %d pts, %d active res, %d lin res!\n",ef->nPoints,(int)activeResiduals.size(), numLRes);
@@ -469,6 +463,8 @@ float FullSystem::optimize(int mnumOptIts)
 	VecX previousX = VecX::Constant(CPARS+ 8*frameHessians.size(), NAN);
 	for(int iteration=0;iteration<mnumOptIts;iteration++)
 	{
+		DSO_PROFILE_STAGE_ARG("optimizeIteration", iteration);
+
 		// solve!
 		backupState(iteration!=0);
 		//solveSystemNew(0);
@@ -605,6 +601,7 @@ float FullSystem::optimize(int mnumOptIts)
 
 void FullSystem::solveSystem(int iteration, double lambda)
 {
+	DSO_PROFILE_STAGE("solveSystem");
 	ef->lastNullspaces_forLogging = getNullspaces(
 			ef->lastNullspaces_pose,
 			ef->lastNullspaces_scale,
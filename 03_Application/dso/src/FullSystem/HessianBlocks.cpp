@@ -27,6 +27,9 @@
 #include "util/FrameShell.h"
 #include "FullSystem/ImmaturePoint.h"
 #include "OptimizationBackend/EnergyFunctionalStructs.h"
+#include "util/StageProfiler.h"
+#include "util/SlabPool.h"
+#include "FullSystem/PyramidRows.h"
 
 namespace dso
 {
@@ -125,71 +128,108 @@ void FrameHessian::release()
 }
 
 
+// dIp & absSquaredGrad of all levels of a frame live in one block from here. sized by the first frame;
+// bigger requests (resolution change) go to the system allocator.
+// frames are made on the tracking and the mapping thread, the static makes the first call thread-safe.
+static SlabPool* pyramidPool(size_t bytes)
+{
+	static SlabPool* pool = new SlabPool(bytes, "FrameHessian pyramid", 1);
+	return pool;
+}
+
+
 void FrameHessian::makeImages(float* color, CalibHessian* HCalib)
 {
+	DSO_PROFILE_STAGE("makeImages");
 
+	size_t bytes = 0;
+	for(int i=0;i<pyrLevelsUsed;i++)
+		bytes += (sizeof(Eigen::Vector3f) + sizeof(float)) * wG[i]*hG[i];
+
+	releaseImages();
+	pyramidBytes = bytes;
+	pyramidBlock = pyramidPool(bytes)->alloc(bytes);
+	char* mem = (char*)pyramidBlock;
 	for(int i=0;i<pyrLevelsUsed;i++)
 	{
-		dIp[i] = new Eigen::Vector3f[wG[i]*hG[i]];
-		absSquaredGrad[i] = new float[wG[i]*hG[i]];
+		dIp[i] = (Eigen::Vector3f*)mem;
+		mem += sizeof(Eigen::Vector3f) * wG[i]*hG[i];
+		absSquaredGrad[i] = (float*)mem;
+		mem += sizeof(float) * wG[i]*hG[i];
 	}
 	dI = dIp[0];
 
 
-	// make d0
-	int w=wG[0];
-	int h=hG[0];
-	for(int i=0;i<w*h;i++)
-		dI[i][0] = color[i];
+	// gamma weights for pixel selection, as table over the (rounded) intensity.
+	bool gammaWeights = (setting_gammaWeightsPixelSelect==1 && HCalib!=0);
+	float gw2[256];
+	if(gammaWeights)
+		for(int c=0;c<256;c++)
+		{
+			float gw = HCalib->getBGradOnly((float)c);
+			gw2[c] = gw*gw;	// convert to gradient of original color space (before removing response).
+		}
+
+
+	// intensity planes of the coarser levels. level 0 is [color] itself.
+	static thread_local std::vector<float> planes[PYR_LEVELS];
+	const float* Ilm = color;
 
 	for(int lvl=0; lvl<pyrLevelsUsed; lvl++)
 	{
 		int wl = wG[lvl], hl = hG[lvl];
 		Eigen::Vector3f* dI_l = dIp[lvl];
-
 		float* dabs_l = absSquaredGrad[lvl];
+
+		const float* I_l = color;
 		if(lvl>0)
 		{
-			int lvlm1 = lvl-1;
-			int wlm1 = wG[lvlm1];
-			Eigen::Vector3f* dI_lm = dIp[lvlm1];
+			planes[lvl].resize(wl*hl);
+			I_l = planes[lvl].data();
+		}
 
+		// one pass over the rows: downsample row y, then the gradients of row y-1 (needs y-2 .. y).
+		for(int y=0;y<hl;y++)
+		{
+			if(lvl>0)
+				downsampleRow(Ilm + 2*y*wG[lvl-1], Ilm + (2*y+1)*wG[lvl-1], planes[lvl].data() + y*wl, wl);
 
+			if(y < 2) continue;
+			int begin = (y-1)*wl, end = y*wl;
+			gradientRow(I_l, dI_l, dabs_l, begin, end, wl);
 
-			for(int y=0;y<hl;y++)
-				for(int x=0;x<wl;x++)
+			if(gammaWeights)
+				for(int idx=begin;idx<end;idx++)
 				{
-					dI_l[x + y*wl][0] = 0.25f * (dI_lm[2*x   + 2*y*wlm1][0] +
-												dI_lm[2*x+1 + 2*y*wlm1][0] +
-												dI_lm[2*x   + 2*y*wlm1+wlm1][0] +
-												dI_lm[2*x+1 + 2*y*wlm1+wlm1][0]);
+					int c = I_l[idx]+0.5f;
+					if(c<5) c=5;
+					if(c>250) c=250;
+					dabs_l[idx] *= gw2[c];
 				}
 		}
 
-		for(int idx=wl;idx < wl*(hl-1);idx++)
+		// first & last row: no gradient.
+		for(int idx=0;idx<wl;idx++)
 		{
-			float dx = 0.5f*(dI_l[idx+1][0] - dI_l[idx-1][0]);
-			float dy = 0.5f*(dI_l[idx+wl][0] - dI_l[idx-wl][0]);
-
-
-			if(!std::isfinite(dx)) dx=0;
-			if(!std::isfinite(dy)) dy=0;
-
-			dI_l[idx][1] = dx;
-			dI_l[idx][2] = dy;
-
-
-			dabs_l[idx] = dx*dx+dy*dy;
-
-			if(setting_gammaWeightsPixelSelect==1 && HCalib!=0)
-			{
-				float gw = HCalib->getBGradOnly((float)(dI_l[idx][0]));
-				dabs_l[idx] *= gw*gw;	// convert to gradient of original color space (before removing response).
-			}
+			dI_l[idx] = Eigen::Vector3f(I_l[idx], 0, 0);
+			dabs_l[idx] = 0;
+			dI_l[idx+(hl-1)*wl] = Eigen::Vector3f(I_l[idx+(hl-1)*wl], 0, 0);
+			dabs_l[idx+(hl-1)*wl] = 0;
 		}
+
+		Ilm = I_l;
 	}
 }
 
+void FrameHessian::releaseImages()
+{
+	if(pyramidBlock == 0) return;
+	pyramidPool(pyramidBytes)->dealloc(pyramidBlock, pyramidBytes);
+	pyramidBlock = 0;
+	for(int i=0;i<pyrLevelsUsed;i++)
+		dIp[i] = 0;
+}
+
 void FrameFramePrecalc::set(FrameHessian* host, FrameHessian* target, CalibHessian* HCalib )
 {
 	this->host = host;
@@ -119,6 +119,8 @@ struct FrameHessian
 	Eigen::Vector3f* dI;				 // trace, fine tracking. Used for direction select (not for gradient histograms etc.)
 	Eigen::Vector3f* dIp[PYR_LEVELS];	 // coarse tracking / coarse initializer. NAN in [0] only.
 	float* absSquaredGrad[PYR_LEVELS];  // only used for pixel select (histograms etc.). no NAN.
+	void* pyramidBlock;					 // dIp & absSquaredGrad of all levels, from the pyramid pool.
+	size_t pyramidBytes;
 
 
 
@@ -232,12 +234,7 @@ struct FrameHessian
 	{
 		assert(efFrame==0);
 		release(); instanceCounter--;
-		for(int i=0;i<pyrLevelsUsed;i++)
-		{
-			delete[] dIp[i];
-			delete[]  absSquaredGrad[i];
-
-		}
+		releaseImages();
 
 
 
@@ -254,10 +251,13 @@ struct FrameHessian
 
 
 		debugImage=0;
+		pyramidBlock=0;
+		pyramidBytes=0;
 	};
 
 
     void makeImages(float* color, CalibHessian* HCalib);
+    void releaseImages();
 
 	inline Vec10 getPrior()
 	{
@@ -402,7 +402,7 @@ struct CalibHessian
 // hessian component associated with one point.
 struct PointHessian
 {
-	EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+	DSO_SLAB_POOLED_NEW(PointHessian);
 	static int instanceCounter;
 	EFPoint* efPoint;
 
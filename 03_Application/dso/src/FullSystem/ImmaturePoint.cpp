@@ -27,8 +27,77 @@
 #include "util/FrameShell.h"
 #include "FullSystem/ResidualProjections.h"
 
+#if !defined(__SSE3__) && !defined(__SSE2__) && !defined(__SSE1__)
+#include "SSE2NEON.h"
+#endif
+
 namespace dso
 {
+
+/*
+ * energy of one step of the discrete epipolar search: the pattern is sampled at (ptx,pty) + (patX,patY),
+ * 4 pattern points at a time. interpolation & huber weights are computed in the same order as the scalar
+ * code (getInterpolatedElement31), and the per-point terms are summed up sequentially afterwards, so the
+ * result is bit-identical to the scalar loop.
+ */
+static inline float traceStepEnergySSE(const Eigen::Vector3f* dI, const int w, const float ptx, const float pty,
+		const float* patX, const float* patY, const float* colorAff)
+{
+	static_assert(patternNum % 4 == 0, "traceStepEnergySSE needs patternNum to be a multiple of 4");
+	EIGEN_ALIGN16 float hit[patternNum];
+	EIGEN_ALIGN16 float term[patternNum];
+	EIGEN_ALIGN16 int ixs[4];
+	EIGEN_ALIGN16 int iys[4];
+	EIGEN_ALIGN16 float tl[4], tr[4], bl[4], br[4];
+
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 huberTH = _mm_set1_ps(setting_huberTH);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+	for(int k=0;k<patternNum;k+=4)
+	{
+		__m128 x = _mm_add_ps(_mm_set1_ps(ptx), _mm_load_ps(patX+k));
+		__m128 y = _mm_add_ps(_mm_set1_ps(pty), _mm_load_ps(patY+k));
+		__m128i ix = _mm_cvttps_epi32(x);
+		__m128i iy = _mm_cvttps_epi32(y);
+		__m128 dx = _mm_sub_ps(x, _mm_cvtepi32_ps(ix));
+		__m128 dy = _mm_sub_ps(y, _mm_cvtepi32_ps(iy));
+		__m128 dxdy = _mm_mul_ps(dx, dy);
+
+		_mm_store_si128((__m128i*)ixs, ix);
+		_mm_store_si128((__m128i*)iys, iy);
+		for(int j=0;j<4;j++)
+		{
+			const Eigen::Vector3f* bp = dI + ixs[j] + iys[j]*w;
+			tl[j] = bp[0][0];
+			tr[j] = bp[1][0];
+			bl[j] = bp[w][0];
+			br[j] = bp[w+1][0];
+		}
+
+		__m128 h = _mm_mul_ps(dxdy, _mm_load_ps(br));
+		h = _mm_add_ps(h, _mm_mul_ps(_mm_sub_ps(dy, dxdy), _mm_load_ps(bl)));
+		h = _mm_add_ps(h, _mm_mul_ps(_mm_sub_ps(dx, dxdy), _mm_load_ps(tr)));
+		h = _mm_add_ps(h, _mm_mul_ps(_mm_add_ps(_mm_sub_ps(_mm_sub_ps(one, dx), dy), dxdy), _mm_load_ps(tl)));
+		_mm_store_ps(hit+k, h);
+
+		__m128 res = _mm_sub_ps(h, _mm_load_ps(colorAff+k));
+		__m128 absRes = _mm_and_ps(res, absMask);
+		__m128 inlier = _mm_cmplt_ps(absRes, huberTH);
+		__m128 hw = _mm_or_ps(_mm_and_ps(inlier, one), _mm_andnot_ps(inlier, _mm_div_ps(huberTH, absRes)));
+		_mm_store_ps(term+k, _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(hw, res), res), _mm_sub_ps(two, hw)));
+	}
+
+	float energy=0;
+	for(int idx=0;idx<patternNum;idx++)
+	{
+		if(!std::isfinite(hit[idx])) {energy+=1e5; continue;}
+		energy += term[idx];
+	}
+	return energy;
+}
+
 ImmaturePoint::ImmaturePoint(int u_, int v_, FrameHessian* host_, float type, CalibHessian* HCalib)
 : u(u_), v(v_), host(host_), my_type(type), idepth_min(0), idepth_max(NAN), lastTraceStatus(IPS_UNINITIALIZED)
 {
@@ -256,21 +325,19 @@ ImmaturePointStatus ImmaturePoint::traceOn(FrameHessian* frame,const Mat33f &hos
 	int bestIdx=-1;
 	if(numSteps >= 100) numSteps = 99;
 
-	for(int i=0;i<numSteps;i++)
+	EIGEN_ALIGN16 float patX[patternNum];
+	EIGEN_ALIGN16 float patY[patternNum];
+	EIGEN_ALIGN16 float colorAff[patternNum];
+	for(int idx=0;idx<patternNum;idx++)
 	{
-		float energy=0;
-		for(int idx=0;idx<patternNum;idx++)
-		{
-			float hitColor = getInterpolatedElement31(frame->dI,
-										(float)(ptx+rotatetPattern[idx][0]),
-										(float)(pty+rotatetPattern[idx][1]),
-										wG[0]);
+		patX[idx] = rotatetPattern[idx][0];
+		patY[idx] = rotatetPattern[idx][1];
+		colorAff[idx] = (float)(hostToFrame_affine[0] * color[idx] + hostToFrame_affine[1]);
+	}
 
-			if(!std::isfinite(hitColor)) {energy+=1e5; continue;}
-			float residual = hitColor - (float)(hostToFrame_affine[0] * color[idx] + hostToFrame_affine[1]);
-			float hw = fabs(residual) < setting_huberTH ? 1 : setting_huberTH / fabs(residual);
-			energy += hw *residual*residual*(2-hw);
-		}
+	for(int i=0;i<numSteps;i++)
+	{
+		float energy = traceStepEnergySSE(frame->dI, wG[0], ptx, pty, patX, patY, colorAff);
 
 		if(debugPrint)
 			printf("step %.1f %.1f (id %f): energy = %f!\n",
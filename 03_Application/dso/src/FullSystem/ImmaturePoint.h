@@ -55,7 +55,7 @@ enum ImmaturePointStatus {
 class ImmaturePoint
 {
 public:
-	EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+	DSO_SLAB_POOLED_NEW(ImmaturePoint);
 	// static values
 	float color[MAX_RES_PER_POINT];
 	float weights[MAX_RES_PER_POINT];
@@ -0,0 +1,267 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "FullSystem/PatternLinearize.h"
+#include "util/settings.h"
+#include "util/globalCalib.h"
+#include "util/globalFuncs.h"
+
+namespace dso
+{
+
+
+bool linearizePattern(const PatternLinInput &in, RawResidualJacobian* J, Eigen::Vector2f* projectedTo, float &energy, float &wJI2_sum)
+{
+	const Mat33f &KRKi = *in.KRKi;
+	const Vec3f &Kt = *in.Kt;
+
+	float energyLeft=0;
+	float JIdxJIdx_00=0, JIdxJIdx_11=0, JIdxJIdx_10=0;
+	float JabJIdx_00=0, JabJIdx_01=0, JabJIdx_10=0, JabJIdx_11=0;
+	float JabJab_00=0, JabJab_01=0, JabJab_11=0;
+
+	wJI2_sum = 0;
+
+	for(int idx=0;idx<patternNum;idx++)
+	{
+		Vec3f ptp = KRKi * Vec3f(in.u+patternP[idx][0], in.v+patternP[idx][1], 1) + Kt*in.idepth;
+		float Ku = ptp[0] / ptp[2];
+		float Kv = ptp[1] / ptp[2];
+		if(!(Ku>1.1f && Kv>1.1f && Ku<wM3G && Kv<hM3G))
+			return false;
+
+		projectedTo[idx][0] = Ku;
+		projectedTo[idx][1] = Kv;
+
+
+		Vec3f hitColor = (getInterpolatedElement33(in.dI, Ku, Kv, in.width));
+		float residual = hitColor[0] - (float)(in.affLL[0] * in.color[idx] + in.affLL[1]);
+
+
+
+		float drdA = (in.color[idx]-in.b0);
+		if(!std::isfinite((float)hitColor[0]))
+			return false;
+
+
+		float w = sqrtf(setting_outlierTHSumComponent / (setting_outlierTHSumComponent + hitColor.tail<2>().squaredNorm()));
+		w = 0.5f*(w + in.weights[idx]);
+
+
+
+		float hw = fabsf(residual) < setting_huberTH ? 1 : setting_huberTH / fabsf(residual);
+		energyLeft += w*w*hw *residual*residual*(2-hw);
+
+		{
+			if(hw < 1) hw = sqrtf(hw);
+			hw = hw*w;
+
+			hitColor[1]*=hw;
+			hitColor[2]*=hw;
+
+			J->resF[idx] = residual*hw;
+
+			J->JIdx[0][idx] = hitColor[1];
+			J->JIdx[1][idx] = hitColor[2];
+			J->JabF[0][idx] = drdA*hw;
+			J->JabF[1][idx] = hw;
+
+			JIdxJIdx_00+=hitColor[1]*hitColor[1];
+			JIdxJIdx_11+=hitColor[2]*hitColor[2];
+			JIdxJIdx_10+=hitColor[1]*hitColor[2];
+
+			JabJIdx_00+= drdA*hw * hitColor[1];
+			JabJIdx_01+= drdA*hw * hitColor[2];
+			JabJIdx_10+= hw * hitColor[1];
+			JabJIdx_11+= hw * hitColor[2];
+
+			JabJab_00+= drdA*drdA*hw*hw;
+			JabJab_01+= drdA*hw*hw;
+			JabJab_11+= hw*hw;
+
+
+			wJI2_sum += hw*hw*(hitColor[1]*hitColor[1]+hitColor[2]*hitColor[2]);
+
+			if(setting_affineOptModeA < 0) J->JabF[0][idx]=0;
+			if(setting_affineOptModeB < 0) J->JabF[1][idx]=0;
+
+		}
+	}
+
+	J->JIdx2(0,0) = JIdxJIdx_00;
+	J->JIdx2(0,1) = JIdxJIdx_10;
+	J->JIdx2(1,0) = JIdxJIdx_10;
+	J->JIdx2(1,1) = JIdxJIdx_11;
+	J->JabJIdx(0,0) = JabJIdx_00;
+	J->JabJIdx(0,1) = JabJIdx_01;
+	J->JabJIdx(1,0) = JabJIdx_10;
+	J->JabJIdx(1,1) = JabJIdx_11;
+	J->Jab2(0,0) = JabJab_00;
+	J->Jab2(0,1) = JabJab_01;
+	J->Jab2(1,0) = JabJab_01;
+	J->Jab2(1,1) = JabJab_11;
+
+	energy = energyLeft;
+	return true;
+}
+
+
+
+
+#ifdef DSO_SIMD_DISPATCH
+
+DSO_TARGET_AVX2 static inline float hsum8(__m256 x)
+{
+	__m128 s = _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x,1));
+	s = _mm_add_ps(s, _mm_movehl_ps(s,s));
+	s = _mm_add_ss(s, _mm_shuffle_ps(s,s,1));
+	return _mm_cvtss_f32(s);
+}
+
+
+DSO_TARGET_AVX2 bool linearizePatternAVX2(const PatternLinInput &in, RawResidualJacobian* J, Eigen::Vector2f* projectedTo, float &energy, float &wJI2_sum)
+{
+#if patternNum != 8 || MAX_RES_PER_POINT != 8
+	return linearizePattern(in, J, projectedTo, energy, wJI2_sum);
+#else
+	const Mat33f &KRKi = *in.KRKi;
+	const Vec3f &Kt = *in.Kt;
+
+	// lane idx = pattern pixel idx.
+	__m256 pu = _mm256_add_ps(_mm256_set1_ps(in.u), _mm256_setr_ps(
+			patternP[0][0], patternP[1][0], patternP[2][0], patternP[3][0],
+			patternP[4][0], patternP[5][0], patternP[6][0], patternP[7][0]));
+	__m256 pv = _mm256_add_ps(_mm256_set1_ps(in.v), _mm256_setr_ps(
+			patternP[0][1], patternP[1][1], patternP[2][1], patternP[3][1],
+			patternP[4][1], patternP[5][1], patternP[6][1], patternP[7][1]));
+
+	// project, as projectPoint(u,v,idepth,KRKi,Kt,Ku,Kv), summed in the same order.
+	__m256 x = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(KRKi(0,0)), pu), _mm256_mul_ps(_mm256_set1_ps(KRKi(0,1)), pv)),
+			_mm256_set1_ps(KRKi(0,2))), _mm256_set1_ps(Kt[0]*in.idepth));
+	__m256 y = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(KRKi(1,0)), pu), _mm256_mul_ps(_mm256_set1_ps(KRKi(1,1)), pv)),
+			_mm256_set1_ps(KRKi(1,2))), _mm256_set1_ps(Kt[1]*in.idepth));
+	__m256 z = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(KRKi(2,0)), pu), _mm256_mul_ps(_mm256_set1_ps(KRKi(2,1)), pv)),
+			_mm256_set1_ps(KRKi(2,2))), _mm256_set1_ps(Kt[2]*in.idepth));
+	__m256 Ku = _mm256_div_ps(x, z);
+	__m256 Kv = _mm256_div_ps(y, z);
+
+	__m256 inside = _mm256_and_ps(
+			_mm256_and_ps(_mm256_cmp_ps(Ku, _mm256_set1_ps(1.1f), _CMP_GT_OQ), _mm256_cmp_ps(Kv, _mm256_set1_ps(1.1f), _CMP_GT_OQ)),
+			_mm256_and_ps(_mm256_cmp_ps(Ku, _mm256_set1_ps(wM3G), _CMP_LT_OQ), _mm256_cmp_ps(Kv, _mm256_set1_ps(hM3G), _CMP_LT_OQ)));
+	if(_mm256_movemask_ps(inside) != 0xFF) return false;
+
+	EIGEN_ALIGN32 float KuBuf[8], KvBuf[8];
+	_mm256_store_ps(KuBuf, Ku);
+	_mm256_store_ps(KvBuf, Kv);
+	for(int idx=0;idx<8;idx++)
+	{
+		projectedTo[idx][0] = KuBuf[idx];
+		projectedTo[idx][1] = KvBuf[idx];
+	}
+
+
+	// bilinear interpolation, as getInterpolatedElement33. dI is packed Vector3f, i.e. 3 floats per pixel.
+	__m256i ix = _mm256_cvttps_epi32(Ku);
+	__m256i iy = _mm256_cvttps_epi32(Kv);
+	__m256 dx = _mm256_sub_ps(Ku, _mm256_cvtepi32_ps(ix));
+	__m256 dy = _mm256_sub_ps(Kv, _mm256_cvtepi32_ps(iy));
+	__m256 dxdy = _mm256_mul_ps(dx, dy);
+	__m256 w11 = dxdy;
+	__m256 w01 = _mm256_sub_ps(dy, dxdy);
+	__m256 w10 = _mm256_sub_ps(dx, dxdy);
+	__m256 w00 = _mm256_add_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_set1_ps(1), dx), dy), dxdy);
+
+	__m256i three = _mm256_set1_epi32(3);
+	__m256i i00 = _mm256_mullo_epi32(_mm256_add_epi32(ix, _mm256_mullo_epi32(iy, _mm256_set1_epi32(in.width))), three);
+	__m256i i10 = _mm256_add_epi32(i00, three);
+	__m256i i01 = _mm256_add_epi32(i00, _mm256_set1_epi32(3*in.width));
+	__m256i i11 = _mm256_add_epi32(i01, three);
+
+	const float* dI = (const float*)in.dI;
+	__m256 hit[3];
+	for(int c=0;c<3;c++)
+		hit[c] = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(
+				_mm256_mul_ps(w11, _mm256_i32gather_ps(dI+c, i11, 4)),
+				_mm256_mul_ps(w01, _mm256_i32gather_ps(dI+c, i01, 4))),
+				_mm256_mul_ps(w10, _mm256_i32gather_ps(dI+c, i10, 4))),
+				_mm256_mul_ps(w00, _mm256_i32gather_ps(dI+c, i00, 4)));
+
+	// not finite: hit-hit is NaN.
+	__m256 zero = _mm256_setzero_ps();
+	if(_mm256_movemask_ps(_mm256_cmp_ps(_mm256_sub_ps(hit[0],hit[0]), zero, _CMP_EQ_OQ)) != 0xFF) return false;
+
+
+	__m256 color = _mm256_loadu_ps(in.color);
+	__m256 residual = _mm256_sub_ps(hit[0], _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(in.affLL[0]), color), _mm256_set1_ps(in.affLL[1])));
+	__m256 drdA = _mm256_sub_ps(color, _mm256_set1_ps(in.b0));
+
+	__m256 th = _mm256_set1_ps(setting_outlierTHSumComponent);
+	__m256 w = _mm256_sqrt_ps(_mm256_div_ps(th, _mm256_add_ps(th, _mm256_add_ps(_mm256_mul_ps(hit[1],hit[1]), _mm256_mul_ps(hit[2],hit[2])))));
+	w = _mm256_mul_ps(_mm256_set1_ps(0.5f), _mm256_add_ps(w, _mm256_loadu_ps(in.weights)));
+
+	__m256 huberTH = _mm256_set1_ps(setting_huberTH);
+	__m256 absRes = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), residual);
+	__m256 one = _mm256_set1_ps(1);
+	__m256 hw = _mm256_blendv_ps(_mm256_div_ps(huberTH, absRes), one, _mm256_cmp_ps(absRes, huberTH, _CMP_LT_OQ));
+	energy = hsum8(_mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(w,w), hw), _mm256_mul_ps(residual,residual)), _mm256_sub_ps(_mm256_set1_ps(2), hw)));
+
+	hw = _mm256_blendv_ps(hw, _mm256_sqrt_ps(hw), _mm256_cmp_ps(hw, one, _CMP_LT_OQ));
+	hw = _mm256_mul_ps(hw, w);
+
+	__m256 JIdx0 = _mm256_mul_ps(hit[1], hw);
+	__m256 JIdx1 = _mm256_mul_ps(hit[2], hw);
+	__m256 JabF0 = _mm256_mul_ps(drdA, hw);
+
+	_mm256_storeu_ps(J->resF.data(), _mm256_mul_ps(residual, hw));
+	_mm256_storeu_ps(J->JIdx[0].data(), JIdx0);
+	_mm256_storeu_ps(J->JIdx[1].data(), JIdx1);
+	_mm256_storeu_ps(J->JabF[0].data(), setting_affineOptModeA < 0 ? zero : JabF0);
+	_mm256_storeu_ps(J->JabF[1].data(), setting_affineOptModeB < 0 ? zero : hw);
+
+	float JIdxJIdx_00 = hsum8(_mm256_mul_ps(JIdx0, JIdx0));
+	float JIdxJIdx_11 = hsum8(_mm256_mul_ps(JIdx1, JIdx1));
+	float JIdxJIdx_10 = hsum8(_mm256_mul_ps(JIdx0, JIdx1));
+	float JabJab_01 = hsum8(_mm256_mul_ps(JabF0, hw));
+
+	J->JIdx2(0,0) = JIdxJIdx_00;
+	J->JIdx2(0,1) = JIdxJIdx_10;
+	J->JIdx2(1,0) = JIdxJIdx_10;
+	J->JIdx2(1,1) = JIdxJIdx_11;
+	J->JabJIdx(0,0) = hsum8(_mm256_mul_ps(JabF0, JIdx0));
+	J->JabJIdx(0,1) = hsum8(_mm256_mul_ps(JabF0, JIdx1));
+	J->JabJIdx(1,0) = hsum8(_mm256_mul_ps(hw, JIdx0));
+	J->JabJIdx(1,1) = hsum8(_mm256_mul_ps(hw, JIdx1));
+	J->Jab2(0,0) = hsum8(_mm256_mul_ps(JabF0, JabF0));
+	J->Jab2(0,1) = JabJab_01;
+	J->Jab2(1,0) = JabJab_01;
+	J->Jab2(1,1) = hsum8(_mm256_mul_ps(hw, hw));
+
+	__m256 hw2 = _mm256_mul_ps(hw, hw);
+	wJI2_sum = hsum8(_mm256_mul_ps(hw2, _mm256_add_ps(_mm256_mul_ps(JIdx0, JIdx0), _mm256_mul_ps(JIdx1, JIdx1))));
+	return true;
+#endif
+}
+#endif
+
+}
@@ -0,0 +1,68 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "util/NumType.h"
+#include "util/SimdDispatch.h"
+#include "OptimizationBackend/RawResidualJacobian.h"
+
+namespace dso
+{
+
+
+/*
+ * the pattern loop of PointFrameResidual::linearize: projects the patternNum pixels of one point into the
+ * target, interpolates the target image and fills resF / JIdx / JabF and the 2x2 shorthands of J.
+ *
+ * color and weights are rows of the residual table (patternNum contiguous floats each), so the
+ * vectorized version reads them with plain vector loads.
+ */
+struct PatternLinInput
+{
+	float u, v;					// host pixel.
+	float idepth;				// idepth_scaled.
+	const float* color;			// patternNum.
+	const float* weights;		// patternNum.
+
+	const Mat33f* KRKi;			// precalc->PRE_KRKiTll.
+	const Vec3f* Kt;			// precalc->PRE_KtTll.
+	const Eigen::Vector3f* dI;	// target->dI.
+	int width;
+
+	Vec2f affLL;
+	float b0;
+};
+
+
+// returns false if one of the pattern pixels is OOB (or its interpolated color is not finite); J is incomplete then.
+bool linearizePattern(const PatternLinInput &in, RawResidualJacobian* J, Eigen::Vector2f* projectedTo, float &energy, float &wJI2_sum);
+
+#ifdef DSO_SIMD_DISPATCH
+// same, all patternNum (= 8) pixels in one AVX2 register. only call if getSimdLevel() >= SIMD_AVX2.
+DSO_TARGET_AVX2 bool linearizePatternAVX2(const PatternLinInput &in, RawResidualJacobian* J, Eigen::Vector2f* projectedTo, float &energy, float &wJI2_sum);
+#endif
+
+}
+
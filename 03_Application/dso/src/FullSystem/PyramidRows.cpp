@@ -0,0 +1,90 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "FullSystem/PyramidRows.h"
+#include <math.h>
+
+#if !defined(__SSE3__) && !defined(__SSE2__) && !defined(__SSE1__)
+#include "SSE2NEON.h"
+#endif
+
+namespace dso
+{
+
+
+void downsampleRow(const float* above, const float* below, float* out, int wl)
+{
+	int x=0;
+	const __m128 quarter = _mm_set1_ps(0.25f);
+	for(;x+4<=wl;x+=4)
+	{
+		__m128 a0 = _mm_loadu_ps(above+2*x), a1 = _mm_loadu_ps(above+2*x+4);
+		__m128 b0 = _mm_loadu_ps(below+2*x), b1 = _mm_loadu_ps(below+2*x+4);
+
+		// same summation order as the scalar version, so the result does not depend on the path.
+		__m128 sum = _mm_add_ps(_mm_shuffle_ps(a0, a1, _MM_SHUFFLE(2,0,2,0)), _mm_shuffle_ps(a0, a1, _MM_SHUFFLE(3,1,3,1)));
+		sum = _mm_add_ps(sum, _mm_shuffle_ps(b0, b1, _MM_SHUFFLE(2,0,2,0)));
+		sum = _mm_add_ps(sum, _mm_shuffle_ps(b0, b1, _MM_SHUFFLE(3,1,3,1)));
+		_mm_storeu_ps(out+x, _mm_mul_ps(quarter, sum));
+	}
+	for(;x<wl;x++)
+		out[x] = 0.25f * (above[2*x] + above[2*x+1] + below[2*x] + below[2*x+1]);
+}
+
+void gradientRow(const float* I, Eigen::Vector3f* dI, float* dabs, int begin, int end, int wl)
+{
+	int idx=begin;
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	const __m128 inf = _mm_set1_ps(INFINITY);
+	float dxs[4], dys[4], cs[4];
+	for(;idx+4<=end;idx+=4)
+	{
+		__m128 c = _mm_loadu_ps(I+idx);
+		__m128 dx = _mm_mul_ps(half, _mm_sub_ps(_mm_loadu_ps(I+idx+1), _mm_loadu_ps(I+idx-1)));
+		__m128 dy = _mm_mul_ps(half, _mm_sub_ps(_mm_loadu_ps(I+idx+wl), _mm_loadu_ps(I+idx-wl)));
+
+		// NAN / inf -> 0.
+		dx = _mm_and_ps(dx, _mm_cmplt_ps(_mm_and_ps(dx, absMask), inf));
+		dy = _mm_and_ps(dy, _mm_cmplt_ps(_mm_and_ps(dy, absMask), inf));
+
+		_mm_storeu_ps(dabs+idx, _mm_add_ps(_mm_mul_ps(dx,dx), _mm_mul_ps(dy,dy)));
+		_mm_storeu_ps(cs, c);
+		_mm_storeu_ps(dxs, dx);
+		_mm_storeu_ps(dys, dy);
+		for(int k=0;k<4;k++)
+			dI[idx+k] = Eigen::Vector3f(cs[k], dxs[k], dys[k]);
+	}
+	for(;idx<end;idx++)
+	{
+		float dx = 0.5f*(I[idx+1] - I[idx-1]);
+		float dy = 0.5f*(I[idx+wl] - I[idx-wl]);
+		if(!std::isfinite(dx)) dx=0;
+		if(!std::isfinite(dy)) dy=0;
+		dI[idx] = Eigen::Vector3f(I[idx], dx, dy);
+		dabs[idx] = dx*dx+dy*dy;
+	}
+}
+
+}
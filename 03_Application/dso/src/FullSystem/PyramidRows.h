@@ -0,0 +1,46 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "util/NumType.h"
+
+namespace dso
+{
+
+
+/*
+ * the row kernels of FrameHessian::makeImages. both have an SSE body and a scalar tail, with the same
+ * summation order as the plain per-pixel loops, so the result does not depend on the width.
+ */
+
+// one 2x2 box-filtered row of the next level: out[x] = 0.25*(above[2x] + above[2x+1] + below[2x] + below[2x+1]).
+void downsampleRow(const float* above, const float* below, float* out, int wl);
+
+// central differences on pixels [begin, end) of plane I (row stride wl), written into dI (with the intensity) and dabs.
+// non-finite gradients are set to 0.
+void gradientRow(const float* I, Eigen::Vector3f* dI, float* dabs, int begin, int end, int wl);
+
+}
+
@@ -41,6 +41,7 @@
 #include <Eigen/Eigenvalues>
 
 #include "FullSystem/ResidualProjections.h"
+#include "FullSystem/PatternLinearize.h"
 #include "OptimizationBackend/EnergyFunctional.h"
 #include "OptimizationBackend/EnergyFunctionalStructs.h"
 
@@ -76,6 +77,12 @@ PointFrameResidual::PointFrameResidual(PointHessian* point_, FrameHessian* host_
 
 
 double PointFrameResidual::linearize(CalibHessian* HCalib)
+{
+	return linearize(HCalib, point->u, point->v, point->color, point->weights);
+}
+
+
+double PointFrameResidual::linearize(CalibHessian* HCalib, float pu, float pv, const float* color, const float* weights)
 {
 	state_NewEnergyWithOutlier=-1;
 
@@ -90,8 +97,6 @@ double PointFrameResidual::linearize(CalibHessian* HCalib)
 	const Vec3f &PRE_KtTll = precalc->PRE_KtTll;
 	const Mat33f &PRE_RTll_0 = precalc->PRE_RTll_0;
 	const Vec3f &PRE_tTll_0 = precalc->PRE_tTll_0;
-	const float * const color = point->color;
-	const float * const weights = point->weights;
 
 	Vec2f affLL = precalc->PRE_aff_mode;
 	float b0 = precalc->PRE_b0_mode;
@@ -105,7 +110,7 @@ double PointFrameResidual::linearize(CalibHessian* HCalib)
 		float Ku, Kv;
 		Vec3f KliP;
 
-		if(!projectPoint(point->u, point->v, point->idepth_zero_scaled, 0, 0,HCalib,
+		if(!projectPoint(pu, pv, point->idepth_zero_scaled, 0, 0,HCalib,
 				PRE_RTll_0,PRE_tTll_0, drescale, u, v, Ku, Kv, KliP, new_idepth))
 			{ state_NewState = ResState::OOB; return state_energy; }
 
@@ -174,89 +179,30 @@ double PointFrameResidual::linearize(CalibHessian* HCalib)
 
 
 
-	float JIdxJIdx_00=0, JIdxJIdx_11=0, JIdxJIdx_10=0;
-	float JabJIdx_00=0, JabJIdx_01=0, JabJIdx_10=0, JabJIdx_11=0;
-	float JabJab_00=0, JabJab_01=0, JabJab_11=0;
+	PatternLinInput in;
+	in.u = pu;
+	in.v = pv;
+	in.idepth = point->idepth_scaled;
+	in.color = color;
+	in.weights = weights;
+	in.KRKi = &PRE_KRKiTll;
+	in.Kt = &PRE_KtTll;
+	in.dI = dIl;
+	in.width = wG[0];
+	in.affLL = affLL;
+	in.b0 = b0;
 
 	float wJI2_sum = 0;
-
-	for(int idx=0;idx<patternNum;idx++)
-	{
-		float Ku, Kv;
-		if(!projectPoint(point->u+patternP[idx][0], point->v+patternP[idx][1], point->idepth_scaled, PRE_KRKiTll, PRE_KtTll, Ku, Kv))
-			{ state_NewState = ResState::OOB; return state_energy; }
-
-		projectedTo[idx][0] = Ku;
-		projectedTo[idx][1] = Kv;
-
-
-        Vec3f hitColor = (getInterpolatedElement33(dIl, Ku, Kv, wG[0]));
-        float residual = hitColor[0] - (float)(affLL[0] * color[idx] + affLL[1]);
-
-
-
-		float drdA = (color[idx]-b0);
-		if(!std::isfinite((float)hitColor[0]))
+	bool inside;
+#ifdef DSO_SIMD_DISPATCH
+	if(getSimdLevel() >= SIMD_AVX2)
+		inside = linearizePatternAVX2(in, J, projectedTo, energyLeft, wJI2_sum);
+	else
+#endif
+		inside = linearizePattern(in, J, projectedTo, energyLeft, wJI2_sum);
+	if(!inside)
 		{ state_NewState = ResState::OOB; return state_energy; }
 
-
-		float w = sqrtf(setting_outlierTHSumComponent / (setting_outlierTHSumComponent + hitColor.tail<2>().squaredNorm()));
-        w = 0.5f*(w + weights[idx]);
-
-
-
-		float hw = fabsf(residual) < setting_huberTH ? 1 : setting_huberTH / fabsf(residual);
-		energyLeft += w*w*hw *residual*residual*(2-hw);
-
-		{
-			if(hw < 1) hw = sqrtf(hw);
-			hw = hw*w;
-
-			hitColor[1]*=hw;
-			hitColor[2]*=hw;
-
-			J->resF[idx] = residual*hw;
-
-			J->JIdx[0][idx] = hitColor[1];
-			J->JIdx[1][idx] = hitColor[2];
-			J->JabF[0][idx] = drdA*hw;
-			J->JabF[1][idx] = hw;
-
-			JIdxJIdx_00+=hitColor[1]*hitColor[1];
-			JIdxJIdx_11+=hitColor[2]*hitColor[2];
-			JIdxJIdx_10+=hitColor[1]*hitColor[2];
-
-			JabJIdx_00+= drdA*hw * hitColor[1];
-			JabJIdx_01+= drdA*hw * hitColor[2];
-			JabJIdx_10+= hw * hitColor[1];
-			JabJIdx_11+= hw * hitColor[2];
-
-			JabJab_00+= drdA*drdA*hw*hw;
-			JabJab_01+= drdA*hw*hw;
-			JabJab_11+= hw*hw;
-
-
-			wJI2_sum += hw*hw*(hitColor[1]*hitColor[1]+hitColor[2]*hitColor[2]);
-
-			if(setting_affineOptModeA < 0) J->JabF[0][idx]=0;
-			if(setting_affineOptModeB < 0) J->JabF[1][idx]=0;
-
-		}
-	}
-
-	J->JIdx2(0,0) = JIdxJIdx_00;
-	J->JIdx2(0,1) = JIdxJIdx_10;
-	J->JIdx2(1,0) = JIdxJIdx_10;
-	J->JIdx2(1,1) = JIdxJIdx_11;
-	J->JabJIdx(0,0) = JabJIdx_00;
-	J->JabJIdx(0,1) = JabJIdx_01;
-	J->JabJIdx(1,0) = JabJIdx_10;
-	J->JabJIdx(1,1) = JabJIdx_11;
-	J->Jab2(0,0) = JabJab_00;
-	J->Jab2(0,1) = JabJab_01;
-	J->Jab2(1,0) = JabJab_01;
-	J->Jab2(1,1) = JabJab_11;
-
 	state_NewEnergyWithOutlier = energyLeft;
 
 	if(energyLeft > std::max<float>(host->frameEnergyTH, target->frameEnergyTH) || wJI2_sum < 2)
@@ -314,12 +260,12 @@ void PointFrameResidual::applyRes(bool copyJacobians)
 		}
 		if(state_NewState == ResState::IN)// && )
 		{
-			efResidual->isActiveAndIsGoodNEW=true;
+			efResidual->setActive(true);
 			efResidual->takeDataF();
 		}
 		else
 		{
-			efResidual->isActiveAndIsGoodNEW=false;
+			efResidual->setActive(false);
 		}
 	}
 
@@ -54,7 +54,7 @@ struct FullJacRowT
 class PointFrameResidual
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    DSO_SLAB_POOLED_NEW(PointFrameResidual);
 
 	EFResidual* efResidual;
 
@@ -87,6 +87,8 @@ public:
 	PointFrameResidual();
 	PointFrameResidual(PointHessian* point_, FrameHessian* host_, FrameHessian* target_);
 	double linearize(CalibHessian* HCalib);
+	// same, but takes the static point data from the SoA residual table.
+	double linearize(CalibHessian* HCalib, float pu, float pv, const float* color, const float* weights);
 
 
 	void resetOOB()
@@ -26,6 +26,7 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <memory>
 
 #include "util/NumType.h"
 #include "util/MinimalImage.h"
@@ -45,6 +46,12 @@ class FrameShell;
 namespace IOWrap
 {
 
+struct FrameOut;
+struct KeyframeOut;
+
+// EnergyFunctional::connectivityMap, see [publishGraph]. overrides have to use exactly this type.
+typedef std::map<uint64_t,Eigen::Vector2i, std::less<uint64_t>, Eigen::aligned_allocator<std::pair<uint64_t, Eigen::Vector2i> > > ConnectivityMap;
+
 /* ======================= Some typical usecases: ===============
  *
  * (1) always get the pose of the most recent frame:
@@ -127,7 +134,7 @@ public:
          *  Calling:
          *  Always called, no overhead if not used.
          */
-        virtual void publishGraph(const std::map<uint64_t,Eigen::Vector2i, std::less<uint64_t>, Eigen::aligned_allocator<std::pair<uint64_t, Eigen::Vector2i> > > &connectivity) {}
+        virtual void publishGraph(const ConnectivityMap &connectivity) {}
 
 
 
@@ -197,6 +204,22 @@ public:
 
 
 
+        /* ==================== asynchronous variants ====================
+         * a wrapper that is registered through an [OutputDispatcher] is called on the dispatcher's thread, some time later.
+         * the solver's FrameHessians may be gone by then, so instead of the FrameHessian-based calls above it gets these,
+         * with immutable copies (see OutputSnapshots.h). [publishGraph] and [pushDepthImage] are forwarded as they are,
+         * on copies. all of them are only valid during the call.
+         *
+         * Calling:
+         * Only called by an [OutputDispatcher], never by the solver.
+         */
+        virtual void publishKeyframeSnapshots(const std::vector<std::shared_ptr<const KeyframeOut>> &frames, bool final) {}
+        virtual void publishCamPoseSnapshot(const FrameOut &frame) {}
+        virtual void pushLiveFrameSnapshot(const FrameOut &frame) {}
+        virtual void pushDepthImageFloatSnapshot(MinimalImageF* image, const FrameOut &KF) {}
+
+
+
         /* call on finish */
         virtual void join() {}
 
@@ -0,0 +1,144 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+#include "IOWrapper/Output3DWrapper.h"
+
+#include "FullSystem/HessianBlocks.h"
+#include "FullSystem/ImmaturePoint.h"
+#include "util/FrameShell.h"
+
+#include <memory>
+#include <vector>
+
+namespace dso
+{
+
+namespace IOWrap
+{
+
+/*
+ * immutable copies of what the solver hands to the output wrappers, for wrappers that are called
+ * asynchronously (OutputDispatcher). made on the solver thread, never changed afterwards.
+ */
+
+
+enum OutPointStatus {OUT_POINT_IMMATURE=0, OUT_POINT_ACTIVE, OUT_POINT_MARGINALIZED, OUT_POINT_OUT};
+
+struct PointOut
+{
+	float u, v;
+	float idepth;			// idepth_scaled. immature points: middle of their idepth interval.
+	float idepthHessian;	// 0 for immature points.
+	float maxRelBaseline;	// 0 for immature points.
+	float color[MAX_RES_PER_POINT];
+	unsigned char status;	// OutPointStatus.
+};
+
+struct FrameOut
+{
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+	FrameShell shell;		// trackingRef is cleared, that shell may be gone.
+	int kfID;				// FrameHessian::frameID, -1 if not a keyframe.
+	float fx, fy, cx, cy;	// most recent intrinsics, 0 if not known.
+};
+
+struct KeyframeOut
+{
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+	FrameOut frame;
+	SE3 camToWorld;			// PRE_camToWorld, i.e., the pose of the last optimization.
+	AffLight aff_g2l;
+	bool final;
+	std::vector<PointOut> points;
+};
+
+
+
+inline void fillFrameOut(FrameOut* out, FrameShell* shell, int kfID, CalibHessian* HCalib)
+{
+	out->shell = *shell;
+	out->shell.trackingRef = 0;
+	out->kfID = kfID;
+	if(HCalib != 0)
+	{
+		out->fx = HCalib->fxl(); out->fy = HCalib->fyl();
+		out->cx = HCalib->cxl(); out->cy = HCalib->cyl();
+	}
+	else
+		out->fx = out->fy = out->cx = out->cy = 0;
+}
+
+inline std::shared_ptr<const FrameOut> snapshotFrame(FrameShell* shell, int kfID, CalibHessian* HCalib)
+{
+	FrameOut* out = new FrameOut();
+	fillFrameOut(out, shell, kfID, HCalib);
+	return std::shared_ptr<const FrameOut>(out);
+}
+
+inline void addPointOut(std::vector<PointOut> &pts, PointHessian* ph, unsigned char status)
+{
+	PointOut p;
+	p.u = ph->u;
+	p.v = ph->v;
+	p.idepth = ph->idepth_scaled;
+	p.idepthHessian = ph->idepth_hessian;
+	p.maxRelBaseline = ph->maxRelBaseline;
+	for(int i=0;i<MAX_RES_PER_POINT;i++) p.color[i] = i < patternNum ? ph->color[i] : 0;
+	p.status = status;
+	pts.push_back(p);
+}
+
+// all points of the keyframe: immature, active, marginalized and outliers.
+inline std::shared_ptr<const KeyframeOut> snapshotKeyframe(FrameHessian* fh, bool final, CalibHessian* HCalib)
+{
+	KeyframeOut* out = new KeyframeOut();
+	fillFrameOut(&out->frame, fh->shell, fh->frameID, HCalib);
+	out->camToWorld = fh->PRE_camToWorld;
+	out->aff_g2l = fh->aff_g2l();
+	out->final = final;
+
+	out->points.reserve(fh->immaturePoints.size() + fh->pointHessians.size() + fh->pointHessiansMarginalized.size() + fh->pointHessiansOut.size());
+	for(ImmaturePoint* ip : fh->immaturePoints)
+	{
+		PointOut p;
+		p.u = ip->u;
+		p.v = ip->v;
+		p.idepth = (ip->idepth_max+ip->idepth_min)*0.5f;
+		p.idepthHessian = 0;
+		p.maxRelBaseline = 0;
+		for(int i=0;i<MAX_RES_PER_POINT;i++) p.color[i] = i < patternNum ? ip->color[i] : 0;
+		p.status = OUT_POINT_IMMATURE;
+		out->points.push_back(p);
+	}
+	for(PointHessian* ph : fh->pointHessians) addPointOut(out->points, ph, OUT_POINT_ACTIVE);
+	for(PointHessian* ph : fh->pointHessiansMarginalized) addPointOut(out->points, ph, OUT_POINT_MARGINALIZED);
+	for(PointHessian* ph : fh->pointHessiansOut) addPointOut(out->points, ph, OUT_POINT_OUT);
+
+	return std::shared_ptr<const KeyframeOut>(out);
+}
+
+}
+
+}
@@ -0,0 +1,159 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * on-disk layout of the binary map / trajectory stream (BinaryMapOutputWrapper, BinaryMapReader).
+ * plain structs only (no Eigen / Sophus), so tools can include this without the rest of DSO.
+ *
+ * file = FileHeader, followed by chunks. every chunk = ChunkHeader + [size] payload bytes, and starts
+ * 8-byte aligned (payloads are padded), so a reader can point straight into a mapped file. unknown
+ * chunk types are skipped; a truncated last chunk (file still being written) is ignored.
+ * all values in host byte order (the header stores a byte order mark).
+ *
+ * every chunk carries the run it belongs to: the writer counts resets, and ids (keyframe, frame) restart
+ * with every run, so they are only unique together with it.
+ *
+ * chunks:
+ *   CHUNK_CALIB       CalibRecord.
+ *   CHUNK_KEYFRAME    KeyframeRecord, followed by numPoints PointRecords.
+ *   CHUNK_FRAME_POSE  FramePoseRecord, one per tracked frame.
+ *   CHUNK_GRAPH       GraphRecord, followed by numEdges GraphEdgeRecords. full snapshot, the last one is current.
+ *
+ * versions:
+ *   1  first version. ChunkHeader::run is always 0.
+ *   2  ChunkHeader::run.
+ */
+
+namespace dso
+{
+namespace BinaryMap
+{
+
+static const char FILE_MAGIC[8] = {'D','S','O','M','A','P','\0','\0'};
+static const uint32_t FILE_VERSION = 2;
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+enum ChunkType
+{
+	CHUNK_CALIB = 1,
+	CHUNK_KEYFRAME = 2,
+	CHUNK_FRAME_POSE = 3,
+	CHUNK_GRAPH = 4
+};
+
+// point status, as in the viewer.
+enum PointStatus
+{
+	POINT_IMMATURE = 0,
+	POINT_ACTIVE = 1,
+	POINT_MARGINALIZED = 2,
+	POINT_OUT = 3
+};
+
+#pragma pack(push, 1)
+
+struct FileHeader
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrderMark;
+};
+
+struct ChunkHeader
+{
+	uint32_t type;
+	uint32_t run;				// number of resets before this chunk was written.
+	uint64_t size;				// payload bytes, incl. padding.
+};
+
+struct CalibRecord
+{
+	float fx, fy, cx, cy;
+	int32_t width, height;
+};
+
+struct KeyframeRecord
+{
+	int32_t kfId;				// keyframe id.
+	int32_t frameId;			// internal frame id.
+	int32_t incomingId;			// id passed into DSO.
+	uint32_t numPoints;
+	double timestamp;
+	double camToWorld[7];		// tx ty tz qx qy qz qw.
+	double affA, affB;			// affine brightness, global to local.
+	double gpsPosition[3];		// external position measurement, if hasGps.
+	uint8_t final;				// 1: marginalized, will not change anymore.
+	uint8_t hasGps;
+	uint8_t pad[6];
+};
+
+struct PointRecord
+{
+	float u, v;					// pixel in the keyframe.
+	float idepth;
+	float idepth_hessian;		// inverse variance of idepth.
+	float maxRelBaseline;
+	uint8_t color[8];			// pattern intensities (first patternNum used).
+	uint8_t status;				// PointStatus.
+	uint8_t pad[3];
+};
+
+struct FramePoseRecord
+{
+	int32_t frameId;
+	int32_t incomingId;
+	double timestamp;
+	double camToWorld[7];
+	double affA, affB;
+};
+
+struct GraphRecord
+{
+	uint32_t numEdges;
+	uint32_t pad;
+};
+
+struct GraphEdgeRecord
+{
+	int32_t host, target;		// keyframe ids.
+	int32_t numActive;			// residuals host -> target, in the window.
+	int32_t numMarginalized;
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(FileHeader) == 16, "BinaryMap::FileHeader");
+static_assert(sizeof(ChunkHeader) == 16, "BinaryMap::ChunkHeader");
+static_assert(sizeof(KeyframeRecord) % 8 == 0, "BinaryMap::KeyframeRecord");
+static_assert(sizeof(PointRecord) == 32, "BinaryMap::PointRecord");
+static_assert(sizeof(FramePoseRecord) % 8 == 0, "BinaryMap::FramePoseRecord");
+
+inline uint64_t paddedSize(uint64_t size) {return (size+7) & ~(uint64_t)7;}
+
+}
+}
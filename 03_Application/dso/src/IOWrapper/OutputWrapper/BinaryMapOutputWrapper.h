@@ -0,0 +1,299 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+#include "boost/thread.hpp"
+#include "IOWrapper/Output3DWrapper.h"
+#include "IOWrapper/OutputWrapper/BinaryMapFormat.h"
+#include "IOWrapper/OutputSnapshots.h"
+
+#include "FullSystem/HessianBlocks.h"
+#include "util/FrameShell.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+
+namespace dso
+{
+
+namespace IOWrap
+{
+
+/*
+ * streams keyframes (pose, affine brightness, GPS, points), per-frame poses and the connectivity graph
+ * into a binary map file, see BinaryMapFormat.h. read it back with BinaryMap::Reader.
+ *
+ * keyframes are written once they are final (marginalized); the last state of the ones still in the
+ * window is written on join(). the graph is re-published in full for every keyframe, so only the latest
+ * snapshot is kept and written on join(). every reset() starts a new run (BinaryMap::ChunkHeader::run).
+ * if a write fails (disk full, ...), the file is closed and nothing more is written: it stays readable
+ * up to the last complete chunk.
+ * works directly on the solver threads as well as behind an OutputDispatcher.
+ */
+class BinaryMapOutputWrapper : public Output3DWrapper
+{
+public:
+	inline BinaryMapOutputWrapper(const std::string &file)
+	{
+		calibWritten = false;
+		numKeyframesWritten = numPosesWritten = 0;
+		run = 0;
+
+		fp = fopen(file.c_str(), "wb");
+		if(fp == 0)
+		{
+			printf("BinaryMapOutputWrapper: could not open %s!\n", file.c_str());
+			return;
+		}
+
+		BinaryMap::FileHeader h;
+		memcpy(h.magic, BinaryMap::FILE_MAGIC, sizeof(h.magic));
+		h.version = BinaryMap::FILE_VERSION;
+		h.byteOrderMark = BinaryMap::BYTE_ORDER_MARK;
+		if(fwrite(&h, sizeof(h), 1, fp) != 1)
+			fail();
+	}
+
+	virtual ~BinaryMapOutputWrapper()
+	{
+		join();
+		boost::unique_lock<boost::mutex> lock(mutex);
+		if(fp != 0)
+		{
+			if(fclose(fp) != 0)
+				printf("BinaryMapOutputWrapper: WRITE FAILED, the file is incomplete!\n");
+			printf("BinaryMapOutputWrapper: wrote %d keyframes, %d frame poses.\n", numKeyframesWritten, numPosesWritten);
+		}
+		fp = 0;
+	}
+
+	virtual void publishGraph(const ConnectivityMap &connectivity) override
+	{
+		boost::unique_lock<boost::mutex> lock(mutex);
+		graph.clear();
+		for(const std::pair<const uint64_t,Eigen::Vector2i> &p : connectivity)
+		{
+			BinaryMap::GraphEdgeRecord e;
+			e.host = (int)(p.first >> 32);
+			e.target = (int)(p.first & (uint64_t)0xFFFFFFFF);
+			if(e.host == e.target) continue;
+			e.numActive = p.second[0];
+			e.numMarginalized = p.second[1];
+			graph.push_back(e);
+		}
+	}
+
+	virtual void publishKeyframes(std::vector<FrameHessian*> &frames, bool final, CalibHessian* HCalib)
+	{
+		std::vector<std::shared_ptr<const KeyframeOut>> snapshots;
+		snapshots.reserve(frames.size());
+		for(FrameHessian* fh : frames)
+			snapshots.push_back(snapshotKeyframe(fh, final, HCalib));
+		publishKeyframeSnapshots(snapshots, final);
+	}
+
+	virtual void publishKeyframeSnapshots(const std::vector<std::shared_ptr<const KeyframeOut>> &frames, bool final)
+	{
+		boost::unique_lock<boost::mutex> lock(mutex);
+		if(fp == 0 || frames.empty()) return;
+
+		if(!calibWritten)
+		{
+			const FrameOut &f = frames[0]->frame;
+			BinaryMap::CalibRecord c;
+			c.fx = f.fx; c.fy = f.fy; c.cx = f.cx; c.cy = f.cy;
+			c.width = wG[0]; c.height = hG[0];
+			if(!writeChunk(BinaryMap::CHUNK_CALIB, &c, sizeof(c))) return;
+			calibWritten = true;
+		}
+
+		for(const std::shared_ptr<const KeyframeOut> &kf : frames)
+		{
+			std::vector<uint8_t> &buf = pendingKeyframes[kf->frame.kfID];
+			makeKeyframe(*kf, buf);
+			if(final)
+			{
+				if(!writeChunk(BinaryMap::CHUNK_KEYFRAME, buf.data(), buf.size())) return;
+				pendingKeyframes.erase(kf->frame.kfID);
+				numKeyframesWritten++;
+			}
+		}
+	}
+
+	virtual void publishCamPose(FrameShell* frame, CalibHessian* HCalib)
+	{
+		writePose(*frame);
+	}
+
+	virtual void publishCamPoseSnapshot(const FrameOut &frame)
+	{
+		writePose(frame.shell);
+	}
+
+	virtual void reset()
+	{
+		// keyframes of the failed run are not finished; they will not be continued. ids restart.
+		boost::unique_lock<boost::mutex> lock(mutex);
+		pendingKeyframes.clear();
+		graph.clear();
+		run++;
+	}
+
+	virtual void join()
+	{
+		boost::unique_lock<boost::mutex> lock(mutex);
+		if(fp == 0) return;
+
+		for(std::pair<const int, std::vector<uint8_t>> &p : pendingKeyframes)
+		{
+			if(!writeChunk(BinaryMap::CHUNK_KEYFRAME, p.second.data(), p.second.size())) return;
+			numKeyframesWritten++;
+		}
+		pendingKeyframes.clear();
+
+		if(!graph.empty())
+		{
+			BinaryMap::GraphRecord g;
+			g.numEdges = graph.size();
+			g.pad = 0;
+			std::vector<uint8_t> buf(sizeof(g) + graph.size()*sizeof(BinaryMap::GraphEdgeRecord));
+			memcpy(buf.data(), &g, sizeof(g));
+			memcpy(buf.data()+sizeof(g), graph.data(), graph.size()*sizeof(BinaryMap::GraphEdgeRecord));
+			if(!writeChunk(BinaryMap::CHUNK_GRAPH, buf.data(), buf.size())) return;
+			graph.clear();
+		}
+		if(fflush(fp) != 0)
+			fail();
+	}
+
+private:
+	FILE* fp;
+	boost::mutex mutex;
+	bool calibWritten;
+	int numKeyframesWritten, numPosesWritten;
+	uint32_t run;			// resets so far.
+	std::map<int, std::vector<uint8_t>> pendingKeyframes;		// last non-final state, by keyframe id.
+	std::vector<BinaryMap::GraphEdgeRecord> graph;
+
+	static inline void setPose(double* out, const SE3 &camToWorld)
+	{
+		for(int i=0;i<3;i++) out[i] = camToWorld.translation()[i];
+		out[3] = camToWorld.unit_quaternion().x();
+		out[4] = camToWorld.unit_quaternion().y();
+		out[5] = camToWorld.unit_quaternion().z();
+		out[6] = camToWorld.unit_quaternion().w();
+	}
+
+	static inline void setColor(BinaryMap::PointRecord &p, const float* color)
+	{
+		for(int i=0;i<8;i++)
+			p.color[i] = i < patternNum ? (uint8_t)std::min(255.0f, std::max(0.0f, color[i])) : 0;
+	}
+
+	inline void writePose(const FrameShell &frame)
+	{
+		BinaryMap::FramePoseRecord r;
+		r.frameId = frame.id;
+		r.incomingId = frame.incoming_id;
+		r.timestamp = frame.timestamp;
+		setPose(r.camToWorld, frame.camToWorld);
+		r.affA = frame.aff_g2l.a;
+		r.affB = frame.aff_g2l.b;
+
+		boost::unique_lock<boost::mutex> lock(mutex);
+		if(fp == 0) return;
+		if(writeChunk(BinaryMap::CHUNK_FRAME_POSE, &r, sizeof(r)))
+			numPosesWritten++;
+	}
+
+	inline void makeKeyframe(const KeyframeOut &kf, std::vector<uint8_t> &buf)
+	{
+		std::vector<BinaryMap::PointRecord> pts(kf.points.size());
+		for(size_t i=0;i<kf.points.size();i++)
+		{
+			const PointOut &src = kf.points[i];
+			BinaryMap::PointRecord &p = pts[i];
+			memset(&p, 0, sizeof(p));
+			p.u = src.u;
+			p.v = src.v;
+			p.idepth = src.idepth;
+			p.idepth_hessian = src.idepthHessian;
+			p.maxRelBaseline = src.maxRelBaseline;
+			setColor(p, src.color);
+			p.status = src.status;		// OutPointStatus has the values of BinaryMap::POINT_*.
+		}
+
+		const FrameShell &shell = kf.frame.shell;
+		BinaryMap::KeyframeRecord k;
+		memset(&k, 0, sizeof(k));
+		k.kfId = kf.frame.kfID;
+		k.frameId = shell.id;
+		k.incomingId = shell.incoming_id;
+		k.numPoints = pts.size();
+		k.timestamp = shell.timestamp;
+		setPose(k.camToWorld, kf.camToWorld);
+		k.affA = kf.aff_g2l.a;
+		k.affB = kf.aff_g2l.b;
+		k.final = kf.final ? 1 : 0;
+		k.hasGps = shell.predictedValid ? 1 : 0;
+		if(shell.predictedValid)
+			for(int i=0;i<3;i++) k.gpsPosition[i] = shell.camToWorld_predicted.translation()[i];
+
+		buf.resize(sizeof(k) + pts.size()*sizeof(BinaryMap::PointRecord));
+		memcpy(buf.data(), &k, sizeof(k));
+		if(!pts.empty()) memcpy(buf.data()+sizeof(k), pts.data(), pts.size()*sizeof(BinaryMap::PointRecord));
+	}
+
+	// false if the write failed; the file is closed then. call with mutex held and fp != 0.
+	inline bool writeChunk(uint32_t type, const void* payload, size_t size)
+	{
+		static const uint8_t zeros[8] = {0,0,0,0,0,0,0,0};
+		BinaryMap::ChunkHeader c;
+		c.type = type;
+		c.run = run;
+		c.size = BinaryMap::paddedSize(size);
+		if(fwrite(&c, sizeof(c), 1, fp) != 1 ||
+				fwrite(payload, 1, size, fp) != size ||
+				fwrite(zeros, 1, c.size - size, fp) != c.size - size)
+		{
+			fail();
+			return false;
+		}
+		return true;
+	}
+
+	inline void fail()
+	{
+		printf("BinaryMapOutputWrapper: WRITE FAILED after %d keyframes, %d frame poses! not writing anything more.\n",
+				numKeyframesWritten, numPosesWritten);
+		fclose(fp);
+		fp = 0;
+	}
+};
+
+}
+
+}
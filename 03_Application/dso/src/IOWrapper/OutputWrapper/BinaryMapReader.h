@@ -0,0 +1,176 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "IOWrapper/OutputWrapper/BinaryMapFormat.h"
+#include <vector>
+#include <map>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace dso
+{
+namespace BinaryMap
+{
+
+/*
+ * header-only, read-only view of a binary map file (see BinaryMapFormat.h). the file is mapped, and
+ * all accessors return pointers into the mapping: nothing is parsed or copied, beyond one pass over the
+ * chunk headers in open(). pointers are valid until close().
+ *
+ *   BinaryMap::Reader r;
+ *   if(r.open("map.bin"))
+ *       for(int i=0;i<r.numKeyframes();i++)
+ *       {
+ *           const BinaryMap::KeyframeRecord* kf = r.keyframe(i);
+ *           const BinaryMap::PointRecord* pts = r.keyframePoints(i);	// kf->numPoints of them.
+ *       }
+ *
+ * a keyframe id can appear more than once: non-final states may be streamed, and ids restart with
+ * every run (reset). latestKeyframes() picks one record per (run, id), preferring final ones.
+ */
+class Reader
+{
+public:
+	inline Reader() : data(0), size(0), calibRecord(0), graphOffset(0) {}
+	inline ~Reader() {close();}
+
+	inline bool open(const char* file)
+	{
+		close();
+		int fd = ::open(file, O_RDONLY);
+		if(fd < 0) return false;
+
+		struct stat st;
+		if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(FileHeader)) {::close(fd); return false;}
+		size = st.st_size;
+
+		void* m = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if(m == MAP_FAILED) {size=0; return false;}
+		data = (const uint8_t*)m;
+
+		const FileHeader* h = (const FileHeader*)data;
+		if(memcmp(h->magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || h->byteOrderMark != BYTE_ORDER_MARK || h->version > FILE_VERSION)
+		{
+			close();
+			return false;
+		}
+
+		// index all chunks.
+		uint64_t offset = sizeof(FileHeader);
+		while(offset + sizeof(ChunkHeader) <= size)
+		{
+			const ChunkHeader* c = (const ChunkHeader*)(data + offset);
+			uint64_t payload = offset + sizeof(ChunkHeader);
+			if(c->size > size - payload) break;		// truncated.
+
+			if(c->type == CHUNK_CALIB && c->size >= sizeof(CalibRecord))
+				calibRecord = (const CalibRecord*)(data + payload);
+			else if(c->type == CHUNK_KEYFRAME && c->size >= sizeof(KeyframeRecord))
+			{
+				const KeyframeRecord* kf = (const KeyframeRecord*)(data + payload);
+				if(sizeof(KeyframeRecord) + kf->numPoints*sizeof(PointRecord) <= c->size)
+					keyframeOffsets.push_back(payload);
+			}
+			else if(c->type == CHUNK_FRAME_POSE && c->size >= sizeof(FramePoseRecord))
+				framePoseOffsets.push_back(payload);
+			else if(c->type == CHUNK_GRAPH && c->size >= sizeof(GraphRecord))
+			{
+				const GraphRecord* g = (const GraphRecord*)(data + payload);
+				if(sizeof(GraphRecord) + g->numEdges*sizeof(GraphEdgeRecord) <= c->size)
+					graphOffset = payload;
+			}
+
+			offset = payload + c->size;
+		}
+		return true;
+	}
+
+	inline void close()
+	{
+		if(data != 0) munmap((void*)data, size);
+		data = 0;
+		size = 0;
+		calibRecord = 0;
+		graphOffset = 0;
+		keyframeOffsets.clear();
+		framePoseOffsets.clear();
+	}
+
+	inline bool isOpen() const {return data != 0;}
+
+	// 0 if not (yet) written.
+	inline const CalibRecord* calib() const {return calibRecord;}
+
+	inline int numKeyframes() const {return keyframeOffsets.size();}
+	inline const KeyframeRecord* keyframe(int i) const {return (const KeyframeRecord*)(data + keyframeOffsets[i]);}
+	inline const PointRecord* keyframePoints(int i) const {return (const PointRecord*)(data + keyframeOffsets[i] + sizeof(KeyframeRecord));}
+	inline uint32_t keyframeRun(int i) const {return chunkRun(keyframeOffsets[i]);}
+
+	inline int numFramePoses() const {return framePoseOffsets.size();}
+	inline const FramePoseRecord* framePose(int i) const {return (const FramePoseRecord*)(data + framePoseOffsets[i]);}
+	inline uint32_t framePoseRun(int i) const {return chunkRun(framePoseOffsets[i]);}
+
+	// last connectivity snapshot. 0 edges if there is none.
+	inline int numGraphEdges() const {return graphOffset == 0 ? 0 : ((const GraphRecord*)(data + graphOffset))->numEdges;}
+	inline const GraphEdgeRecord* graphEdges() const {return (const GraphEdgeRecord*)(data + graphOffset + sizeof(GraphRecord));}
+
+	// indices of the keyframes to use: the last written state of each (run, keyframe id), ordered by run and id.
+	inline std::vector<int> latestKeyframes() const
+	{
+		std::vector<int> latest;
+		std::map<std::pair<uint32_t,int>, int> byId;
+		for(int i=0;i<numKeyframes();i++)
+		{
+			int id = keyframe(i)->kfId;
+			if(id < 0) continue;
+			std::map<std::pair<uint32_t,int>, int>::iterator it = byId.insert(std::make_pair(std::make_pair(keyframeRun(i), id), i)).first;
+			if(!keyframe(it->second)->final || keyframe(i)->final) it->second = i;
+		}
+		for(const std::pair<const std::pair<uint32_t,int>, int> &p : byId) latest.push_back(p.second);
+		return latest;
+	}
+
+private:
+	Reader(const Reader&);
+	Reader& operator=(const Reader&);
+
+	inline uint32_t chunkRun(uint64_t payload) const {return ((const ChunkHeader*)(data + payload - sizeof(ChunkHeader)))->run;}
+
+	const uint8_t* data;
+	uint64_t size;
+	const CalibRecord* calibRecord;
+	uint64_t graphOffset;
+	std::vector<uint64_t> keyframeOffsets;
+	std::vector<uint64_t> framePoseOffsets;
+};
+
+}
+}
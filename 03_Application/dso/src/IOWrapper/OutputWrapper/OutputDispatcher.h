@@ -0,0 +1,245 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+#include "boost/thread.hpp"
+#include "IOWrapper/Output3DWrapper.h"
+#include "IOWrapper/OutputSnapshots.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <deque>
+#include <functional>
+
+namespace dso
+{
+
+namespace IOWrap
+{
+
+/*
+ * runs one output wrapper on its own thread, so the tracking and mapping threads never wait for its I/O.
+ * registered in FullSystem::outputWrapper in place of the wrapped one: every callback takes a snapshot on the
+ * calling solver thread (OutputSnapshots.h) and queues it; the wrapped wrapper gets the asynchronous variants
+ * ([publishKeyframeSnapshots] etc.), in order, on the dispatcher thread.
+ *
+ * the queue holds at most [capacity] messages. what happens when it is full is up to [policy]; final keyframes are
+ * never dropped (if nothing can be dropped, the solver thread waits). a queued window of non-final keyframes and a
+ * queued graph are replaced by newer ones, they always contain the full state.
+ *
+ * owns the wrapped wrapper.
+ */
+class OutputDispatcher : public Output3DWrapper
+{
+public:
+	enum DropPolicy
+	{
+		DROP_NONE = 0,		// nothing is dropped, a full queue blocks the solver thread.
+		DROP_FRAMES,		// a full queue drops its oldest per-frame message (pose, live frame, depth image).
+		KEYFRAMES_ONLY		// per-frame messages are not even snapshotted: only keyframes & the graph are forwarded.
+	};
+
+	inline OutputDispatcher(Output3DWrapper* wrapped_, int capacity_, DropPolicy policy_) :
+		wrapped(wrapped_), capacity(std::max(1, capacity_)), policy(policy_)
+	{
+		running = true;
+		delivering = false;
+		numDropped = numWaits = 0;
+		thread = boost::thread(&OutputDispatcher::dispatchLoop, this);
+	}
+
+	virtual ~OutputDispatcher()
+	{
+		{
+			boost::unique_lock<boost::mutex> lock(mutex);
+			running = false;
+			queueNotEmpty.notify_all();
+			queueNotFull.notify_all();
+		}
+		thread.join();
+
+		if(numDropped > 0 || numWaits > 0)
+			printf("OutputDispatcher: dropped %d messages, solver waited %d times.\n", numDropped, numWaits);
+		delete wrapped;
+	}
+
+	virtual void publishGraph(const ConnectivityMap &connectivity)
+	{
+		std::shared_ptr<const ConnectivityMap> g(new ConnectivityMap(connectivity));
+		Output3DWrapper* w = wrapped;
+		push(MSG_GRAPH, [w, g]() { w->publishGraph(*g); });
+	}
+
+	virtual void publishKeyframes(std::vector<FrameHessian*> &frames, bool final, CalibHessian* HCalib)
+	{
+		std::vector<std::shared_ptr<const KeyframeOut>> snapshots;
+		snapshots.reserve(frames.size());
+		for(FrameHessian* fh : frames)
+			snapshots.push_back(snapshotKeyframe(fh, final, HCalib));
+
+		Output3DWrapper* w = wrapped;
+		push(final ? MSG_FINAL_KEYFRAMES : MSG_KEYFRAMES, [w, snapshots, final]() { w->publishKeyframeSnapshots(snapshots, final); });
+	}
+
+	virtual void publishCamPose(FrameShell* frame, CalibHessian* HCalib)
+	{
+		if(policy == KEYFRAMES_ONLY) return;
+		std::shared_ptr<const FrameOut> f = snapshotFrame(frame, -1, HCalib);
+		Output3DWrapper* w = wrapped;
+		push(MSG_FRAME, [w, f]() { w->publishCamPoseSnapshot(*f); });
+	}
+
+	virtual void pushLiveFrame(FrameHessian* image)
+	{
+		if(policy == KEYFRAMES_ONLY) return;
+		std::shared_ptr<const FrameOut> f = snapshotFrame(image->shell, -1, 0);
+		Output3DWrapper* w = wrapped;
+		push(MSG_FRAME, [w, f]() { w->pushLiveFrameSnapshot(*f); });
+	}
+
+	virtual void pushDepthImage(MinimalImageB3* image)
+	{
+		if(policy == KEYFRAMES_ONLY) return;
+		std::shared_ptr<MinimalImageB3> img(image->getClone());
+		Output3DWrapper* w = wrapped;
+		push(MSG_FRAME, [w, img]() { w->pushDepthImage(img.get()); });
+	}
+
+	virtual bool needPushDepthImage()
+	{
+		return policy != KEYFRAMES_ONLY && wrapped->needPushDepthImage();
+	}
+
+	virtual void pushDepthImageFloat(MinimalImageF* image, FrameHessian* KF)
+	{
+		if(policy == KEYFRAMES_ONLY) return;
+		std::shared_ptr<MinimalImageF> img(image->getClone());
+		std::shared_ptr<const FrameOut> f = snapshotFrame(KF->shell, KF->frameID, 0);
+		Output3DWrapper* w = wrapped;
+		push(MSG_FRAME, [w, img, f]() { w->pushDepthImageFloatSnapshot(img.get(), *f); });
+	}
+
+	virtual void join()
+	{
+		// everything queued so far is delivered first. the lock keeps the dispatcher thread out.
+		boost::unique_lock<boost::mutex> lock(mutex);
+		while(!queue.empty() || delivering) queueDrained.wait(lock);
+		wrapped->join();
+	}
+
+	virtual void reset()
+	{
+		// messages of the failed run are not delivered anymore.
+		boost::unique_lock<boost::mutex> lock(mutex);
+		queue.clear();
+		queueNotFull.notify_all();
+		while(delivering) queueDrained.wait(lock);
+		wrapped->reset();
+	}
+
+private:
+	enum MessageType {MSG_GRAPH=0, MSG_KEYFRAMES, MSG_FINAL_KEYFRAMES, MSG_FRAME};
+	struct Message
+	{
+		MessageType type;
+		std::function<void()> deliver;
+	};
+
+	Output3DWrapper* wrapped;
+	int capacity;
+	DropPolicy policy;
+
+	boost::thread thread;
+	boost::mutex mutex;
+	boost::condition_variable queueNotEmpty;
+	boost::condition_variable queueNotFull;
+	boost::condition_variable queueDrained;
+	std::deque<Message> queue;
+	bool running;
+	bool delivering;
+	int numDropped, numWaits;
+
+	inline void push(MessageType type, const std::function<void()> &deliver)
+	{
+		boost::unique_lock<boost::mutex> lock(mutex);
+		if(!running) return;
+
+		// full-state messages: only the newest one is of interest.
+		if(type == MSG_GRAPH || type == MSG_KEYFRAMES)
+			for(std::deque<Message>::iterator it = queue.begin(); it != queue.end(); ++it)
+				if(it->type == type) { queue.erase(it); break; }
+
+		while((int)queue.size() >= capacity && running)
+		{
+			if(policy != DROP_NONE)
+			{
+				std::deque<Message>::iterator it = queue.begin();
+				while(it != queue.end() && it->type != MSG_FRAME) ++it;
+				if(it != queue.end())
+				{
+					queue.erase(it);
+					numDropped++;
+					continue;
+				}
+			}
+			numWaits++;
+			queueNotFull.wait(lock);
+		}
+		if(!running) return;
+
+		Message m;
+		m.type = type;
+		m.deliver = deliver;
+		queue.push_back(m);
+		queueNotEmpty.notify_one();
+	}
+
+	inline void dispatchLoop()
+	{
+		boost::unique_lock<boost::mutex> lock(mutex);
+		while(true)
+		{
+			while(queue.empty() && running) queueNotEmpty.wait(lock);
+			if(queue.empty()) break;		// stopped, and everything delivered.
+
+			Message m = queue.front();
+			queue.pop_front();
+			delivering = true;
+			queueNotFull.notify_all();
+
+			lock.unlock();
+			m.deliver();
+			m.deliver = std::function<void()>();	// frees the snapshots outside the lock.
+			lock.lock();
+
+			delivering = false;
+			if(queue.empty()) queueDrained.notify_all();
+		}
+		queueDrained.notify_all();
+	}
+};
+
+}
+
+}
@@ -26,6 +26,7 @@
 #include "boost/thread.hpp"
 #include "util/MinimalImage.h"
 #include "IOWrapper/Output3DWrapper.h"
+#include "IOWrapper/OutputSnapshots.h"
 
 #include "FullSystem/HessianBlocks.h"
 #include "util/FrameShell.h"
@@ -65,7 +66,7 @@ public:
 		
         }
 
-        virtual void publishGraph(const std::map<uint64_t,Eigen::Vector2i> &connectivity)
+        virtual void publishGraph(const ConnectivityMap &connectivity) override
         {
             /*
             printf("OUT: got graph with %d edges\n", (int)connectivity.size());
@@ -113,11 +114,22 @@ public:
         }
 
         virtual void publishCamPose(FrameShell* frame, CalibHessian* HCalib)
+        {
+            writePose(*frame);
+        }
+
+        // same, behind an OutputDispatcher.
+        virtual void publishCamPoseSnapshot(const FrameOut &frame)
+        {
+            writePose(frame.shell);
+        }
+
+        void writePose(const FrameShell &frame)
         {
             printf("OUT: Current Frame %d (time %f, internal ID %d). CameraToWorld:\n",
-                   frame->incoming_id,
-                   frame->timestamp,
-                   frame->id);
+                   frame.incoming_id,
+                   frame.timestamp,
+                   frame.id);
             
             // Matrix converting from DSO space to Blender space (will be used later for visualization):
             // x = -x
@@ -133,7 +145,7 @@ public:
 
             // Transform the pose back to Blender:
 
-            Eigen::Affine3d dsoPose(frame->camToWorld.matrix3x4());
+            Eigen::Affine3d dsoPose(frame.camToWorld.matrix3x4());
             
             Eigen::Affine3d blenderCam2World = dso2Blender * dsoPose;
             Eigen::Affine3d blenderWorld2Cam = blenderCam2World.inverse(); //Inverse = World to Camera
@@ -141,13 +153,13 @@ public:
             Eigen::Quaterniond q(blenderWorld2Cam.linear());
             Eigen::Vector3d t(blenderWorld2Cam.translation());
             
-            std::cout << frame->camToWorld.matrix3x4() << "\n";
-            std::cout << "camToTrackingRef: " << frame->camToTrackingRef.matrix3x4() << "\n";
+            std::cout << frame.camToWorld.matrix3x4() << "\n";
+            std::cout << "camToTrackingRef: " << frame.camToTrackingRef.matrix3x4() << "\n";
             // Matrix3x4 from Sophus library is of type SE3
             // which - in turn - internally is a Matrix<Scalar,3,4>
             // Conversion to Translation and Quaternion is below.
             // First show timestamp (based on 25 fps) in milliseconds:
-            csvFile << frame->id * (1.0 / 25.0) * 1000.0 << ",";
+            csvFile << frame.id * (1.0 / 25.0) * 1000.0 << ",";
             // Translation:
             csvFile << t.x() << ","
                     << t.y() << ","
@@ -167,6 +179,11 @@ public:
             printf("OUT; pushLiveFrame\n");
         }
 
+        virtual void pushLiveFrameSnapshot(const FrameOut &frame)
+        {
+            printf("OUT; pushLiveFrame\n");
+        }
+
         virtual void pushDepthImage(MinimalImageB3* image)
         {
             // can be used to get the raw image with depth overlay.
@@ -46,13 +46,13 @@ namespace IOWrap
 
 KeyFrameDisplay::KeyFrameDisplay()
 {
-	originalInputSparse = 0;
-	numSparseBufferSize=0;
-	numSparsePoints=0;
-
 	id = 0;
 	active= true;
 	camToWorld = SE3();
+	worldCenter = Vec3f::Zero();
+	worldRadius = 0;
+	gridKey = 0;
+	inGrid = false;
 
 	needRefresh=true;
 
@@ -63,6 +63,7 @@ KeyFrameDisplay::KeyFrameDisplay()
 	my_sparsifyFactor = 1;
 
 	numGLBufferPoints=0;
+	numGLBufferGoodPoints=0;
 	bufferValid = false;
 }
 void KeyFrameDisplay::setFromF(FrameShell* frame, CalibHessian* HCalib)
@@ -82,9 +83,18 @@ void KeyFrameDisplay::setFromF(FrameShell* frame, CalibHessian* HCalib)
 	needRefresh=true;
 }
 
-void KeyFrameDisplay::setFromKF(FrameHessian* fh, CalibHessian* HCalib)
+std::shared_ptr<const KeyFrameSnapshot> KeyFrameDisplay::snapshotKF(FrameHessian* fh, bool final, CalibHessian* HCalib)
 {
-	setFromF(fh->shell, HCalib);
+	KeyFrameSnapshot* snap = new KeyFrameSnapshot();
+	snap->id = fh->frameID;
+	snap->final = final;
+	snap->fx = HCalib->fxl();
+	snap->fy = HCalib->fyl();
+	snap->cx = HCalib->cxl();
+	snap->cy = HCalib->cyl();
+	snap->width = wG[0];
+	snap->height = hG[0];
+	snap->camToWorld = fh->PRE_camToWorld;
 
 	// add all traces, inlier and outlier points.
 	int npoints = 	fh->immaturePoints.size() +
@@ -92,15 +102,9 @@ void KeyFrameDisplay::setFromKF(FrameHessian* fh, CalibHessian* HCalib)
 					fh->pointHessiansMarginalized.size() +
 					fh->pointHessiansOut.size();
 
-	if(numSparseBufferSize < npoints)
-	{
-		if(originalInputSparse != 0) delete originalInputSparse;
-		numSparseBufferSize = npoints+100;
-        originalInputSparse = new InputPointSparse<MAX_RES_PER_POINT>[numSparseBufferSize];
-	}
-
-    InputPointSparse<MAX_RES_PER_POINT>* pc = originalInputSparse;
-	numSparsePoints=0;
+	snap->points.resize(npoints);
+    InputPointSparse<MAX_RES_PER_POINT>* pc = snap->points.data();
+	int numSparsePoints=0;
 	for(ImmaturePoint* p : fh->immaturePoints)
 	{
 		for(int i=0;i<patternNum;i++)
@@ -158,17 +162,80 @@ void KeyFrameDisplay::setFromKF(FrameHessian* fh, CalibHessian* HCalib)
 		pc[numSparsePoints].status=3;
 		numSparsePoints++;
 	}
-	assert(numSparsePoints <= npoints);
+	assert(numSparsePoints == npoints);
+
+	return std::shared_ptr<const KeyFrameSnapshot>(snap);
+}
 
-	camToWorld = fh->PRE_camToWorld;
+void KeyFrameDisplay::setFromSnapshot(const std::shared_ptr<const KeyFrameSnapshot> &snapshot)
+{
+	this->snapshot = snapshot;
+	id = snapshot->id;
+	fx = snapshot->fx;
+	fy = snapshot->fy;
+	cx = snapshot->cx;
+	cy = snapshot->cy;
+	width = snapshot->width;
+	height = snapshot->height;
+	fxi = 1/fx;
+	fyi = 1/fy;
+	cxi = -cx / fx;
+	cyi = -cy / fy;
+	camToWorld = snapshot->camToWorld;
 	needRefresh=true;
+
+	// bounding sphere, used for culling. the camera center is part of it, so the frustum is culled along with the points.
+	Vec3f sum = Vec3f::Zero();
+	int num = 1;
+	float maxDepth = 0;
+	for(const InputPointSparse<MAX_RES_PER_POINT> &p : snapshot->points)
+	{
+		if(p.idpeth <= 0) continue;
+		float depth = 1.0f / p.idpeth;
+		sum += Vec3f((p.u*fxi + cxi) * depth, (p.v*fyi + cyi) * depth, depth);
+		maxDepth = std::max(maxDepth, depth);
+		num++;
+	}
+	Vec3f center = sum / num;
+	float radius2 = center.squaredNorm();
+	for(const InputPointSparse<MAX_RES_PER_POINT> &p : snapshot->points)
+	{
+		if(p.idpeth <= 0) continue;
+		float depth = 1.0f / p.idpeth;
+		radius2 = std::max(radius2, (Vec3f((p.u*fxi + cxi) * depth, (p.v*fyi + cyi) * depth, depth) - center).squaredNorm());
+	}
+	worldCenter = (camToWorld * center.cast<double>()).cast<float>();
+
+	// refreshPC draws the pattern around every point (pixel offsets) and jitters the depth by up to depth*fxi;
+	// both scale with the depth, so the margin is taken at the deepest point.
+	float patternExtent = 0;
+	for(int pnt=0;pnt<patternNum;pnt++)
+		patternExtent = std::max(patternExtent, sqrtf((float)(patternP[pnt][0]*patternP[pnt][0] + patternP[pnt][1]*patternP[pnt][1])));
+	worldRadius = sqrtf(radius2) + maxDepth * (2*fxi + patternExtent*std::max(fxi, fyi));
 }
 
 
 KeyFrameDisplay::~KeyFrameDisplay()
 {
-	if(originalInputSparse != 0)
-		delete[] originalInputSparse;
+}
+
+size_t KeyFrameDisplay::getMemoryBytes() const
+{
+	size_t inputBytes = snapshot ? snapshot->points.size()*sizeof(InputPointSparse<MAX_RES_PER_POINT>) : 0;
+	return inputBytes + numGLBufferPoints*(sizeof(float)*3 + 3);
+}
+
+void KeyFrameDisplay::releasePoints()
+{
+	snapshot.reset();
+
+	// right away: a culled keyframe might never get to refreshPC again.
+	vertexBuffer.Free();
+	colorBuffer.Free();
+	numGLBufferPoints = 0;
+	numGLBufferGoodPoints = 0;
+	bufferValid = false;
+	needRefresh = true;
 }
 
 bool KeyFrameDisplay::refreshPC(bool canRefresh, float scaledTH, float absTH, int mode, float minBS, int sparsity)
@@ -194,8 +261,10 @@ bool KeyFrameDisplay::refreshPC(bool canRefresh, float scaledTH, float absTH, in
 
 
 	// if there are no vertices, done!
+	int numSparsePoints = snapshot ? snapshot->points.size() : 0;
 	if(numSparsePoints == 0)
 		return false;
+	const InputPointSparse<MAX_RES_PER_POINT>* originalInputSparse = snapshot->points.data();
 
 	// make data
 	Vec3f* tmpVertexBuffer = new Vec3f[numSparsePoints*patternNum];
@@ -365,8 +434,9 @@ void KeyFrameDisplay::drawCam(float lineWidth, float* color, float sizeFactor)
 }
 
 
-void KeyFrameDisplay::drawPC(float pointSize)
+void KeyFrameDisplay::drawPC(float pointSize, int decimation)
 {
+	if(decimation < 1) decimation = 1;
 
 	if(!bufferValid || numGLBufferGoodPoints==0)
 		return;
@@ -382,14 +452,15 @@ void KeyFrameDisplay::drawPC(float pointSize)
 		glPointSize(pointSize);
 
 
+		// decimation via the stride. vertices are ordered by point, not by image area, so every n'th one is an even subsample.
 		colorBuffer.Bind();
-		glColorPointer(colorBuffer.count_per_element, colorBuffer.datatype, 0, 0);
+		glColorPointer(colorBuffer.count_per_element, colorBuffer.datatype, decimation*sizeof(unsigned char)*3, 0);
 		glEnableClientState(GL_COLOR_ARRAY);
 
 		vertexBuffer.Bind();
-		glVertexPointer(vertexBuffer.count_per_element, vertexBuffer.datatype, 0, 0);
+		glVertexPointer(vertexBuffer.count_per_element, vertexBuffer.datatype, decimation*sizeof(float)*3, 0);
 		glEnableClientState(GL_VERTEX_ARRAY);
-		glDrawArrays(GL_POINTS, 0, numGLBufferGoodPoints);
+		glDrawArrays(GL_POINTS, 0, (numGLBufferGoodPoints+decimation-1)/decimation);
 		glDisableClientState(GL_VERTEX_ARRAY);
 		vertexBuffer.Unbind();
 
@@ -31,6 +31,8 @@
 
 #include <sstream>
 #include <fstream>
+#include <memory>
+#include <vector>
 
 namespace dso
 {
@@ -54,6 +56,18 @@ struct InputPointSparse
 	unsigned char status;
 };
 
+// immutable copy of one keyframe: made on the mapping thread, handed to the render thread as a whole.
+struct KeyFrameSnapshot
+{
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+	int id;
+	bool final;				// marginalized: this is the last snapshot of the keyframe.
+	SE3 camToWorld;
+	float fx,fy,cx,cy;
+	int width, height;
+	std::vector<InputPointSparse<MAX_RES_PER_POINT>> points;
+};
+
 struct MyVertex
 {
 	float point[3];
@@ -69,9 +83,12 @@ public:
 	KeyFrameDisplay();
 	~KeyFrameDisplay();
 
-	// copies points from KF over to internal buffer,
-	// keeping some additional information so we can render it differently.
-	void setFromKF(FrameHessian* fh, CalibHessian* HCalib);
+	// copies points from KF over to a new snapshot,
+	// keeping some additional information so we can render it differently. mapping thread.
+	static std::shared_ptr<const KeyFrameSnapshot> snapshotKF(FrameHessian* fh, bool final, CalibHessian* HCalib);
+
+	// takes over the snapshot (not copied). render thread.
+	void setFromSnapshot(const std::shared_ptr<const KeyFrameSnapshot> &snapshot);
 
 	// copies points from KF over to internal buffer,
 	// keeping some additional information so we can render it differently.
@@ -82,12 +99,25 @@ public:
 
 	// renders cam & pointcloud.
 	void drawCam(float lineWidth = 1, float* color = 0, float sizeFactor=1);
-	void drawPC(float pointSize);
+	// decimation: only every decimation'th point is drawn (level of detail).
+	void drawPC(float pointSize, int decimation=1);
+
+	// bytes held for the pointcloud (input copy + GL buffers).
+	size_t getMemoryBytes() const;
+
+	// drops the pointcloud & frees its GL buffers, only the camera is kept. render thread only.
+	void releasePoints();
 
 	int id;
 	bool active;
 	SE3 camToWorld;
 
+	// bounding sphere of camera & pointcloud, world frame. set in setFromSnapshot.
+	Vec3f worldCenter;
+	float worldRadius;
+	uint64_t gridKey;	// cell in PangolinDSOViewer's keyframe grid, if inGrid.
+	bool inGrid;
+
     inline bool operator < (const KeyFrameDisplay& other) const
     {
         return (id < other.id);
@@ -106,9 +136,7 @@ private:
 	bool needRefresh;
 
 
-	int numSparsePoints;
-	int numSparseBufferSize;
-    InputPointSparse<MAX_RES_PER_POINT>* originalInputSparse;
+	std::shared_ptr<const KeyFrameSnapshot> snapshot;	// 0 for the current camera and after releasePoints().
 
 
 	bool bufferValid;
@@ -31,12 +31,20 @@
 #include "FullSystem/HessianBlocks.h"
 #include "FullSystem/FullSystem.h"
 #include "FullSystem/ImmaturePoint.h"
+#include <algorithm>
 
 namespace dso
 {
 namespace IOWrap
 {
 
+static inline bool sphereInFrustum(const Eigen::Matrix<double,6,4> &planes, const Vec3f &c, float r)
+{
+	for(int i=0;i<6;i++)
+		if(planes(i,0)*c[0] + planes(i,1)*c[1] + planes(i,2)*c[2] + planes(i,3) < -r) return false;
+	return true;
+}
+
 
 
 PangolinDSOViewer::PangolinDSOViewer(int w, int h, bool startRunThread)
@@ -61,6 +69,9 @@ PangolinDSOViewer::PangolinDSOViewer(int w, int h, bool startRunThread)
 
 	{
 		currentCam = new KeyFrameDisplay();
+		pendingConnectivityValid = false;
+		gridCellSize = setting_render_gridCellSize;
+		lodScale = 0;
 	}
 
 	needReset = false;
@@ -162,6 +173,12 @@ void PangolinDSOViewer::run()
 	pangolin::Var<double> settings_trackFps("ui.Track fps",0,0,0,false);
 	pangolin::Var<double> settings_mapFps("ui.KF fps",0,0,0,false);
 
+	pangolin::Var<double> settings_frameBudget("ui.3D budget ms",setting_render_frameBudgetMs,0,100,false);
+	pangolin::Var<double> settings_render3DMs("ui.3D ms",0,0,0,false);
+	pangolin::Var<int> settings_drawnKFs("ui.drawn KFs",0,0,0,false);
+	pangolin::Var<double> settings_lod("ui.LOD",0,0,0,false);
+	float render3DMs = 0;
+
 
 	// Default hooks for exiting (Esc) and fullscreen (tab).
 	while( !pangolin::ShouldQuit() && running )
@@ -171,24 +188,37 @@ void PangolinDSOViewer::run()
 
 		if(setting_render_display3D)
 		{
+			struct timeval t3dStart, t3dEnd;
+			gettimeofday(&t3dStart, NULL);
+
+			applyPendingUpdates();
+
 			// Activate efficiently by object
 			Visualization3D_display.Activate(Visualization3D_camera);
-			boost::unique_lock<boost::mutex> lk3d(model3DMutex);
 			//pangolin::glDrawColouredCube();
-			int refreshed=0;
-			for(KeyFrameDisplay* fh : keyframes)
+			settings_drawnKFs = drawKeyframes(Visualization3D_camera);
+			if(this->settings_showCurrentCamera)
 			{
-				float blue[3] = {0,0,1};
-				if(this->settings_showKFCameras) fh->drawCam(1,blue,0.1);
-
-
-				refreshed =+ (int)(fh->refreshPC(refreshed < 10, this->settings_scaledVarTH, this->settings_absVarTH,
-						this->settings_pointCloudMode, this->settings_minRelBS, this->settings_sparsity));
-				fh->drawPC(1);
+				boost::unique_lock<boost::mutex> lk3d(model3DMutex);
+				currentCam->drawCam(2,0,0.2);
 			}
-			if(this->settings_showCurrentCamera) currentCam->drawCam(2,0,0.2);
 			drawConstraints();
-			lk3d.unlock();
+
+			// adapt the level of detail: coarser right away when over budget, finer slowly when well below.
+			gettimeofday(&t3dEnd, NULL);
+			float ms = (t3dEnd.tv_sec-t3dStart.tv_sec)*1000.0f + (t3dEnd.tv_usec-t3dStart.tv_usec)/1000.0f;
+			render3DMs = 0.8f*render3DMs + 0.2f*ms;
+			if(setting_render_frameBudgetMs <= 0)
+				lodScale = 0;
+			else if(render3DMs > setting_render_frameBudgetMs)
+				lodScale = std::min(100.0f, std::max(0.25f, lodScale*1.25f));
+			else if(render3DMs < 0.5f*setting_render_frameBudgetMs)
+			{
+				lodScale *= 0.9f;
+				if(lodScale < 0.1f) lodScale = 0;
+			}
+			settings_render3DMs = render3DMs;
+			settings_lod = lodScale;
 		}
 
 
@@ -266,6 +296,7 @@ void PangolinDSOViewer::run()
 	    this->settings_scaledVarTH = settings_scaledVarTH.Get();
 	    this->settings_minRelBS = settings_minRelBS.Get();
 	    this->settings_sparsity = settings_sparsity.Get();
+	    setting_render_frameBudgetMs = settings_frameBudget.Get();
 
 	    setting_desiredPointDensity = settings_nPts.Get();
 	    setting_desiredImmatureDensity = settings_nCandidates.Get();
@@ -315,12 +346,20 @@ void PangolinDSOViewer::reset()
 void PangolinDSOViewer::reset_internal()
 {
 	model3DMutex.lock();
+	pendingSnapshots.clear();
+	pendingConnectivity.clear();
+	pendingConnectivityValid = false;
+	pendingFramePoses.clear();
+	model3DMutex.unlock();
+
 	for(size_t i=0; i<keyframes.size();i++) delete keyframes[i];
 	keyframes.clear();
 	allFramePoses.clear();
 	keyframesByKFID.clear();
+	finalKeyframes.clear();
 	connections.clear();
-	model3DMutex.unlock();
+	keyframeGrid.clear();
+	lodScale = 0;
 
 
 	openImagesMutex.lock();
@@ -336,6 +375,9 @@ void PangolinDSOViewer::reset_internal()
 
 void PangolinDSOViewer::drawConstraints()
 {
+	// trajectories are thinned out along with the point clouds.
+	unsigned int trajectoryStep = 1 + (unsigned int)lodScale;
+
 	if(settings_showAllConstraints)
 	{
 		// draw constraints
@@ -388,12 +430,17 @@ void PangolinDSOViewer::drawConstraints()
 		glLineWidth(3);
 
 		glBegin(GL_LINE_STRIP);
-		for(unsigned int i=0;i<keyframes.size();i++)
+		unsigned int n = keyframes.size();
+		for(unsigned int i=0;i<n;i+=trajectoryStep)
 		{
 			glVertex3f((float)keyframes[i]->camToWorld.translation()[0],
 					(float)keyframes[i]->camToWorld.translation()[1],
 					(float)keyframes[i]->camToWorld.translation()[2]);
 		}
+		if(n > 0 && (n-1)%trajectoryStep != 0)
+			glVertex3f((float)keyframes[n-1]->camToWorld.translation()[0],
+					(float)keyframes[n-1]->camToWorld.translation()[1],
+					(float)keyframes[n-1]->camToWorld.translation()[2]);
 		glEnd();
 	}
 
@@ -404,12 +451,15 @@ void PangolinDSOViewer::drawConstraints()
 		glLineWidth(3);
 
 		glBegin(GL_LINE_STRIP);
-		for(unsigned int i=0;i<allFramePoses.size();i++)
+		unsigned int n = allFramePoses.size();
+		for(unsigned int i=0;i<n;i+=trajectoryStep)
 		{
 			glVertex3f((float)allFramePoses[i][0],
 					(float)allFramePoses[i][1],
 					(float)allFramePoses[i][2]);
 		}
+		if(n > 0 && (n-1)%trajectoryStep != 0)
+			glVertex3f(allFramePoses[n-1][0], allFramePoses[n-1][1], allFramePoses[n-1][2]);
 		glEnd();
 	}
 }
@@ -419,13 +469,66 @@ void PangolinDSOViewer::drawConstraints()
 
 
 
-void PangolinDSOViewer::publishGraph(const std::map<uint64_t,Eigen::Vector2i> &connectivity)
+void PangolinDSOViewer::applyPendingUpdates()
 {
-    if(!setting_render_display3D) return;
-    if(disableAllDisplay) return;
+	// take the pending buffers, leaving empty ones behind. this is the only time the render thread locks for the model.
+	std::map<int, std::shared_ptr<const KeyFrameSnapshot>> snapshots;
+	std::map<uint64_t,Eigen::Vector2i> connectivity;
+	std::vector<Vec3f,Eigen::aligned_allocator<Vec3f>> framePoses;
+	bool haveConnectivity;
+	{
+		boost::unique_lock<boost::mutex> lk(model3DMutex);
+		snapshots.swap(pendingSnapshots);
+		connectivity.swap(pendingConnectivity);
+		framePoses.swap(pendingFramePoses);
+		haveConnectivity = pendingConnectivityValid;
+		pendingConnectivityValid = false;
+	}
 
-	model3DMutex.lock();
-    connections.resize(connectivity.size());
+	allFramePoses.insert(allFramePoses.end(), framePoses.begin(), framePoses.end());
+
+
+	// only keyframes that changed since the last frame are touched.
+	bool gotFinal = false;
+	for(std::pair<const int, std::shared_ptr<const KeyFrameSnapshot>> &p : snapshots)
+	{
+		if(keyframesByKFID.find(p.first) == keyframesByKFID.end())
+		{
+			KeyFrameDisplay* kfd = new KeyFrameDisplay();
+			keyframesByKFID[p.first] = kfd;
+			keyframes.push_back(kfd);
+		}
+		KeyFrameDisplay* kfd = keyframesByKFID[p.first];
+		kfd->setFromSnapshot(p.second);
+		gridRemove(kfd);
+		gridInsert(kfd);
+		if(p.second->final)
+		{
+			finalKeyframes.push_back(kfd);
+			gotFinal = true;
+		}
+	}
+
+	// over budget: drop the pointclouds of the oldest marginalized keyframes.
+	if(gotFinal && setting_viewerMemoryBudgetMB > 0)
+	{
+		size_t budget = (size_t)setting_viewerMemoryBudgetMB * 1024 * 1024;
+		size_t total = 0;
+		for(KeyFrameDisplay* kfd : keyframes) total += kfd->getMemoryBytes();
+
+		while(total > budget && !finalKeyframes.empty())
+		{
+			KeyFrameDisplay* kfd = finalKeyframes.front();
+			finalKeyframes.pop_front();
+			total -= kfd->getMemoryBytes();
+			kfd->releasePoints();
+		}
+	}
+
+
+	if(!haveConnectivity) return;
+
+	connections.resize(connectivity.size());
 	int runningID=0;
 	int totalActFwd=0, totalActBwd=0, totalMargFwd=0, totalMargBwd=0;
     for(std::pair<uint64_t,Eigen::Vector2i> p : connectivity)
@@ -459,9 +562,113 @@ void PangolinDSOViewer::publishGraph(const std::map<uint64_t,Eigen::Vector2i> &c
 
 		runningID++;
 	}
+	connections.resize(runningID);
+}
 
 
-	model3DMutex.unlock();
+
+void PangolinDSOViewer::gridInsert(KeyFrameDisplay* kfd)
+{
+	if(!std::isfinite(kfd->worldCenter.sum())) return;
+
+	int ix = (int)floorf(kfd->worldCenter[0] / gridCellSize);
+	int iy = (int)floorf(kfd->worldCenter[1] / gridCellSize);
+	int iz = (int)floorf(kfd->worldCenter[2] / gridCellSize);
+	uint64_t key = (((uint64_t)(ix & 0x1FFFFF)) << 42) | (((uint64_t)(iy & 0x1FFFFF)) << 21) | ((uint64_t)(iz & 0x1FFFFF));
+
+	GridCell &cell = keyframeGrid[key];
+	if(cell.keyframes.empty())
+	{
+		cell.center = Vec3f(ix+0.5f, iy+0.5f, iz+0.5f) * gridCellSize;
+		cell.maxRadius = 0;
+	}
+	cell.keyframes.push_back(kfd);
+	cell.maxRadius = std::max(cell.maxRadius, kfd->worldRadius);
+
+	kfd->gridKey = key;
+	kfd->inGrid = true;
+}
+
+void PangolinDSOViewer::gridRemove(KeyFrameDisplay* kfd)
+{
+	if(!kfd->inGrid) return;
+
+	std::unordered_map<uint64_t, GridCell>::iterator it = keyframeGrid.find(kfd->gridKey);
+	assert(it != keyframeGrid.end());
+	std::vector<KeyFrameDisplay*> &v = it->second.keyframes;
+	v.erase(std::find(v.begin(), v.end(), kfd));
+	if(v.empty()) keyframeGrid.erase(it);
+
+	kfd->inGrid = false;
+}
+
+int PangolinDSOViewer::drawKeyframes(pangolin::OpenGlRenderState &cam)
+{
+	if(gridCellSize != setting_render_gridCellSize)
+	{
+		gridCellSize = setting_render_gridCellSize;
+		keyframeGrid.clear();
+		for(KeyFrameDisplay* kfd : keyframes)
+		{
+			kfd->inGrid = false;
+			gridInsert(kfd);
+		}
+	}
+
+	// frustum planes from projection*modelview (Gribb & Hartmann), normalized; inside is n*x+d >= 0.
+	Eigen::Matrix4d PMV = Eigen::Map<Eigen::Matrix<pangolin::GLprecision,4,4>>(cam.GetProjectionModelViewMatrix().m).cast<double>();
+	Eigen::Matrix<double,6,4> planes;
+	for(int i=0;i<3;i++)
+	{
+		planes.row(2*i) = PMV.row(3) + PMV.row(i);
+		planes.row(2*i+1) = PMV.row(3) - PMV.row(i);
+	}
+	for(int i=0;i<6;i++)
+		planes.row(i) /= planes.row(i).head<3>().norm();
+
+	Eigen::Matrix4d MV = Eigen::Map<Eigen::Matrix<pangolin::GLprecision,4,4>>(cam.GetModelViewMatrix().m).cast<double>();
+	Vec3f viewPos = (-MV.topLeftCorner<3,3>().transpose() * MV.topRightCorner<3,1>()).cast<float>();
+
+	float lodPerDistance = setting_render_lodDistance > 0 ? lodScale / setting_render_lodDistance : 0;
+
+	int refreshed=0;
+	int drawn=0;
+	float cellRadius = 0.8660254f*gridCellSize;	// half the cell diagonal.
+	for(std::pair<const uint64_t, GridCell> &cell : keyframeGrid)
+	{
+		if(!sphereInFrustum(planes, cell.second.center, cellRadius + cell.second.maxRadius)) continue;
+
+		for(KeyFrameDisplay* fh : cell.second.keyframes)
+		{
+			if(!sphereInFrustum(planes, fh->worldCenter, fh->worldRadius)) continue;
+
+			float blue[3] = {0,0,1};
+			if(this->settings_showKFCameras) fh->drawCam(1,blue,0.1);
+
+
+			refreshed += (int)(fh->refreshPC(refreshed < 10, this->settings_scaledVarTH, this->settings_absVarTH,
+					this->settings_pointCloudMode, this->settings_minRelBS, this->settings_sparsity));
+
+			float dist = std::max(0.0f, (fh->worldCenter - viewPos).norm() - fh->worldRadius);
+			fh->drawPC(1, 1 + (int)std::min(1000.0f, lodPerDistance * dist));
+			drawn++;
+		}
+	}
+	return drawn;
+}
+
+
+
+void PangolinDSOViewer::publishGraph(const ConnectivityMap &connectivity)
+{
+    if(!setting_render_display3D) return;
+    if(disableAllDisplay) return;
+
+	// copy outside the lock; the old pending map (if not picked up yet) is freed after unlocking.
+	std::map<uint64_t,Eigen::Vector2i> copy(connectivity.begin(), connectivity.end());
+	boost::unique_lock<boost::mutex> lk(model3DMutex);
+	pendingConnectivity.swap(copy);
+	pendingConnectivityValid = true;
 }
 void PangolinDSOViewer::publishKeyframes(
 		std::vector<FrameHessian*> &frames,
@@ -471,17 +678,15 @@ void PangolinDSOViewer::publishKeyframes(
 	if(!setting_render_display3D) return;
     if(disableAllDisplay) return;
 
-	boost::unique_lock<boost::mutex> lk(model3DMutex);
+	// the snapshots are made without the lock. only handing them over is locked, never any rendering.
+	std::vector<std::shared_ptr<const KeyFrameSnapshot>> snapshots;
+	snapshots.reserve(frames.size());
 	for(FrameHessian* fh : frames)
-	{
-		if(keyframesByKFID.find(fh->frameID) == keyframesByKFID.end())
-		{
-			KeyFrameDisplay* kfd = new KeyFrameDisplay();
-			keyframesByKFID[fh->frameID] = kfd;
-			keyframes.push_back(kfd);
-		}
-		keyframesByKFID[fh->frameID]->setFromKF(fh, HCalib);
-	}
+		snapshots.push_back(KeyFrameDisplay::snapshotKF(fh, final, HCalib));
+
+	boost::unique_lock<boost::mutex> lk(model3DMutex);
+	for(std::shared_ptr<const KeyFrameSnapshot> &snap : snapshots)
+		pendingSnapshots[snap->id] = snap;
 }
 void PangolinDSOViewer::publishCamPose(FrameShell* frame,
 		CalibHessian* HCalib)
@@ -499,7 +704,7 @@ void PangolinDSOViewer::publishCamPose(FrameShell* frame,
 	if(!setting_render_display3D) return;
 
 	currentCam->setFromF(frame, HCalib);
-	allFramePoses.push_back(frame->camToWorld.translation().cast<float>());
+	pendingFramePoses.push_back(frame->camToWorld.translation().cast<float>());
 }
 
 
@@ -29,6 +29,8 @@
 #include "IOWrapper/Output3DWrapper.h"
 #include <map>
 #include <deque>
+#include <memory>
+#include <unordered_map>
 
 
 namespace dso
@@ -43,6 +45,7 @@ namespace IOWrap
 {
 
 class KeyFrameDisplay;
+struct KeyFrameSnapshot;
 
 struct GraphConnection
 {
@@ -67,7 +70,7 @@ public:
 
 
 	// ==================== Output3DWrapper Functionality ======================
-    virtual void publishGraph(const std::map<uint64_t,Eigen::Vector2i> &connectivity);
+    virtual void publishGraph(const ConnectivityMap &connectivity) override;
     virtual void publishKeyframes( std::vector<FrameHessian*> &frames, bool final, CalibHessian* HCalib);
     virtual void publishCamPose(FrameShell* frame, CalibHessian* HCalib);
 
@@ -84,6 +87,10 @@ private:
 	bool needReset;
 	void reset_internal();
 	void drawConstraints();
+	void applyPendingUpdates();
+	void gridInsert(KeyFrameDisplay* kfd);
+	void gridRemove(KeyFrameDisplay* kfd);
+	int drawKeyframes(pangolin::OpenGlRenderState &cam);
 
 	boost::thread runThread;
 	bool running;
@@ -100,14 +107,36 @@ private:
 
 
 
-	// 3D model rendering
+	// 3D model rendering. the publishing threads only fill the pending* buffers (under [model3DMutex]);
+	// the render thread swaps them out once per frame and owns everything else, so it never holds the lock while drawing.
 	boost::mutex model3DMutex;
 	KeyFrameDisplay* currentCam;
+	std::map<int, std::shared_ptr<const KeyFrameSnapshot>> pendingSnapshots;	// newest snapshot per keyframe id.
+	std::map<uint64_t,Eigen::Vector2i> pendingConnectivity;
+	bool pendingConnectivityValid;
+	std::vector<Vec3f,Eigen::aligned_allocator<Vec3f>> pendingFramePoses;
+
+	// render thread only.
 	std::vector<KeyFrameDisplay*> keyframes;
 	std::vector<Vec3f,Eigen::aligned_allocator<Vec3f>> allFramePoses;
 	std::map<int, KeyFrameDisplay*> keyframesByKFID;
+	std::deque<KeyFrameDisplay*> finalKeyframes;	// marginalized, pointcloud not yet dropped for setting_viewerMemoryBudgetMB.
 	std::vector<GraphConnection,Eigen::aligned_allocator<GraphConnection>> connections;
 
+	// uniform grid over the keyframe bounding spheres, for frustum culling.
+	struct GridCell
+	{
+		std::vector<KeyFrameDisplay*> keyframes;
+		Vec3f center;
+		float maxRadius;		// largest bounding sphere in the cell. only grows until the cell is empty.
+	};
+	std::unordered_map<uint64_t, GridCell> keyframeGrid;
+	float gridCellSize;			// setting_render_gridCellSize when the grid was built.
+
+	// level of detail: a keyframe at distance d is drawn with every (1 + lodScale*d/setting_render_lodDistance)'th point.
+	// adapted each frame to keep the 3D pass within setting_render_frameBudgetMs.
+	float lodScale;
+
 
 
 	// render settings
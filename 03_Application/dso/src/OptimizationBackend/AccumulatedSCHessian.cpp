@@ -33,8 +33,7 @@ namespace dso
 
 void AccumulatedSCHessianSSE::addPoint(EFPoint* p, bool shiftPriorToZero, int tid)
 {
-	int ngoodres = 0;
-	for(EFResidual* r : p->residualsAll) if(r->isActive()) ngoodres++;
+	int ngoodres = p->numActive();
 	if(ngoodres==0)
 	{
 		p->HdiF=0;
@@ -59,14 +58,16 @@ void AccumulatedSCHessianSSE::addPoint(EFPoint* p, bool shiftPriorToZero, int ti
 	assert(std::isfinite((float)(p->HdiF)));
 
 	int nFrames2 = nframes[tid]*nframes[tid];
-	for(EFResidual* r1 : p->residualsAll)
+	// the active residuals are the first [ngoodres] (EnergyFunctional::partitionResidualsF).
+	EFResidual* const* active = p->residualsAll.data();
+	for(int i=0;i<ngoodres;i++)
 	{
-		if(!r1->isActive()) continue;
+		EFResidual* r1 = active[i];
 		int r1ht = r1->hostIDX + r1->targetIDX*nframes[tid];
 
-		for(EFResidual* r2 : p->residualsAll)
+		for(int j=0;j<ngoodres;j++)
 		{
-			if(!r2->isActive()) continue;
+			EFResidual* r2 = active[j];
 
 			accD[tid][r1ht+r2->targetIDX*nFrames2].update(r1->JpJdF, r2->JpJdF, p->HdiF);
 		}
@@ -79,7 +80,7 @@ void AccumulatedSCHessianSSE::stitchDoubleInternal(
 		MatXX* H, VecX* b, EnergyFunctional const * const EF,
 		int min, int max, Vec10* stats, int tid)
 {
-	int toAggregate = NUM_THREADS;
+	int toAggregate = nThreadsUsed;
 	if(tid == -1) { toAggregate = 1; tid = 0; }	// special case: if we dont do multithreading, dont aggregate.
 	if(min==max) return;
 
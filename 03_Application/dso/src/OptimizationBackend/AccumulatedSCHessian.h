@@ -42,19 +42,21 @@ class AccumulatedSCHessianSSE
 {
 public:
 	EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
-	inline AccumulatedSCHessianSSE()
+	// numThreads: size of the reduce pool, tid is always below that.
+	inline AccumulatedSCHessianSSE(int numThreads)
 	{
-		for(int i=0;i<NUM_THREADS;i++)
-		{
-			accE[i]=0;
-			accEB[i]=0;
-			accD[i]=0;
-			nframes[i]=0;
-		}
+		if(numThreads < 1) numThreads = 1;
+		accE.assign(numThreads, 0);
+		accEB.assign(numThreads, 0);
+		accD.assign(numThreads, 0);
+		accHcc.resize(numThreads);
+		accbc.resize(numThreads);
+		nframes.assign(numThreads, 0);
+		nThreadsUsed=1;
 	};
 	inline ~AccumulatedSCHessianSSE()
 	{
-		for(int i=0;i<NUM_THREADS;i++)
+		for(unsigned int i=0;i<accE.size();i++)
 		{
 			if(accE[i] != 0) delete[] accE[i];
 			if(accEB[i] != 0) delete[] accEB[i];
@@ -95,9 +97,11 @@ public:
 		// sum up, splitting by bock in square.
 		if(MT)
 		{
-			MatXX Hs[NUM_THREADS];
-			VecX bs[NUM_THREADS];
-			for(int i=0;i<NUM_THREADS;i++)
+			nThreadsUsed = red->getNumThreads();
+			assert(nThreadsUsed <= (int)accE.size());
+			std::vector<MatXX> Hs(nThreadsUsed);
+			std::vector<VecX> bs(nThreadsUsed);
+			for(int i=0;i<nThreadsUsed;i++)
 			{
 				assert(nframes[0] == nframes[i]);
 				Hs[i] = MatXX::Zero(nframes[0]*8+CPARS, nframes[0]*8+CPARS);
@@ -105,13 +109,13 @@ public:
 			}
 
 			red->reduce(boost::bind(&AccumulatedSCHessianSSE::stitchDoubleInternal,
-				this,Hs, bs, EF,  _1, _2, _3, _4), 0, nframes[0]*nframes[0], 0);
+				this,Hs.data(), bs.data(), EF,  _1, _2, _3, _4), 0, nframes[0]*nframes[0], 0);
 
 			// sum up results
 			H = Hs[0];
 			b = bs[0];
 
-			for(int i=1;i<NUM_THREADS;i++)
+			for(int i=1;i<nThreadsUsed;i++)
 			{
 				H.noalias() += Hs[i];
 				b.noalias() += bs[i];
@@ -133,12 +137,13 @@ public:
 	}
 
 
-	AccumulatorXX<8,CPARS>* accE[NUM_THREADS];
-	AccumulatorX<8>* accEB[NUM_THREADS];
-	AccumulatorXX<8,8>* accD[NUM_THREADS];
-	AccumulatorXX<CPARS,CPARS> accHcc[NUM_THREADS];
-	AccumulatorX<CPARS> accbc[NUM_THREADS];
-	int nframes[NUM_THREADS];
+	std::vector<AccumulatorXX<8,CPARS>*> accE;
+	std::vector<AccumulatorX<8>*> accEB;
+	std::vector<AccumulatorXX<8,8>*> accD;
+	std::vector<AccumulatorXX<CPARS,CPARS>, Eigen::aligned_allocator<AccumulatorXX<CPARS,CPARS>>> accHcc;
+	std::vector<AccumulatorX<CPARS>, Eigen::aligned_allocator<AccumulatorX<CPARS>>> accbc;
+	std::vector<int> nframes;
+	int nThreadsUsed;	// number of per-thread accumulators filled by the last MT pass.
 
 
 	void addPointsInternal(
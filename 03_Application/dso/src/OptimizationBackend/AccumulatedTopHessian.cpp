@@ -50,26 +50,26 @@ void AccumulatedTopHessianSSE::addPoint(EFPoint* p, EnergyFunctional const * con
 	float Hdd_acc=0;
 	VecCf  Hcd_acc = VecCf::Zero();
 
-	for(EFResidual* r : p->residualsAll)
+	// residualsAll is partitioned by state (EnergyFunctional::partitionResidualsF), so only the span of this mode is visited.
+	// mode 2 takes all active ones, which are all linearized for a point to be marginalized.
+	EFResidual* const* span = p->residualsAll.data() + (mode==1 ? p->numActiveUnlin : 0);
+	int spanSize = mode==0 ? p->numActiveUnlin : (mode==1 ? p->numActiveLin : p->numActive());
+
+	for(int k=0;k<spanSize;k++)
 	{
-		if(mode==0)
-		{
-			if(r->isLinearized || !r->isActive()) continue;
-		}
-		if(mode==1)
+		EFResidual* r = span[k];
+		assert(r->isActive() && r->isLinearized == (mode!=0));
+		if(k+1<spanSize)
 		{
-			if(!r->isLinearized || !r->isActive()) continue;
+			_mm_prefetch((const char*)span[k+1]->J, _MM_HINT_T0);
+			_mm_prefetch((const char*)span[k+1]->J + 64, _MM_HINT_T0);
 		}
-		if(mode==2)
-		{
-			if(!r->isActive()) continue;
-			assert(r->isLinearized);
-		}
-
 
 		RawResidualJacobian* rJ = r->J;
 		int htIDX = r->hostIDX + r->targetIDX*nframes[tid];
 		Mat18f dp = ef->adHTdeltaF[htIDX];
+		assert(pairSlot[htIDX] >= 0);
+		AccumulatorApprox &a = acc[tid][pairSlot[htIDX]];
 
 
 
@@ -112,16 +112,16 @@ void AccumulatedTopHessianSSE::addPoint(EFPoint* p, EnergyFunctional const * con
 		}
 
 
-		acc[tid][htIDX].update(
+		a.update(
 				rJ->Jpdc[0].data(), rJ->Jpdxi[0].data(),
 				rJ->Jpdc[1].data(), rJ->Jpdxi[1].data(),
 				rJ->JIdx2(0,0),rJ->JIdx2(0,1),rJ->JIdx2(1,1));
 
-		acc[tid][htIDX].updateBotRight(
+		a.updateBotRight(
 				rJ->Jab2(0,0), rJ->Jab2(0,1), Jab_r[0],
 				rJ->Jab2(1,1), Jab_r[1],rr);
 
-		acc[tid][htIDX].updateTopRight(
+		a.updateTopRight(
 				rJ->Jpdc[0].data(), rJ->Jpdxi[0].data(),
 				rJ->Jpdc[1].data(), rJ->Jpdxi[1].data(),
 				rJ->JabJIdx(0,0), rJ->JabJIdx(0,1),
@@ -174,39 +174,38 @@ void AccumulatedTopHessianSSE::stitchDouble(MatXX &H, VecX &b, EnergyFunctional
 	b = VecX::Zero(nframes[tid]*8+CPARS);
 
 
-	for(int h=0;h<nframes[tid];h++)
-		for(int t=0;t<nframes[tid];t++)
-		{
-			int hIdx = CPARS+h*8;
-			int tIdx = CPARS+t*8;
-			int aidx = h+nframes[tid]*t;
-
-
+	for(int k=0;k<(int)pairs.size();k++)
+	{
+		int aidx = pairs[k];
+		int h = aidx%nframes[tid];
+		int t = aidx/nframes[tid];
+		int hIdx = CPARS+h*8;
+		int tIdx = CPARS+t*8;
 
-			acc[tid][aidx].finish();
-			if(acc[tid][aidx].num==0) continue;
+		acc[tid][k].finish();
+		if(acc[tid][k].num==0) continue;
 
-			MatPCPC accH = acc[tid][aidx].H.cast<double>();
+		MatPCPC accH = acc[tid][k].H.cast<double>();
 
 
-			H.block<8,8>(hIdx, hIdx).noalias() += EF->adHost[aidx] * accH.block<8,8>(CPARS,CPARS) * EF->adHost[aidx].transpose();
+		H.block<8,8>(hIdx, hIdx).noalias() += EF->adHost[aidx] * accH.block<8,8>(CPARS,CPARS) * EF->adHost[aidx].transpose();
 
-			H.block<8,8>(tIdx, tIdx).noalias() += EF->adTarget[aidx] * accH.block<8,8>(CPARS,CPARS) * EF->adTarget[aidx].transpose();
+		H.block<8,8>(tIdx, tIdx).noalias() += EF->adTarget[aidx] * accH.block<8,8>(CPARS,CPARS) * EF->adTarget[aidx].transpose();
 
-			H.block<8,8>(hIdx, tIdx).noalias() += EF->adHost[aidx] * accH.block<8,8>(CPARS,CPARS) * EF->adTarget[aidx].transpose();
+		H.block<8,8>(hIdx, tIdx).noalias() += EF->adHost[aidx] * accH.block<8,8>(CPARS,CPARS) * EF->adTarget[aidx].transpose();
 
-			H.block<8,CPARS>(hIdx,0).noalias() += EF->adHost[aidx] * accH.block<8,CPARS>(CPARS,0);
+		H.block<8,CPARS>(hIdx,0).noalias() += EF->adHost[aidx] * accH.block<8,CPARS>(CPARS,0);
 
-			H.block<8,CPARS>(tIdx,0).noalias() += EF->adTarget[aidx] * accH.block<8,CPARS>(CPARS,0);
+		H.block<8,CPARS>(tIdx,0).noalias() += EF->adTarget[aidx] * accH.block<8,CPARS>(CPARS,0);
 
-			H.topLeftCorner<CPARS,CPARS>().noalias() += accH.block<CPARS,CPARS>(0,0);
+		H.topLeftCorner<CPARS,CPARS>().noalias() += accH.block<CPARS,CPARS>(0,0);
 
-			b.segment<8>(hIdx).noalias() += EF->adHost[aidx] * accH.block<8,1>(CPARS,8+CPARS);
+		b.segment<8>(hIdx).noalias() += EF->adHost[aidx] * accH.block<8,1>(CPARS,8+CPARS);
 
-			b.segment<8>(tIdx).noalias() += EF->adTarget[aidx] * accH.block<8,1>(CPARS,8+CPARS);
+		b.segment<8>(tIdx).noalias() += EF->adTarget[aidx] * accH.block<8,1>(CPARS,8+CPARS);
 
-			b.head<CPARS>().noalias() += accH.block<CPARS,1>(0,8+CPARS);
-		}
+		b.head<CPARS>().noalias() += accH.block<CPARS,1>(0,8+CPARS);
+	}
 
 
 	// ----- new: copy transposed parts.
@@ -227,44 +226,65 @@ void AccumulatedTopHessianSSE::stitchDouble(MatXX &H, VecX &b, EnergyFunctional
 	if(usePrior)
 	{
 		assert(useDelta);
-		H.diagonal().head<CPARS>() += EF->cPrior;
-		b.head<CPARS>() += EF->cPrior.cwiseProduct(EF->cDeltaF.cast<double>());
-		for(int h=0;h<nframes[tid];h++)
+		addPrior(H, b, EF);
+	}
+}
+
+void AccumulatedTopHessianSSE::setPairs(EnergyFunctional const * const ef)
+{
+	int nf = ef->nFrames;
+	pairFrames = nf;
+	pairs.clear();
+	pairSlot.assign(nf*nf, -1);
+
+	for(int t=0;t<nf;t++)
+		for(int h=0;h<nf;h++)
 		{
-            H.diagonal().segment<8>(CPARS+h*8) += EF->frames[h]->prior;
-            b.segment<8>(CPARS+h*8) += EF->frames[h]->prior.cwiseProduct(EF->frames[h]->delta_prior);
+			auto it = ef->connectivityMap.find((((uint64_t)ef->frames[h]->frameID) << 32) + ((uint64_t)ef->frames[t]->frameID));
+			if(it == ef->connectivityMap.end() || it->second[0] == 0) continue;
+			pairSlot[h+nf*t] = pairs.size();
+			pairs.push_back(h+nf*t);
 		}
+}
+
+void AccumulatedTopHessianSSE::addPrior(MatXX &H, VecX &b, EnergyFunctional const * const EF)
+{
+	H.diagonal().head<CPARS>() += EF->cPrior;
+	b.head<CPARS>() += EF->cPrior.cwiseProduct(EF->cDeltaF.cast<double>());
+	for(int h=0;h<EF->nFrames;h++)
+	{
+        H.diagonal().segment<8>(CPARS+h*8) += EF->frames[h]->prior;
+        b.segment<8>(CPARS+h*8) += EF->frames[h]->prior.cwiseProduct(EF->frames[h]->delta_prior);
 	}
 }
 
 
 void AccumulatedTopHessianSSE::stitchDoubleInternal(
-		MatXX* H, VecX* b, EnergyFunctional const * const EF, bool usePrior,
+		MatXX* H, VecX* b, EnergyFunctional const * const EF,
 		int min, int max, Vec10* stats, int tid)
 {
-	int toAggregate = NUM_THREADS;
+	int toAggregate = nThreadsUsed;
 	if(tid == -1) { toAggregate = 1; tid = 0; }	// special case: if we dont do multithreading, dont aggregate.
 	if(min==max) return;
 
 
+	// only pairs with residuals have a slot.
 	for(int k=min;k<max;k++)
 	{
-		int h = k%nframes[0];
-		int t = k/nframes[0];
+		int aidx = pairs[k];
+		int h = aidx%nframes[0];
+		int t = aidx/nframes[0];
 
 		int hIdx = CPARS+h*8;
 		int tIdx = CPARS+t*8;
-		int aidx = h+nframes[0]*t;
-
-		assert(aidx == k);
 
 		MatPCPC accH = MatPCPC::Zero();
 
 		for(int tid2=0;tid2 < toAggregate;tid2++)
 		{
-			acc[tid2][aidx].finish();
-			if(acc[tid2][aidx].num==0) continue;
-			accH += acc[tid2][aidx].H.cast<double>();
+			acc[tid2][k].finish();
+			if(acc[tid2][k].num==0) continue;
+			accH += acc[tid2][k].H.cast<double>();
 		}
 
 		H[tid].block<8,8>(hIdx, hIdx).noalias() += EF->adHost[aidx] * accH.block<8,8>(CPARS,CPARS) * EF->adHost[aidx].transpose();
@@ -287,19 +307,6 @@ void AccumulatedTopHessianSSE::stitchDoubleInternal(
 
 	}
 
-
-	// only do this on one thread.
-	if(min==0 && usePrior)
-	{
-		H[tid].diagonal().head<CPARS>() += EF->cPrior;
-		b[tid].head<CPARS>() += EF->cPrior.cwiseProduct(EF->cDeltaF.cast<double>());
-		for(int h=0;h<nframes[tid];h++)
-		{
-            H[tid].diagonal().segment<8>(CPARS+h*8) += EF->frames[h]->prior;
-            b[tid].segment<8>(CPARS+h*8) += EF->frames[h]->prior.cwiseProduct(EF->frames[h]->delta_prior);
-
-		}
-	}
 }
 
 
@@ -44,38 +44,47 @@ class AccumulatedTopHessianSSE
 {
 public:
 	EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
-	inline AccumulatedTopHessianSSE()
+	// numThreads: size of the reduce pool, tid is always below that.
+	inline AccumulatedTopHessianSSE(int numThreads)
 	{
-		for(int tid=0;tid < NUM_THREADS; tid++)
-		{
-			nres[tid]=0;
-			acc[tid]=0;
-			nframes[tid]=0;
-		}
+		if(numThreads < 1) numThreads = 1;
+		nres.assign(numThreads, 0);
+		acc.assign(numThreads, 0);
+		accCapacity.assign(numThreads, 0);
+		nframes.assign(numThreads, 0);
+		nThreadsUsed=1;
+		pairFrames=0;
 
 	};
 	inline ~AccumulatedTopHessianSSE()
 	{
-		for(int tid=0;tid < NUM_THREADS; tid++)
+		for(unsigned int tid=0;tid < acc.size(); tid++)
 		{
 			if(acc[tid] != 0) delete[] acc[tid];
 		}
 	};
 
+	// builds the host-target pair table from ef->connectivityMap. has to be called (single-threaded) before setZero.
+	void setPairs(EnergyFunctional const * const ef);
+
 	inline void setZero(int nFrames, int min=0, int max=1, Vec10* stats=0, int tid=0)
 	{
+		assert(nFrames == pairFrames);
+		int numPairs = pairs.size();
 
-		if(nFrames != nframes[tid])
+		// per-thread storage only grows, so it is allocated a few times per run, not every time the window changes.
+		if(numPairs > accCapacity[tid])
 		{
 			if(acc[tid] != 0) delete[] acc[tid];
+			accCapacity[tid] = std::max(numPairs, 2*accCapacity[tid]);
 #if USE_XI_MODEL
-			acc[tid] = new Accumulator14[nFrames*nFrames];
+			acc[tid] = new Accumulator14[accCapacity[tid]];
 #else
-			acc[tid] = new AccumulatorApprox[nFrames*nFrames];
+			acc[tid] = new AccumulatorApprox[accCapacity[tid]];
 #endif
 		}
 
-		for(int i=0;i<nFrames*nFrames;i++)
+		for(int i=0;i<numPairs;i++)
 		{ acc[tid][i].initialize(); }
 
 		nframes[tid]=nFrames;
@@ -93,9 +102,11 @@ public:
 		// sum up, splitting by bock in square.
 		if(MT)
 		{
-			MatXX Hs[NUM_THREADS];
-			VecX bs[NUM_THREADS];
-			for(int i=0;i<NUM_THREADS;i++)
+			nThreadsUsed = red->getNumThreads();
+			assert(nThreadsUsed <= (int)acc.size());
+			std::vector<MatXX> Hs(nThreadsUsed);
+			std::vector<VecX> bs(nThreadsUsed);
+			for(int i=0;i<nThreadsUsed;i++)
 			{
 				assert(nframes[0] == nframes[i]);
 				Hs[i] = MatXX::Zero(nframes[0]*8+CPARS, nframes[0]*8+CPARS);
@@ -103,13 +114,13 @@ public:
 			}
 
 			red->reduce(boost::bind(&AccumulatedTopHessianSSE::stitchDoubleInternal,
-				this,Hs, bs, EF, usePrior,  _1, _2, _3, _4), 0, nframes[0]*nframes[0], 0);
+				this,Hs.data(), bs.data(), EF,  _1, _2, _3, _4), 0, pairs.size(), 0);
 
 			// sum up results
 			H = Hs[0];
 			b = bs[0];
 
-			for(int i=1;i<NUM_THREADS;i++)
+			for(int i=1;i<nThreadsUsed;i++)
 			{
 				H.noalias() += Hs[i];
 				b.noalias() += bs[i];
@@ -120,9 +131,11 @@ public:
 		{
 			H = MatXX::Zero(nframes[0]*8+CPARS, nframes[0]*8+CPARS);
 			b = VecX::Zero(nframes[0]*8+CPARS);
-			stitchDoubleInternal(&H, &b, EF, usePrior,0,nframes[0]*nframes[0],0,-1);
+			stitchDoubleInternal(&H, &b, EF,0,pairs.size(),0,-1);
 		}
 
+		if(usePrior) addPrior(H, b, EF);
+
 		// make diagonal by copying over parts.
 		for(int h=0;h<nframes[0];h++)
 		{
@@ -141,12 +154,19 @@ public:
 
 
 
-	int nframes[NUM_THREADS];
+	std::vector<int> nframes;
+
+	// one accumulator per host-target pair with residuals: acc[tid][slot] belongs to pair pairs[slot] (= h+nframes*t).
+	std::vector<AccumulatorApprox*> acc;
+	std::vector<int> accCapacity;
 
-	EIGEN_ALIGN16 AccumulatorApprox* acc[NUM_THREADS];
+	int pairFrames;					// nFrames the pair table was built for.
+	std::vector<int> pairs;			// slot -> h+nframes*t.
+	std::vector<int> pairSlot;		// h+nframes*t -> slot, -1 if there are no residuals from h into t.
 
 
-	int nres[NUM_THREADS];
+	std::vector<int> nres;
+	int nThreadsUsed;	// number of per-thread accumulators filled by the last MT pass.
 
 
 	template<int mode> void addPointsInternal(
@@ -161,8 +181,9 @@ public:
 private:
 
 	void stitchDoubleInternal(
-			MatXX* H, VecX* b, EnergyFunctional const * const EF, bool usePrior,
+			MatXX* H, VecX* b, EnergyFunctional const * const EF,
 			int min, int max, Vec10* stats, int tid);
+	void addPrior(MatXX &H, VecX &b, EnergyFunctional const * const EF);
 };
 }
 
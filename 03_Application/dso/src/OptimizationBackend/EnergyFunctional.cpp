@@ -29,6 +29,7 @@
 #include "FullSystem/Residuals.h"
 #include "OptimizationBackend/AccumulatedSCHessian.h"
 #include "OptimizationBackend/AccumulatedTopHessian.h"
+#include "OptimizationBackend/ResidualTable.h"
 
 #if !defined(__SSE3__) && !defined(__SSE2__) && !defined(__SSE1__)
 #include "SSE2NEON.h"
@@ -107,13 +108,13 @@ void EnergyFunctional::setAdjointsF(CalibHessian* Hcalib)
 
 
 
-EnergyFunctional::EnergyFunctional()
+EnergyFunctional::EnergyFunctional(IndexThreadReduce<Vec10>* red_)
 {
 	adHost=0;
 	adTarget=0;
 
 
-	red=0;
+	red=red_;
 
 	adHostF=0;
 	adTargetF=0;
@@ -125,12 +126,21 @@ EnergyFunctional::EnergyFunctional()
 	bM = VecX::Zero(CPARS);
 
 
-	accSSE_top_L = new AccumulatedTopHessianSSE();
-	accSSE_top_A = new AccumulatedTopHessianSSE();
-	accSSE_bot = new AccumulatedSCHessianSSE();
+	// per-thread accumulators: as many as the pool has workers.
+	int numThreads = red != 0 ? red->getNumThreads() : 1;
+	accSSE_top_L = new AccumulatedTopHessianSSE(numThreads);
+	accSSE_top_A = new AccumulatedTopHessianSSE(numThreads);
+	accSSE_bot = new AccumulatedSCHessianSSE(numThreads);
+	resTable = new ResidualTable();
 
 	resInA = resInL = resInM = 0;
 	currentLambda=0;
+
+	gpsAlignmentValid=false;
+	gpsScale=1;
+	gpsR = Mat33::Identity();
+	gpsT = Vec3::Zero();
+	nGpsPriors=0;
 }
 EnergyFunctional::~EnergyFunctional()
 {
@@ -163,6 +173,7 @@ EnergyFunctional::~EnergyFunctional()
 	delete accSSE_top_L;
 	delete accSSE_top_A;
 	delete accSSE_bot;
+	delete resTable;
 }
 
 
@@ -196,6 +207,7 @@ void EnergyFunctional::setDeltaF(CalibHessian* HCalib)
 // accumulates & shifts L.
 void EnergyFunctional::accumulateAF_MT(MatXX &H, VecX &b, bool MT)
 {
+	accSSE_top_A->setPairs(this);
 	if(MT)
 	{
 		red->reduce(boost::bind(&AccumulatedTopHessianSSE::setZero, accSSE_top_A, nFrames,  _1, _2, _3, _4), 0, 0, 0);
@@ -218,6 +230,7 @@ void EnergyFunctional::accumulateAF_MT(MatXX &H, VecX &b, bool MT)
 // accumulates & shifts L.
 void EnergyFunctional::accumulateLF_MT(MatXX &H, VecX &b, bool MT)
 {
+	accSSE_top_L->setPairs(this);
 	if(MT)
 	{
 		red->reduce(boost::bind(&AccumulatedTopHessianSSE::setZero, accSSE_top_L, nFrames,  _1, _2, _3, _4), 0, 0, 0);
@@ -260,6 +273,13 @@ void EnergyFunctional::accumulateSCF_MT(MatXX &H, VecX &b, bool MT)
 	}
 }
 
+void EnergyFunctional::partitionResidualsF()
+{
+	for(EFFrame* f : frames)
+		for(EFPoint* p : f->points)
+			p->partitionResiduals();
+}
+
 void EnergyFunctional::resubstituteF_MT(VecX x, CalibHessian* HCalib, bool MT)
 {
 	assert(x.size() == CPARS+nFrames*8);
@@ -295,8 +315,7 @@ void EnergyFunctional::resubstituteFPt(
 	{
 		EFPoint* p = allPoints[k];
 
-		int ngoodres = 0;
-		for(EFResidual* r : p->residualsAll) if(r->isActive()) ngoodres++;
+		int ngoodres = p->numActive();
 		if(ngoodres==0)
 		{
 			p->data->step = 0;
@@ -305,9 +324,9 @@ void EnergyFunctional::resubstituteFPt(
 		float b = p->bdSumF;
 		b -= xc.dot(p->Hcd_accAF + p->Hcd_accLF);
 
-		for(EFResidual* r : p->residualsAll)
+		for(int i=0;i<ngoodres;i++)
 		{
-			if(!r->isActive()) continue;
+			EFResidual* r = p->residualsAll[i];
 			b -= xAd[r->hostIDX*nFrames + r->targetIDX] * r->JpJdF;
 		}
 
@@ -341,9 +360,10 @@ void EnergyFunctional::calcLEnergyPt(int min, int max, Vec10* stats, int tid)
 		EFPoint* p = allPoints[i];
 		float dd = p->deltaF;
 
-		for(EFResidual* r : p->residualsAll)
+		EFResidual* const* lin = p->residualsAll.data() + p->numActiveUnlin;
+		for(int k=0;k<p->numActiveLin;k++)
 		{
-			if(!r->isLinearized || !r->isActive()) continue;
+			EFResidual* r = lin[k];
 
 			Mat18f dp = adHTdeltaF[r->hostIDX+nFrames*r->targetIDX];
 			RawResidualJacobian* rJ = r->J;
@@ -406,9 +426,12 @@ double EnergyFunctional::calcLEnergyF_MT()
 
 	E += cDeltaF.cwiseProduct(cPriorF).dot(cDeltaF);
 
+	partitionResidualsF();
 	red->reduce(boost::bind(&EnergyFunctional::calcLEnergyPt,
 			this, _1, _2, _3, _4), 0, allPoints.size(), 50);
 
+	E += calcGpsEnergyF();
+
 	return E+red->stats[0];
 }
 
@@ -419,6 +442,7 @@ EFResidual* EnergyFunctional::insertResidual(PointFrameResidual* r)
 	EFResidual* efr = new EFResidual(r, r->point->efPoint, r->host->efFrame, r->target->efFrame);
 	efr->idxInAll = r->point->efPoint->residualsAll.size();
 	r->point->efPoint->residualsAll.push_back(efr);
+	resTable->insert(efr);
 
     connectivityMap[(((uint64_t)efr->host->frameID) << 32) + ((uint64_t)efr->target->frameID)][0]++;
 
@@ -476,12 +500,8 @@ EFPoint* EnergyFunctional::insertPoint(PointHessian* ph)
 
 void EnergyFunctional::dropResidual(EFResidual* r)
 {
-	EFPoint* p = r->point;
-	assert(r == p->residualsAll[r->idxInAll]);
-
-	p->residualsAll[r->idxInAll] = p->residualsAll.back();
-	p->residualsAll[r->idxInAll]->idxInAll = r->idxInAll;
-	p->residualsAll.pop_back();
+	r->point->eraseResidual(r);
+	resTable->remove(r);
 
 
 	if(r->isActive())
@@ -503,6 +523,10 @@ void EnergyFunctional::marginalizeFrame(EFFrame* fh)
 	assert(EFIndicesValid);
 
 	assert((int)fh->points.size()==0);
+
+	// the GPS prior is not marginalized, only kept for the alignment.
+	marginalizeGpsPriorF(fh);
+
 	int ndim = nFrames*8+CPARS-8;// new dimension
 	int odim = nFrames*8+CPARS;// old dimension
 
@@ -619,6 +643,8 @@ void EnergyFunctional::marginalizePointsF()
 	assert(EFIndicesValid);
 
 
+	partitionResidualsF();
+
 	allPointsToMarg.clear();
 	for(EFFrame* f : frames)
 	{
@@ -628,15 +654,18 @@ void EnergyFunctional::marginalizePointsF()
 			if(p->stateFlag == EFPointStatus::PS_MARGINALIZE)
 			{
 				p->priorF *= setting_idepthFixPriorMargFac;
-				for(EFResidual* r : p->residualsAll)
-					if(r->isActive())
-                        connectivityMap[(((uint64_t)r->host->frameID) << 32) + ((uint64_t)r->target->frameID)][1]++;
+				for(int k=0;k<p->numActive();k++)
+				{
+					EFResidual* r = p->residualsAll[k];
+					connectivityMap[(((uint64_t)r->host->frameID) << 32) + ((uint64_t)r->target->frameID)][1]++;
+				}
 				allPointsToMarg.push_back(p);
 			}
 		}
 	}
 
 	accSSE_bot->setZero(nFrames);
+	accSSE_top_A->setPairs(this);
 	accSSE_top_A->setZero(nFrames);
 	for(EFPoint* p : allPointsToMarg)
 	{
@@ -699,8 +728,8 @@ void EnergyFunctional::dropPointsF()
 
 void EnergyFunctional::removePoint(EFPoint* p)
 {
-	for(EFResidual* r : p->residualsAll)
-		dropResidual(r);
+	while(!p->residualsAll.empty())
+		dropResidual(p->residualsAll.back());
 
 	EFFrame* h = p->host;
 	h->points[p->idxInPoints] = h->points.back();
@@ -784,6 +813,10 @@ void EnergyFunctional::solveSystemF(int iteration, double lambda, CalibHessian*
 	MatXX HL_top, HA_top, H_sc;
 	VecX  bL_top, bA_top, bM_top, b_sc;
 
+	partitionResidualsF();
+
+	// accumulated from scratch on every solve: linearizeAll re-linearizes every active residual in each
+	// LM iteration and applyRes runs after every accepted step, so no accumulated block can be reused.
 	accumulateAF_MT(HA_top, bA_top,multiThreading);
 
 
@@ -824,6 +857,7 @@ void EnergyFunctional::solveSystemF(int iteration, double lambda, CalibHessian*
 
 		HFinal_top = HT_act + HM;
 		bFinal_top = bT_act + bM_top;
+		addGpsPriorsF(HFinal_top, bFinal_top);
 
 
 
@@ -841,6 +875,7 @@ void EnergyFunctional::solveSystemF(int iteration, double lambda, CalibHessian*
 
 		HFinal_top = HL_top + HM + HA_top;
 		bFinal_top = bL_top + bM_top + bA_top - b_sc;
+		addGpsPriorsF(HFinal_top, bFinal_top);
 
 		lastHS = HFinal_top - H_sc;
 		lastbS = bFinal_top;
@@ -887,6 +922,8 @@ void EnergyFunctional::solveSystemF(int iteration, double lambda, CalibHessian*
 	}
 	else
 	{
+		// dense on purpose: HM and the point Schur complement H_sc couple every pair of frames in the window,
+		// so the reduced frame system has no zero blocks a block-sparse factorization could skip.
 		VecX SVecI = (HFinal_top.diagonal()+VecX::Constant(HFinal_top.cols(), 10)).cwiseSqrt().cwiseInverse();
 		MatXX HFinalScaled = SVecI.asDiagonal() * HFinal_top * SVecI.asDiagonal();
 		x = SVecI.asDiagonal() * HFinalScaled.ldlt().solve(SVecI.asDiagonal() * bFinal_top);//  SVec.asDiagonal() * svd.matrixV() * Ub;
@@ -894,6 +931,8 @@ void EnergyFunctional::solveSystemF(int iteration, double lambda, CalibHessian*
 
 
 
+	// also with GPS priors: the GPS alignment is re-estimated from the current poses before every
+	// optimization, so the priors never pin the Sim(3) gauge, they only pull on the window's shape.
 	if((setting_solverMode & SOLVER_ORTHOGONALIZE_X) || (iteration >= 2 && (setting_solverMode & SOLVER_ORTHOGONALIZE_X_LATER)))
 	{
 		VecX xOld = x;
@@ -911,6 +950,17 @@ void EnergyFunctional::solveSystemF(int iteration, double lambda, CalibHessian*
 
 
 }
+void EnergyFunctional::eraseConnectivityF(int frameID)
+{
+	for(auto it = connectivityMap.begin(); it != connectivityMap.end(); )
+	{
+		if((int)(it->first >> 32) == frameID || (int)(it->first & (uint64_t)0xFFFFFFFF) == frameID)
+			it = connectivityMap.erase(it);
+		else
+			++it;
+	}
+}
+
 void EnergyFunctional::makeIDX()
 {
 	for(unsigned int idx=0;idx<frames.size();idx++)
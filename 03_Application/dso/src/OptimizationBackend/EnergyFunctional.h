@@ -39,6 +39,7 @@ class PointFrameResidual;
 class CalibHessian;
 class FrameHessian;
 class PointHessian;
+class FrameShell;
 
 
 class EFResidual;
@@ -49,6 +50,35 @@ class AccumulatedTopHessian;
 class AccumulatedTopHessianSSE;
 class AccumulatedSCHessian;
 class AccumulatedSCHessianSSE;
+class ResidualTable;
+
+
+// the marginalized keyframes with GPS, only kept for estimating the GPS alignment: weighted sums of
+// (DSO camera center at marginalization, GPS position), relative to the first one. constant size.
+struct GpsAnchorSums
+{
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+	int num;
+	double wSum;
+	Vec3 originC, originG;		// first center / measurement, subtracted from all (GPS coordinates can be large).
+	Vec3 sumC, sumG;			// sum w*c, sum w*g.
+	double sumCC, sumGG;		// sum w*|c|^2, sum w*|g|^2.
+	Mat33 sumGC;				// sum w*g*c'.
+
+	inline GpsAnchorSums() {num=0; wSum=sumCC=sumGG=0; originC.setZero(); originG.setZero(); sumC.setZero(); sumG.setZero(); sumGC.setZero();}
+	inline void add(const Vec3 &center, const Vec3 &measurement, double w)
+	{
+		if(num==0) {originC = center; originG = measurement;}
+		Vec3 c = center-originC, g = measurement-originG;
+		num++;
+		wSum += w;
+		sumC += w*c;
+		sumG += w*g;
+		sumCC += w*c.squaredNorm();
+		sumGG += w*g.squaredNorm();
+		sumGC += w*g*c.transpose();
+	}
+};
 
 
 extern bool EFAdjointsValid;
@@ -68,7 +98,8 @@ public:
 	friend class AccumulatedSCHessian;
 	friend class AccumulatedSCHessianSSE;
 
-	EnergyFunctional();
+	// red: the reduce pool of the owning FullSystem (0: single-threaded only). sizes the per-thread accumulators.
+	EnergyFunctional(IndexThreadReduce<Vec10>* red);
 	~EnergyFunctional();
 
 
@@ -91,10 +122,17 @@ public:
 
 	void makeIDX();
 
+	// removes all connectivityMap entries of a (marginalized) frame.
+	void eraseConnectivityF(int frameID);
+
 	void setDeltaF(CalibHessian* HCalib);
 
 	void setAdjointsF(CalibHessian* Hcalib);
 
+	// GPS priors (EnergyFunctionalGps.cpp).
+	void updateGpsAlignmentF();
+	double calcGpsEnergyF();
+
 	std::vector<EFFrame*> frames;
 	int nPoints, nFrames, nResiduals;
 
@@ -113,6 +151,8 @@ public:
 
 	IndexThreadReduce<Vec10>* red;
 
+	ResidualTable* resTable;		// all residuals, grouped by (host,target).
+
 
 	std::map<uint64_t,
 	  Eigen::Vector2i,
@@ -120,10 +160,20 @@ public:
 	  Eigen::aligned_allocator<std::pair<uint64_t, Eigen::Vector2i>>
 	  > connectivityMap;
 
+	// similarity DSO world -> GPS frame: gps = gpsScale * gpsR * world + gpsT.
+	bool gpsAlignmentValid;
+	double gpsScale;
+	Mat33 gpsR;
+	Vec3 gpsT;
+	int nGpsPriors;		// frames with an active GPS prior in the last solve.
+
 private:
 
 	VecX getStitchedDeltaF() const;
 
+	// brings every point's residualsAll into [active unlinearized | active linearized | rest] order. cheap if nothing changed.
+	void partitionResidualsF();
+
 	void resubstituteF_MT(VecX x, CalibHessian* HCalib, bool MT);
     void resubstituteFPt(const VecCf &xc, Mat18f* xAd, int min, int max, Vec10* stats, int tid);
 
@@ -134,6 +184,11 @@ private:
 	void calcLEnergyPt(int min, int max, Vec10* stats, int tid);
 
 	void orthogonalize(VecX* b, MatXX* H);
+
+	bool getGpsFactorF(EFFrame* f, Mat33 &JtWJ, Vec3 &JtWr, double &E) const;
+	void addGpsPriorsF(MatXX &H, VecX &b);
+	void marginalizeGpsPriorF(EFFrame* fh);
+	GpsAnchorSums gpsAnchors;
 	Mat18f* adHTdeltaF;
 
 	Mat88* adHost;
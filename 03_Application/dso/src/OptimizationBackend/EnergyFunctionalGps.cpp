@@ -0,0 +1,144 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ * GPS position priors in the sliding window.
+ *
+ * each keyframe with an external position measurement g (FrameShell::camToWorld_predicted) gets the residual
+ *     r = s * R * c + t - g,      E = r' * W * r,      W = setting_gpsPriorWeight * cov^-1
+ * where c is its camera center in DSO world, and (s,R,t) the similarity from DSO world into the GPS frame.
+ * the residual only depends on the frame's own pose, so it adds one 8x8 diagonal block per frame to the
+ * system (same as the frame priors).
+ * the similarity is re-estimated from all current and marginalized keyframes before each optimization,
+ * and kept fixed during the LM iterations. it is not a state of the system (there are no alignment rows
+ * in H), so the factors do not go through the accumulators and stitching: they are added to the reduced
+ * frame system in solveSystemF, after the points are Schur-eliminated.
+ * since the similarity keeps changing, the factor is dropped when its frame is marginalized instead of
+ * being frozen into HM with a stale similarity; marginalized keyframes only contribute to the alignment.
+ * for the same reason the priors do not fix the gauge: solveSystemF still projects out the nullspace.
+ */
+
+#include "OptimizationBackend/EnergyFunctional.h"
+#include "OptimizationBackend/EnergyFunctionalStructs.h"
+#include "FullSystem/HessianBlocks.h"
+#include "util/FrameShell.h"
+#include <Eigen/SVD>
+
+namespace dso
+{
+
+
+bool EnergyFunctional::getGpsFactorF(EFFrame* f, Mat33 &JtWJ, Vec3 &JtWr, double &E) const
+{
+	FrameShell* shell = f->data->shell;
+	if(!gpsAlignmentValid || setting_gpsPriorWeight <= 0 || !shell->predictedValid) return false;
+
+	const SE3 &camToWorld = f->data->PRE_camToWorld;
+	Vec3 r = gpsScale * (gpsR * camToWorld.translation()) + gpsT - shell->camToWorld_predicted.translation();
+	Mat33 W = setting_gpsPriorWeight * shell->predictedPositionCov.inverse();
+
+	// camToWorld' = camToWorld * exp(-eps), so to first order dc / d(eps_trans) = -R_cw, dc / d(eps_rot) = 0.
+	Mat33 J = -gpsScale * gpsR * camToWorld.rotationMatrix() * SCALE_XI_TRANS;
+
+	JtWJ = J.transpose() * W * J;
+	JtWr = J.transpose() * W * r;
+	E = r.dot(W*r);
+	return true;
+}
+
+
+void EnergyFunctional::addGpsPriorsF(MatXX &H, VecX &b)
+{
+	nGpsPriors=0;
+	for(EFFrame* f : frames)
+	{
+		Mat33 JtWJ; Vec3 JtWr; double E;
+		if(!getGpsFactorF(f, JtWJ, JtWr, E)) continue;
+		H.block<3,3>(CPARS+8*f->idx, CPARS+8*f->idx) += JtWJ;
+		b.segment<3>(CPARS+8*f->idx) += JtWr;
+		nGpsPriors++;
+	}
+}
+
+
+double EnergyFunctional::calcGpsEnergyF()
+{
+	double Esum = 0;
+	for(EFFrame* f : frames)
+	{
+		Mat33 JtWJ; Vec3 JtWr; double E;
+		if(getGpsFactorF(f, JtWJ, JtWr, E)) Esum += E;
+	}
+	return Esum;
+}
+
+
+void EnergyFunctional::marginalizeGpsPriorF(EFFrame* fh)
+{
+	FrameShell* shell = fh->data->shell;
+	if(!shell->predictedValid) return;
+
+	// keep it for estimating the alignment.
+	gpsAnchors.add(fh->data->PRE_camToWorld.translation(), shell->camToWorld_predicted.translation(),
+			1.0 / std::max(1e-10, shell->predictedPositionCov.trace()));
+}
+
+
+void EnergyFunctional::updateGpsAlignmentF()
+{
+	// all pairs (DSO camera center, GPS position).
+	GpsAnchorSums pairs = gpsAnchors;
+	for(EFFrame* f : frames)
+	{
+		FrameShell* shell = f->data->shell;
+		if(!shell->predictedValid) continue;
+		pairs.add(f->data->PRE_camToWorld.translation(), shell->camToWorld_predicted.translation(),
+				1.0 / std::max(1e-10, shell->predictedPositionCov.trace()));
+	}
+
+	if(pairs.num < setting_gpsMinAlignFrames) return;
+
+
+	// weighted umeyama, from the sums.
+	double wSum = pairs.wSum;
+	Vec3 muC = pairs.sumC / wSum;
+	Vec3 muG = pairs.sumG / wSum;
+	double varC = pairs.sumCC / wSum - muC.squaredNorm();
+	double varG = pairs.sumGG / wSum - muG.squaredNorm();
+	Mat33 cov = pairs.sumGC / wSum - muG * muC.transpose();
+
+	// not spread enough (yet): scale and rotation are not observable.
+	if(!(varG >= setting_gpsMinAlignExtent*setting_gpsMinAlignExtent) || varC < 1e-12) return;
+
+	Eigen::JacobiSVD<Mat33> svd(cov, Eigen::ComputeFullU | Eigen::ComputeFullV);
+	Mat33 S = Mat33::Identity();
+	if(svd.matrixU().determinant() * svd.matrixV().determinant() < 0) S(2,2) = -1;
+
+	gpsR = svd.matrixU() * S * svd.matrixV().transpose();
+	gpsScale = (svd.singularValues().asDiagonal() * S).trace() / varC;
+	gpsT = (muG + pairs.originG) - gpsScale * gpsR * (muC + pairs.originC);
+	gpsAlignmentValid = true;
+}
+
+}
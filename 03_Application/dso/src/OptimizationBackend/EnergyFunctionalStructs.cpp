@@ -84,6 +84,66 @@ void EFPoint::takeData()
 	deltaF = data->idepth-data->idepth_zero;
 }
 
+void EFPoint::partitionResiduals()
+{
+	if(residualsPartitioned.load(std::memory_order_relaxed)) return;
+
+	// two in-place passes: first pull the active & unlinearized ones to the front, then the active & linearized ones.
+	int n = residualsAll.size();
+	int endA = 0;
+	for(int i=0;i<n;i++)
+		if(residualsAll[i]->isActive() && !residualsAll[i]->isLinearized)
+			std::swap(residualsAll[i], residualsAll[endA++]);
+	int endL = endA;
+	for(int i=endA;i<n;i++)
+		if(residualsAll[i]->isActive() && residualsAll[i]->isLinearized)
+			std::swap(residualsAll[i], residualsAll[endL++]);
+
+	for(int i=0;i<n;i++)
+		residualsAll[i]->idxInAll = i;
+
+	numActiveUnlin = endA;
+	numActiveLin = endL-endA;
+	residualsPartitioned.store(true, std::memory_order_relaxed);
+}
+
+void EFPoint::eraseResidual(EFResidual* r)
+{
+	int i = r->idxInAll;
+	assert(r == residualsAll[i]);
+
+	// move the hole to the end of each span it passes through, then fill it with the last residual.
+	// (the hole keeps a stale pointer, so a span that ends at the hole must not be moved onto it.)
+	int last = residualsAll.size()-1;
+	if(residualsPartitioned.load(std::memory_order_relaxed))
+	{
+		int endA = numActiveUnlin;
+		int endL = numActiveUnlin+numActiveLin;
+		if(i < endA) numActiveUnlin--;
+		else if(i < endL) numActiveLin--;
+
+		if(i < endA-1)
+		{
+			residualsAll[i] = residualsAll[endA-1];
+			residualsAll[i]->idxInAll = i;
+			i = endA-1;
+		}
+		if(i < endL-1)
+		{
+			residualsAll[i] = residualsAll[endL-1];
+			residualsAll[i]->idxInAll = i;
+			i = endL-1;
+		}
+	}
+
+	if(i < last)
+	{
+		residualsAll[i] = residualsAll[last];
+		residualsAll[i]->idxInAll = i;
+	}
+	residualsAll.pop_back();
+}
+
 
 void EFResidual::fixLinearizationF(EnergyFunctional* ef)
 {
@@ -110,7 +170,7 @@ void EFResidual::fixLinearizationF(EnergyFunctional* ef)
 		_mm_store_ps(((float*)&res_toZeroF)+i, rtz);
 	}
 
-	isLinearized = true;
+	setLinearized(true);
 }
 
 }
@@ -29,6 +29,8 @@
 #include "vector"
 #include <math.h>
 #include "OptimizationBackend/RawResidualJacobian.h"
+#include "util/SlabPool.h"
+#include <atomic>
 
 namespace dso
 {
@@ -42,6 +44,7 @@ class EFResidual;
 class EFPoint;
 class EFFrame;
 class EnergyFunctional;
+class ResidualBlock;
 
 
 
@@ -51,13 +54,15 @@ class EnergyFunctional;
 class EFResidual
 {
 public:
-	EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+	DSO_SLAB_POOLED_NEW(EFResidual);
 
 	inline EFResidual(PointFrameResidual* org, EFPoint* point_, EFFrame* host_, EFFrame* target_) :
 		data(org), point(point_), host(host_), target(target_)
 	{
 		isLinearized=false;
 		isActiveAndIsGoodNEW=false;
+		block=0;
+		idxInBlock=-1;
 		J = new RawResidualJacobian();
 		assert(((long)this)%16==0);
 		assert(((long)J)%16==0);
@@ -73,6 +78,10 @@ public:
 
 	void fixLinearizationF(EnergyFunctional* ef);
 
+	// state changes go through these, so the point knows its residual spans are stale.
+	inline void setActive(bool active);
+	inline void setLinearized(bool linearized);
+
 
 	// structural pointers
 	PointFrameResidual* data;
@@ -81,6 +90,8 @@ public:
 	EFFrame* host;
 	EFFrame* target;
 	int idxInAll;
+	ResidualBlock* block;		// slot in the SoA residual table.
+	int idxInBlock;
 
 	RawResidualJacobian* J;
 
@@ -102,14 +113,21 @@ enum EFPointStatus {PS_GOOD=0, PS_MARGINALIZE, PS_DROP};
 class EFPoint
 {
 public:
-    EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+    DSO_SLAB_POOLED_NEW(EFPoint);
 	EFPoint(PointHessian* d, EFFrame* host_) : data(d),host(host_)
 	{
 		takeData();
 		stateFlag=EFPointStatus::PS_GOOD;
+		numActiveUnlin=numActiveLin=0;
+		residualsPartitioned=true;
 	}
 	void takeData();
 
+	// re-sorts residualsAll into its spans, if a residual changed state since the last call.
+	void partitionResiduals();
+	// removes r from residualsAll, keeping the spans contiguous.
+	void eraseResidual(EFResidual* r);
+
 	PointHessian* data;
 
 
@@ -122,8 +140,15 @@ public:
 	int idxInPoints;
 	EFFrame* host;
 
-	// contains all residuals.
+	// contains all residuals. after partitionResiduals(), ordered by state:
+	// [0, numActiveUnlin): active, not linearized. (A pass)
+	// [numActiveUnlin, numActiveUnlin+numActiveLin): active, linearized. (L pass / marginalization)
+	// rest: not active.
 	std::vector<EFResidual*> residualsAll;
+	int numActiveUnlin;
+	int numActiveLin;
+	inline int numActive() const {return numActiveUnlin+numActiveLin;}
+	std::atomic<bool> residualsPartitioned;	// false if a residual changed state. set from parallel applyRes.
 
 	float bdSumF;
 	float HdiF;
@@ -139,6 +164,20 @@ public:
 };
 
 
+inline void EFResidual::setActive(bool active)
+{
+	if(isActiveAndIsGoodNEW == active) return;
+	isActiveAndIsGoodNEW = active;
+	point->residualsPartitioned.store(false, std::memory_order_relaxed);
+}
+inline void EFResidual::setLinearized(bool linearized)
+{
+	if(isLinearized == linearized) return;
+	isLinearized = linearized;
+	point->residualsPartitioned.store(false, std::memory_order_relaxed);
+}
+
+
 
 class EFFrame
 {
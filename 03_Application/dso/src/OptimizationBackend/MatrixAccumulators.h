@@ -28,6 +28,7 @@
 #if !defined(__SSE3__) && !defined(__SSE2__) && !defined(__SSE1__)
 #include "SSE2NEON.h"
 #endif
+#include "util/SimdDispatch.h"
 
 namespace dso
 {
@@ -995,7 +996,9 @@ public:
     memset(SSEData,0, sizeof(float)*4*45);
     memset(SSEData1k,0, sizeof(float)*4*45);
     memset(SSEData1m,0, sizeof(float)*4*45);
+    memset(WideData,0, sizeof(float)*16*45);
     num = numIn1 = numIn1k = numIn1m = 0;
+    wideUsed = false;
   }
 
   inline void finish()
@@ -1166,6 +1169,169 @@ public:
   }
 
 
+#ifdef DSO_SIMD_DISPATCH
+  // same as updateSSE_eighted, 8 / 16 terms at once. only call if getSimdLevel() allows it.
+  DSO_TARGET_AVX2
+  inline void updateAVX2_eighted(
+		  const __m256 J0,const __m256 J1,
+		  const __m256 J2,const __m256 J3,
+		  const __m256 J4,const __m256 J5,
+		  const __m256 J6,const __m256 J7,
+		  const __m256 J8, const __m256 w)
+  {
+	  float* pt=WideData;
+
+	  __m256 J0w = _mm256_mul_ps(J0,w);
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J0w,J0,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J0w,J1,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J0w,J2,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J0w,J3,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J0w,J4,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J0w,J5,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J0w,J6,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J0w,J7,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J0w,J8,_mm256_loadu_ps(pt))); pt+=16;
+
+	  __m256 J1w = _mm256_mul_ps(J1,w);
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J1w,J1,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J1w,J2,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J1w,J3,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J1w,J4,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J1w,J5,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J1w,J6,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J1w,J7,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J1w,J8,_mm256_loadu_ps(pt))); pt+=16;
+
+	  __m256 J2w = _mm256_mul_ps(J2,w);
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J2w,J2,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J2w,J3,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J2w,J4,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J2w,J5,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J2w,J6,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J2w,J7,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J2w,J8,_mm256_loadu_ps(pt))); pt+=16;
+
+	  __m256 J3w = _mm256_mul_ps(J3,w);
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J3w,J3,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J3w,J4,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J3w,J5,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J3w,J6,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J3w,J7,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J3w,J8,_mm256_loadu_ps(pt))); pt+=16;
+
+	  __m256 J4w = _mm256_mul_ps(J4,w);
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J4w,J4,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J4w,J5,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J4w,J6,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J4w,J7,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J4w,J8,_mm256_loadu_ps(pt))); pt+=16;
+
+	  __m256 J5w = _mm256_mul_ps(J5,w);
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J5w,J5,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J5w,J6,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J5w,J7,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J5w,J8,_mm256_loadu_ps(pt))); pt+=16;
+
+	  __m256 J6w = _mm256_mul_ps(J6,w);
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J6w,J6,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J6w,J7,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J6w,J8,_mm256_loadu_ps(pt))); pt+=16;
+
+	  __m256 J7w = _mm256_mul_ps(J7,w);
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J7w,J7,_mm256_loadu_ps(pt))); pt+=16;
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J7w,J8,_mm256_loadu_ps(pt))); pt+=16;
+
+	  __m256 J8w = _mm256_mul_ps(J8,w);
+	  _mm256_storeu_ps(pt, _mm256_fmadd_ps(J8w,J8,_mm256_loadu_ps(pt))); pt+=16;
+
+	  num+=8;
+	  numIn1++;
+	  wideUsed = true;
+	  shiftUp(false);
+  }
+
+
+  DSO_TARGET_AVX512
+  inline void updateAVX512_eighted(
+		  const __m512 J0,const __m512 J1,
+		  const __m512 J2,const __m512 J3,
+		  const __m512 J4,const __m512 J5,
+		  const __m512 J6,const __m512 J7,
+		  const __m512 J8, const __m512 w)
+  {
+	  float* pt=WideData;
+
+	  __m512 J0w = _mm512_mul_ps(J0,w);
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J0w,J0,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J0w,J1,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J0w,J2,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J0w,J3,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J0w,J4,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J0w,J5,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J0w,J6,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J0w,J7,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J0w,J8,_mm512_loadu_ps(pt))); pt+=16;
+
+	  __m512 J1w = _mm512_mul_ps(J1,w);
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J1w,J1,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J1w,J2,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J1w,J3,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J1w,J4,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J1w,J5,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J1w,J6,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J1w,J7,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J1w,J8,_mm512_loadu_ps(pt))); pt+=16;
+
+	  __m512 J2w = _mm512_mul_ps(J2,w);
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J2w,J2,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J2w,J3,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J2w,J4,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J2w,J5,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J2w,J6,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J2w,J7,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J2w,J8,_mm512_loadu_ps(pt))); pt+=16;
+
+	  __m512 J3w = _mm512_mul_ps(J3,w);
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J3w,J3,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J3w,J4,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J3w,J5,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J3w,J6,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J3w,J7,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J3w,J8,_mm512_loadu_ps(pt))); pt+=16;
+
+	  __m512 J4w = _mm512_mul_ps(J4,w);
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J4w,J4,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J4w,J5,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J4w,J6,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J4w,J7,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J4w,J8,_mm512_loadu_ps(pt))); pt+=16;
+
+	  __m512 J5w = _mm512_mul_ps(J5,w);
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J5w,J5,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J5w,J6,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J5w,J7,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J5w,J8,_mm512_loadu_ps(pt))); pt+=16;
+
+	  __m512 J6w = _mm512_mul_ps(J6,w);
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J6w,J6,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J6w,J7,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J6w,J8,_mm512_loadu_ps(pt))); pt+=16;
+
+	  __m512 J7w = _mm512_mul_ps(J7,w);
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J7w,J7,_mm512_loadu_ps(pt))); pt+=16;
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J7w,J8,_mm512_loadu_ps(pt))); pt+=16;
+
+	  __m512 J8w = _mm512_mul_ps(J8,w);
+	  _mm512_storeu_ps(pt, _mm512_fmadd_ps(J8w,J8,_mm512_loadu_ps(pt))); pt+=16;
+
+	  num+=16;
+	  numIn1++;
+	  wideUsed = true;
+	  shiftUp(false);
+  }
+#endif
+
+
   inline void updateSingle(
 		  const float J0,const float J1,
 		  const float J2,const float J3,
@@ -1319,15 +1485,36 @@ private:
   EIGEN_ALIGN16 float SSEData[4*45];
   EIGEN_ALIGN16 float SSEData1k[4*45];
   EIGEN_ALIGN16 float SSEData1m[4*45];
+  EIGEN_ALIGN16 float WideData[16*45];	// lanes of the AVX2 (first 8) / AVX-512 (all 16) updates. folded in shiftUp.
   float numIn1, numIn1k, numIn1m;
+  bool wideUsed;	// WideData is non-zero. SSE-only runs never touch it.
 
 
   void shiftUp(bool force)
   {
 	  if(numIn1 > 1000 || force)
 	  {
-		  for(int i=0;i<45;i++)
-			  _mm_store_ps(SSEData1k+4*i, _mm_add_ps(_mm_load_ps(SSEData+4*i),_mm_load_ps(SSEData1k+4*i)));
+		  if(wideUsed)
+		  {
+			  // fold the wide lanes and clear them in the same pass.
+			  __m128 zero = _mm_setzero_ps();
+			  for(int i=0;i<45;i++)
+			  {
+				  float* pt = WideData+16*i;
+				  __m128 wide = _mm_add_ps(
+						  _mm_add_ps(_mm_load_ps(pt),_mm_load_ps(pt+4)),
+						  _mm_add_ps(_mm_load_ps(pt+8),_mm_load_ps(pt+12)));
+				  _mm_store_ps(pt, zero); _mm_store_ps(pt+4, zero);
+				  _mm_store_ps(pt+8, zero); _mm_store_ps(pt+12, zero);
+				  _mm_store_ps(SSEData1k+4*i, _mm_add_ps(_mm_add_ps(_mm_load_ps(SSEData+4*i),wide),_mm_load_ps(SSEData1k+4*i)));
+			  }
+			  wideUsed = false;
+		  }
+		  else
+		  {
+			  for(int i=0;i<45;i++)
+				  _mm_store_ps(SSEData1k+4*i, _mm_add_ps(_mm_load_ps(SSEData+4*i),_mm_load_ps(SSEData1k+4*i)));
+		  }
 		  numIn1k+=numIn1;
 		  numIn1=0;
 		  memset(SSEData,0, sizeof(float)*4*45);
@@ -0,0 +1,417 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "OptimizationBackend/PoseGraphBackend.h"
+#include "util/FrameShell.h"
+#include "util/settings.h"
+#include "util/StageProfiler.h"
+#include <Eigen/SparseCholesky>
+#include <algorithm>
+#include <limits>
+#include <stdio.h>
+
+namespace dso
+{
+
+
+PoseGraphBackend::PoseGraphBackend(boost::mutex* shellPoseMutex) : shellPoseMutex(shellPoseMutex)
+{
+	firstDirtyAttached = -1;
+	gpsValid = queuedGpsValid = false;
+	gpsScale = queuedGpsScale = 1;
+	gpsR = queuedGpsR = Mat33::Identity();
+	gpsT = queuedGpsT = Vec3::Zero();
+	queuedOldestWindowId = -1;
+	numOptimizations = numIterations = 0;
+	numDroppedNodes = numDroppedAttached = 0;
+	lastChi2Before = lastChi2After = 0;
+
+	oldestShellId = inFlightOldestId = std::numeric_limits<int>::max();
+	busy = false;
+	running = true;
+	finished = false;
+	thread = boost::thread(&PoseGraphBackend::threadLoop, this);
+}
+
+PoseGraphBackend::~PoseGraphBackend()
+{
+	{
+		boost::unique_lock<boost::mutex> lock(queueMutex);
+		running = false;
+		queueSignal.notify_all();
+	}
+	thread.join();
+
+	for(Node* n : nodes) delete n;
+	for(Node* n : queuedNodes) delete n;
+}
+
+
+void PoseGraphBackend::addKeyframe(FrameShell* shell, int oldestWindowId)
+{
+	Node* n = new Node();
+	n->shell = shell;
+	n->poseOrig = n->pose = shell->camToWorld;
+	n->hasGps = setting_gpsPriorWeight > 0 && shell->predictedValid;
+	n->gps = shell->camToWorld_predicted.translation();
+	n->gpsInfo = setting_gpsPriorWeight * shell->predictedPositionCov.inverse();
+
+	boost::unique_lock<boost::mutex> lock(queueMutex);
+	queuedNodes.push_back(n);
+	queuedOldestWindowId = oldestWindowId;
+	queueSignal.notify_all();
+}
+
+void PoseGraphBackend::setGpsAlignment(bool valid, double scale, const Mat33 &R, const Vec3 &t)
+{
+	boost::unique_lock<boost::mutex> lock(queueMutex);
+	queuedGpsValid = valid;
+	queuedGpsScale = scale;
+	queuedGpsR = R;
+	queuedGpsT = t;
+}
+
+void PoseGraphBackend::attachFrame(FrameShell* shell)
+{
+	if(shell->trackingRef == 0) return;
+
+	boost::unique_lock<boost::mutex> lock(queueMutex);
+	queuedAttached.push_back(shell);
+	queueSignal.notify_all();
+}
+
+void PoseGraphBackend::flush()
+{
+	boost::unique_lock<boost::mutex> lock(queueMutex);
+	while(running && (busy || !queuedNodes.empty() || !queuedAttached.empty()))
+		idleSignal.wait(lock);
+}
+
+int PoseGraphBackend::getOldestShellId()
+{
+	boost::unique_lock<boost::mutex> lock(queueMutex);
+	int oldest = std::min(oldestShellId, inFlightOldestId);
+	for(Node* n : queuedNodes) oldest = std::min(oldest, n->shell->id);
+	for(FrameShell* s : queuedAttached) oldest = std::min(oldest, s->id);
+	return oldest;
+}
+
+void PoseGraphBackend::finish(const std::vector<FrameShell*> &window)
+{
+	flush();
+
+	// the backend thread is idle and waits for [queueMutex].
+	boost::unique_lock<boost::mutex> lock(queueMutex);
+	if(finished || nodes.empty()) return;
+	finished = true;
+
+	SE3 correction = nodes.back()->pose * nodes.back()->poseOrig.inverse();
+
+	boost::unique_lock<boost::mutex> crlock(*shellPoseMutex);
+	for(FrameShell* s : window)
+		s->camToWorld = correction * s->camToWorld;
+	for(std::pair<const int, std::vector<FrameShell*>> &a : attachedByRef)
+		for(FrameShell* s : a.second)
+			s->camToWorld = s->trackingRef->camToWorld * s->camToTrackingRef;
+	attachedByRef.clear();
+}
+
+void PoseGraphBackend::printStats()
+{
+	printf("PoseGraph: %d nodes, %d edges (%d nodes dropped). %d optimizations (%d its), last chi2 %.3f -> %.3f. %d unattached frames dropped\n",
+			(int)nodes.size(), (int)edges.size(), numDroppedNodes, numOptimizations, numIterations,
+			lastChi2Before, lastChi2After, numDroppedAttached);
+}
+
+
+void PoseGraphBackend::threadLoop()
+{
+	boost::unique_lock<boost::mutex> lock(queueMutex);
+	while(running)
+	{
+		if(queuedNodes.empty() && queuedAttached.empty())
+		{
+			busy = false;
+			idleSignal.notify_all();
+			queueSignal.wait(lock);
+			continue;
+		}
+
+		std::vector<Node*> newNodes;
+		std::vector<FrameShell*> newAttached;
+		newNodes.swap(queuedNodes);
+		newAttached.swap(queuedAttached);
+		int oldestWindowId = queuedOldestWindowId;
+		for(Node* n : newNodes) inFlightOldestId = std::min(inFlightOldestId, n->shell->id);
+		for(FrameShell* s : newAttached) inFlightOldestId = std::min(inFlightOldestId, s->id);
+		gpsValid = queuedGpsValid;
+		gpsScale = queuedGpsScale;
+		gpsR = queuedGpsR;
+		gpsT = queuedGpsT;
+		busy = true;
+		lock.unlock();
+
+		// optimization & write-back run without holding the queue.
+		for(Node* n : newNodes) insertNode(n);
+		for(FrameShell* s : newAttached) insertAttached(s);
+		pruneAttached(oldestWindowId);
+
+		int firstFree = 0;
+		int from = (int)nodes.size();
+		if(!newNodes.empty())
+		{
+			firstFree = std::max(0, (int)nodes.size() - setting_poseGraphWindow);
+
+			// without enough GPS in the optimized part, the oldest node fixes the gauge.
+			int nGps = 0;
+			if(gpsValid)
+				for(int k=firstFree;k<(int)nodes.size();k++) if(nodes[k]->hasGps) nGps++;
+			if(firstFree == 0 && nGps < 3) firstFree = 1;
+
+			if(firstFree < (int)nodes.size())
+				optimize(firstFree);
+			from = std::min(from, firstFree);
+		}
+		if(firstDirtyAttached >= 0) from = std::min(from, firstDirtyAttached);
+		firstDirtyAttached = -1;
+
+		writeBack(from);
+		if(!newNodes.empty()) pruneNodes(firstFree);
+
+		// nodes are not ordered by id (frames are not marginalized oldest first), attached frames are newer than their node.
+		int oldest = std::numeric_limits<int>::max();
+		for(Node* n : nodes) oldest = std::min(oldest, n->shell->id);
+		if(!attachedByRef.empty()) oldest = std::min(oldest, attachedByRef.begin()->first);
+
+		lock.lock();
+		oldestShellId = oldest;
+		inFlightOldestId = std::numeric_limits<int>::max();
+	}
+	busy = false;
+	idleSignal.notify_all();
+}
+
+
+void PoseGraphBackend::insertNode(Node* n)
+{
+	int k = nodes.size();
+
+	// start from the correction of the previous node.
+	if(k > 0)
+		n->pose = nodes[k-1]->pose * nodes[k-1]->poseOrig.inverse() * n->poseOrig;
+
+	std::map<int, std::vector<FrameShell*>>::iterator it = attachedByRef.find(n->shell->id);
+	if(it != attachedByRef.end())
+	{
+		n->attached.swap(it->second);
+		attachedByRef.erase(it);
+	}
+
+	nodes.push_back(n);
+	nodeIdxByShellId[n->shell->id] = k;
+
+	// edges to the predecessors. the further apart, the less certain.
+	for(int m=1;m<=setting_poseGraphNeighbours && k-m >= 0;m++)
+	{
+		Edge e;
+		e.i = k-m;
+		e.j = k;
+		e.meas = nodes[e.i]->poseOrig.inverse() * n->poseOrig;
+
+		double sigmaT = sqrt((double)m) * (setting_poseGraphSigmaTrans * e.meas.translation().norm() + 1e-3);
+		double sigmaR = sqrt((double)m) * setting_poseGraphSigmaRot;
+		e.info.head<3>().setConstant(1.0 / (sigmaT*sigmaT));
+		e.info.tail<3>().setConstant(1.0 / (sigmaR*sigmaR));
+		edges.push_back(e);
+	}
+}
+
+void PoseGraphBackend::insertAttached(FrameShell* shell)
+{
+	std::map<int, int>::iterator it = nodeIdxByShellId.find(shell->trackingRef->id);
+	if(it == nodeIdxByShellId.end())
+	{
+		attachedByRef[shell->trackingRef->id].push_back(shell);
+		return;
+	}
+
+	nodes[it->second]->attached.push_back(shell);
+	if(firstDirtyAttached < 0 || it->second < firstDirtyAttached)
+		firstDirtyAttached = it->second;
+}
+
+void PoseGraphBackend::pruneAttached(int oldestWindowId)
+{
+	// refs older than the window that are not a node by now never become one (e.g. after a reset).
+	while(!attachedByRef.empty() && attachedByRef.begin()->first < oldestWindowId)
+	{
+		numDroppedAttached += attachedByRef.begin()->second.size();
+		attachedByRef.erase(attachedByRef.begin());
+	}
+}
+
+void PoseGraphBackend::pruneNodes(int firstFree)
+{
+	// free nodes have edges back to firstFree - setting_poseGraphNeighbours, everything before that is
+	// fixed, written back and not referenced any more. dropped in batches, so this is amortized O(1).
+	int cut = firstFree - std::max(1, setting_poseGraphNeighbours);
+	if(cut < setting_poseGraphWindow) return;
+
+	for(int k=0;k<cut;k++)
+	{
+		nodeIdxByShellId.erase(nodes[k]->shell->id);
+		delete nodes[k];
+	}
+	nodes.erase(nodes.begin(), nodes.begin()+cut);
+	for(std::map<int, int>::iterator it = nodeIdxByShellId.begin(); it != nodeIdxByShellId.end(); ++it)
+		it->second -= cut;
+
+	// keeps the order by j.
+	edges.erase(std::remove_if(edges.begin(), edges.end(), [cut](const Edge &e) {return e.i < cut;}), edges.end());
+	for(Edge &e : edges)
+	{
+		e.i -= cut;
+		e.j -= cut;
+	}
+	numDroppedNodes += cut;
+}
+
+
+// linearizes all factors touching a free node. returns chi2; fills H (as triplets) and b if given.
+double PoseGraphBackend::buildSystem(int firstFree, std::vector<Eigen::Triplet<double>>* triplets, VecX* b)
+{
+	double chi2 = 0;
+
+	Edge probe; probe.j = firstFree;
+	std::vector<Edge, Eigen::aligned_allocator<Edge>>::iterator first = std::lower_bound(edges.begin(), edges.end(), probe,
+			[](const Edge &a, const Edge &b) {return a.j < b.j;});
+
+	for(std::vector<Edge, Eigen::aligned_allocator<Edge>>::iterator e = first; e != edges.end(); ++e)
+	{
+		const SE3 &Ti = nodes[e->i]->pose;
+		const SE3 &Tj = nodes[e->j]->pose;
+
+		// r = log(meas^-1 * Ti^-1 * Tj). right-perturbation, dr/dj ~ I, dr/di ~ -Adj(Tj^-1 * Ti).
+		Vec6 r = (e->meas.inverse() * Ti.inverse() * Tj).log();
+		chi2 += r.dot(e->info.cwiseProduct(r));
+		if(triplets == 0) continue;
+
+		Mat66 W = e->info.asDiagonal();
+		Mat66 Ji = -(Tj.inverse() * Ti).Adj();
+		int jj = 6*(e->j - firstFree);
+		int ii = 6*(e->i - firstFree);
+		bool iFree = e->i >= firstFree;
+
+		Mat66 Hjj = W;
+		Mat66 Hij = Ji.transpose() * W;
+		Mat66 Hii = Hij * Ji;
+		for(int y=0;y<6;y++)
+			for(int x=0;x<6;x++)
+			{
+				triplets->push_back(Eigen::Triplet<double>(jj+y, jj+x, Hjj(y,x)));
+				if(!iFree) continue;
+				triplets->push_back(Eigen::Triplet<double>(ii+y, ii+x, Hii(y,x)));
+				triplets->push_back(Eigen::Triplet<double>(ii+y, jj+x, Hij(y,x)));
+				triplets->push_back(Eigen::Triplet<double>(jj+x, ii+y, Hij(y,x)));
+			}
+		b->segment<6>(jj) += W*r;
+		if(iFree) b->segment<6>(ii) += Hij*r;
+	}
+
+	// GPS: r = c - center, dr/d(trans) = R.
+	for(int k=firstFree;k<(int)nodes.size() && gpsValid;k++)
+	{
+		Node* n = nodes[k];
+		if(!n->hasGps) continue;
+
+		// g = s*R*c + t  =>  c = R' * (g-t) / s,  info_c = s^2 * R' * info_g * R.
+		Vec3 center = gpsR.transpose() * (n->gps - gpsT) / gpsScale;
+		Mat33 info = gpsScale * gpsScale * gpsR.transpose() * n->gpsInfo * gpsR;
+
+		Vec3 r = n->pose.translation() - center;
+		chi2 += r.dot(info*r);
+		if(triplets == 0) continue;
+
+		Mat33 R = n->pose.rotationMatrix();
+		Mat33 H = R.transpose() * info * R;
+		int kk = 6*(k - firstFree);
+		for(int y=0;y<3;y++)
+			for(int x=0;x<3;x++)
+				triplets->push_back(Eigen::Triplet<double>(kk+y, kk+x, H(y,x)));
+		b->segment<3>(kk) += R.transpose() * info * r;
+	}
+
+	return chi2;
+}
+
+void PoseGraphBackend::optimize(int firstFree)
+{
+	DSO_PROFILE_STAGE("poseGraphOptimize");
+
+	int dim = 6*((int)nodes.size() - firstFree);
+	std::vector<Eigen::Triplet<double>> triplets;
+	Eigen::SparseMatrix<double> H(dim, dim);
+	Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>> ldlt;	// AMD ordering.
+
+	lastChi2Before = buildSystem(firstFree, 0, 0);
+	for(int it=0;it<setting_poseGraphIterations;it++)
+	{
+		triplets.clear();
+		VecX b = VecX::Zero(dim);
+		buildSystem(firstFree, &triplets, &b);
+
+		// tiny damping: with few GPS factors, parts of the gauge can be unobserved.
+		for(int i=0;i<dim;i++)
+			triplets.push_back(Eigen::Triplet<double>(i, i, 1e-9));
+		H.setFromTriplets(triplets.begin(), triplets.end());
+
+		if(it == 0) ldlt.analyzePattern(H);
+		ldlt.factorize(H);
+		if(ldlt.info() != Eigen::Success) break;
+
+		VecX x = ldlt.solve(b);
+		for(int k=firstFree;k<(int)nodes.size();k++)
+			nodes[k]->pose = nodes[k]->pose * SE3::exp(-x.segment<6>(6*(k-firstFree)));
+
+		numIterations++;
+		if(x.lpNorm<Eigen::Infinity>() < 1e-9) break;
+	}
+	lastChi2After = buildSystem(firstFree, 0, 0);
+	numOptimizations++;
+}
+
+
+void PoseGraphBackend::writeBack(int from)
+{
+	boost::unique_lock<boost::mutex> crlock(*shellPoseMutex);
+	for(int k=from;k<(int)nodes.size();k++)
+	{
+		Node* n = nodes[k];
+		n->shell->camToWorld = n->pose;
+		for(FrameShell* s : n->attached)
+			s->camToWorld = n->pose * s->camToTrackingRef;
+	}
+}
+
+}
@@ -0,0 +1,158 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+ 
+#include "util/NumType.h"
+#include "boost/thread.hpp"
+#include <vector>
+#include <map>
+#include <Eigen/SparseCore>
+
+namespace dso
+{
+
+class FrameShell;
+
+/*
+ * fixed-lag pose graph over the marginalized keyframes, on its own thread.
+ *
+ * once a keyframe leaves the window, it becomes a node (pose camToWorld, in DSO world). it is connected
+ * to the setting_poseGraphNeighbours previously marginalized keyframes by relative-pose edges, measured
+ * from the window estimates at marginalization time, and optionally gets a GPS position factor. GPS is kept
+ * in the GPS frame and mapped into DSO world with the latest alignment on every update.
+ * the last setting_poseGraphWindow nodes are optimized with gauss-newton (sparse cholesky with AMD
+ * reordering), older nodes are kept fixed, and dropped once no edge of a free node reaches them.
+ * corrected poses are written back to FrameShell::camToWorld under [shellPoseMutex]; non-keyframes that
+ * were tracked against a node follow it (node * camToTrackingRef).
+ * the window keyframes stay in DSO world while running (they are the state of the window optimization);
+ * finish() moves them and their non-keyframes by the correction of the newest node.
+ *
+ * nodes are SE3, so scale drift is only corrected as far as the GPS factors pull the positions.
+ * addKeyframe() / attachFrame() only push into a queue, the mapping thread never waits for an optimization.
+ */
+class PoseGraphBackend
+{
+public:
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+
+	PoseGraphBackend(boost::mutex* shellPoseMutex);
+	~PoseGraphBackend();
+
+	// called by the mapping thread, with the final window estimate of the keyframe in shell->camToWorld.
+	// its GPS (if any) is taken from shell->camToWorld_predicted. oldestWindowId: shell id of the oldest
+	// keyframe still in the window; non-keyframes tracked against an older one that is not a node are dropped.
+	void addKeyframe(FrameShell* shell, int oldestWindowId);
+
+	// similarity DSO world -> GPS frame (EnergyFunctional::gpsR ...), used from the next update on.
+	void setGpsAlignment(bool valid, double scale, const Mat33 &R, const Vec3 &t);
+
+	// non-keyframe tracked against shell->trackingRef. corrected together with its reference once that is a node.
+	void attachFrame(FrameShell* shell);
+
+	// waits until all queued keyframes are optimized & written back.
+	void flush();
+
+	// shell id of the oldest frame the backend may still read or write (node, attached or queued frame).
+	// older shells can be deleted. INT_MAX if there is none.
+	int getOldestShellId();
+
+	// flush(), then applies the correction of the newest node to the remaining window keyframes and the
+	// non-keyframes tracked against them. call at the end, after the mapping thread has stopped; only the
+	// first call does anything (FullSystem's destructor calls it again).
+	void finish(const std::vector<FrameShell*> &window);
+
+	void printStats();
+
+private:
+	struct Node
+	{
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+		FrameShell* shell;
+		SE3 pose;			// optimized camToWorld.
+		SE3 poseOrig;		// window estimate at marginalization.
+		bool hasGps;
+		Vec3 gps;			// camera center in the GPS frame.
+		Mat33 gpsInfo;		// information matrix, GPS frame.
+		std::vector<FrameShell*> attached;
+	};
+	struct Edge
+	{
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+		int i, j;			// i < j, node indices.
+		SE3 meas;			// poseOrig_i^-1 * poseOrig_j.
+		Vec6 info;			// diagonal, (trans, rot).
+	};
+
+	void threadLoop();
+	void insertNode(Node* n);
+	void insertAttached(FrameShell* shell);
+	void pruneAttached(int oldestWindowId);
+	void pruneNodes(int firstFree);
+	double buildSystem(int firstFree, std::vector<Eigen::Triplet<double>>* triplets, VecX* b);
+	void optimize(int firstFree);
+	void writeBack(int from);
+
+	// only touched by the backend thread.
+	std::vector<Node*> nodes;
+	std::vector<Edge, Eigen::aligned_allocator<Edge>> edges;		// sorted by j.
+	std::map<int, int> nodeIdxByShellId;
+	std::map<int, std::vector<FrameShell*>> attachedByRef;			// ref shell id -> frames, ref not a node yet.
+	int firstDirtyAttached;											// lowest node that got new attached frames.
+	bool gpsValid;
+	double gpsScale;
+	Mat33 gpsR;
+	Vec3 gpsT;
+
+	// queue, protected by [queueMutex].
+	boost::mutex queueMutex;
+	boost::condition_variable queueSignal;
+	boost::condition_variable idleSignal;
+	std::vector<Node*> queuedNodes;
+	std::vector<FrameShell*> queuedAttached;
+	int queuedOldestWindowId;
+	bool queuedGpsValid;
+	double queuedGpsScale;
+	Mat33 queuedGpsR;
+	Vec3 queuedGpsT;
+	int oldestShellId;		// of the processed nodes / attached frames, see getOldestShellId.
+	int inFlightOldestId;	// of the ones taken from the queue and not processed yet.
+	bool busy;
+	bool running;
+	bool finished;		// finish() was called.
+	boost::thread thread;
+
+	boost::mutex* shellPoseMutex;
+
+	// statistics.
+	int numOptimizations;
+	int numIterations;
+	int numDroppedNodes;
+	int numDroppedAttached;
+	double lastChi2Before, lastChi2After;
+};
+
+}
+
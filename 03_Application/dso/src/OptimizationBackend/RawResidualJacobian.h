@@ -26,12 +26,13 @@
 
  
 #include "util/NumType.h"
+#include "util/SlabPool.h"
 
 namespace dso
 {
 struct RawResidualJacobian
 {
-	EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+	DSO_SLAB_POOLED_NEW(RawResidualJacobian);
 	// ================== new structure: save independently =============.
 	VecNRf resF;
 
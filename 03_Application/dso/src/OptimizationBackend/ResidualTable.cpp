@@ -0,0 +1,135 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "OptimizationBackend/ResidualTable.h"
+#include "OptimizationBackend/EnergyFunctionalStructs.h"
+#include "FullSystem/HessianBlocks.h"
+#include "FullSystem/Residuals.h"
+
+namespace dso
+{
+
+
+ResidualTable::ResidualTable()
+{
+	nResiduals=0;
+}
+ResidualTable::~ResidualTable()
+{
+	clear();
+}
+
+void ResidualTable::clear()
+{
+	for(std::pair<const uint64_t, ResidualBlock*> &b : blocks)
+		delete b.second;
+	blocks.clear();
+	nResiduals=0;
+}
+
+
+void ResidualTable::insert(EFResidual* r)
+{
+	uint64_t key = (((uint64_t)r->host->frameID) << 32) + ((uint64_t)r->target->frameID);
+	ResidualBlock* &b = blocks[key];
+	if(b==0)
+	{
+		b = new ResidualBlock();
+		b->host = r->host;
+		b->target = r->target;
+	}
+
+	PointHessian* ph = r->data->point;
+	r->block = b;
+	r->idxInBlock = b->size();
+
+	b->residuals.push_back(r->data);
+	b->u.push_back(ph->u);
+	b->v.push_back(ph->v);
+	for(int i=0;i<MAX_RES_PER_POINT;i++)
+	{
+		b->color.push_back(i < patternNum ? ph->color[i] : 0);
+		b->weights.push_back(i < patternNum ? ph->weights[i] : 0);
+	}
+	nResiduals++;
+}
+
+
+void ResidualTable::remove(EFResidual* r)
+{
+	ResidualBlock* b = r->block;
+	int idx = r->idxInBlock;
+	int last = b->size()-1;
+	assert(b->residuals[idx] == r->data);
+
+	// move last into the gap.
+	if(idx != last)
+	{
+		b->residuals[idx] = b->residuals[last];
+		b->u[idx] = b->u[last];
+		b->v[idx] = b->v[last];
+		memcpy(b->color.data()+idx*MAX_RES_PER_POINT, b->colorOf(last), sizeof(float)*MAX_RES_PER_POINT);
+		memcpy(b->weights.data()+idx*MAX_RES_PER_POINT, b->weightsOf(last), sizeof(float)*MAX_RES_PER_POINT);
+		b->residuals[idx]->efResidual->idxInBlock = idx;
+	}
+
+	b->residuals.pop_back();
+	b->u.pop_back();
+	b->v.pop_back();
+	b->color.resize(last*MAX_RES_PER_POINT);
+	b->weights.resize(last*MAX_RES_PER_POINT);
+
+	r->block = 0;
+	r->idxInBlock = -1;
+	nResiduals--;
+
+	if(b->size()==0)
+	{
+		blocks.erase((((uint64_t)b->host->frameID) << 32) + ((uint64_t)b->target->frameID));
+		delete b;
+	}
+}
+
+
+void ResidualTable::getActive(std::vector<PointFrameResidual*> &res, std::vector<ResidualSlot> &slots) const
+{
+	res.clear();
+	slots.clear();
+	res.reserve(nResiduals);
+	slots.reserve(nResiduals);
+
+	for(const std::pair<const uint64_t, ResidualBlock*> &bp : blocks)
+	{
+		ResidualBlock* b = bp.second;
+		for(int i=0;i<b->size();i++)
+		{
+			if(b->residuals[i]->efResidual->isLinearized) continue;
+			res.push_back(b->residuals[i]);
+			ResidualSlot s; s.block = b; s.idx = i;
+			slots.push_back(s);
+		}
+	}
+}
+
+}
@@ -0,0 +1,92 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+ 
+#include "util/NumType.h"
+#include "vector"
+#include "map"
+
+namespace dso
+{
+
+class PointFrameResidual;
+class EFResidual;
+class EFFrame;
+
+
+/*
+ * all residuals of one (host,target) pair, structure-of-arrays.
+ * holds the per-point data linearize() needs that never change over the lifetime of a point
+ * (pixel position, reference colors, pattern weights), contiguous in memory.
+ */
+class ResidualBlock
+{
+public:
+	EFFrame* host;
+	EFFrame* target;
+
+	std::vector<PointFrameResidual*> residuals;
+	std::vector<float> u;
+	std::vector<float> v;
+	std::vector<float> color;			// MAX_RES_PER_POINT per residual, one vector load in linearizePatternAVX2.
+	std::vector<float> weights;			// MAX_RES_PER_POINT per residual, one vector load in linearizePatternAVX2.
+
+	inline int size() const {return residuals.size();}
+	inline const float* colorOf(int idx) const {return color.data() + idx*MAX_RES_PER_POINT;}
+	inline const float* weightsOf(int idx) const {return weights.data() + idx*MAX_RES_PER_POINT;}
+};
+
+struct ResidualSlot
+{
+	ResidualBlock* block;
+	int idx;
+};
+
+
+/*
+ * residual store grouped by (host,target), kept in sync by EnergyFunctional::insertResidual / dropResidual.
+ * blocks are ordered by (host frameID, target frameID), so iterating over them visits
+ * all residuals of one frame pair (same precalc, same target image) in a row.
+ */
+class ResidualTable
+{
+public:
+	ResidualTable();
+	~ResidualTable();
+
+	void insert(EFResidual* r);
+	void remove(EFResidual* r);
+	void clear();
+
+	// all residuals that are not linearized, in block order.
+	void getActive(std::vector<PointFrameResidual*> &res, std::vector<ResidualSlot> &slots) const;
+
+	std::map<uint64_t, ResidualBlock*> blocks;
+	int nResiduals;
+};
+
+}
+
@@ -0,0 +1,587 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+ * headless benchmark: runs the full pipeline over a sequence, several times and for several thread
+ * counts, without GUI, real-time sleeps or log files, and writes the results as JSON.
+ *
+ * the frames are decoded once into an in-memory cache of fixed size (cache=[MB]); if the sequence does
+ * not fit, it is cut, so every run sees exactly the same input and decoding is never timed.
+ *
+ * e.g. dso_bench files=... calib=... mode=1 poses=poses.csv reps=3 threads=1,2,4,8 out=bench.json
+ *
+ * mapthread=1: mapping on its own thread (as in real-time operation) instead of after every frame; the
+ * JSON then also has the tracking->mapping queue metrics of every run.
+ *
+ * poolbench=1: no sequence, only compares the reduce pool (IndexThreadReduce) against the old barrier-based
+ * one on synthetic loads, for each of threads=..., e.g. dso_bench poolbench=1 threads=1,2,4,8 out=pool.json
+ */
+
+#include <locale.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/time.h>
+#include <math.h>
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <Eigen/Geometry>
+#include <boost/bind.hpp>
+
+#include "util/settings.h"
+#include "util/globalFuncs.h"
+#include "util/DatasetReader.h"
+#include "util/StageProfiler.h"
+#include "util/globalCalib.h"
+#include "util/NumType.h"
+#include "util/IndexThreadReduce.h"
+#include "FullSystem/FullSystem.h"
+
+
+std::string vignette = "";
+std::string gammaCalib = "";
+std::string source = "";
+std::string calib = "";
+std::string poses = "";
+std::string outFile = "bench.json";
+int start=0;
+int end=100000;
+int reps=3;
+int cacheMB=2048;
+bool usePosePriors=false;
+bool poolBench=false;
+bool mapThread=false;
+std::vector<int> threadCounts;
+
+using namespace dso;
+
+
+
+void parseArgument(char* arg)
+{
+	int option;
+	float foption;
+	char buf[1000];
+
+	if(1==sscanf(arg,"files=%s",buf)) { source = buf; return; }
+	if(1==sscanf(arg,"calib=%s",buf)) { calib = buf; return; }
+	if(1==sscanf(arg,"vignette=%s",buf)) { vignette = buf; return; }
+	if(1==sscanf(arg,"gamma=%s",buf)) { gammaCalib = buf; return; }
+	if(1==sscanf(arg,"poses=%s",buf)) { poses = buf; return; }
+	if(1==sscanf(arg,"out=%s",buf)) { outFile = buf; return; }
+	if(1==sscanf(arg,"start=%d",&option)) { start = option; return; }
+	if(1==sscanf(arg,"end=%d",&option)) { end = option; return; }
+	if(1==sscanf(arg,"reps=%d",&option)) { reps = std::max(1, option); return; }
+	if(1==sscanf(arg,"cache=%d",&option)) { cacheMB = option; return; }
+	if(1==sscanf(arg,"priors=%d",&option)) { usePosePriors = option==1; return; }
+	if(1==sscanf(arg,"poolbench=%d",&option)) { poolBench = option==1; return; }
+	if(1==sscanf(arg,"mapthread=%d",&option)) { mapThread = option==1; return; }
+	if(1==sscanf(arg,"posegraph=%d",&option)) { setting_poseGraph = option==1; return; }
+	if(1==sscanf(arg,"gpsweight=%f",&foption)) { setting_gpsPriorWeight = foption; return; }
+	if(1==sscanf(arg,"maxframes=%d",&option)) { setting_maxFrames = option; setting_minFrames = std::min(setting_minFrames, option); return; }
+	if(1==sscanf(arg,"threads=%s",buf))
+	{
+		// comma separated list.
+		std::stringstream ss(buf);
+		std::string item;
+		while(std::getline(ss, item, ','))
+			if(atoi(item.c_str()) > 0) threadCounts.push_back(atoi(item.c_str()));
+		return;
+	}
+	if(1==sscanf(arg,"mode=%d",&option))
+	{
+		if(option==1)
+		{
+			setting_photometricCalibration = 0;
+			setting_affineOptModeA = 0;
+			setting_affineOptModeB = 0;
+		}
+		if(option==2)
+		{
+			setting_photometricCalibration = 0;
+			setting_affineOptModeA = -1;
+			setting_affineOptModeB = -1;
+			setting_minGradHistAdd=3;
+		}
+		return;
+	}
+	if(1==sscanf(arg,"preset=%d",&option))
+	{
+		// only the accuracy / speed tradeoff of the presets; real-time enforcing does not apply here.
+		if(option == 2 || option == 3)
+		{
+			setting_desiredImmatureDensity = 600;
+			setting_desiredPointDensity = 800;
+			setting_minFrames = 4;
+			setting_maxFrames = 6;
+			setting_maxOptIterations=4;
+			setting_minOptIterations=1;
+			benchmarkSetting_width = 424;
+			benchmarkSetting_height = 320;
+		}
+		return;
+	}
+
+	printf("could not parse argument \"%s\"!!!!\n", arg);
+	exit(1);
+}
+
+
+static double wallSeconds()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec*1e-6;
+}
+
+
+/*
+ * the reduce pool before the work-stealing version: one mutex, chunks handed out under it, and a
+ * barrier at the end of every reduce. kept here only as the reference for poolbench=1.
+ */
+class BarrierThreadReduce
+{
+public:
+	inline BarrierThreadReduce(int numThreads) : numThreads(numThreads), isDone(numThreads), gotOne(numThreads)
+	{
+		nextIndex = maxIndex = 0;
+		stepSize = 1;
+		running = true;
+		for(int i=0;i<numThreads;i++)
+		{
+			isDone[i] = false;
+			gotOne[i] = true;
+			workerThreads.push_back(boost::thread(&BarrierThreadReduce::workerLoop, this, i));
+		}
+	}
+	inline ~BarrierThreadReduce()
+	{
+		{
+			boost::unique_lock<boost::mutex> lock(exMutex);
+			running = false;
+			todo_signal.notify_all();
+		}
+		for(boost::thread &t : workerThreads) t.join();
+	}
+
+	inline void reduce(boost::function<void(int,int,Vec10*,int)> callPerIndex, int first, int end, int stepSize = 0)
+	{
+		stats.setZero();
+		if(stepSize == 0)
+			stepSize = ((end-first)+numThreads-1)/numThreads;
+		if(stepSize < 1) stepSize = 1;
+
+		boost::unique_lock<boost::mutex> lock(exMutex);
+		this->callPerIndex = callPerIndex;
+		nextIndex = first;
+		maxIndex = end;
+		this->stepSize = stepSize;
+		for(int i=0;i<numThreads;i++)
+		{
+			isDone[i] = false;
+			gotOne[i] = false;
+		}
+		todo_signal.notify_all();
+
+		while(true)
+		{
+			bool allDone = true;
+			for(int i=0;i<numThreads;i++)
+				allDone = allDone && isDone[i];
+			if(allDone) break;
+			done_signal.wait(lock);
+		}
+		nextIndex = maxIndex = 0;
+	}
+
+	Vec10 stats;
+
+private:
+	int numThreads;
+	std::vector<boost::thread> workerThreads;
+	std::vector<char> isDone;
+	std::vector<char> gotOne;
+	boost::mutex exMutex;
+	boost::condition_variable todo_signal;
+	boost::condition_variable done_signal;
+	int nextIndex, maxIndex, stepSize;
+	bool running;
+	boost::function<void(int,int,Vec10*,int)> callPerIndex;
+
+	void workerLoop(int idx)
+	{
+		boost::unique_lock<boost::mutex> lock(exMutex);
+		while(running)
+		{
+			if(nextIndex < maxIndex)
+			{
+				int todo = nextIndex;
+				nextIndex += stepSize;
+				int max = std::min(todo+stepSize, maxIndex);
+				lock.unlock();
+				Vec10 s = Vec10::Zero();
+				callPerIndex(todo, max, &s, idx);
+				lock.lock();
+				gotOne[idx] = true;
+				stats += s;
+			}
+			else
+			{
+				if(!gotOne[idx])
+				{
+					lock.unlock();
+					Vec10 s = Vec10::Zero();
+					callPerIndex(0, 0, &s, idx);
+					lock.lock();
+					gotOne[idx] = true;
+					stats += s;
+				}
+				if(!isDone[idx])
+				{
+					isDone[idx] = true;
+					done_signal.notify_all();
+				}
+				todo_signal.wait(lock);
+			}
+		}
+	}
+};
+
+
+// synthetic per-index work: [skew]=0 uniform, otherwise the cost grows with the index (unbalanced chunks).
+static void poolWork(int skew, int min, int max, Vec10* stats, int tid)
+{
+	double acc = 0;
+	for(int i=min;i<max;i++)
+	{
+		int n = skew ? 1 + (i % 1000)/8 : 16;
+		for(int k=0;k<n;k++) acc += sin(0.001*(i+k));
+	}
+	(*stats)[0] += acc;
+}
+
+struct PoolResult
+{
+	int threads;
+	std::string load;
+	double oldUs, newUs;		// mean wall time per reduce.
+};
+
+template<typename Pool>
+static double timeReduce(Pool &pool, int skew, int end, int step, int iterations)
+{
+	pool.reduce(boost::bind(&poolWork, skew, _1, _2, _3, _4), 0, end, step);	// warm up.
+	double t0 = wallSeconds();
+	for(int it=0;it<iterations;it++)
+		pool.reduce(boost::bind(&poolWork, skew, _1, _2, _3, _4), 0, end, step);
+	return (wallSeconds()-t0) * 1e6 / iterations;
+}
+
+static std::vector<PoolResult> runPoolBench()
+{
+	// empty: setZero-style calls (every worker once, no work). uniform / skewed: accumulation-style calls.
+	struct Load { const char* name; int skew, end, step, iterations; };
+	const Load loads[] = {{"empty", 0, 0, 0, 20000}, {"uniform", 0, 20000, 50, 500}, {"skewed", 1, 20000, 50, 500}};
+
+	std::vector<PoolResult> results;
+	for(int threads : threadCounts)
+	{
+		BarrierThreadReduce oldPool(threads);
+		IndexThreadReduce<Vec10> newPool(threads);
+		for(const Load &l : loads)
+		{
+			PoolResult r;
+			r.threads = threads;
+			r.load = l.name;
+			r.oldUs = timeReduce(oldPool, l.skew, l.end, l.step, l.iterations);
+			r.newUs = timeReduce(newPool, l.skew, l.end, l.step, l.iterations);
+			printf("dso_bench: pool, %d threads, %s: barrier %.1fus, work-stealing %.1fus per reduce.\n",
+					threads, l.name, r.oldUs, r.newUs);
+			results.push_back(r);
+		}
+	}
+	return results;
+}
+
+static void writePoolJSON(std::string file, const std::vector<PoolResult> &results)
+{
+	std::ofstream f(file.c_str());
+	f << std::setprecision(6);
+	f << "{\n  \"pool\": [\n";
+	for(unsigned int i=0;i<results.size();i++)
+	{
+		const PoolResult &r = results[i];
+		f << "    {\"threads\": " << r.threads << ", \"load\": \"" << r.load
+				<< "\", \"barrier_us\": " << r.oldUs << ", \"stealing_us\": " << r.newUs
+				<< "}" << (i+1 < results.size() ? "," : "") << "\n";
+	}
+	f << "  ]\n}\n";
+	f.close();
+}
+
+
+// absolute trajectory error (RMSE of the positions), after a sim(3) alignment: monocular scale is arbitrary.
+// -1 if there are not enough matched frames.
+static double computeATE(const std::vector<SE3> &est, const std::vector<int> &estIds, const std::vector<SE3> &gt)
+{
+	std::vector<Vec3> a, b;
+	for(unsigned int i=0;i<est.size();i++)
+	{
+		if(estIds[i] < 0 || estIds[i] >= (int)gt.size()) continue;
+		a.push_back(est[i].translation());
+		b.push_back(gt[estIds[i]].translation());
+	}
+	if(a.size() < 3) return -1;
+
+	Eigen::Matrix<double,3,Eigen::Dynamic> A(3, a.size()), B(3, a.size());
+	for(unsigned int i=0;i<a.size();i++)
+	{
+		A.col(i) = a[i];
+		B.col(i) = b[i];
+	}
+
+	Eigen::Matrix4d T = Eigen::umeyama(A, B, true);
+	double sse=0;
+	for(unsigned int i=0;i<a.size();i++)
+		sse += (T.topLeftCorner<3,3>()*A.col(i) + T.topRightCorner<3,1>() - B.col(i)).squaredNorm();
+	return sqrt(sse / a.size());
+}
+
+
+struct BenchRun
+{
+	int threads;
+	int rep;
+	int frames;			// actually fed, less than the sequence if lost.
+	int keyframes;
+	double seconds;
+	double ate;
+	bool lost;
+	int resets;
+	MappingQueueStats queue;		// only if mapThread.
+	std::map<std::string, StageStats> stages;
+};
+
+
+static BenchRun runOnce(ImageFolderReader* reader, const std::vector<ImageAndExposure*> &images,
+		const std::vector<int> &ids, int threads, int rep)
+{
+	setting_numThreads = threads;
+
+	BenchRun r;
+	r.threads = threads;
+	r.rep = rep;
+	r.lost = false;
+	r.resets = 0;
+
+	FullSystem* fullSystem = new FullSystem();
+	fullSystem->setGammaFunction(reader->getPhotometricGamma());
+	fullSystem->linearizeOperation = !mapThread;
+	if(usePosePriors) fullSystem->setCameraPoses(reader->getCameraPoses());
+
+	long long sinceNs = StageProfiler::nowNs();
+	double tStart = wallSeconds();
+
+	r.frames = 0;
+	for(unsigned int ii=0;ii<images.size();ii++)
+	{
+		fullSystem->addActiveFrame(images[ii], ids[ii]);
+		r.frames++;
+
+		// same reset policy as main_dso_pangolin.
+		if(fullSystem->initFailed || setting_fullResetRequested)
+		{
+			if(ii < 250 || setting_fullResetRequested)
+			{
+				delete fullSystem;
+				fullSystem = new FullSystem();
+				fullSystem->setGammaFunction(reader->getPhotometricGamma());
+				fullSystem->linearizeOperation = !mapThread;
+				if(usePosePriors) fullSystem->setCameraPoses(reader->getCameraPoses());
+				setting_fullResetRequested=false;
+				r.resets++;
+			}
+		}
+
+		if(fullSystem->isLost)
+		{
+			r.lost = true;
+			break;
+		}
+	}
+	fullSystem->blockUntilMappingIsFinished();
+
+	r.seconds = wallSeconds() - tStart;
+	r.keyframes = fullSystem->getNumKeyframes();
+	r.queue = fullSystem->getMappingQueueStats();
+	StageProfiler::getAllStats(r.stages, sinceNs);
+
+	r.ate = -1;
+	if(reader->getCameraPoses().size() > 0)
+	{
+		std::vector<SE3> est;
+		std::vector<int> estIds;
+		fullSystem->getTrajectory(est, estIds);
+		r.ate = computeATE(est, estIds, reader->getCameraPoses());
+	}
+
+	delete fullSystem;
+	return r;
+}
+
+
+// as a JSON string literal (without the quotes).
+static std::string jsonEscape(const std::string &s)
+{
+	std::string out;
+	for(char c : s)
+	{
+		if(c == '"' || c == '\\') { out += '\\'; out += c; }
+		else if((unsigned char)c < 0x20)
+		{
+			char buf[8];
+			snprintf(buf, sizeof(buf), "\\u%04x", (unsigned char)c);
+			out += buf;
+		}
+		else out += c;
+	}
+	return out;
+}
+
+static void writeJSON(std::string file, const std::vector<BenchRun> &runs, int numFrames)
+{
+	std::ofstream f(file.c_str());
+	f << std::setprecision(6);
+	f << "{\n  \"sequence\": \"" << jsonEscape(source) << "\",\n  \"frames\": " << numFrames << ",\n  \"reps\": " << reps << ",\n  \"runs\": [\n";
+	for(unsigned int i=0;i<runs.size();i++)
+	{
+		const BenchRun &r = runs[i];
+		f << "    {\"threads\": " << r.threads << ", \"rep\": " << r.rep
+				<< ", \"frames\": " << r.frames
+				<< ", \"seconds\": " << r.seconds
+				<< ", \"fps\": " << r.frames / r.seconds
+				<< ", \"keyframes\": " << r.keyframes
+				<< ", \"kfps\": " << r.keyframes / r.seconds
+				<< ", \"ate_rmse\": ";
+		if(r.ate >= 0) f << r.ate; else f << "null";
+		f << ", \"lost\": " << (r.lost ? "true" : "false")
+				<< ", \"resets\": " << r.resets;
+		if(mapThread)
+		{
+			const MappingQueueStats &q = r.queue;
+			f << ",\n      \"queue\": {\"capacity\": " << q.ring.capacity << ", \"pushed\": " << q.ring.numPushed
+					<< ", \"depth_avg\": " << q.ring.avgDepth << ", \"depth_max\": " << q.ring.maxDepth
+					<< ", \"producer_waits\": " << q.ring.numProducerWaits << ", \"producer_wait_ms\": " << q.ring.msProducerWaited
+					<< ", \"consumer_waits\": " << q.ring.numConsumerWaits << ", \"consumer_wait_ms\": " << q.ring.msConsumerWaited
+					<< ", \"dropped\": " << q.numDropped << ", \"coalesced\": " << q.numCoalesced << ", \"lost\": " << q.numLost << "}";
+		}
+		f << ",\n      \"stages\": {";
+
+		bool first=true;
+		for(auto &s : r.stages)
+		{
+			f << (first ? "\n" : ",\n") << "        \"" << jsonEscape(s.first) << "\": {\"count\": " << s.second.count
+					<< ", \"mean_ms\": " << s.second.meanMs << ", \"p50_ms\": " << s.second.p50Ms
+					<< ", \"p90_ms\": " << s.second.p90Ms << ", \"p99_ms\": " << s.second.p99Ms
+					<< ", \"max_ms\": " << s.second.maxMs << "}";
+			first=false;
+		}
+		f << "}}" << (i+1 < runs.size() ? "," : "") << "\n";
+	}
+	f << "  ]\n}\n";
+	f.close();
+}
+
+
+int main( int argc, char** argv )
+{
+	for(int i=1; i<argc;i++)
+		parseArgument(argv[i]);
+	if(threadCounts.size() == 0) threadCounts.push_back(setting_numThreads);
+
+	if(poolBench)
+	{
+		writePoolJSON(outFile, runPoolBench());
+		printf("dso_bench: wrote %s\n", outFile.c_str());
+		return 0;
+	}
+
+	// no GUI, no logs, no sleeps, no console noise. stage timing on.
+	disableAllDisplay = true;
+	setting_debugout_runquiet = true;
+	setting_logStuff = false;
+	setting_profileStages = true;
+
+	ImageFolderReader* reader = new ImageFolderReader(source, calib, gammaCalib, vignette, poses);
+	reader->setGlobalCalibration();
+
+	if(setting_photometricCalibration > 0 && reader->getPhotometricGamma() == 0)
+	{
+		printf("ERROR: dont't have photometric calibation. Need to use commandline options mode=1 or mode=2 ");
+		exit(1);
+	}
+
+
+	// fill the cache.
+	long long bytesPerFrame = (long long)wG[0]*hG[0]*sizeof(float);
+	int maxCached = std::max(1LL, (long long)cacheMB*1024*1024 / bytesPerFrame);
+	std::vector<int> ids;
+	for(int i=start; i<end && i<reader->getNumImages(); i++)
+		ids.push_back(i);
+	if((int)ids.size() > maxCached)
+	{
+		printf("dso_bench: sequence cut to %d of %d frames, to fit cache=%dMB.\n", maxCached, (int)ids.size(), cacheMB);
+		ids.resize(maxCached);
+	}
+
+	std::vector<ImageAndExposure*> images;
+	for(int id : ids)
+		images.push_back(reader->getImage(id));
+	printf("dso_bench: cached %d frames (%.1fMB).\n", (int)images.size(), images.size()*bytesPerFrame/(1024.0*1024.0));
+
+
+	std::vector<BenchRun> runs;
+	for(int threads : threadCounts)
+		for(int rep=0;rep<reps;rep++)
+		{
+			BenchRun r = runOnce(reader, images, ids, threads, rep);
+			printf("dso_bench: threads %d rep %d: %.2f fps, %.2f kf/s, ATE %.4f%s\n",
+					threads, rep, r.frames / r.seconds, r.keyframes / r.seconds, r.ate, r.lost ? " (LOST)" : "");
+			runs.push_back(r);
+		}
+
+	writeJSON(outFile, runs, images.size());
+	printf("dso_bench: wrote %s\n", outFile.c_str());
+
+	for(ImageAndExposure* img : images) delete img;
+	delete reader;
+	return 0;
+}
@@ -38,6 +38,9 @@
 #include "util/settings.h"
 #include "util/globalFuncs.h"
 #include "util/DatasetReader.h"
+#include "util/FramePrefetcher.h"
+#include "util/StageProfiler.h"
+#include "util/KeyframeArchive.h"
 #include "util/globalCalib.h"
 
 #include "util/NumType.h"
@@ -49,6 +52,8 @@
 
 #include "IOWrapper/Pangolin/PangolinDSOViewer.h"
 #include "IOWrapper/OutputWrapper/SampleOutputWrapper.h"
+#include "IOWrapper/OutputWrapper/BinaryMapOutputWrapper.h"
+#include "IOWrapper/OutputWrapper/OutputDispatcher.h"
 
 
 std::string vignette = "";
@@ -56,14 +61,16 @@ std::string gammaCalib = "";
 std::string source = "";
 std::string calib = "";
 std::string poses = ""; // Added for reading in available camera poses
+std::string archiveFile = "";	// marginalized keyframes are written here (KeyframeArchive).
+std::string binaryMapFile = "";	// keyframes, poses & graph are streamed here (BinaryMapOutputWrapper).
 double rescale = 1;
 bool reverse = false;
 bool disableROS = false;
 int start=0;
 int end=100000;
-bool prefetch = false;
+int prefetchFrames=8;		// how many frames are decoded ahead of tracking. memory is bounded by this.
+int prefetchWorkers=2;		// decode / undistort threads. 0: decode on the tracking thread.
 float playbackSpeed=0;	// 0 for linearize (play as fast as possible, while sequentializing tracking & mapping). otherwise, factor on timestamps.
-bool preload=false;
 bool useSampleOutput=false;
 
 
@@ -111,7 +118,6 @@ void settingsDefault(int preset)
 				"- original image resolution\n", preset==0 ? "no " : "1x");
 
 		playbackSpeed = (preset==0 ? 0 : 1);
-		preload = preset==1;
 		setting_desiredImmatureDensity = 1500;
 		setting_desiredPointDensity = 2000;
 		setting_minFrames = 5;
@@ -132,7 +138,6 @@ void settingsDefault(int preset)
 				"- 424 x 320 image resolution\n", preset==0 ? "no " : "5x");
 
 		playbackSpeed = (preset==2 ? 0 : 5);
-		preload = preset==3;
 		setting_desiredImmatureDensity = 600;
 		setting_desiredPointDensity = 800;
 		setting_minFrames = 4;
@@ -248,13 +253,89 @@ void parseArgument(char* arg)
 		}
 		return;
 	}
+	if(1==sscanf(arg,"threads=%d",&option))
+	{
+		setting_numThreads = option;
+		printf("USING %d WORKER THREADS (max %d)!\n", setting_numThreads, NUM_THREADS);
+		return;
+	}
+	if(1==sscanf(arg,"simd=%d",&option))
+	{
+		setting_simdLevel = option;
+		printf("LIMITING SIMD LEVEL TO %d (0: SSE, 1: AVX2, 2: AVX-512)!\n", setting_simdLevel);
+		return;
+	}
+	if(1==sscanf(arg,"posegraph=%d",&option))
+	{
+		setting_poseGraph = option==1;
+		if(setting_poseGraph) printf("CORRECTING MARGINALIZED KEYFRAMES WITH A POSE GRAPH!\n");
+		return;
+	}
+	if(1==sscanf(arg,"gpsweight=%f",&foption))
+	{
+		setting_gpsPriorWeight = foption;
+		if(setting_gpsPriorWeight > 0) printf("USING THE EXTERNAL POSITIONS AS GPS PRIORS, WEIGHT %f!\n", setting_gpsPriorWeight);
+		return;
+	}
+	if(1==sscanf(arg,"membudget=%d",&option))
+	{
+		setting_memoryBudgetMB = option;
+		printf("KEEPING AT MOST %d MB OF FRAME HISTORY, OLDER FRAMES GO TO THE ARCHIVE!\n", setting_memoryBudgetMB);
+		return;
+	}
+	if(1==sscanf(arg,"viewerbudget=%d",&option))
+	{
+		setting_viewerMemoryBudgetMB = option;
+		printf("KEEPING AT MOST %d MB OF KEYFRAME POINTCLOUDS FOR DISPLAY!\n", setting_viewerMemoryBudgetMB);
+		return;
+	}
+	if(1==sscanf(arg,"renderbudget=%d",&option))
+	{
+		setting_render_frameBudgetMs = option;
+		printf("3D VIEW: %d MS PER FRAME!\n", option);
+		return;
+	}
+	if(1==sscanf(arg,"mapqueue=%d",&option))
+	{
+		setting_mappingQueueSize = option;
+		printf("MAPPING QUEUE HOLDS %d FRAMES!\n", setting_mappingQueueSize);
+		return;
+	}
+	if(1==sscanf(arg,"outqueue=%d",&option))
+	{
+		setting_outputQueueSize = option;
+		if(option > 0) printf("OUTPUT WRAPPERS QUEUE %d MESSAGES ON THEIR OWN THREAD!\n", setting_outputQueueSize);
+		else printf("OUTPUT WRAPPERS RUN ON THE SOLVER THREADS!\n");
+		return;
+	}
+	if(1==sscanf(arg,"kfonly=%d",&option))
+	{
+		setting_outputKeyframesOnly = option==1;
+		if(setting_outputKeyframesOnly) printf("OUTPUT WRAPPERS ONLY GET KEYFRAMES!\n");
+		return;
+	}
+	if(1==sscanf(arg,"mappolicy=%d",&option))
+	{
+		setting_mappingQueuePolicy = option;
+		printf("MAPPING QUEUE FULL: %s!\n", option==1 ? "DROP NON-KEYFRAMES" : "TRACKER WAITS");
+		return;
+	}
+	if(1==sscanf(arg,"profile=%d",&option))
+	{
+		setting_profileStages = option==1;
+		if(setting_profileStages) printf("PROFILING STAGE LATENCIES!\n");
+		return;
+	}
 	if(1==sscanf(arg,"prefetch=%d",&option))
 	{
-		if(option==1)
-		{
-			prefetch = true;
-			printf("PREFETCH!\n");
-		}
+		prefetchFrames = option;
+		printf("PREFETCHING %d FRAMES AHEAD!\n", prefetchFrames);
+		return;
+	}
+	if(1==sscanf(arg,"decoders=%d",&option))
+	{
+		prefetchWorkers = option;
+		printf("USING %d DECODER THREADS!\n", prefetchWorkers);
 		return;
 	}
 	if(1==sscanf(arg,"start=%d",&option))
@@ -291,6 +372,20 @@ void parseArgument(char* arg)
 		return;
 	}
 
+	if(1==sscanf(arg,"archive=%s",buf))
+	{
+		archiveFile = buf;
+		printf("WRITING MARGINALIZED KEYFRAMES TO %s!\n", archiveFile.c_str());
+		return;
+	}
+
+	if(1==sscanf(arg,"binmap=%s",buf))
+	{
+		binaryMapFile = buf;
+		printf("WRITING BINARY MAP TO %s!\n", binaryMapFile.c_str());
+		return;
+	}
+
 	if(1==sscanf(arg,"gamma=%s",buf))
 	{
 		gammaCalib = buf;
@@ -415,6 +510,9 @@ int main( int argc, char** argv )
     // This is the heart of the algorithm. Almost everything is contained in
     // the "FullSystem". Create it:
     FullSystem* fullSystem = new FullSystem();
+    // survives resets; keyframes of a failed start stay in the file.
+    KeyframeArchive* kfArchive = archiveFile != "" ? new KeyframeArchive(archiveFile) : 0;
+    fullSystem->setKeyframeArchive(kfArchive);
     // The gamma function is set per complete image sequence set.
     // The photometric gamma is determined based on the file "pcalib.txt",
     // which contains 256 values ranging from 0.0 to 255.0.
@@ -449,8 +547,23 @@ int main( int argc, char** argv )
 
 
 
+    // outqueue>0 or kfonly: all but the viewer get their own dispatcher thread (the viewer only copies in its callbacks anyway).
+    // kfonly without outqueue: a queue of 64, i.e. several seconds of keyframes; a queue of 1 would make the solver wait
+    // for every keyframe write.
+    auto addOutputWrapper = [&](IOWrap::Output3DWrapper* ow, IOWrap::OutputDispatcher::DropPolicy policy)
+    {
+        if(setting_outputKeyframesOnly) policy = IOWrap::OutputDispatcher::KEYFRAMES_ONLY;
+        if(setting_outputQueueSize > 0 || setting_outputKeyframesOnly)
+            ow = new IOWrap::OutputDispatcher(ow, setting_outputQueueSize > 0 ? setting_outputQueueSize : 64, policy);
+        fullSystem->outputWrapper.push_back(ow);
+    };
+
+    // the csv and the map file have to be complete: nothing is dropped, a lagging writer makes the solver wait.
     if(useSampleOutput)
-        fullSystem->outputWrapper.push_back(new IOWrap::SampleOutputWrapper());
+        addOutputWrapper(new IOWrap::SampleOutputWrapper(), IOWrap::OutputDispatcher::DROP_NONE);
+
+    if(binaryMapFile != "")
+        addOutputWrapper(new IOWrap::BinaryMapOutputWrapper(binaryMapFile), IOWrap::OutputDispatcher::DROP_NONE);
 
 
 
@@ -479,17 +592,8 @@ int main( int argc, char** argv )
         }
 
         
-        std::vector<ImageAndExposure*> preloadedImages;
-        if(preload)
-        {
-            printf("LOADING ALL IMAGES!\n");
-            // Get which IDs we want to use and push them back in the image list
-            for(int ii=0;ii<(int)idsToPlay.size(); ii++)
-            {
-                int i = idsToPlay[ii];
-                preloadedImages.push_back(reader->getImage(i));
-            }
-        }
+        // decodes the frames we want to use in the background, a bounded number ahead.
+        FramePrefetcher prefetcher(reader, idsToPlay, prefetchWorkers, prefetchFrames);
 
         struct timeval tv_start;
         gettimeofday(&tv_start, NULL);
@@ -519,14 +623,10 @@ int main( int argc, char** argv )
 
             //*****************************************************
             //
-            // STEP2: Load image on-the-fly or use preloaded images
+            // STEP2: Get the image from the prefetcher (blocks if it is not decoded yet)
             //
             //*****************************************************
-            ImageAndExposure* img;
-            if(preload)
-                img = preloadedImages[ii];
-            else
-                img = reader->getImage(i);
+            ImageAndExposure* img = prefetcher.get(ii);
 
 
             //*****************************************************
@@ -558,8 +658,8 @@ int main( int argc, char** argv )
             
             if(!skipFrame) fullSystem->addActiveFrame(img, i);
 
-            // Free memory reserved for a pointer to the image object
-            delete img;
+            // Hand the image buffer back to the prefetcher
+            prefetcher.recycle(img);
 
             //*****************************************************
             //
@@ -580,6 +680,7 @@ int main( int argc, char** argv )
                     fullSystem = new FullSystem();
                     fullSystem->setGammaFunction(reader->getPhotometricGamma());
                     fullSystem->linearizeOperation = (playbackSpeed==0);
+                    fullSystem->setKeyframeArchive(kfArchive);
 
                     fullSystem->outputWrapper = wraps;
 
@@ -612,6 +713,12 @@ int main( int argc, char** argv )
         gettimeofday(&tv_end, NULL);
 
 
+        if(!setting_debugout_runquiet) prefetcher.printStats();
+        if(setting_profileStages)
+        {
+            StageProfiler::printSummary();
+            StageProfiler::dumpChromeTrace("stageTrace.json");
+        }
         fullSystem->printResult("result.txt");
 
 
@@ -662,6 +769,7 @@ int main( int argc, char** argv )
 
 	printf("DELETE FULLSYSTEM!\n");
 	delete fullSystem;
+	if(kfArchive != 0) delete kfArchive;
 
 	printf("DELETE READER!\n");
 	delete reader;
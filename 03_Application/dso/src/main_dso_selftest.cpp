@@ -0,0 +1,356 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+/*
+ * self-checks of the optimized kernels against their reference implementation, on random input.
+ * needs no data, prints one line per check and returns non-zero if any of them fails.
+ *
+ * e.g. dso_selftest            (all checks)
+ *      dso_selftest simd       (only the named ones)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "util/settings.h"
+#include "util/NumType.h"
+#include "util/SimdDispatch.h"
+#include "util/globalCalib.h"
+#include "OptimizationBackend/MatrixAccumulators.h"
+#include "FullSystem/PatternLinearize.h"
+#include "FullSystem/PyramidRows.h"
+
+
+using namespace dso;
+
+
+
+// ================================== simd: wide Accumulator9 updates vs. updateSSE_eighted ==================================
+#define SELFTEST_ACC_N (16*3001)	// rows stay 64-byte aligned.
+float accJ[9][SELFTEST_ACC_N] __attribute__((aligned(64)));
+float accW[SELFTEST_ACC_N] __attribute__((aligned(64)));
+
+void accumulateSSE(Accumulator9 &acc, int start, int end)
+{
+	for(int i=start;i<end;i+=4)
+		acc.updateSSE_eighted(
+				_mm_load_ps(accJ[0]+i), _mm_load_ps(accJ[1]+i), _mm_load_ps(accJ[2]+i),
+				_mm_load_ps(accJ[3]+i), _mm_load_ps(accJ[4]+i), _mm_load_ps(accJ[5]+i),
+				_mm_load_ps(accJ[6]+i), _mm_load_ps(accJ[7]+i), _mm_load_ps(accJ[8]+i),
+				_mm_load_ps(accW+i));
+}
+
+#ifdef DSO_SIMD_DISPATCH
+DSO_TARGET_AVX2 int accumulateAVX2(Accumulator9 &acc, int n)
+{
+	n -= n%8;
+	for(int i=0;i<n;i+=8)
+		acc.updateAVX2_eighted(
+				_mm256_load_ps(accJ[0]+i), _mm256_load_ps(accJ[1]+i), _mm256_load_ps(accJ[2]+i),
+				_mm256_load_ps(accJ[3]+i), _mm256_load_ps(accJ[4]+i), _mm256_load_ps(accJ[5]+i),
+				_mm256_load_ps(accJ[6]+i), _mm256_load_ps(accJ[7]+i), _mm256_load_ps(accJ[8]+i),
+				_mm256_load_ps(accW+i));
+	return n;
+}
+
+DSO_TARGET_AVX512 int accumulateAVX512(Accumulator9 &acc, int n)
+{
+	n -= n%16;
+	for(int i=0;i<n;i+=16)
+		acc.updateAVX512_eighted(
+				_mm512_load_ps(accJ[0]+i), _mm512_load_ps(accJ[1]+i), _mm512_load_ps(accJ[2]+i),
+				_mm512_load_ps(accJ[3]+i), _mm512_load_ps(accJ[4]+i), _mm512_load_ps(accJ[5]+i),
+				_mm512_load_ps(accJ[6]+i), _mm512_load_ps(accJ[7]+i), _mm512_load_ps(accJ[8]+i),
+				_mm512_load_ps(accW+i));
+	return n;
+}
+#endif
+
+bool checkSimd()
+{
+	const int n = 16*3000+12;	// > 1000 updates, so shiftUp folds during the run, and not a multiple of 8 / 16.
+	srand(1);
+	for(int i=0;i<n;i++)
+	{
+		for(int k=0;k<9;k++)
+			accJ[k][i] = 20.0f*rand()/(float)RAND_MAX - 10.0f;
+		accW[i] = rand()/(float)RAND_MAX;
+	}
+
+	// reference in double; the SSE path is checked against it the same way.
+	Eigen::Matrix<double,9,9> ref = Eigen::Matrix<double,9,9>::Zero();
+	for(int i=0;i<n;i++)
+		for(int r=0;r<9;r++)
+			for(int c=0;c<9;c++)
+				ref(r,c) += (double)accJ[r][i]*accJ[c][i]*accW[i];
+
+	bool ok = true;
+	const double maxRelErr = 1e-5;
+	int supported = getSimdLevel();
+	for(int level=SIMD_SSE; level<=SIMD_AVX512; level++)
+	{
+		if(level > supported)
+		{
+			printf("  simd level %d: not supported by this CPU, skipped.\n", level);
+			continue;
+		}
+
+		Accumulator9 acc;
+		int start = 0;
+		// run it twice, so a fold that leaves data in the wide buffers shows up.
+		for(int rep=0;rep<2;rep++)
+		{
+			acc.initialize();
+			start = 0;
+#ifdef DSO_SIMD_DISPATCH
+			if(level == SIMD_AVX2) start = accumulateAVX2(acc, n);
+			if(level == SIMD_AVX512) start = accumulateAVX512(acc, n);
+#endif
+			accumulateSSE(acc, start, n);
+			acc.finish();
+		}
+
+		double relErr = (acc.H.cast<double>()-ref).norm() / ref.norm();
+		bool pass = relErr < maxRelErr && acc.num == (size_t)n;
+		printf("  simd level %d: %d terms (%d wide), rel. error %g %s\n",
+				level, (int)acc.num, start, relErr, pass ? "ok" : "FAILED");
+		ok = ok && pass;
+	}
+	return ok;
+}
+
+
+
+// ================================== linearize: linearizePatternAVX2 vs. linearizePattern ==================================
+float relDiff(float a, float b)
+{
+	return fabsf(a-b) / std::max(1.0f, std::max(fabsf(a), fabsf(b)));
+}
+
+float maxRelDiff(const RawResidualJacobian &a, const RawResidualJacobian &b)
+{
+	// relative to max(1,|.|): the residuals cancel (hit color - reference color), so small ones only agree absolutely.
+	float d = 0;
+	for(int i=0;i<patternNum;i++)
+	{
+		d = std::max(d, relDiff(a.resF[i], b.resF[i]));
+		d = std::max(d, relDiff(a.JIdx[0][i], b.JIdx[0][i]));
+		d = std::max(d, relDiff(a.JIdx[1][i], b.JIdx[1][i]));
+		d = std::max(d, relDiff(a.JabF[0][i], b.JabF[0][i]));
+		d = std::max(d, relDiff(a.JabF[1][i], b.JabF[1][i]));
+	}
+	// the 2x2 shorthands are inner products with cancellation, compare them relative to their Cauchy-Schwarz bound.
+	for(int r=0;r<2;r++)
+		for(int c=0;c<2;c++)
+		{
+			d = std::max(d, fabsf(a.JIdx2(r,c)-b.JIdx2(r,c)) / std::max(1.0f, sqrtf(a.JIdx2(r,r)*a.JIdx2(c,c))));
+			d = std::max(d, fabsf(a.JabJIdx(r,c)-b.JabJIdx(r,c)) / std::max(1.0f, sqrtf(a.Jab2(r,r)*a.JIdx2(c,c))));
+			d = std::max(d, fabsf(a.Jab2(r,c)-b.Jab2(r,c)) / std::max(1.0f, sqrtf(a.Jab2(r,r)*a.Jab2(c,c))));
+		}
+	return d;
+}
+
+bool checkLinearize()
+{
+#ifdef DSO_SIMD_DISPATCH
+	if(getSimdLevel() < SIMD_AVX2)
+	{
+		printf("  AVX2 not supported by this CPU, skipped.\n");
+		return true;
+	}
+
+	const int w=160, h=120;
+	wM3G = w-3; hM3G = h-3;
+	std::vector<Eigen::Vector3f> dI(w*h);
+	srand(2);
+	// smooth image with its gradients. on pixel noise the one-ulp projection differences between the two
+	// versions are amplified by the interpolation, which says nothing about the kernel.
+	for(int y=0;y<h;y++)
+		for(int x=0;x<w;x++)
+			dI[x+y*w] = Eigen::Vector3f(
+					128 + 60*sinf(x/7.0f)*cosf(y/5.0f) + 0.3f*x,
+					60/7.0f*cosf(x/7.0f)*cosf(y/5.0f) + 0.3f,
+					-60/5.0f*sinf(x/7.0f)*sinf(y/5.0f));
+
+	srand(2);
+	int numIn=0, numOOB=0, numMismatch=0;
+	float maxDiff = 0;
+	for(int k=0;k<20000;k++)
+	{
+		// a small random motion, so some of the points leave the image.
+		Mat33f KRKi = Mat33f::Identity() + 0.01f*Mat33f::Random();
+		KRKi.row(2) = Vec3f(0.0001f*rand()/(float)RAND_MAX, 0.0001f*rand()/(float)RAND_MAX, 1).transpose();
+		Vec3f Kt = Vec3f(10.0f*rand()/(float)RAND_MAX-5, 10.0f*rand()/(float)RAND_MAX-5, 0.1f*rand()/(float)RAND_MAX);
+		float color[MAX_RES_PER_POINT], weights[MAX_RES_PER_POINT];
+		for(int i=0;i<MAX_RES_PER_POINT;i++)
+		{
+			color[i] = 255.0f*rand()/(float)RAND_MAX;
+			weights[i] = rand()/(float)RAND_MAX;
+		}
+
+		PatternLinInput in;
+		in.u = w*(rand()/(float)RAND_MAX);
+		in.v = h*(rand()/(float)RAND_MAX);
+		in.idepth = rand()/(float)RAND_MAX;
+		in.color = color;
+		in.weights = weights;
+		in.KRKi = &KRKi;
+		in.Kt = &Kt;
+		in.dI = dI.data();
+		in.width = w;
+		in.affLL = Vec2f(0.8f+0.4f*rand()/(float)RAND_MAX, 20.0f*rand()/(float)RAND_MAX-10);
+		in.b0 = 10.0f*rand()/(float)RAND_MAX;
+
+		RawResidualJacobian Jref, Jw;
+		Eigen::Vector2f pref[MAX_RES_PER_POINT], pw[MAX_RES_PER_POINT];
+		float eRef=0, eW=0, sRef=0, sW=0;
+		bool okRef = linearizePattern(in, &Jref, pref, eRef, sRef);
+		bool okW = linearizePatternAVX2(in, &Jw, pw, eW, sW);
+
+		if(okRef != okW) { numMismatch++; continue; }
+		if(!okRef) { numOOB++; continue; }
+		numIn++;
+
+		float d = std::max(maxRelDiff(Jref, Jw), std::max(relDiff(eRef, eW), relDiff(sRef, sW)));
+		for(int i=0;i<patternNum;i++)
+			d = std::max(d, (pref[i]-pw[i]).norm());
+		maxDiff = std::max(maxDiff, d);
+	}
+
+	bool pass = numMismatch == 0 && maxDiff < 1e-3 && numIn > 1000 && numOOB > 100;
+	printf("  %d in, %d OOB, %d OOB mismatches, max. rel. difference %g %s\n",
+			numIn, numOOB, numMismatch, maxDiff, pass ? "ok" : "FAILED");
+	return pass;
+#else
+	printf("  no SIMD dispatch on this platform, skipped.\n");
+	return true;
+#endif
+}
+
+
+
+// ================================== downsample: makeImages row kernels vs. the per-pixel loops ==================================
+bool checkDownsample()
+{
+	// every SSE tail length, on even and odd source widths. the kernels keep the summation order of the
+	// per-pixel loops they replaced, so the results have to be bit-identical, NaN / inf pixels included.
+	srand(3);
+	int numLevels=0, numMismatch=0;
+	for(int wl=1; wl<=37; wl++)
+		for(int odd=0; odd<2; odd++)
+		{
+			int wlm1 = 2*wl+odd, hl = 7;
+			std::vector<float> Ilm(wlm1*2*hl);
+			for(unsigned int i=0;i<Ilm.size();i++)
+				Ilm[i] = 255.0f*rand()/(float)RAND_MAX;
+			Ilm[rand()%Ilm.size()] = NAN;
+			Ilm[rand()%Ilm.size()] = INFINITY;
+
+			std::vector<float> I(wl*hl), Iref(wl*hl);
+			std::vector<Eigen::Vector3f> dI(wl*hl, Eigen::Vector3f::Zero()), dIref(wl*hl, Eigen::Vector3f::Zero());
+			std::vector<float> dabs(wl*hl, 0), dabsRef(wl*hl, 0);
+
+			// kernels, called the way makeImages does: downsample row y, then the gradients of row y-1.
+			for(int y=0;y<hl;y++)
+			{
+				downsampleRow(Ilm.data() + 2*y*wlm1, Ilm.data() + (2*y+1)*wlm1, I.data() + y*wl, wl);
+				if(y >= 2) gradientRow(I.data(), dI.data(), dabs.data(), (y-1)*wl, y*wl, wl);
+			}
+
+			// reference.
+			for(int y=0;y<hl;y++)
+				for(int x=0;x<wl;x++)
+					Iref[x + y*wl] = 0.25f * (Ilm[2*x   + 2*y*wlm1] +
+											Ilm[2*x+1 + 2*y*wlm1] +
+											Ilm[2*x   + 2*y*wlm1+wlm1] +
+											Ilm[2*x+1 + 2*y*wlm1+wlm1]);
+			for(int idx=wl;idx < wl*(hl-1);idx++)
+			{
+				float dx = 0.5f*(Iref[idx+1] - Iref[idx-1]);
+				float dy = 0.5f*(Iref[idx+wl] - Iref[idx-wl]);
+				if(!std::isfinite(dx)) dx=0;
+				if(!std::isfinite(dy)) dy=0;
+				dIref[idx] = Eigen::Vector3f(Iref[idx], dx, dy);
+				dabsRef[idx] = dx*dx+dy*dy;
+			}
+
+			numLevels++;
+			if(memcmp(I.data(), Iref.data(), sizeof(float)*wl*hl) != 0 ||
+					memcmp(dI.data()+wl, dIref.data()+wl, sizeof(Eigen::Vector3f)*wl*(hl-2)) != 0 ||
+					memcmp(dabs.data()+wl, dabsRef.data()+wl, sizeof(float)*wl*(hl-2)) != 0)
+			{
+				printf("  width %d (from %d) differs from the reference!\n", wl, wlm1);
+				numMismatch++;
+			}
+		}
+
+	printf("  %d levels, %d not bit-identical %s\n", numLevels, numMismatch, numMismatch==0 ? "ok" : "FAILED");
+	return numMismatch == 0;
+}
+
+
+
+struct SelfTest
+{
+	const char* name;
+	bool (*run)();
+};
+
+SelfTest selfTests[] = {
+		{"simd", &checkSimd},
+		{"linearize", &checkLinearize},
+		{"downsample", &checkDownsample},
+};
+
+
+
+int main( int argc, char** argv )
+{
+	int numTests = sizeof(selfTests)/sizeof(SelfTest);
+	int failed = 0, ran = 0;
+
+	for(int t=0;t<numTests;t++)
+	{
+		bool selected = argc < 2;
+		for(int i=1; i<argc; i++)
+			if(strcmp(argv[i], selfTests[t].name) == 0) selected = true;
+		if(!selected) continue;
+
+		printf("%s:\n", selfTests[t].name);
+		bool ok = selfTests[t].run();
+		printf("%s: %s\n", selfTests[t].name, ok ? "ok" : "FAILED");
+		ran++;
+		if(!ok) failed++;
+	}
+
+	printf("%d checks, %d failed.\n", ran, failed);
+	return (failed > 0 || ran == 0) ? 1 : 0;
+}
@@ -106,6 +106,8 @@ public:
 	{
 		this->path = path;
 		this->calibfile = calibFile;
+		this->gammafile = gammaFile;
+		this->vignettefile = vignetteFile;
                 this->posesfile = cameraPoses; //Added class variable for camera poses
 
 #if HAS_ZIPLIB
@@ -215,12 +217,6 @@ public:
 	}
 
 
-	void prepImage(int id, bool as8U=false)
-	{
-
-	}
-
-
 	MinimalImageB* getImageRaw(int id)
 	{
 			return getImageRaw_internal(id,0);
@@ -231,6 +227,26 @@ public:
 		return getImage_internal(id, 0);
 	}
 
+	// a fresh undistorter with the same calibration, for decoding on another thread
+	// (Undistort::undistort is not re-entrant). caller owns it.
+	Undistort* makeUndistorter()
+	{
+		return Undistort::getUndistorterForFile(calibfile, gammafile, vignettefile);
+	}
+
+	// decodes & undistorts image [id] into [out] (of size getCalibMono()). thread-safe, as long as every
+	// thread passes its own [undist].
+	void getImageInto(int id, ImageAndExposure* out, Undistort* undist)
+	{
+		MinimalImageB* minimg = getImageRaw_internal(id, 0);
+		undist->undistortInto<unsigned char>(
+				minimg,
+				out,
+				(exposures.size() == 0 ? 1.0f : exposures[id]),
+				(timestamps.size() == 0 ? 0.0 : timestamps[id]));
+		delete minimg;
+	}
+
 
 	inline float* getPhotometricGamma()
 	{
@@ -259,6 +275,7 @@ private:
 		else
 		{
 #if HAS_ZIPLIB
+			boost::unique_lock<boost::mutex> lock(zipMutex);	// archive handle & databuffer are shared.
 			if(databuffer==0) databuffer = new char[widthOrg*heightOrg*6+10000];
 			zip_file_t* fle = zip_fopen(ziparchive, files[id].c_str(), 0);
 			long readbytes = zip_fread(fle, databuffer, (long)widthOrg*heightOrg*6+10000);
@@ -600,7 +617,6 @@ private:
 
 
 
-	std::vector<ImageAndExposure*> preloadedImages;
 	std::vector<std::string> files;
 	std::vector<double> timestamps;
 	std::vector<float> exposures;
@@ -611,6 +627,8 @@ private:
 
 	std::string path;
 	std::string calibfile;
+	std::string gammafile;
+	std::string vignettefile;
         std::string posesfile; // Path to cameraPoses.csv file
 
 	bool isZipped;
@@ -618,6 +636,7 @@ private:
 #if HAS_ZIPLIB
 	zip_t* ziparchive;
 	char* databuffer;
+	boost::mutex zipMutex;
 #endif
 };
 
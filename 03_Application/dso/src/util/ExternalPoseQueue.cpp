@@ -0,0 +1,139 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "util/ExternalPoseQueue.h"
+#include "util/settings.h"
+#include <algorithm>
+#include <iterator>
+#include <stdio.h>
+
+namespace dso
+{
+
+ExternalPoseQueue::ExternalPoseQueue(int maxSize)
+{
+	this->maxSize = maxSize;
+	warnedFull = false;
+}
+
+
+void ExternalPoseQueue::push(const ExternalPoseMeasurement &m)
+{
+	boost::unique_lock<boost::mutex> lock(mutex);
+
+	// in order: hint at the end, so this stays O(1). same stamp: replace.
+	measurements.insert(measurements.end(), std::make_pair(m.timestamp, m))->second = m;
+
+	if((int)measurements.size() > maxSize && !warnedFull)
+	{
+		printf("EXTERNAL POSES: more than %d measurements, dropping the oldest!\n", maxSize);
+		warnedFull = true;
+	}
+	while((int)measurements.size() > maxSize)
+		measurements.erase(measurements.begin());
+}
+
+void ExternalPoseQueue::clear()
+{
+	boost::unique_lock<boost::mutex> lock(mutex);
+	measurements.clear();
+	warnedFull = false;
+}
+
+int ExternalPoseQueue::size()
+{
+	boost::unique_lock<boost::mutex> lock(mutex);
+	return measurements.size();
+}
+
+void ExternalPoseQueue::setMaxSize(int maxSize)
+{
+	boost::unique_lock<boost::mutex> lock(mutex);
+	this->maxSize = maxSize;
+}
+
+
+bool ExternalPoseQueue::lookUp(double timestamp, ExternalPoseMeasurement &out)
+{
+	boost::unique_lock<boost::mutex> lock(mutex);
+	if(measurements.empty()) return false;
+
+	// first measurement after timestamp.
+	MeasurementMap::const_iterator it1 = measurements.upper_bound(timestamp);
+
+	if(measurements.size()==1)
+	{
+		const ExternalPoseMeasurement &m = measurements.begin()->second;
+		if(fabs(m.timestamp - timestamp) > setting_externalPoseMaxExtrapolation) return false;
+		out = m;
+		out.timestamp = timestamp;
+		return true;
+	}
+
+	// pick the two measurements to inter- / extrapolate from.
+	MeasurementMap::const_iterator it0;
+	if(it1 == measurements.begin()) it0 = it1++;						// before the first: extrapolate backwards.
+	else if(it1 == measurements.end()) it0 = std::prev(--it1);		// after the last: extrapolate forwards.
+	else it0 = std::prev(it1);
+
+	const ExternalPoseMeasurement &m0 = it0->second;
+	const ExternalPoseMeasurement &m1 = it1->second;
+
+	double span = m1.timestamp - m0.timestamp;
+	double t = span > 0 ? (timestamp - m0.timestamp) / span : 0;
+
+	// how far outside of the measured range we are, in seconds.
+	double outside = 0;
+	if(timestamp < m0.timestamp) outside = m0.timestamp - timestamp;
+	if(timestamp > m1.timestamp) outside = timestamp - m1.timestamp;
+	if(outside > setting_externalPoseMaxExtrapolation) return false;
+
+	out.timestamp = timestamp;
+	out.position = (1-t)*m0.position + t*m1.position;
+	out.hasOrientation = m0.hasOrientation && m1.hasOrientation;
+	if(out.hasOrientation)
+	{
+		// only interpolate the rotation, hold it when extrapolating.
+		double tc = std::min(1.0, std::max(0.0, t));
+		out.orientation = m0.orientation.slerp(tc, m1.orientation);
+	}
+	else if(m0.hasOrientation || m1.hasOrientation)
+	{
+		out.hasOrientation = true;
+		out.orientation = m0.hasOrientation ? m0.orientation : m1.orientation;
+	}
+
+	double tc = std::min(1.0, std::max(0.0, t));
+	out.covariance = (1-tc)*m0.covariance + tc*m1.covariance;
+	if(outside > 0 && span > 0)
+	{
+		// uncertainty grows with the extrapolated distance, in units of the sample spacing.
+		double grow = 1 + outside / span;
+		out.covariance *= grow*grow;
+	}
+	return true;
+}
+
+}
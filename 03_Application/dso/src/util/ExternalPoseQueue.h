@@ -0,0 +1,95 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "util/NumType.h"
+#include "boost/thread/mutex.hpp"
+#include <map>
+
+
+namespace dso
+{
+
+// one external pose measurement (GPS, motion capture, ground truth, ...), in world coordinates.
+struct ExternalPoseMeasurement
+{
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+
+	double timestamp;					// same time base as ImageAndExposure::timestamp.
+	Vec3 position;						// camera center in world.
+	Eigen::Quaterniond orientation;		// camera to world. only valid if hasOrientation.
+	bool hasOrientation;
+	Mat33 covariance;					// of position.
+
+	inline ExternalPoseMeasurement()
+	{
+		timestamp=0;
+		position.setZero();
+		orientation.setIdentity();
+		hasOrientation=false;
+		covariance = Mat33::Identity();
+	}
+
+	inline SE3 camToWorld() const
+	{
+		return SE3(hasOrientation ? orientation : Eigen::Quaterniond::Identity(), position);
+	}
+};
+
+
+/*
+ * thread-safe queue of timestamped external pose measurements.
+ * push() can be called from any thread at any rate (e.g. a GPS receiver callback); lookUp() is called
+ * by the tracking thread for each new frame. the lock is only held for the insert / the binary
+ * search, so neither side waits on the other for long.
+ */
+class ExternalPoseQueue
+{
+public:
+	ExternalPoseQueue(int maxSize = 100000);
+
+	// measurements may arrive slightly out of order, they are sorted in (O(log n)).
+	// if there are more than maxSize, the oldest are dropped, with a warning.
+	void push(const ExternalPoseMeasurement &m);
+	void clear();
+	int size();
+	void setMaxSize(int maxSize);
+
+	// interpolates between the two measurements around [timestamp]. outside of the measured range,
+	// extrapolates linearly for at most setting_externalPoseMaxExtrapolation seconds, with grown covariance.
+	// O(log n). returns false if there is nothing usable.
+	bool lookUp(double timestamp, ExternalPoseMeasurement &out);
+
+private:
+	typedef std::map<double, ExternalPoseMeasurement, std::less<double>,
+			Eigen::aligned_allocator<std::pair<const double, ExternalPoseMeasurement> > > MeasurementMap;
+
+	boost::mutex mutex;
+	MeasurementMap measurements;	// by timestamp.
+	int maxSize;
+	bool warnedFull;
+};
+
+}
@@ -0,0 +1,215 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#pragma once
+#include "util/DatasetReader.h"
+#include "util/ImageAndExposure.h"
+#include <boost/thread.hpp>
+#include <sys/time.h>
+#include <vector>
+
+
+
+namespace dso
+{
+
+/*
+ * bounded, in-order frame prefetcher on top of ImageFolderReader.
+ *
+ * [numWorkers] threads decode & undistort the frames ids[0], ids[1], ... into a ring of [lookahead] slots.
+ * a worker only claims frame ii if ii < nextToConsume + lookahead, so at most [lookahead] frames are ever
+ * decoded ahead of the consumer (backpressure), independent of the sequence length. frame ii always goes
+ * to slot ii % lookahead, which is free by then.
+ *
+ * images come from a buffer pool and should be handed back with recycle() instead of being deleted.
+ * get() has to be called with ii = 0, 1, 2, ... in order, from one thread.
+ * with numWorkers == 0, get() decodes directly on the calling thread (old on-the-fly mode).
+ */
+class FramePrefetcher
+{
+public:
+	inline FramePrefetcher(ImageFolderReader* reader, const std::vector<int> &ids, int numWorkers, int lookahead)
+		: reader(reader), ids(ids)
+	{
+		if(numWorkers < 0) numWorkers = 0;
+		if(lookahead < 1) lookahead = 1;
+		this->numWorkers = numWorkers;
+		this->lookahead = lookahead;
+		w = reader->undistort->getSize()[0];
+		h = reader->undistort->getSize()[1];
+
+		slots.resize(lookahead, 0);
+		slotIds.resize(lookahead, -1);
+		nextToDecode = 0;
+		nextToConsume = 0;
+		numAllocated = 0;
+		numWaits = 0;
+		msWaited = 0;
+		running = true;
+
+		for(int i=0;i<numWorkers;i++)
+		{
+			undistorters.push_back(reader->makeUndistorter());
+			workerThreads.push_back(new boost::thread(&FramePrefetcher::workerLoop, this, i));
+		}
+	}
+
+	inline ~FramePrefetcher()
+	{
+		{
+			boost::unique_lock<boost::mutex> lock(mut);
+			running = false;
+			workSignal.notify_all();
+		}
+		for(unsigned int i=0;i<workerThreads.size();i++)
+		{
+			workerThreads[i]->join();
+			delete workerThreads[i];
+		}
+		for(unsigned int i=0;i<undistorters.size();i++)
+			delete undistorters[i];
+
+		for(unsigned int i=0;i<slots.size();i++)
+			if(slots[i] != 0) delete slots[i];
+		for(unsigned int i=0;i<pool.size();i++)
+			delete pool[i];
+	}
+
+	// blocks until frame ids[ii] is ready. the image stays valid until recycle().
+	inline ImageAndExposure* get(int ii)
+	{
+		assert(ii == nextToConsume && ii < (int)ids.size());
+
+		if(numWorkers == 0)
+		{
+			ImageAndExposure* img;
+			{
+				boost::unique_lock<boost::mutex> lock(mut);
+				img = takeBuffer();
+			}
+			reader->getImageInto(ids[ii], img, reader->undistort);
+			nextToConsume++;
+			return img;
+		}
+
+		boost::unique_lock<boost::mutex> lock(mut);
+		int s = ii % lookahead;
+		if(slotIds[s] != ii)
+		{
+			struct timeval tv_start, tv_end;
+			gettimeofday(&tv_start, NULL);
+			while(slotIds[s] != ii)
+				readySignal.wait(lock);
+			gettimeofday(&tv_end, NULL);
+			numWaits++;
+			msWaited += (tv_end.tv_sec-tv_start.tv_sec)*1000.0f + (tv_end.tv_usec-tv_start.tv_usec)/1000.0f;
+		}
+
+		ImageAndExposure* img = slots[s];
+		slots[s] = 0;
+		slotIds[s] = -1;
+		nextToConsume = ii+1;
+		workSignal.notify_all();
+		return img;
+	}
+
+	// hands an image from get() back to the pool.
+	inline void recycle(ImageAndExposure* img)
+	{
+		if(img == 0) return;
+		boost::unique_lock<boost::mutex> lock(mut);
+		pool.push_back(img);
+	}
+
+	inline void printStats()
+	{
+		boost::unique_lock<boost::mutex> lock(mut);
+		printf("FramePrefetcher: %d workers, %d frames ahead, %d buffers allocated. "
+				"consumer waited %d times, %.1fms total.\n",
+				numWorkers, lookahead, numAllocated, numWaits, msWaited);
+	}
+
+private:
+	ImageFolderReader* reader;
+	std::vector<int> ids;
+	int numWorkers;
+	int lookahead;
+	int w, h;
+
+	// all below protected by [mut].
+	boost::mutex mut;
+	boost::condition_variable workSignal;		// a slot got free, or shutting down.
+	boost::condition_variable readySignal;		// a frame got decoded.
+	std::vector<ImageAndExposure*> slots;		// ring, frame ii lives in slots[ii % lookahead].
+	std::vector<int> slotIds;					// which ii is in the slot. -1 if not (yet) there.
+	std::vector<ImageAndExposure*> pool;		// free buffers.
+	int nextToDecode;							// next ii a worker will claim.
+	int nextToConsume;							// next ii get() will be called with.
+	int numAllocated;
+	int numWaits;
+	float msWaited;
+	bool running;
+
+	std::vector<boost::thread*> workerThreads;
+	std::vector<Undistort*> undistorters;		// one per worker.
+
+
+	// needs [mut].
+	inline ImageAndExposure* takeBuffer()
+	{
+		if(pool.size() > 0)
+		{
+			ImageAndExposure* img = pool.back();
+			pool.pop_back();
+			return img;
+		}
+		numAllocated++;
+		return new ImageAndExposure(w, h);
+	}
+
+	void workerLoop(int idx)
+	{
+		boost::unique_lock<boost::mutex> lock(mut);
+		while(true)
+		{
+			while(running && !(nextToDecode < (int)ids.size() && nextToDecode < nextToConsume + lookahead))
+				workSignal.wait(lock);
+			if(!running) return;
+
+			int ii = nextToDecode++;
+			ImageAndExposure* img = takeBuffer();
+
+			lock.unlock();
+			reader->getImageInto(ids[ii], img, undistorters[idx]);
+			lock.lock();
+
+			slots[ii % lookahead] = img;
+			slotIds[ii % lookahead] = ii;
+			readySignal.notify_all();
+		}
+	}
+};
+
+}
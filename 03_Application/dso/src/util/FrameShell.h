@@ -46,6 +46,9 @@ public:
 	// constantly adapted.
 	SE3 camToWorld;				// Write: TRACKING, while frame is still fresh; MAPPING: only when locked [shellPoseMutex].
 	SE3 camToWorld_predicted;		// this is used for integrating other Measurements, e.g. GPS
+	bool predictedValid;			// camToWorld_predicted was set from an external measurement.
+	bool predictedHasOrientation;	// if not, only its translation is measured.
+	Mat33 predictedPositionCov;
 	AffLight aff_g2l;
 	bool poseValid;
 
@@ -62,6 +65,9 @@ public:
 		poseValid=true;
 		camToWorld = SE3();
 		camToWorld_predicted = SE3();
+		predictedValid=false;
+		predictedHasOrientation=false;
+		predictedPositionCov = Mat33::Identity();
 		timestamp=0;
 		marginalizedAt=-1;
 		movedByOpt=0;
@@ -25,15 +25,39 @@
 
 #pragma once
 #include "util/settings.h"
+#include "util/NumType.h"
 #include "boost/thread.hpp"
 #include <stdio.h>
 #include <iostream>
+#include <vector>
+#include <atomic>
+#include <memory>
 
 
 
 namespace dso
 {
 
+/*
+ * work-stealing thread pool behind the reduce(callPerIndex, first, end, stepSize) interface.
+ *
+ * every call to reduce() becomes a job. the index range is cut into chunks of [stepSize], and the
+ * chunks are dealt out as contiguous blocks into one deque per worker. a worker pops chunks from the
+ * front of its own deque; once that is empty, it steals from the back of the others. each deque is a
+ * single packed 64bit [begin,end) word, so claiming a chunk is one CAS and no lock is taken per chunk.
+ * the mutex is only used to publish / retire jobs and to park idle workers.
+ *
+ * guarantees (same as the old barrier version):
+ * - callPerIndex(min, max, stats, tid) always gets a tid in [0, getNumThreads()), and a tid is only
+ *   ever used by one thread. per-thread accumulators can be indexed by it.
+ * - on a top-level reduce, every worker is called at least once, with min==max==0 if it did not get
+ *   a chunk (the setZero() calls of the accumulators rely on this).
+ *
+ * nested parallel regions: reduce() may be called from inside callPerIndex. the calling worker then
+ * works on the nested job with its own tid, and idle workers steal from it. the "every worker is
+ * called once" guarantee does not hold for nested jobs, and the result is only returned, not written
+ * to [stats].
+ */
 template<typename Running>
 class IndexThreadReduce
 {
@@ -41,31 +65,28 @@ class IndexThreadReduce
 public:
         EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
 
-	inline IndexThreadReduce()
+	inline IndexThreadReduce(int numThreads = 0)
 	{
-		nextIndex = 0;
-		maxIndex = 0;
-		stepSize = 1;
-		callPerIndex = boost::bind(&IndexThreadReduce::callPerIndexDefault, this, _1, _2, _3, _4);
+		if(numThreads <= 0) numThreads = setting_numThreads;
+		if(numThreads < 1) numThreads = 1;
+		if(numThreads > NUM_THREADS) numThreads = NUM_THREADS;
+		this->numThreads = numThreads;
+
+		memset(&stats, 0, sizeof(Running));
 
 		running = true;
-		for(int i=0;i<NUM_THREADS;i++)
-		{
-			isDone[i] = false;
-			gotOne[i] = true;
+		workerThreads.resize(numThreads);
+		for(int i=0;i<numThreads;i++)
 			workerThreads[i] = boost::thread(&IndexThreadReduce::workerLoop, this, i);
-		}
-
 	}
 	inline ~IndexThreadReduce()
 	{
-		running = false;
-
 		exMutex.lock();
+		running = false;
 		todo_signal.notify_all();
 		exMutex.unlock();
 
-		for(int i=0;i<NUM_THREADS;i++)
+		for(int i=0;i<numThreads;i++)
 			workerThreads[i].join();
 
 
@@ -73,141 +94,242 @@ public:
 
 	}
 
-	inline void reduce(boost::function<void(int,int,Running*,int)> callPerIndex, int first, int end, int stepSize = 0)
-	{
-
-		memset(&stats, 0, sizeof(Running));
-
-//		if(!multiThreading)
-//		{
-//			callPerIndex(first, end, &stats, 0);
-//			return;
-//		}
+	inline int getNumThreads() const {return numThreads;}
 
+	inline Running reduce(boost::function<void(int,int,Running*,int)> callPerIndex, int first, int end, int stepSize = 0)
+	{
+		// called from one of my own workers: nested region.
+		bool nested = (currentPool() == this);
 
+		// top-level jobs are serialized, same as before.
+		boost::unique_lock<boost::mutex> reduceLock(reduceMutex, boost::defer_lock);
+		if(!nested) reduceLock.lock();
 
 		if(stepSize == 0)
-			stepSize = ((end-first)+NUM_THREADS-1)/NUM_THREADS;
-
-
-		//printf("reduce called\n");
+			stepSize = ((end-first)+numThreads-1)/numThreads;
+		if(stepSize < 1) stepSize = 1;
 
-		boost::unique_lock<boost::mutex> lock(exMutex);
+		int numChunks = end > first ? ((end-first)+stepSize-1)/stepSize : 0;
 
-		// save
-		this->callPerIndex = callPerIndex;
-		nextIndex = first;
-		maxIndex = end;
-		this->stepSize = stepSize;
 
-		// go worker threads!
-		for(int i=0;i<NUM_THREADS;i++)
+		Job job(numThreads);
+		job.callPerIndex = callPerIndex;
+		job.first = first;
+		job.end = end;
+		job.stepSize = stepSize;
+		job.requireAll = !nested;
+		job.users = 0;
+		job.pending = numChunks + (nested ? 0 : numThreads);
+		for(int i=0;i<numThreads;i++)
 		{
-			isDone[i] = false;
-			gotOne[i] = false;
+			job.ranges[i].store(packRange(numChunks*i/numThreads, numChunks*(i+1)/numThreads));
+			job.gotOne[i] = false;
+			job.checkedIn[i] = false;
+			memset(&job.partial[i], 0, sizeof(Running));
 		}
 
-		// let them start!
-		todo_signal.notify_all();
 
+		// publish & let them start!
+		boost::unique_lock<boost::mutex> lock(exMutex);
+		activeJobs.push_back(&job);
+		todo_signal.notify_all();
 
-		//printf("reduce waiting for threads to finish\n");
-		// wait for all worker threads to signal they are done.
-		while(true)
+		if(nested)
 		{
-			// wait for at least one to finish
-			done_signal.wait(lock);
-			//printf("thread finished!\n");
+			// help with my own job, using my own tid.
+			lock.unlock();
+			workOn(&job, currentTid());
+			lock.lock();
+		}
 
-			// check if actually all are finished.
-			bool allDone = true;
-			for(int i=0;i<NUM_THREADS;i++)
-				allDone = allDone && isDone[i];
+		// wait until all chunks are done, and no worker holds on to the job anymore.
+		while(job.pending.load() != 0 || job.users != 0)
+			done_signal.wait(lock);
 
-			// all are finished! exit.
-			if(allDone)
+		for(unsigned int i=0;i<activeJobs.size();i++)
+			if(activeJobs[i] == &job)
+			{
+				activeJobs.erase(activeJobs.begin()+i);
 				break;
-		}
+			}
+		lock.unlock();
+
 
-		nextIndex = 0;
-		maxIndex = 0;
-		this->callPerIndex = boost::bind(&IndexThreadReduce::callPerIndexDefault, this, _1, _2, _3, _4);
+		Running result; memset(&result, 0, sizeof(Running));
+		for(int i=0;i<numThreads;i++)
+			result += job.partial[i];
 
-		//printf("reduce done (all threads finished)\n");
+		if(!nested) stats = result;
+		return result;
 	}
 
 	Running stats;
 
 private:
-	boost::thread workerThreads[NUM_THREADS];
-	bool isDone[NUM_THREADS];
-	bool gotOne[NUM_THREADS];
 
+	// per-worker state is sized by the pool, not by NUM_THREADS (a job lives on the stack of reduce()).
+	struct Job
+	{
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+		inline Job(int n) : ranges(new std::atomic<unsigned long long>[n]), gotOne(n), checkedIn(n), partial(n) {}
+
+		boost::function<void(int,int,Running*,int)> callPerIndex;
+		int first;
+		int end;
+		int stepSize;
+		bool requireAll;						// every worker has to be called at least once.
+
+		std::unique_ptr<std::atomic<unsigned long long>[]> ranges;	// per-worker deque of chunk indices, packed [begin,end).
+		std::atomic<int> pending;				// chunks not yet finished + workers not yet checked in.
+		int users;								// workers holding a pointer to this job. protected by [exMutex].
+
+		std::vector<char> gotOne;				// only written by the respective worker (not vector<bool>: no shared words).
+		std::vector<char> checkedIn;			// only written by the respective worker.
+		std::vector<Running, Eigen::aligned_allocator<Running>> partial;	// only written by the respective worker.
+	};
+
+	std::vector<boost::thread> workerThreads;
+	int numThreads;
+
+	boost::mutex reduceMutex;
 	boost::mutex exMutex;
 	boost::condition_variable todo_signal;
 	boost::condition_variable done_signal;
 
-	int nextIndex;
-	int maxIndex;
-	int stepSize;
+	std::vector<Job*> activeJobs;				// protected by [exMutex]. innermost nested job last.
 
 	bool running;
 
-	boost::function<void(int,int,Running*,int)> callPerIndex;
 
-	void callPerIndexDefault(int i, int j,Running* k, int tid)
+	static inline IndexThreadReduce*& currentPool() { static thread_local IndexThreadReduce* pool = 0; return pool; }
+	static inline int& currentTid() { static thread_local int tid = -1; return tid; }
+
+	static inline unsigned long long packRange(unsigned int begin, unsigned int end)
 	{
-		printf("ERROR: should never be called....\n");
-		assert(false);
+		return (((unsigned long long)end) << 32) | (unsigned long long)begin;
+	}
+
+	// owner side: take the first chunk. returns -1 if empty.
+	inline int popFront(Job* job, int tid)
+	{
+		unsigned long long r = job->ranges[tid].load();
+		while(true)
+		{
+			unsigned int begin = (unsigned int)(r & 0xffffffff);
+			unsigned int end = (unsigned int)(r >> 32);
+			if(begin >= end) return -1;
+			if(job->ranges[tid].compare_exchange_weak(r, packRange(begin+1, end)))
+				return begin;
+		}
+	}
+
+	// thief side: take the last chunk of someone else. returns -1 if everything is empty.
+	inline int steal(Job* job, int tid)
+	{
+		for(int k=1;k<numThreads;k++)
+		{
+			int victim = (tid+k)%numThreads;
+			unsigned long long r = job->ranges[victim].load();
+			while(true)
+			{
+				unsigned int begin = (unsigned int)(r & 0xffffffff);
+				unsigned int end = (unsigned int)(r >> 32);
+				if(begin >= end) break;
+				if(job->ranges[victim].compare_exchange_weak(r, packRange(begin, end-1)))
+					return end-1;
+			}
+		}
+		return -1;
+	}
+
+	inline bool hasWork(Job* job, int tid)
+	{
+		if(job->requireAll && !job->checkedIn[tid]) return true;
+		for(int i=0;i<numThreads;i++)
+		{
+			unsigned long long r = job->ranges[i].load();
+			if((unsigned int)(r & 0xffffffff) < (unsigned int)(r >> 32)) return true;
+		}
+		return false;
+	}
+
+	inline void finishOne(Job* job)
+	{
+		if(job->pending.fetch_sub(1) == 1)
+		{
+			boost::unique_lock<boost::mutex> lock(exMutex);
+			done_signal.notify_all();
+		}
+	}
+
+	void workOn(Job* job, int tid)
+	{
+		while(true)
+		{
+			int chunk = popFront(job, tid);
+			if(chunk < 0) chunk = steal(job, tid);
+			if(chunk < 0) break;
+
+			int min = job->first + chunk*job->stepSize;
+			int max = std::min(min+job->stepSize, job->end);
+
+			assert(job->callPerIndex != 0);
+			Running s; memset(&s, 0, sizeof(Running));
+			job->callPerIndex(min, max, &s, tid);
+			job->partial[tid] += s;
+			job->gotOne[tid] = true;
+			finishOne(job);
+		}
+
+		if(job->requireAll && !job->checkedIn[tid])
+		{
+			if(!job->gotOne[tid])
+			{
+				Running s; memset(&s, 0, sizeof(Running));
+				job->callPerIndex(0, 0, &s, tid);
+				job->partial[tid] += s;
+				job->gotOne[tid] = true;
+			}
+			job->checkedIn[tid] = true;
+			finishOne(job);
+		}
 	}
 
 	void workerLoop(int idx)
 	{
+		currentPool() = this;
+		currentTid() = idx;
+
 		boost::unique_lock<boost::mutex> lock(exMutex);
 
 		while(running)
 		{
-			// try to get something to do.
-			int todo = 0;
-			bool gotSomething = false;
-			if(nextIndex < maxIndex)
-			{
-				// got something!
-				todo = nextIndex;
-				nextIndex+=stepSize;
-				gotSomething = true;
-			}
+			// try to get something to do. innermost nested job first.
+			Job* job = 0;
+			for(int j=(int)activeJobs.size()-1; j>=0; j--)
+				if(hasWork(activeJobs[j], idx))
+				{
+					job = activeJobs[j];
+					break;
+				}
 
 			// if got something: do it (unlock in the meantime)
-			if(gotSomething)
+			if(job != 0)
 			{
+				job->users++;
 				lock.unlock();
 
-				assert(callPerIndex != 0);
+				workOn(job, idx);
 
-				Running s; memset(&s, 0, sizeof(Running));
-				callPerIndex(todo, std::min(todo+stepSize, maxIndex), &s, idx);
-				gotOne[idx] = true;
 				lock.lock();
-				stats += s;
+				job->users--;
+				if(job->users == 0 && job->pending.load() == 0)
+					done_signal.notify_all();
 			}
 
 			// otherwise wait on signal, releasing lock in the meantime.
 			else
 			{
-				if(!gotOne[idx])
-				{
-					lock.unlock();
-					assert(callPerIndex != 0);
-					Running s; memset(&s, 0, sizeof(Running));
-					callPerIndex(0, 0, &s, idx);
-					gotOne[idx] = true;
-					lock.lock();
-					stats += s;
-				}
-				isDone[idx] = true;
-				//printf("worker %d waiting..\n", idx);
-				done_signal.notify_all();
 				todo_signal.wait(lock);
 			}
 		}
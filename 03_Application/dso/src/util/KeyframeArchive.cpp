@@ -0,0 +1,206 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include "util/KeyframeArchive.h"
+#include <string.h>
+
+namespace dso
+{
+
+static const char archiveMagic[6] = {'D','S','O','K','F','A'};
+static const uint16_t archiveVersion = 2;	// 2: pose records.
+
+
+KeyframeArchive::KeyframeArchive(const std::string &file) : file(file)
+{
+	bytesWritten = 0;
+	numKeyframes = 0;
+	numPoses = 0;
+	fp = fopen(file.c_str(), "wb");
+	if(fp == 0)
+	{
+		printf("KeyframeArchive: could not open %s for writing!\n", file.c_str());
+		return;
+	}
+
+	uint32_t pointSize = sizeof(ArchivedPoint);
+	if(!write(archiveMagic, sizeof(archiveMagic))) return;
+	if(!write(&archiveVersion, sizeof(archiveVersion))) return;
+	write(&pointSize, sizeof(pointSize));
+}
+
+KeyframeArchive::~KeyframeArchive()
+{
+	if(fp == 0) return;
+
+	// buffered records only hit the disk here.
+	if(fclose(fp) != 0)
+		printf("KeyframeArchive: could not write %s, the archive is incomplete!\n", file.c_str());
+	else
+		printf("KeyframeArchive: %d keyframes, %d frame poses, %.1f MB in %s\n", numKeyframes, numPoses, bytesWritten / (1024.0*1024.0), file.c_str());
+}
+
+
+// on failure (disk full...) the archive is closed, everything after is dropped.
+bool KeyframeArchive::write(const void* data, size_t bytes)
+{
+	if(fp == 0) return false;
+	if(fwrite(data, 1, bytes, fp) == bytes)
+	{
+		bytesWritten += bytes;
+		return true;
+	}
+
+	printf("KeyframeArchive: could not write %s, archiving stopped after %d keyframes!\n", file.c_str(), numKeyframes);
+	fclose(fp);
+	fp = 0;
+	return false;
+}
+
+
+void KeyframeArchive::append(const ArchivedKeyframe &kf)
+{
+	if(fp == 0) return;
+
+	RecordHeader h;
+	h.kfId = kf.kfId;
+	h.frameId = kf.frameId;
+	h.incomingId = kf.incomingId;
+	h.numPoints = kf.points.size();
+	h.timestamp = kf.timestamp;
+	for(int i=0;i<3;i++) h.camToWorld[i] = kf.camToWorld.translation()[i];
+	h.camToWorld[3] = kf.camToWorld.unit_quaternion().x();
+	h.camToWorld[4] = kf.camToWorld.unit_quaternion().y();
+	h.camToWorld[5] = kf.camToWorld.unit_quaternion().z();
+	h.camToWorld[6] = kf.camToWorld.unit_quaternion().w();
+	h.fx = kf.fx; h.fy = kf.fy; h.cx = kf.cx; h.cy = kf.cy;
+	h.width = kf.width; h.height = kf.height;
+
+	boost::unique_lock<boost::mutex> lock(mutex);
+	if(!write(&h, sizeof(RecordHeader))) return;
+	if(h.numPoints > 0 && !write(kf.points.data(), sizeof(ArchivedPoint)*h.numPoints)) return;
+	if(h.kfId >= 0) numKeyframes++;
+	else numPoses++;
+}
+
+size_t KeyframeArchive::getBytesWritten()
+{
+	boost::unique_lock<boost::mutex> lock(mutex);
+	return bytesWritten;
+}
+
+int KeyframeArchive::getNumKeyframes()
+{
+	boost::unique_lock<boost::mutex> lock(mutex);
+	return numKeyframes;
+}
+
+int KeyframeArchive::getNumRecords()
+{
+	boost::unique_lock<boost::mutex> lock(mutex);
+	return numKeyframes + numPoses;
+}
+
+void KeyframeArchive::flush()
+{
+	boost::unique_lock<boost::mutex> lock(mutex);
+	if(fp != 0 && fflush(fp) != 0)
+	{
+		printf("KeyframeArchive: could not write %s, archiving stopped after %d keyframes!\n", file.c_str(), numKeyframes);
+		fclose(fp);
+		fp = 0;
+	}
+}
+
+
+
+KeyframeArchiveReader::KeyframeArchiveReader(const std::string &file)
+{
+	fp = fopen(file.c_str(), "rb");
+	if(fp == 0)
+	{
+		printf("KeyframeArchiveReader: could not open %s!\n", file.c_str());
+		return;
+	}
+
+	char magic[sizeof(archiveMagic)];
+	uint16_t version;
+	uint32_t pointSize;
+	if(fread(magic, sizeof(magic), 1, fp) != 1 || memcmp(magic, archiveMagic, sizeof(magic)) != 0 ||
+			fread(&version, sizeof(version), 1, fp) != 1 || version != archiveVersion ||
+			fread(&pointSize, sizeof(pointSize), 1, fp) != 1 || pointSize != sizeof(ArchivedPoint))
+	{
+		printf("KeyframeArchiveReader: %s is not a keyframe archive of this version!\n", file.c_str());
+		fclose(fp);
+		fp = 0;
+		return;
+	}
+
+	fseek(fp, 0, SEEK_END);
+	long fileSize = ftell(fp);
+	long offset = sizeof(archiveMagic) + sizeof(version) + sizeof(pointSize);
+	while(offset + (long)sizeof(KeyframeArchive::RecordHeader) <= fileSize)
+	{
+		KeyframeArchive::RecordHeader h;
+		fseek(fp, offset, SEEK_SET);
+		if(fread(&h, sizeof(h), 1, fp) != 1 || h.numPoints < 0) break;
+
+		long next = offset + sizeof(h) + (long)sizeof(ArchivedPoint)*h.numPoints;
+		if(next > fileSize) break;
+		offsets.push_back(offset);
+		offset = next;
+	}
+}
+
+KeyframeArchiveReader::~KeyframeArchiveReader()
+{
+	if(fp != 0) fclose(fp);
+}
+
+bool KeyframeArchiveReader::load(int idx, ArchivedKeyframe &out, bool withPoints)
+{
+	if(fp == 0 || idx < 0 || idx >= (int)offsets.size()) return false;
+
+	KeyframeArchive::RecordHeader h;
+	fseek(fp, offsets[idx], SEEK_SET);
+	if(fread(&h, sizeof(h), 1, fp) != 1) return false;
+
+	out.kfId = h.kfId;
+	out.frameId = h.frameId;
+	out.incomingId = h.incomingId;
+	out.timestamp = h.timestamp;
+	out.camToWorld = SE3(Eigen::Quaterniond(h.camToWorld[6], h.camToWorld[3], h.camToWorld[4], h.camToWorld[5]),
+			Vec3(h.camToWorld[0], h.camToWorld[1], h.camToWorld[2]));
+	out.fx = h.fx; out.fy = h.fy; out.cx = h.cx; out.cy = h.cy;
+	out.width = h.width; out.height = h.height;
+
+	out.points.clear();
+	if(!withPoints) return true;
+	out.points.resize(h.numPoints);
+	if(h.numPoints > 0 && fread(out.points.data(), sizeof(ArchivedPoint), h.numPoints, fp) != (size_t)h.numPoints)
+		return false;
+	return true;
+}
+
+}
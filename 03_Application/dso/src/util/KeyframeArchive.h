@@ -0,0 +1,144 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "util/NumType.h"
+#include "util/settings.h"
+#include "boost/thread/mutex.hpp"
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include <stdint.h>
+
+
+namespace dso
+{
+
+struct ArchivedPoint
+{
+	float u, v;
+	float idepth;				// scaled.
+	float idepth_hessian;
+	float maxRelBaseline;
+	unsigned char color[MAX_RES_PER_POINT];
+	unsigned char status;		// as in KeyFrameDisplay: 2 = marginalized, 3 = dropped (outlier / OOB).
+	unsigned char pad[3];
+};
+
+struct ArchivedKeyframe
+{
+	EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
+	int kfId;					// FrameHessian::frameID. -1 for a pose record.
+	int frameId;				// FrameShell::id.
+	int incomingId;
+	double timestamp;
+	SE3 camToWorld;				// keyframe record: at marginalization. pose record: final.
+	float fx, fy, cx, cy;
+	int width, height;
+	std::vector<ArchivedPoint> points;
+};
+
+
+/*
+ * append-only binary file of marginalized keyframes (pose + final point cloud), so that nothing has to
+ * keep them in memory for a later export. the writer keeps nothing per keyframe in RAM;
+ * KeyframeArchiveReader pages the records back in.
+ *
+ * two kinds of records:
+ * - keyframe records (kfId >= 0), appended by FullSystem::marginalizeFrame, with the point cloud. their
+ *   pose is the window estimate at marginalization, i.e. before any pose-graph correction.
+ * - pose records (kfId = -1, no points), one per frame with a valid pose, with its final camToWorld
+ *   (pose-graph corrections included). appended when FullSystem drops the frame from its history
+ *   (setting_memoryBudgetMB) or when the FullSystem is deleted, so they are not in frame order.
+ *
+ * layout: "DSOKFA" magic, uint16 version, uint32 sizeof(ArchivedPoint); then per record one
+ * RecordHeader, followed by numPoints ArchivedPoints, in host byte order.
+ * append() is thread-safe. if a write fails, the archive is closed and stays incomplete.
+ */
+class KeyframeArchive
+{
+public:
+	KeyframeArchive(const std::string &file);
+	~KeyframeArchive();
+
+	inline bool isOpen() const {return fp != 0;}
+
+	void append(const ArchivedKeyframe &kf);
+	// writes the buffered records, so a KeyframeArchiveReader sees them.
+	void flush();
+
+	size_t getBytesWritten();
+	int getNumKeyframes();
+	int getNumRecords();
+	inline const std::string &getFile() const {return file;}
+
+private:
+#pragma pack(push, 1)
+	struct RecordHeader
+	{
+		int32_t kfId, frameId, incomingId, numPoints;
+		double timestamp;
+		double camToWorld[7];	// tx ty tz qx qy qz qw.
+		float fx, fy, cx, cy;
+		int32_t width, height;
+	};
+#pragma pack(pop)
+
+	bool write(const void* data, size_t bytes);
+	friend class KeyframeArchiveReader;
+
+	boost::mutex mutex;
+	FILE* fp;
+	std::string file;
+	size_t bytesWritten;
+	int numKeyframes;
+	int numPoses;
+};
+
+
+/*
+ * reads a KeyframeArchive, e.g. for an export after the run. the constructor scans the record headers
+ * once and keeps one file offset per record; a truncated last record (archive still open, or a failed
+ * write) is left out. not thread-safe.
+ */
+class KeyframeArchiveReader
+{
+public:
+	KeyframeArchiveReader(const std::string &file);
+	~KeyframeArchiveReader();
+
+	inline bool isOpen() const {return fp != 0;}
+	inline int size() const {return offsets.size();}
+
+	// pages record [idx] (in order of appending) back in. withPoints=false: header only, out.points stays empty.
+	bool load(int idx, ArchivedKeyframe &out, bool withPoints=true);
+
+private:
+	FILE* fp;
+	std::vector<long> offsets;
+};
+
+}
+
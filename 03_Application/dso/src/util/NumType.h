@@ -39,7 +39,7 @@ namespace dso
 
 
 #define MAX_RES_PER_POINT 8
-#define NUM_THREADS 6
+#define NUM_THREADS 32		// max. number of worker threads. per-thread buffers are sized from the pool (setting_numThreads), not from this.
 
 
 #define todouble(x) (x).cast<double>()
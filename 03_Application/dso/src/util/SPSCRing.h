@@ -0,0 +1,229 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#pragma once
+#include <boost/thread.hpp>
+#include <sys/time.h>
+#include <stdio.h>
+#include <atomic>
+#include <vector>
+
+
+
+namespace dso
+{
+
+struct SPSCRingStats
+{
+	int capacity;
+	long numPushed;
+	double avgDepth;			// queue depth right after a push, averaged over all pushes.
+	int maxDepth;
+	int numProducerWaits;		// push() found the ring full ...
+	float msProducerWaited;		// ... and blocked that long in total.
+	int numConsumerWaits;		// pop() found the ring empty ...
+	float msConsumerWaited;		// ... and blocked that long in total.
+};
+
+/*
+ * bounded single-producer / single-consumer ring.
+ *
+ * tryPush() / tryPop() never take a lock: [head] is only written by the consumer, [tail] only by the
+ * producer. the mutex & condition variables are only touched when one side has to sleep (ring empty
+ * for the consumer, full for the producer): the sleeping side announces itself in [consumerSleeping] /
+ * [producerSleeping] before re-checking the ring, and the other side only locks to notify if it sees
+ * that flag. all these accesses are seq_cst, so a wake-up can not get lost.
+ *
+ * push() / tryPush() may only be called from one thread, pop() / tryPop() only from one (other) thread.
+ * after close(), push() and pop() return false instead of blocking; tryPop() still drains what is left.
+ */
+template<typename T>
+class SPSCRing
+{
+public:
+	inline SPSCRing(int capacity)
+	{
+		cap = 1;
+		while(cap < (size_t)capacity) cap *= 2;
+		mask = cap-1;
+		buffer.resize(cap);
+		head = 0;
+		tail = 0;
+		closed = false;
+		consumerSleeping = false;
+		producerSleeping = false;
+
+		maxDepth = 0;
+		numPushed = 0;
+		depthSum = 0;
+		numProducerWaits = numConsumerWaits = 0;
+		msProducerWaited = msConsumerWaited = 0;
+	}
+
+	inline int capacity() const {return (int)cap;}
+
+	// number of queued elements. exact when called from the producer or consumer thread, otherwise a snapshot.
+	inline int size() const {return (int)(tail.load() - head.load());}
+
+	// producer only. false if full.
+	inline bool tryPush(const T &v)
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		size_t depth = t - head.load();
+		if(depth >= cap) return false;
+		buffer[t & mask] = v;
+		tail.store(t+1);
+
+		numPushed++;
+		depthSum += depth+1;
+		if(depth+1 > maxDepth) maxDepth = depth+1;
+
+		if(consumerSleeping.load())
+		{
+			boost::unique_lock<boost::mutex> lock(mut);
+			dataSignal.notify_all();
+		}
+		return true;
+	}
+
+	// producer only. blocks while full. false if closed.
+	inline bool push(const T &v)
+	{
+		if(tryPush(v)) return true;
+
+		struct timeval tv_start, tv_end;
+		gettimeofday(&tv_start, NULL);
+		{
+			boost::unique_lock<boost::mutex> lock(mut);
+			producerSleeping.store(true);
+			while(!closed.load() && tail.load() - head.load() >= cap)
+				spaceSignal.wait(lock);
+			producerSleeping.store(false);
+		}
+		gettimeofday(&tv_end, NULL);
+		numProducerWaits++;
+		msProducerWaited += (tv_end.tv_sec-tv_start.tv_sec)*1000.0f + (tv_end.tv_usec-tv_start.tv_usec)/1000.0f;
+
+		if(closed.load()) return false;
+		return tryPush(v);
+	}
+
+	// consumer only. false if empty.
+	inline bool tryPop(T &v)
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		if(h == tail.load()) return false;
+		v = buffer[h & mask];
+		head.store(h+1);
+
+		if(producerSleeping.load())
+		{
+			boost::unique_lock<boost::mutex> lock(mut);
+			spaceSignal.notify_all();
+		}
+		return true;
+	}
+
+	// consumer only. blocks while empty. false if closed.
+	inline bool pop(T &v)
+	{
+		if(closed.load()) return false;
+		if(tryPop(v)) return true;
+
+		struct timeval tv_start, tv_end;
+		gettimeofday(&tv_start, NULL);
+		{
+			boost::unique_lock<boost::mutex> lock(mut);
+			consumerSleeping.store(true);
+			while(!closed.load() && tail.load() == head.load())
+				dataSignal.wait(lock);
+			consumerSleeping.store(false);
+		}
+		gettimeofday(&tv_end, NULL);
+		numConsumerWaits++;
+		msConsumerWaited += (tv_end.tv_sec-tv_start.tv_sec)*1000.0f + (tv_end.tv_usec-tv_start.tv_usec)/1000.0f;
+
+		if(closed.load()) return false;
+		return tryPop(v);
+	}
+
+	// any thread. wakes up both sides.
+	inline void close()
+	{
+		boost::unique_lock<boost::mutex> lock(mut);
+		closed.store(true);
+		dataSignal.notify_all();
+		spaceSignal.notify_all();
+	}
+
+	// call when both sides are done: the counters are written by either side without synchronization.
+	inline SPSCRingStats getStats() const
+	{
+		SPSCRingStats s;
+		s.capacity = (int)cap;
+		s.numPushed = (long)numPushed;
+		s.avgDepth = numPushed > 0 ? (double)depthSum / numPushed : 0.0;
+		s.maxDepth = (int)maxDepth;
+		s.numProducerWaits = numProducerWaits;
+		s.msProducerWaited = msProducerWaited;
+		s.numConsumerWaits = numConsumerWaits;
+		s.msConsumerWaited = msConsumerWaited;
+		return s;
+	}
+
+	// call when both sides are done.
+	inline void printStats(const char* name) const
+	{
+		SPSCRingStats s = getStats();
+		printf("%s: capacity %d, %ld pushed, depth avg %.1f max %d. "
+				"producer blocked %d times (%.1fms), consumer idle %d times (%.1fms).\n",
+				name, s.capacity, s.numPushed, s.avgDepth, s.maxDepth,
+				s.numProducerWaits, s.msProducerWaited, s.numConsumerWaits, s.msConsumerWaited);
+	}
+
+private:
+	std::vector<T> buffer;
+	size_t cap, mask;
+
+	std::atomic<size_t> head;				// next to pop. only written by the consumer.
+	std::atomic<size_t> tail;				// next to push. only written by the producer.
+	std::atomic<bool> closed;
+	std::atomic<bool> consumerSleeping;
+	std::atomic<bool> producerSleeping;
+
+	boost::mutex mut;
+	boost::condition_variable dataSignal;	// something was pushed, or closed.
+	boost::condition_variable spaceSignal;	// something was popped, or closed.
+
+	// written by the producer.
+	size_t maxDepth, numPushed, depthSum;
+	int numProducerWaits;
+	float msProducerWaited;
+	// written by the consumer.
+	int numConsumerWaits;
+	float msConsumerWaited;
+};
+
+}
@@ -0,0 +1,75 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "util/settings.h"
+
+/*
+ * runtime selection of the vector width for the hot loops.
+ *
+ * the whole code is compiled for the baseline (SSE, or NEON through SSE2NEON). the wider kernels are
+ * compiled per function with DSO_TARGET_AVX2 / DSO_TARGET_AVX512, and are only called if
+ * getSimdLevel() says the CPU supports them. this way one binary runs on all x86 hosts.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DSO_SIMD_DISPATCH 1
+#define DSO_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#define DSO_TARGET_AVX512 __attribute__((target("avx512f,avx2,fma")))
+#include <immintrin.h>
+#endif
+
+
+namespace dso
+{
+
+enum SimdLevel
+{
+	SIMD_SSE = 0,
+	SIMD_AVX2 = 1,
+	SIMD_AVX512 = 2
+};
+
+
+inline int detectSimdLevel()
+{
+#ifdef DSO_SIMD_DISPATCH
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f")) return SIMD_AVX512;
+	if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SIMD_AVX2;
+#endif
+	return SIMD_SSE;
+}
+
+
+// widest level supported by the CPU, capped by setting_simdLevel (if >= 0).
+inline int getSimdLevel()
+{
+	static const int supported = detectSimdLevel();
+	if(setting_simdLevel >= 0 && setting_simdLevel < supported)
+		return setting_simdLevel;
+	return supported;
+}
+
+}
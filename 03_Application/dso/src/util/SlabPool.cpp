@@ -0,0 +1,237 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#include "util/SlabPool.h"
+#include "stdio.h"
+#include <stdlib.h>
+
+namespace dso
+{
+
+// pools beyond this many are not cached per thread.
+#define SLAB_MAX_CACHED_POOLS 16
+
+static std::vector<SlabPool*> &allPools()
+{
+	static std::vector<SlabPool*>* pools = new std::vector<SlabPool*>();
+	return *pools;
+}
+static boost::mutex &allPoolsMutex()
+{
+	static boost::mutex* m = new boost::mutex();
+	return *m;
+}
+
+static void* slabAlignedMalloc(size_t size)
+{
+	void* ptr = 0;
+	if(posix_memalign(&ptr, DSO_SLAB_ALIGN, size) != 0) throw std::bad_alloc();
+	return ptr;
+}
+
+
+struct SlabPool::ThreadCache
+{
+	ThreadCache() : head(0), count(0), allocs(0), live(0) {}
+	FreeNode* head;
+	int count;
+	long allocs;	// not yet added to the pool counters.
+	long live;
+};
+
+// the per-thread free lists of all pools. given back to the pools when the thread exits.
+struct SlabThreadCaches
+{
+	SlabPool::ThreadCache c[SLAB_MAX_CACHED_POOLS];
+	~SlabThreadCaches()
+	{
+		std::vector<SlabPool*> pools;
+		{
+			boost::unique_lock<boost::mutex> lock(allPoolsMutex());
+			pools = allPools();
+		}
+		for(SlabPool* p : pools)
+			if(p->poolIdx < SLAB_MAX_CACHED_POOLS) p->flush(c[p->poolIdx], 0);
+	}
+};
+
+
+SlabPool::SlabPool(size_t objectSize, const char* name, int objectsPerSlab)
+{
+	// keep every object aligned, and big enough to hold a free list node.
+	if(objectSize < sizeof(FreeNode)) objectSize = sizeof(FreeNode);
+	this->objectSize = (objectSize+DSO_SLAB_ALIGN-1) & ~((size_t)DSO_SLAB_ALIGN-1);
+	this->name = name;
+	this->objectsPerSlab = objectsPerSlab;
+	batchSize = objectsPerSlab/16;
+
+	numAllocs = numSystemAllocs = numLive = maxLive = 0;
+	freeList = 0;
+
+	boost::unique_lock<boost::mutex> lock(allPoolsMutex());
+	poolIdx = allPools().size();
+	allPools().push_back(this);
+}
+
+
+SlabPool::ThreadCache* SlabPool::threadCache()
+{
+	static thread_local SlabThreadCaches caches;
+	if(batchSize == 0 || poolIdx >= SLAB_MAX_CACHED_POOLS) return 0;
+	return &caches.c[poolIdx];
+}
+
+
+void SlabPool::addSlab()
+{
+	char* slab = (char*)slabAlignedMalloc(objectSize*objectsPerSlab);
+	slabs.push_back(slab);
+	numSystemAllocs++;
+
+	// thread in reverse, so objects are handed out in address order.
+	for(int i=objectsPerSlab-1;i>=0;i--)
+	{
+		FreeNode* n = (FreeNode*)(slab + i*objectSize);
+		n->next = freeList;
+		freeList = n;
+	}
+}
+
+
+void SlabPool::refill(ThreadCache &c)
+{
+	boost::unique_lock<boost::mutex> lock(mutex);
+	numAllocs += c.allocs;
+	numLive += c.live;
+	if(numLive > maxLive) maxLive = numLive;
+	c.allocs = c.live = 0;
+
+	for(int i=0;i<batchSize;i++)
+	{
+		if(freeList == 0) addSlab();
+		FreeNode* n = freeList;
+		freeList = n->next;
+		n->next = c.head;
+		c.head = n;
+	}
+	c.count += batchSize;
+}
+
+
+void SlabPool::flush(ThreadCache &c, int keep)
+{
+	boost::unique_lock<boost::mutex> lock(mutex);
+	numAllocs += c.allocs;
+	numLive += c.live;
+	if(numLive > maxLive) maxLive = numLive;
+	c.allocs = c.live = 0;
+
+	while(c.count > keep)
+	{
+		FreeNode* n = c.head;
+		c.head = n->next;
+		n->next = freeList;
+		freeList = n;
+		c.count--;
+	}
+}
+
+
+void* SlabPool::alloc(size_t size)
+{
+	ThreadCache* c = size > objectSize ? 0 : threadCache();
+	if(c != 0)
+	{
+		if(c->head == 0) refill(*c);
+		FreeNode* n = c->head;
+		c->head = n->next;
+		c->count--;
+		c->allocs++;
+		c->live++;
+		return n;
+	}
+
+	boost::unique_lock<boost::mutex> lock(mutex);
+	numAllocs++;
+	numLive++;
+	if(numLive > maxLive) maxLive = numLive;
+
+	// derived class or similar: not ours.
+	if(size > objectSize)
+	{
+		numSystemAllocs++;
+		return slabAlignedMalloc(size);
+	}
+
+	if(freeList == 0) addSlab();
+	FreeNode* n = freeList;
+	freeList = n->next;
+	return n;
+}
+
+
+void SlabPool::dealloc(void* ptr, size_t size)
+{
+	if(ptr == 0) return;
+
+	ThreadCache* c = size > objectSize ? 0 : threadCache();
+	if(c != 0)
+	{
+		FreeNode* n = (FreeNode*)ptr;
+		n->next = c->head;
+		c->head = n;
+		c->count++;
+		c->live--;
+		// a thread that mostly frees (e.g. the mapper, for what the tracker allocated) hands the surplus back.
+		if(c->count > 2*batchSize) flush(*c, batchSize);
+		return;
+	}
+
+	boost::unique_lock<boost::mutex> lock(mutex);
+	numLive--;
+
+	if(size > objectSize)
+	{
+		free(ptr);
+		return;
+	}
+
+	FreeNode* n = (FreeNode*)ptr;
+	n->next = freeList;
+	freeList = n;
+}
+
+
+void SlabPool::printStats()
+{
+	boost::unique_lock<boost::mutex> lock(allPoolsMutex());
+	for(SlabPool* p : allPools())
+	{
+		printf("POOL %s: %ld allocs served by %ld system allocs (%d B objects, %d per slab). live %ld, max %ld.\n",
+				p->name, p->numAllocs, p->numSystemAllocs, (int)p->objectSize, p->objectsPerSlab, p->numLive, p->maxLive);
+	}
+}
+
+}
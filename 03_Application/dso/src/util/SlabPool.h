@@ -0,0 +1,103 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#pragma once
+
+#include "util/NumType.h"
+#include "boost/thread/mutex.hpp"
+#include <vector>
+#include <new>
+
+
+namespace dso
+{
+
+// alignment of all pooled objects: whatever Eigen's fixed-size members need (32 / 64 with AVX / AVX-512), at least 16.
+#if defined(EIGEN_MAX_ALIGN_BYTES) && EIGEN_MAX_ALIGN_BYTES > 16
+#define DSO_SLAB_ALIGN EIGEN_MAX_ALIGN_BYTES
+#else
+#define DSO_SLAB_ALIGN 16
+#endif
+
+/*
+ * fixed-size object pool for the small objects that are created / destroyed in large numbers per
+ * keyframe (points, residuals and their jacobians). memory is taken from the system in slabs of
+ * [objectsPerSlab] objects and recycled through a free list; slabs are only given back on exit.
+ * all objects are DSO_SLAB_ALIGN-byte aligned, as EIGEN_MAKE_ALIGNED_OPERATOR_NEW would do.
+ *
+ * each thread keeps a small free list per pool and only takes the pool mutex to move a batch of
+ * objects between it and the shared free list. pools with less than 16 objects per slab (big objects)
+ * are not cached per thread.
+ */
+class SlabPool
+{
+public:
+	SlabPool(size_t objectSize, const char* name, int objectsPerSlab = 512);
+
+	void* alloc(size_t size);
+	void dealloc(void* ptr, size_t size);
+
+	// allocation counters of all pools. the per-thread parts are only added per batch, so they lag behind a bit.
+	static void printStats();
+
+	const char* name;
+	size_t objectSize;
+	int objectsPerSlab;
+	int batchSize;			// objects moved between a thread's free list and the shared one at once. 0: no per-thread lists.
+
+	long numAllocs;			// objects handed out.
+	long numSystemAllocs;	// calls to the system allocator (slabs, and objects of unexpected size).
+	long numLive;
+	long maxLive;
+
+	struct FreeNode { FreeNode* next; };
+	struct ThreadCache;
+
+private:
+	void addSlab();
+	void refill(ThreadCache &c);
+	void flush(ThreadCache &c, int keep);
+	ThreadCache* threadCache();
+
+	friend struct SlabThreadCaches;
+	int poolIdx;			// in allPools(), and in the per-thread free lists.
+
+	boost::mutex mutex;
+	FreeNode* freeList;
+	std::vector<void*> slabs;
+};
+
+}
+
+
+// use instead of EIGEN_MAKE_ALIGNED_OPERATOR_NEW to take the objects from a SlabPool.
+#define DSO_SLAB_POOLED_NEW(Type) \
+	static inline dso::SlabPool& slabPool() {static dso::SlabPool* pool = new dso::SlabPool(sizeof(Type), #Type); return *pool;} \
+	void* operator new(std::size_t size) {return slabPool().alloc(size);} \
+	void operator delete(void* ptr, std::size_t size) {slabPool().dealloc(ptr, size);} \
+	void* operator new[](std::size_t size) {return Eigen::internal::conditional_aligned_malloc<true>(size);} \
+	void operator delete[](void* ptr) {Eigen::internal::conditional_aligned_free<true>(ptr);} \
+	void* operator new(std::size_t, void* ptr) {return ptr;} \
+	void operator delete(void*, void*) {}
+
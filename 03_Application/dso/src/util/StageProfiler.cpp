@@ -0,0 +1,219 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+
+#include "util/StageProfiler.h"
+#include "boost/thread/mutex.hpp"
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <string.h>
+#include <stdio.h>
+
+namespace dso
+{
+
+static std::vector<StageProfiler::ThreadRing*> &allRings()
+{
+	static std::vector<StageProfiler::ThreadRing*>* rings = new std::vector<StageProfiler::ThreadRing*>();
+	return *rings;
+}
+static boost::mutex &allRingsMutex()
+{
+	static boost::mutex* m = new boost::mutex();
+	return *m;
+}
+
+
+// gives the ring back when its thread exits.
+struct ThreadRingOwner
+{
+	StageProfiler::ThreadRing* ring;
+	ThreadRingOwner() : ring(0) {}
+	~ThreadRingOwner()
+	{
+		if(ring == 0) return;
+		boost::unique_lock<boost::mutex> lock(allRingsMutex());
+		ring->inUse = false;
+	}
+};
+
+
+StageProfiler::ThreadRing* StageProfiler::threadRing()
+{
+	// rings are never freed but recycled: threads come and go (resets, dso_bench runs), the events of
+	// finished threads should stay visible, and the memory should not grow with every new thread.
+	static thread_local ThreadRingOwner owner;
+	if(owner.ring == 0)
+	{
+		boost::unique_lock<boost::mutex> lock(allRingsMutex());
+		for(ThreadRing* r : allRings())
+			if(!r->inUse) { owner.ring = r; break; }
+
+		if(owner.ring == 0)
+		{
+			owner.ring = new ThreadRing();
+			owner.ring->head.store(0);
+			owner.ring->tid = allRings().size();
+			allRings().push_back(owner.ring);
+		}
+		owner.ring->inUse = true;
+	}
+	return owner.ring;
+}
+
+
+void StageProfiler::snapshot(std::vector<StageEvent> &out, std::vector<int> *tids)
+{
+	std::vector<ThreadRing*> rings;
+	{
+		boost::unique_lock<boost::mutex> lock(allRingsMutex());
+		rings = allRings();
+	}
+
+	for(ThreadRing* r : rings)
+	{
+		long long headBefore = r->head.load(std::memory_order_acquire);
+		long long first = std::max(0LL, headBefore-RING_SIZE);
+		size_t startOut = out.size();
+		for(long long i=first;i<headBefore;i++)
+			out.push_back(r->events[i & (RING_SIZE-1)]);
+
+		// whatever the writer overwrote in the meantime (incl. the slot it is writing right now) may be torn: drop it.
+		long long headAfter = r->head.load(std::memory_order_acquire);
+		long long numTorn = std::min(headBefore-first, std::max(0LL, headAfter-RING_SIZE+1-first));
+		out.erase(out.begin()+startOut, out.begin()+startOut+numTorn);
+
+		if(tids != 0) tids->resize(out.size(), r->tid);
+	}
+}
+
+
+static void statsFromDurations(std::vector<long long> &durs, StageStats &out)
+{
+	std::sort(durs.begin(), durs.end());
+	int n = durs.size();
+	double sum=0;
+	for(long long d : durs) sum += d;
+
+	out.count = n;
+	out.meanMs = sum / n * 1e-6;
+	out.p50Ms = durs[(n-1)*50/100] * 1e-6;
+	out.p90Ms = durs[(n-1)*90/100] * 1e-6;
+	out.p99Ms = durs[(n-1)*99/100] * 1e-6;
+	out.maxMs = durs[n-1] * 1e-6;
+}
+
+
+bool StageProfiler::getStats(const char* name, int arg, StageStats &out, long long sinceNs)
+{
+	std::vector<StageEvent> events;
+	snapshot(events, 0);
+
+	std::vector<long long> durs;
+	for(StageEvent &e : events)
+		if(e.startNs >= sinceNs && strcmp(e.name, name)==0 && (arg < 0 || e.arg == arg))
+			durs.push_back(e.durNs);
+
+	if(durs.size() == 0) return false;
+	statsFromDurations(durs, out);
+	return true;
+}
+
+
+void StageProfiler::getAllStats(std::map<std::string, StageStats> &out, long long sinceNs)
+{
+	std::vector<StageEvent> events;
+	snapshot(events, 0);
+
+	std::map<std::string, std::vector<long long> > byStage;
+	char label[64];
+	for(StageEvent &e : events)
+	{
+		if(e.startNs < sinceNs) continue;
+		if(e.arg >= 0)
+			snprintf(label, 64, "%s[%d]", e.name, e.arg);
+		else
+			snprintf(label, 64, "%s", e.name);
+		byStage[label].push_back(e.durNs);
+	}
+
+	out.clear();
+	for(auto &s : byStage)
+		statsFromDurations(s.second, out[s.first]);
+}
+
+
+void StageProfiler::printSummary()
+{
+	std::map<std::string, StageStats> stats;
+	getAllStats(stats);
+
+	printf("\n=============== Stage latencies [ms] ===============\n");
+	printf("%-24s %8s %8s %8s %8s %8s %8s\n", "stage", "count", "mean", "p50", "p90", "p99", "max");
+	for(auto &s : stats)
+	{
+		StageStats &st = s.second;
+		printf("%-24s %8d %8.3f %8.3f %8.3f %8.3f %8.3f\n", s.first.c_str(), st.count, st.meanMs, st.p50Ms, st.p90Ms, st.p99Ms, st.maxMs);
+	}
+	printf("====================================================\n");
+}
+
+
+bool StageProfiler::dumpChromeTrace(std::string file)
+{
+	std::vector<StageEvent> events;
+	std::vector<int> tids;
+	snapshot(events, &tids);
+
+	std::ofstream f(file.c_str());
+	if(!f.good())
+	{
+		printf("StageProfiler: could not open %s!\n", file.c_str());
+		return false;
+	}
+
+	long long t0 = 0;
+	for(unsigned int i=0;i<events.size();i++)
+		if(i==0 || events[i].startNs < t0) t0 = events[i].startNs;
+
+	f << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	char buf[512];
+	for(unsigned int i=0;i<events.size();i++)
+	{
+		StageEvent &e = events[i];
+		snprintf(buf, 512, "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"arg\":%d}}%s\n",
+				e.name, tids[i], (e.startNs-t0)*1e-3, e.durNs*1e-3, e.arg,
+				i+1 < events.size() ? "," : "");
+		f << buf;
+	}
+	f << "]}\n";
+	f.close();
+
+	printf("StageProfiler: wrote %d events to %s\n", (int)events.size(), file.c_str());
+	return true;
+}
+
+}
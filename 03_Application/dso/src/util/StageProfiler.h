@@ -0,0 +1,143 @@
+/**
+* This file is part of DSO.
+* 
+* Copyright 2016 Technical University of Munich and Intel.
+* Developed by Jakob Engel <engelj at in dot tum dot de>,
+* for more information see <http://vision.in.tum.de/dso>.
+* If you use this code, please cite the respective publications as
+* listed on the above website.
+*
+* DSO is free software: you can redistribute it and/or modify
+* it under the terms of the GNU General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* DSO is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+* GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License
+* along with DSO. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+
+#pragma once
+
+#include "util/settings.h"
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+#include <time.h>
+
+
+namespace dso
+{
+
+/*
+ * per-stage latency instrumentation for the tracking & mapping threads.
+ *
+ * every thread that records something gets its own ring buffer of the last RING_SIZE timed scopes.
+ * when the thread exits, its ring is handed to the next new thread (events stay visible until they are
+ * overwritten), so memory is bounded by the number of threads alive at the same time, not ever started.
+ * only the owning thread writes to it, and publishes each entry with one release-store of [head];
+ * readers (stats / trace dump, from any thread) never block the writer, and drop entries that may
+ * have been overwritten while they were reading. recording is off unless setting_profileStages.
+ *
+ * stage names have to be string literals (only the pointer is stored). [arg] distinguishes
+ * sub-stages, e.g. the pyramid level or the iteration; -1 if unused.
+ */
+struct StageEvent
+{
+	const char* name;
+	int arg;
+	long long startNs;
+	long long durNs;
+};
+
+struct StageStats
+{
+	int count;
+	double meanMs, p50Ms, p90Ms, p99Ms, maxMs;
+};
+
+class StageProfiler
+{
+public:
+	static const int RING_SIZE = 1<<16;
+
+	static inline long long nowNs()
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (long long)ts.tv_sec*1000000000LL + ts.tv_nsec;
+	}
+
+	// called by ScopedStageTimer.
+	static inline void record(const char* name, int arg, long long startNs, long long durNs)
+	{
+		ThreadRing* r = threadRing();
+		long long h = r->head.load(std::memory_order_relaxed);
+		StageEvent &e = r->events[h & (RING_SIZE-1)];
+		e.name = name;
+		e.arg = arg;
+		e.startNs = startNs;
+		e.durNs = durNs;
+		r->head.store(h+1, std::memory_order_release);
+	}
+
+	// percentiles over all samples of [name] (and [arg], if >= 0) still in the rings, that started
+	// at / after [sinceNs] (nowNs() clock). false if there are none.
+	static bool getStats(const char* name, int arg, StageStats &out, long long sinceNs=0);
+
+	// same for all stages, keyed by "name" resp. "name[arg]".
+	static void getAllStats(std::map<std::string, StageStats> &out, long long sinceNs=0);
+
+	// one line per (stage, arg).
+	static void printSummary();
+
+	// all events still in the rings, as chrome://tracing / perfetto JSON.
+	static bool dumpChromeTrace(std::string file);
+
+	struct ThreadRing
+	{
+		std::atomic<long long> head;	// number of events ever written.
+		int tid;						// lane of the ring, shared by all threads that owned it.
+		bool inUse;						// owned by a live thread. guarded by the ring list mutex.
+		StageEvent events[RING_SIZE];
+	};
+
+private:
+	static ThreadRing* threadRing();
+	static void snapshot(std::vector<StageEvent> &out, std::vector<int> *tids);
+};
+
+
+class ScopedStageTimer
+{
+public:
+	inline ScopedStageTimer(const char* name, int arg=-1) : name(name), arg(arg)
+	{
+		startNs = setting_profileStages ? StageProfiler::nowNs() : -1;
+	}
+	inline ~ScopedStageTimer()
+	{
+		if(startNs < 0) return;
+		StageProfiler::record(name, arg, startNs, StageProfiler::nowNs()-startNs);
+	}
+private:
+	const char* name;
+	int arg;
+	long long startNs;
+};
+
+}
+
+#define DSO_STAGE_CAT2(a,b) a##b
+#define DSO_STAGE_CAT(a,b) DSO_STAGE_CAT2(a,b)
+
+// times the rest of the enclosing scope.
+#define DSO_PROFILE_STAGE(name) dso::ScopedStageTimer DSO_STAGE_CAT(stageTimer_, __LINE__)(name)
+#define DSO_PROFILE_STAGE_ARG(name, arg) dso::ScopedStageTimer DSO_STAGE_CAT(stageTimer_, __LINE__)(name, arg)
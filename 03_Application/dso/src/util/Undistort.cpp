@@ -253,6 +253,15 @@ void PhotometricUndistorter::processFrame(T* image_in, float exposure_time, floa
 template void PhotometricUndistorter::processFrame<unsigned char>(unsigned char* image_in, float exposure_time, float factor);
 template void PhotometricUndistorter::processFrame<unsigned short>(unsigned short* image_in, float exposure_time, float factor);
 
+const float* PhotometricUndistorter::getFrameResponse(float exposure_time, bool &applyVignette) const
+{
+	applyVignette = false;
+	if(!valid || exposure_time <= 0 || setting_photometricCalibration==0)
+		return 0;
+	applyVignette = (setting_photometricCalibration==2);
+	return G;
+}
+
 
 
 
@@ -261,6 +270,9 @@ Undistort::~Undistort()
 {
 	if(remapX != 0) delete[] remapX;
 	if(remapY != 0) delete[] remapY;
+	if(remapIdx != 0) delete[] remapIdx;
+	if(remapFrac != 0) delete[] remapFrac;
+	if(remapVignetteInv != 0) delete[] remapVignetteInv;
 }
 
 Undistort* Undistort::getUndistorterForFile(std::string configFilename, std::string gammaFilename, std::string vignetteFilename)
@@ -380,19 +392,200 @@ Undistort* Undistort::getUndistorterForFile(std::string configFilename, std::str
 void Undistort::loadPhotometricCalibration(std::string file, std::string noiseImage, std::string vignetteImage)
 {
 	photometricUndist = new PhotometricUndistorter(file, noiseImage, vignetteImage,getOriginalSize()[0], getOriginalSize()[1]);
+	makeRemapVignette();
+}
+
+void Undistort::makeRemapTables()
+{
+	if(remapIdx == 0) remapIdx = new int[w*h];
+	if(remapFrac == 0) remapFrac = new unsigned int[w*h];
+
+	for(int idx=0;idx<w*h;idx++)
+	{
+		float xx = remapX[idx];
+		float yy = remapY[idx];
+		int xxi = xx;
+		int yyi = yy;
+
+		// the bilinear lookup touches (xxi+1, yyi+1), which has to be inside.
+		if(xx < 0 || yy < 0 || xxi+1 >= wOrg || yyi+1 >= hOrg)
+		{
+			remapIdx[idx] = -1;
+			remapFrac[idx] = 0;
+			continue;
+		}
+
+		unsigned int fx = (unsigned int)((xx-xxi)*65536.0f + 0.5f);
+		unsigned int fy = (unsigned int)((yy-yyi)*65536.0f + 0.5f);
+		if(fx > 0xffff) fx = 0xffff;
+		if(fy > 0xffff) fy = 0xffff;
+
+		remapIdx[idx] = xxi + yyi*wOrg;
+		remapFrac[idx] = (fy << 16) | fx;
+	}
+}
+
+void Undistort::makeRemapVignette()
+{
+	if(remapVignetteInv != 0) delete[] remapVignetteInv;
+	remapVignetteInv = 0;
+
+	const float* vigInv = photometricUndist == 0 ? 0 : photometricUndist->getVignetteMapInv();
+	if(vigInv == 0 || remapIdx == 0) return;
+
+	// the vignette is smooth, so dividing by it after the interpolation instead of before is fine.
+	remapVignetteInv = new float[w*h];
+	for(int idx=0;idx<w*h;idx++)
+	{
+		if(remapIdx[idx] < 0)
+		{
+			remapVignetteInv[idx] = 0;
+			continue;
+		}
+		remapVignetteInv[idx] = getInterpolatedElement(vigInv, remapX[idx], remapY[idx], wOrg);
+	}
 }
 
+template<typename T>
+void Undistort::remapFused(const T* in, float* out, const float* lut, float factor, const float* vigInv, int start, int end) const
+{
+	for(int idx=start;idx<end;idx++)
+	{
+		int srcIdx = remapIdx[idx];
+		if(srcIdx < 0)
+		{
+			out[idx] = 0;
+			continue;
+		}
+
+		unsigned int frac = remapFrac[idx];
+		float xx = (frac & 0xffff) * (1.0f/65536.0f);
+		float yy = (frac >> 16) * (1.0f/65536.0f);
+		float xxyy = xx*yy;
+		const T* src = in + srcIdx;
+
+		float c00, c01, c10, c11;
+		if(lut != 0)
+		{
+			c00 = lut[src[0]]; c01 = lut[src[1]];
+			c10 = lut[src[wOrg]]; c11 = lut[src[1+wOrg]];
+		}
+		else
+		{
+			c00 = factor*src[0]; c01 = factor*src[1];
+			c10 = factor*src[wOrg]; c11 = factor*src[1+wOrg];
+		}
+
+		float val = xxyy * c11
+				+ (yy-xxyy) * c10
+				+ (xx-xxyy) * c01
+				+ (1-xx-yy+xxyy) * c00;
+
+		if(vigInv != 0) val *= vigInv[idx];
+		out[idx] = val;
+	}
+}
+
+#ifdef DSO_SIMD_DISPATCH
+int Undistort::remapFusedAVX2(const unsigned char* in, float* out, const float* lut, const float* vigInv) const
+{
+	const int n = (w*h) & ~7;
+
+	// the gathers load 4 bytes at the source pixel and at the one below it. blocks that reach the
+	// last bytes of the image go through the scalar loop, so nothing is read past the end.
+	const __m256i maxSrc = _mm256_set1_epi32(wOrg*hOrg - wOrg - 4);
+	const __m256i minusOne = _mm256_set1_epi32(-1);
+	const __m256i byteMask = _mm256_set1_epi32(0xff);
+	const __m256i fracMask = _mm256_set1_epi32(0xffff);
+	const __m256 fracScale = _mm256_set1_ps(1.0f/65536.0f);
+	const int* inTop = (const int*)in;
+	const int* inBot = (const int*)(in + wOrg);
+
+	for(int idx=0;idx<n;idx+=8)
+	{
+		__m256i srcIdx = _mm256_loadu_si256((const __m256i*)(remapIdx+idx));
+		__m256i tooFar = _mm256_cmpgt_epi32(srcIdx, maxSrc);
+		if(!_mm256_testz_si256(tooFar, tooFar))
+		{
+			remapFused<unsigned char>(in, out, lut, 1, vigInv, idx, idx+8);
+			continue;
+		}
+
+		__m256i valid = _mm256_cmpgt_epi32(srcIdx, minusOne);
+		__m256i top = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), inTop, srcIdx, valid, 1);
+		__m256i bot = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), inBot, srcIdx, valid, 1);
+
+		__m256 c00 = _mm256_i32gather_ps(lut, _mm256_and_si256(top, byteMask), 4);
+		__m256 c01 = _mm256_i32gather_ps(lut, _mm256_and_si256(_mm256_srli_epi32(top, 8), byteMask), 4);
+		__m256 c10 = _mm256_i32gather_ps(lut, _mm256_and_si256(bot, byteMask), 4);
+		__m256 c11 = _mm256_i32gather_ps(lut, _mm256_and_si256(_mm256_srli_epi32(bot, 8), byteMask), 4);
+
+		__m256i frac = _mm256_loadu_si256((const __m256i*)(remapFrac+idx));
+		__m256 xx = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(frac, fracMask)), fracScale);
+		__m256 yy = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(frac, 16)), fracScale);
+
+		// bilinear as three lerps.
+		__m256 upper = _mm256_fmadd_ps(xx, _mm256_sub_ps(c01, c00), c00);
+		__m256 lower = _mm256_fmadd_ps(xx, _mm256_sub_ps(c11, c10), c10);
+		__m256 val = _mm256_fmadd_ps(yy, _mm256_sub_ps(lower, upper), upper);
+
+		if(vigInv != 0) val = _mm256_mul_ps(val, _mm256_loadu_ps(vigInv+idx));
+		val = _mm256_and_ps(val, _mm256_castsi256_ps(valid));
+		_mm256_storeu_ps(out+idx, val);
+	}
+	return n;
+}
+#endif
+
 template<typename T>
 ImageAndExposure* Undistort::undistort(const MinimalImage<T>* image_raw, float exposure, double timestamp, float factor) const
+{
+	ImageAndExposure* result = new ImageAndExposure(w, h, timestamp);
+	undistortInto<T>(image_raw, result, exposure, timestamp, factor);
+	return result;
+}
+
+template<typename T>
+void Undistort::undistortInto(const MinimalImage<T>* image_raw, ImageAndExposure* result, float exposure, double timestamp, float factor) const
 {
 	if(image_raw->w != wOrg || image_raw->h != hOrg)
 	{
 		printf("Undistort::undistort: wrong image size (%d %d instead of %d %d) \n", image_raw->w, image_raw->h, w, h);
 		exit(1);
 	}
+	assert(result->w == w && result->h == h);
+
+	if(!passthrough && benchmark_varNoise<=0 && remapIdx != 0)
+	{
+		// fused: the photometric correction is applied to the four source pixels while sampling,
+		// so the input is read once and no intermediate irradiance image is written.
+		bool applyVignette;
+		const float* lut = photometricUndist->getFrameResponse(exposure, applyVignette);
+		const float* vigInv = applyVignette ? remapVignetteInv : 0;
+
+		// 8bit input always goes through a lookup, also for the plain factor*I case.
+		float factorLut[256];
+		if(lut == 0 && sizeof(T) == 1)
+		{
+			for(int i=0;i<256;i++) factorLut[i] = factor*i;
+			lut = factorLut;
+		}
+
+		int start = 0;
+#ifdef DSO_SIMD_DISPATCH
+		if(sizeof(T) == 1 && getSimdLevel() >= SIMD_AVX2)
+			start = remapFusedAVX2((const unsigned char*)image_raw->data, result->image, lut, vigInv);
+#endif
+		remapFused<T>(image_raw->data, result->image, lut, factor, vigInv, start, w*h);
+
+		result->timestamp = timestamp;
+		result->exposure_time = setting_useExposure ? exposure : 1;
+		applyBlurNoise(result->image);
+		return;
+	}
 
 	photometricUndist->processFrame<T>(image_raw->data, exposure, factor);
-	ImageAndExposure* result = new ImageAndExposure(w, h, timestamp);
+	result->timestamp = timestamp;
 	photometricUndist->output->copyMetaTo(*result);
 
 	if (!passthrough)
@@ -477,11 +670,11 @@ ImageAndExposure* Undistort::undistort(const MinimalImage<T>* image_raw, float e
 	}
 
 	applyBlurNoise(result->image);
-
-	return result;
 }
 template ImageAndExposure* Undistort::undistort<unsigned char>(const MinimalImage<unsigned char>* image_raw, float exposure, double timestamp, float factor) const;
 template ImageAndExposure* Undistort::undistort<unsigned short>(const MinimalImage<unsigned short>* image_raw, float exposure, double timestamp, float factor) const;
+template void Undistort::undistortInto<unsigned char>(const MinimalImage<unsigned char>* image_raw, ImageAndExposure* result, float exposure, double timestamp, float factor) const;
+template void Undistort::undistortInto<unsigned short>(const MinimalImage<unsigned short>* image_raw, ImageAndExposure* result, float exposure, double timestamp, float factor) const;
 
 
 void Undistort::applyBlurNoise(float* img) const
@@ -720,6 +913,9 @@ void Undistort::readFromFile(const char* configFileName, int nPars, std::string
 	passthrough=false;
 	remapX = 0;
 	remapY = 0;
+	remapIdx = 0;
+	remapFrac = 0;
+	remapVignetteInv = 0;
 	
 	float outputCalibration[5];
 
@@ -942,6 +1138,8 @@ void Undistort::readFromFile(const char* configFileName, int nPars, std::string
 			}
 		}
 
+	makeRemapTables();
+
 	valid = true;
 
 
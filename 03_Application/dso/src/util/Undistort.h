@@ -27,6 +27,7 @@
 #include "util/ImageAndExposure.h"
 #include "util/MinimalImage.h"
 #include "util/NumType.h"
+#include "util/SimdDispatch.h"
 #include "Eigen/Core"
 
 
@@ -54,6 +55,11 @@ public:
 	ImageAndExposure* output;
 
 	float* getG() {if(!valid) return 0; else return G;};
+	const float* getVignetteMapInv() const {if(!valid) return 0; else return vignetteMapInv;};
+
+	// what processFrame would apply to a frame with this exposure: the response lookup
+	// (0: plain factor*I), and whether to divide by the vignette.
+	const float* getFrameResponse(float exposure_time, bool &applyVignette) const;
 private:
     float G[256*256];
     int GDepth;
@@ -81,6 +87,10 @@ public:
 
 	template<typename T>
 	ImageAndExposure* undistort(const MinimalImage<T>* image_raw, float exposure=0, double timestamp=0, float factor=1) const;
+	// same, but writes into an existing image of getSize() (no allocation). not thread-safe either,
+	// as it goes through photometricUndist->output: use one Undistort per thread.
+	template<typename T>
+	void undistortInto(const MinimalImage<T>* image_raw, ImageAndExposure* result, float exposure=0, double timestamp=0, float factor=1) const;
 	static Undistort* getUndistorterForFile(std::string configFilename, std::string gammaFilename, std::string vignetteFilename);
 
 	void loadPhotometricCalibration(std::string file, std::string noiseImage, std::string vignetteImage);
@@ -98,6 +108,23 @@ protected:
 	float* remapX;
 	float* remapY;
 
+	// fixed-point version of remapX / remapY, built once the rectification is final.
+	// remapIdx: top-left source pixel (-1 if outside), remapFrac: (fy << 16) | fx in 1/65536 pixel.
+	int* remapIdx;
+	unsigned int* remapFrac;
+	float* remapVignetteInv;	// 1/vignette at the remapped position. only if a valid vignette is loaded.
+
+	void makeRemapTables();
+	void makeRemapVignette();
+
+	// fused photometric + geometric undistortion of pixels [start, end), one pass over the tables.
+	template<typename T>
+	void remapFused(const T* in, float* out, const float* lut, float factor, const float* vigInv, int start, int end) const;
+#ifdef DSO_SIMD_DISPATCH
+	// same for 8 pixels at once, using gathers. returns how many pixels were done.
+	DSO_TARGET_AVX2 int remapFusedAVX2(const unsigned char* in, float* out, const float* lut, const float* vigInv) const;
+#endif
+
 	void applyBlurNoise(float* img) const;
 
 	void makeOptimalK_crop();
@@ -99,6 +99,7 @@ float setting_margWeightFac = 0.5*0.5;          // factor on hessian when margin
 
 /* when to re-track a frame */
 float setting_reTrackThreshold = 1.5; // (larger = re-track more often)
+int setting_reTrackRefine = 3;	// re-track: all other initializations are ranked on the coarsest level in parallel, only the best that many are tracked fully. 0: try all one after another.
 
 
 
@@ -188,6 +189,26 @@ float freeDebugParam5 = 1;
 bool disableReconfigure=false;
 bool debugSaveImages = false;
 bool multiThreading = true;
+int setting_numThreads = 6;	// worker threads of the reduce pool. clamped to [1, NUM_THREADS].
+float setting_externalPoseMaxExtrapolation = 0.5;	// [s]. external poses (GPS, ...) are not extrapolated further than this.
+float setting_gpsPriorWeight = 0;	// weight of the GPS position priors (FrameShell::camToWorld_predicted). 0: off, e.g. poses= are only used for tracking initialization.
+int setting_gpsMinAlignFrames = 5;	// keyframes with GPS needed before the GPS alignment is estimated...
+float setting_gpsMinAlignExtent = 1;	// ... and how far (RMS, in GPS units) their positions have to be spread.
+bool setting_poseGraph = false;	// keep correcting marginalized keyframes in a fixed-lag pose graph (PoseGraphBackend).
+int setting_poseGraphWindow = 100;	// that many of the last marginalized keyframes are optimized, older ones are fixed.
+int setting_poseGraphNeighbours = 3;	// relative-pose edges from each marginalized keyframe to its predecessors.
+int setting_poseGraphIterations = 5;	// gauss-newton iterations per update.
+float setting_poseGraphSigmaTrans = 0.02;	// std.dev. of the relative-pose edges: translation, relative to the edge length...
+float setting_poseGraphSigmaRot = 0.005;	// ... and rotation [rad].
+int setting_memoryBudgetMB = 0;	// solver budget: FullSystem keeps at most that many MB of frame history; older frames go to the keyframe archive (only with one) and connectivity of marginalized keyframes is dropped. 0: unlimited.
+int setting_viewerMemoryBudgetMB = 0;	// viewer budget: the 3D view keeps at most that many MB of marginalized keyframe point clouds (oldest are dropped first; use an archive to keep them). 0: unlimited.
+int setting_mappingQueueSize = 8;	// tracked frames waiting for the mapper (non-linearize mode only).
+int setting_mappingQueuePolicy = 1;	// queue full: 0 = tracker waits, 1 = non-keyframes are dropped (only their pose is propagated). keyframes always wait.
+int setting_mappingCoalesceAfter = 3;	// more than that many queued: mapper only traces the newest non-keyframe, older ones only get their pose.
+int setting_outputQueueSize = 0;	// >0: non-GUI output wrappers run on their own thread (OutputDispatcher), with that many messages queued. 0: called on the solver threads.
+bool setting_outputKeyframesOnly = false;	// non-GUI output wrappers only get keyframes & the graph, no per-frame poses / images (headless mapping). queue of 64 if setting_outputQueueSize is 0.
+int setting_simdLevel = -1;	// max. vector width of the dispatched kernels. -1: whatever the CPU supports, 0: SSE, 1: AVX2, 2: AVX-512.
+bool setting_profileStages = false;	// record per-stage latencies (StageProfiler). cheap, but not free.
 bool disableAllDisplay = false;
 bool setting_onlyLogKFPoses = true;
 bool setting_logStuff = true;
@@ -204,6 +225,9 @@ bool setting_render_display3D = true;
 bool setting_render_displayResidual = true;
 bool setting_render_displayVideo = true;
 bool setting_render_displayDepth = true;
+float setting_render_frameBudgetMs = 30;	// 3D view: far keyframes are drawn with fewer points to keep the 3D pass below this. 0: always all points.
+float setting_render_lodDistance = 5;	// 3D view: distance up to which keyframes keep all points (shrinks while over budget).
+float setting_render_gridCellSize = 4;	// 3D view: cell size of the keyframe grid used for frustum culling.
 
 bool setting_fullResetRequested = false;
 
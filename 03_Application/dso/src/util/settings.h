@@ -104,6 +104,7 @@ extern int setting_GNItsOnPointActivation;
 extern float setting_minTraceQuality;
 extern int setting_minTraceTestRadius;
 extern float setting_reTrackThreshold;
+extern int setting_reTrackRefine;
 
 
 extern int   setting_minGoodActiveResForMarg;
@@ -166,6 +167,9 @@ extern bool setting_render_display3D;
 extern bool setting_render_displayResidual;
 extern bool setting_render_displayVideo;
 extern bool setting_render_displayDepth;
+extern float setting_render_frameBudgetMs;
+extern float setting_render_lodDistance;
+extern float setting_render_gridCellSize;
 
 extern bool setting_fullResetRequested;
 
@@ -187,6 +191,26 @@ extern int sparsityFactor;
 extern bool goStepByStep;
 extern bool plotStereoImages;
 extern bool multiThreading;
+extern int setting_numThreads;
+extern int setting_simdLevel;
+extern bool setting_profileStages;
+extern float setting_externalPoseMaxExtrapolation;
+extern float setting_gpsPriorWeight;
+extern int setting_gpsMinAlignFrames;
+extern float setting_gpsMinAlignExtent;
+extern bool setting_poseGraph;
+extern int setting_poseGraphWindow;
+extern int setting_poseGraphNeighbours;
+extern int setting_poseGraphIterations;
+extern float setting_poseGraphSigmaTrans;
+extern float setting_poseGraphSigmaRot;
+extern int setting_memoryBudgetMB;
+extern int setting_viewerMemoryBudgetMB;
+extern int setting_mappingQueueSize;
+extern int setting_mappingQueuePolicy;
+extern int setting_mappingCoalesceAfter;
+extern int setting_outputQueueSize;
+extern bool setting_outputKeyframesOnly;
 
 extern float freeDebugParam1;
 extern float freeDebugParam2;
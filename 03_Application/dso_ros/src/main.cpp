@@ -109,6 +109,18 @@ void parseArgument(char* arg)
 		}
 		return;
 	}
+	if(1==sscanf(arg,"threads=%d",&option))
+	{
+		setting_numThreads = option;
+		printf("USING %d WORKER THREADS (max %d)!\n", setting_numThreads, NUM_THREADS);
+		return;
+	}
+	if(1==sscanf(arg,"simd=%d",&option))
+	{
+		setting_simdLevel = option;
+		printf("LIMITING SIMD LEVEL TO %d (0: SSE, 1: AVX2, 2: AVX-512)!\n", setting_simdLevel);
+		return;
+	}
 	if(1==sscanf(arg,"calib=%s",buf))
 	{
 		calib = buf;